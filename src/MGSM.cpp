@@ -3,9 +3,16 @@
 #include "utils.h"
 #include "snva.h"
 #include "gva.h"
+#include "parallel-utils.h"
+#include "psqn.h"
+#include "hess-utils.h"
+#include "phase-timers.h"
+#include "tape-info.h"
+#include "taping-arena.h"
 #include <memory>
 #include <vector>
 #include <utility>
+#include <algorithm>
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -25,6 +32,29 @@ vector<Tout> get_args_va(Rcpp::List parameters) {
   return get_args_va<Tout, Type>(eps, kappa, b, theta, theta_va);
 }
 
+/* returns the data values which are arguments of the tapes when the data
+ * can be changed later. The order is tobs, event, X, XD, and Z with the
+ * matrices in column-major order */
+template<typename Tout, typename Tin>
+vector<Tout> get_data_args
+  (vector<Tin> const &tobs, vector<Tin> const &event, matrix<Tin> const &X,
+   matrix<Tin> const &XD, matrix<Tin> const &Z){
+  vector<Tout> out(tobs.size() + event.size() + X.size() + XD.size() +
+    Z.size());
+  Tout *o = out.data();
+  auto add = [&](Tin const *x, std::size_t const n){
+    for(std::size_t i = 0; i < n; ++i, ++o)
+      *o = Tout(x[i]);
+  };
+  add(tobs .data(), tobs .size());
+  add(event.data(), event.size());
+  add(X    .data(), X    .size());
+  add(XD   .data(), XD   .size());
+  add(Z    .data(), Z    .size());
+
+  return out;
+}
+
 /* define and declare functor to use */
 template<class Type>
 class VA_worker {
@@ -39,7 +69,12 @@ public:
   std::size_t const n_b = b       .size(),
                     n_t = theta   .size(),
                     n_v = theta_VA.size(),
-                 n_para = 2L + n_b + n_t + n_v;
+                 n_para = 2L + n_b + n_t + n_v,
+               n_shared = 2L + n_b + n_t,
+               n_groups = grp_size.size(),
+               n_va_grp = n_groups > 0 ? n_v / n_groups : 0L,
+                 n_data = tobs.size() + event.size() + X.size() +
+                   XD.size() + Z.size();
 
 #ifdef _OPENMP
   std::size_t const n_blocks = n_threads;
@@ -47,6 +82,57 @@ public:
   std::size_t const n_blocks = 1L;
 #endif
 
+private:
+  /* index of the first observation in each group and the number of
+   * observations as the last element */
+  std::vector<std::size_t> const grp_start = ([&](){
+    std::vector<std::size_t> out(n_groups + 1L);
+    out[0] = 0L;
+    for(unsigned g = 0; g < n_groups; ++g)
+      out[g + 1L] = out[g] + grp_size[g];
+    return out;
+  })();
+
+  /* copies the arguments to the separate parameter objects */
+  void set_args(vector<Type> const &args, Type &eps, Type &kappa,
+                vector<Type> &b, vector<Type> &theta,
+                vector<Type> &theta_VA) const {
+    eps   = args[0];
+    kappa = args[1];
+    Type const *a = &args[2];
+
+    for(unsigned i = 0; i < n_b; ++i, ++a)
+      b[i] = *a;
+    for(unsigned i = 0; i < n_t; ++i, ++a)
+      theta[i] = *a;
+    for(int i = 0; i < theta_VA.size(); ++i, ++a)
+      theta_VA[i] = *a;
+  }
+
+  Type eval_lb
+    (vector<Type> const &tobs, vector<Type> const &event,
+     matrix<Type> const &X, matrix<Type> const &XD, matrix<Type> const &Z,
+     vector<int> const &grp, Type const &eps, Type const &kappa,
+     vector<Type> const &b, vector<Type> const &theta,
+     vector<int> const &grp_size, vector<Type> const &theta_VA,
+     bool const is_serial) const {
+    survTMB::accumulator_mock<Type> result(is_serial);
+    if(app_type =="GVA"){
+      GVA(COMMON_CALL, theta_VA, n_nodes);
+      return result;
+
+    } else if(app_type == "SNVA"){
+      SNVA(COMMON_CALL, theta_VA, n_nodes, param_type);
+      return result;
+
+    }
+
+    error("VA_worker<Type>: approximation method '%s' is not implemented",
+          app_type.c_str());
+    return Type(0);
+  }
+
+public:
   VA_worker(Rcpp::List data, Rcpp::List parameters):
   data(data), parameters(parameters) {
     SETUP_DATA_CHECK;
@@ -64,37 +150,88 @@ public:
     return ::get_args_va<Tout, Type>(eps, kappa, b, theta, theta_VA);
   }
 
+  /* returns the arguments for a sub-tape with groups [g_begin, g_end) */
+  template<typename Tout>
+  vector<Tout> get_args_va(unsigned const g_begin,
+                           unsigned const g_end) const {
+    vector<Type> const theta_VA_sub =
+      theta_VA.segment(g_begin * n_va_grp, (g_end - g_begin) * n_va_grp);
+    return ::get_args_va<Tout, Type>(eps, kappa, b, theta, theta_VA_sub);
+  }
+
   Type operator()(vector<Type> &args) const {
     if((unsigned)args.size() != n_para)
       error("VA_worker: invalid args length");
-    Type eps = args[0],
-       kappa = args[1];
-    Type const *a = &args[2];
-
-    vector<Type> b(n_b);
-    for(unsigned i = 0; i < n_b; ++i, ++a)
-      b[i] = *a;
-    vector<Type> theta(n_t);
-    for(unsigned i = 0; i < n_t; ++i, ++a)
-      theta[i] = *a;
-    vector<Type> theta_VA(n_v);
-    for(unsigned i = 0; i < n_v; ++i, ++a)
-      theta_VA[i] = *a;
+    Type eps, kappa;
+    vector<Type> b(n_b), theta(n_t), theta_VA(n_v);
+    set_args(args, eps, kappa, b, theta, theta_VA);
 
-    survTMB::accumulator_mock<Type> result;
-    if(app_type =="GVA"){
-      GVA(COMMON_CALL, theta_VA, n_nodes);
-      return result;
+    return eval_lb(tobs, event, X, XD, Z, grp, eps, kappa, b, theta,
+                   grp_size, theta_VA, false);
+  }
 
-    } else if(app_type == "SNVA"){
-      SNVA(COMMON_CALL, theta_VA, n_nodes, param_type);
-      return result;
+  template<typename Tout>
+  vector<Tout> get_data_args() const {
+    return ::get_data_args<Tout, Type>(tobs, event, X, XD, Z);
+  }
 
-    }
+  /* computes the lower bound where the arguments are the parameters
+   * followed by the data in the order from get_data_args. The data may then
+   * be changed without making a new tape */
+  Type eval_with_data(vector<Type> &args) const {
+    if((unsigned)args.size() != n_para + n_data)
+      error("VA_worker: invalid args length");
+    Type eps, kappa;
+    vector<Type> b(n_b), theta(n_t), theta_VA(n_v);
+    set_args(args, eps, kappa, b, theta, theta_VA);
+
+    vector<Type> tobs_a(tobs.size()), event_a(event.size());
+    matrix<Type> X_a(X.rows(), X.cols()), XD_a(XD.rows(), XD.cols()),
+                 Z_a(Z.rows(), Z.cols());
+    Type const *a = args.data() + n_para;
+    auto set = [&](Type *x, std::size_t const n){
+      for(std::size_t i = 0; i < n; ++i, ++a)
+        x[i] = *a;
+    };
+    set(tobs_a .data(), tobs_a .size());
+    set(event_a.data(), event_a.size());
+    set(X_a    .data(), X_a    .size());
+    set(XD_a   .data(), XD_a   .size());
+    set(Z_a    .data(), Z_a    .size());
+
+    return eval_lb(tobs_a, event_a, X_a, XD_a, Z_a, grp, eps, kappa, b,
+                   theta, grp_size, theta_VA, false);
+  }
 
-    error("VA_worker<Type>: approximation method '%s' is not implemented",
-          app_type.c_str());
-    return Type(0);
+  /* computes the lower bound terms for groups [g_begin, g_end). The
+   * arguments are the shared parameters followed by the VA parameters of
+   * the groups */
+  Type operator()(vector<Type> &args, unsigned const g_begin,
+                  unsigned const g_end) const {
+    unsigned const n_grp_sub = g_end - g_begin;
+    if(g_end > n_groups or g_begin >= g_end)
+      error("VA_worker: invalid groups");
+    if((unsigned)args.size() != n_shared + n_grp_sub * n_va_grp)
+      error("VA_worker: invalid args length");
+    Type eps, kappa;
+    vector<Type> b(n_b), theta(n_t), theta_VA(n_grp_sub * n_va_grp);
+    set_args(args, eps, kappa, b, theta, theta_VA);
+
+    /* get the data for this subset of the groups */
+    std::size_t const i_start = grp_start[g_begin],
+                      n_obs   = grp_start[g_end] - i_start;
+    vector<Type> const tobs_sub  = tobs .segment(i_start, n_obs),
+                       event_sub = event.segment(i_start, n_obs);
+    matrix<Type> const X_sub  = X .middleRows(i_start, n_obs),
+                       XD_sub = XD.middleRows(i_start, n_obs),
+                       Z_sub  = Z .middleRows(i_start, n_obs);
+    vector<int> grp_sub(n_obs);
+    for(unsigned i = 0; i < n_obs; ++i)
+      grp_sub[i] = grp[i_start + i] - g_begin;
+    vector<int> const grp_size_sub = grp_size.segment(g_begin, n_grp_sub);
+
+    return eval_lb(tobs_sub, event_sub, X_sub, XD_sub, Z_sub, grp_sub, eps,
+                   kappa, b, theta, grp_size_sub, theta_VA, true);
   }
 };
 
@@ -105,30 +242,213 @@ class VA_func {
   template<class Type>
   using ADFun = CppAD::ADFun<Type>;
 
-  size_t n_para;
+  size_t n_para, n_shared;
+  /* kept to make the Hessian objects on request */
+  Rcpp::List data, parameters;
+
+  /* true if the data are arguments of the tapes in funcs such that they can
+   * be changed with set_data */
+  bool rebind_data = false;
+  vector<double> data_args;
+
+  /* number of groups in each sub-tape. Zero if there are no sub-tapes */
+  int n_grp_per_tape;
+  /* holds the data until the tapes for the lower bound are recorded */
+  std::unique_ptr<VA_worker<ADd> > worker;
+  bool recorded = false;
 
 public:
 
   size_t get_n_para() const {
     return n_para;
   }
+  size_t get_n_shared() const {
+    return n_shared;
+  }
+
+  unsigned n_threads = 1L;
+
+  /* buffers used to sum the output from the blocks */
+  survTMB::block_reducer lb_red, grad_red, hess_red, hess_vec_red;
+  /* holds the gradient elements which each block in funcs depends on */
+  survTMB::sparse_block_reducer grad_sp_red;
 
-                  std::vector<std::unique_ptr<ADFun<double> > >   funcs;
-  std::unique_ptr<std::vector<std::unique_ptr<ADFun<double> > > > grads;
+  /* timers and counters of the taping and the evaluations */
+  survTMB::phase_timers timers;
 
-  struct sparse_mat_data {
-    vector<int> row_idx, col_idx;
-    CppAD::ADFun<double> ddf;
+  std::vector<std::unique_ptr<ADFun<double> > > funcs;
+
+  /* tape for a chunk of groups. The tape's arguments are the shared
+   * parameters followed by the chunk's VA parameters which start at
+   * va_begin in the full parameter vector */
+  struct sub_tape {
+    unsigned g_begin, g_end;
+    std::size_t va_begin, va_size;
+    std::unique_ptr<ADFun<double> > func;
+  };
+  std::vector<sub_tape> sub_tapes;
+
+  /* persistent buffers for the evaluations. CppAD::vector uses CppAD's
+   * thread_alloc which holds on to the memory. Thus, neither the buffers nor
+   * the vectors returned by the tapes cause heap allocations after the
+   * first call */
+  struct eval_workspace {
+    CppAD::vector<double> par, w, dir, hv;
+    eval_workspace(): w(1) {
+      w[0] = 1;
+    }
   };
-  std::unique_ptr<sparse_mat_data> sparse_hess_dat;
+  /* one for each thread with the sub-tapes and one for each block
+   * otherwise */
+  std::vector<eval_workspace> workspaces;
+  /* copy of the parameters which is shared by the full tapes */
+  CppAD::vector<double> par_full;
+
+  /* sets the argument vector for a sub-tape */
+  void set_sub_par(double const *par, sub_tape const &st,
+                   CppAD::vector<double> &out) const {
+    out.resize(n_shared + st.va_size);
+    for(unsigned i = 0; i < n_shared; ++i)
+      out[i] = par[i];
+    for(unsigned i = 0; i < st.va_size; ++i)
+      out[n_shared + i] = par[st.va_begin + i];
+  }
+
+  /* copies par and possibly the data to the vector which is passed to the
+   * full tapes */
+  CppAD::vector<double> const & set_par_full(double const *par){
+    std::size_t const n_data = data_args.size();
+    par_full.resize(n_para + n_data);
+    std::copy(par, par + n_para, &par_full[0]);
+    if(n_data > 0)
+      std::copy(data_args.data(), data_args.data() + n_data,
+                &par_full[n_para]);
+    return par_full;
+  }
+
+  /* sets the data values which are passed to the full tapes */
+  void set_data_args(){
+    data_args = get_data_args<double, double>(
+      get_vec<double>(data["tobs"]), get_vec<double>(data["event"]),
+      get_mat<double>(data["X"]), get_mat<double>(data["XD"]),
+      get_mat<double>(data["Z"]));
+  }
+
+  /* like set_par_full but returns a new vector */
+  CppAD::vector<double> get_par_full(double const *par) const {
+    std::size_t const n_data = data_args.size();
+    CppAD::vector<double> out(n_para + n_data);
+    std::copy(par, par + n_para, &out[0]);
+    if(n_data > 0)
+      std::copy(data_args.data(), data_args.data() + n_data, &out[n_para]);
+    return out;
+  }
+
+  /* returns n workspaces */
+  std::vector<eval_workspace> & get_workspaces(std::size_t const n){
+    if(workspaces.size() != n)
+      workspaces.resize(n);
+    return workspaces;
+  }
+
+  std::unique_ptr<survTMB::sparse_hess_dat> sparse_hess_dat;
+
+  /* the data and parameters are copied in the constructor. If defer is
+   * true then the tapes are not recorded until record is called. record
+   * does not use any R objects and can thus be called in parallel for
+   * different objects */
+  VA_func(Rcpp::List data, Rcpp::List parameters, bool const defer = false):
+  data(data), parameters(parameters),
+  n_grp_per_tape(data.containsElementNamed("n_grp_per_tape") ?
+      Rcpp::as<int>(data["n_grp_per_tape"]) : 0L),
+  worker(new VA_worker<ADd>(data, parameters)) {
+    rebind_data = data.containsElementNamed("rebind_data") ?
+      Rcpp::as<bool>(data["rebind_data"]) : false;
+    if(rebind_data and n_grp_per_tape > 0L)
+      throw std::invalid_argument(
+          "VA_func: rebind_data is not supported with n_grp_per_tape > 0");
+
+    n_para    = worker->n_para;
+    n_shared  = worker->n_shared;
+    n_threads = worker->n_blocks;
+    if(rebind_data)
+      set_data_args();
+
+    if(defer)
+      return;
+
+    record();
+    release_worker();
+
+    /* the sparse Hessian objects are otherwise made on the first request.
+     * The dense Hessian is computed with the tapes in funcs */
+    DATA_LOGICAL(sparse_hess);
+    if(sparse_hess)
+      build_sparse_hess();
+  }
+
+  bool is_recorded() const {
+    return recorded;
+  }
+  bool has_sub_tapes() const {
+    return n_grp_per_tape > 0L;
+  }
+
+  /* records the tapes for the lower bound and the gradient if they have not
+   * already been recorded */
+  void record(){
+    if(recorded)
+      return;
+    if(!worker)
+      throw std::runtime_error("VA_func::record: the worker is released");
+    VA_worker<ADd> const &w = *worker;
+
+    if(n_grp_per_tape > 0L){
+      /* to compute function and gradient with a tape for each chunk of
+       * groups. The tapes are recorded and evaluated by the threads as
+       * they become available */
+      unsigned const n_groups = w.n_groups,
+                     n_tapes  = (n_groups + n_grp_per_tape - 1L) /
+                       n_grp_per_tape;
+      sub_tapes.resize(n_tapes);
 
-  VA_func(Rcpp::List data, Rcpp::List parameters){
-    {
+#ifdef _OPENMP
+#pragma omp parallel for if(w.n_blocks > 1L) schedule(dynamic)
+#endif
+      for(unsigned i = 0; i < n_tapes; ++i){
+        sub_tape &st = sub_tapes[i];
+        st.g_begin  = i * n_grp_per_tape;
+        st.g_end    = std::min<unsigned>(st.g_begin + n_grp_per_tape,
+                                         n_groups);
+        st.va_begin = n_shared + st.g_begin * w.n_va_grp;
+        st.va_size  = (st.g_end - st.g_begin) * w.n_va_grp;
+        st.func.reset(new ADFun<double>());
+
+        vector<ADd> args = w.get_args_va<ADd>(st.g_begin, st.g_end);
+        {
+          survTMB::scoped_phase timer(timers, survTMB::phase_taping);
+          survTMB::scoped_taping_arena arena;
+          CppAD::Independent(args);
+          vector<ADd> y(1);
+          y[0] = w(args, st.g_begin, st.g_end);
+
+          st.func->Dependent(args, y);
+        }
+        survTMB::scoped_phase timer(timers, survTMB::phase_optimize);
+        st.func->optimize();
+      }
+
+    } else {
       /* to compute function and gradient */
-      VA_worker<ADd> w(data, parameters);
       funcs.resize(w.n_blocks);
       vector<ADd> args = w.get_args_va<ADd>();
-      n_para = w.n_para;
+      if(rebind_data){
+        /* the data are arguments after the parameters */
+        vector<ADd> const d_args = w.get_data_args<ADd>();
+        vector<ADd> all_args(args.size() + d_args.size());
+        all_args << args, d_args;
+        args = all_args;
+      }
 
 #ifdef _OPENMP
 #pragma omp parallel for if(w.n_blocks > 1L) firstprivate(args)
@@ -136,152 +456,362 @@ public:
       for(unsigned i = 0; i < w.n_blocks; ++i){
         funcs[i].reset(new ADFun<double>());
 
-        CppAD::Independent(args);
-        vector<ADd> y(1);
-        y[0] = w(args);
+        {
+          survTMB::scoped_phase timer(timers, survTMB::phase_taping);
+          survTMB::scoped_taping_arena arena;
+          CppAD::Independent(args);
+          vector<ADd> y(1);
+          y[0] = rebind_data ? w.eval_with_data(args) : w(args);
 
-        funcs[i]->Dependent(args, y);
+          funcs[i]->Dependent(args, y);
+        }
+        survTMB::scoped_phase timer(timers, survTMB::phase_optimize);
         funcs[i]->optimize();
       }
-    }
 
-    /* TODO: build this on request afterwards */
-    DATA_LOGICAL(dense_hess);
-    if(dense_hess){
-      /* to compute dense Hessian
-       * TODO: use base2ad if CppAD gets updated */
-      grads.reset(new std::vector<std::unique_ptr<ADFun<double> > >());
-      auto &grs = *grads;
-
-      VA_worker<ADdd> w(data, parameters);
-      grs.resize(w.n_blocks);
-      vector<ADdd> x = w.get_args_va<ADdd>();
+      /* find the VA parameters which each block depends on */
+      std::vector<std::vector<bool> > patterns(w.n_blocks);
 #ifdef _OPENMP
-#pragma omp parallel for if(w.n_blocks > 1L) firstprivate(x)
+#pragma omp parallel for if(w.n_blocks > 1L)
 #endif
       for(unsigned i = 0; i < w.n_blocks; ++i){
-        grs[i].reset(new ADFun<double>());
+        patterns[i] = funcs[i]->RevSparseJac(1L, std::vector<bool>(1L, true));
+        /* drop the data if they are arguments */
+        patterns[i].resize(n_para);
+      }
 
-        CppAD::Independent(x);
-        vector<ADdd> y(1);
-        y[0] = w(x);
+      grad_sp_red = survTMB::sparse_block_reducer(n_shared, n_para);
+      for(unsigned i = 0; i < w.n_blocks; ++i)
+        grad_sp_red.add_block(survTMB::sparse_block_reducer::get_ranges(
+            patterns[i], n_shared));
+    }
 
-        ADFun<ADd> tmp;
-        tmp.Dependent(x, y);
-        tmp.optimize();
+    recorded = true;
+  }
 
-        vector<ADd> xx(x.size());
-        for(unsigned i = 0; i < x.size(); ++i)
-          xx[i] = CppAD::Value(x[i]);
+  /* releases the data used to record the tapes. The worker holds R objects
+   * so this must not be called in parallel */
+  void release_worker(){
+    if(recorded)
+      worker.reset();
+  }
+
+  /* records the tapes if they have not been recorded. Must not be called in
+   * parallel */
+  void ensure_recorded(){
+    if(recorded)
+      return;
+    setup_parallel_ad setup_ADd(n_threads);
+    record();
+    release_worker();
+  }
+
+  /* returns the object to compute the sparse Hessian. It is made if it does
+   * not exist */
+  survTMB::sparse_hess_dat & get_sparse_hess_dat(){
+    if(!sparse_hess_dat)
+      build_sparse_hess();
+    return *sparse_hess_dat;
+  }
 
-        CppAD::Independent(xx);
-        vector<ADd> yy = tmp.Jacobian(xx);
+  /* returns the number of variables on the tapes used to evaluate the
+   * lower bound and its gradient */
+  std::size_t tape_size() const {
+    std::size_t out(0L);
+    for(auto &f : funcs)
+      out += f->size_var();
+    for(auto &st : sub_tapes)
+      out += st.func->size_var();
+    return out;
+  }
+
+  /* returns the size and the memory use of all the tapes */
+  survTMB::tape_info get_tape_info() const {
+    survTMB::tape_info out;
+    out.add("lb", funcs);
+    for(std::size_t i = 0; i < sub_tapes.size(); ++i)
+      out.add("sub_tape", i, *sub_tapes[i].func);
+    if(sparse_hess_dat)
+      for(std::size_t b = 0; b < sparse_hess_dat->get_n_blocks(); ++b)
+        out.add("sparse_hess", b, sparse_hess_dat->get_block(b).ddf);
+    return out;
+  }
 
-        grs[i]->Dependent(xx, yy);
-        grs[i]->optimize();
+  /* evaluates the lower bound. par points to get_n_para() elements and is
+   * read directly by the sub-tapes */
+  double eval_lb(double const *par){
+    ensure_recorded();
+    double out(0);
+    if(!sub_tapes.empty()){
+      /* the assignment of tapes to threads is fixed between calls */
+      unsigned const n_tapes = sub_tapes.size();
+      lb_red.resize(n_threads, 1L);
+      std::vector<eval_workspace> &wks = get_workspaces(n_threads);
+#ifdef _OPENMP
+#pragma omp parallel for if(n_threads > 1L) schedule(static, 1)
+#endif
+      for(unsigned t = 0; t < n_threads; ++t){
+        survTMB::scoped_atomic_slot atomic_slot(timers);
+        double &term = *lb_red.block(t);
+        term = 0;
+        CppAD::vector<double> &par_i = wks[t].par;
+        for(unsigned i = t; i < n_tapes; i += n_threads){
+          set_sub_par(par, sub_tapes[i], par_i);
+          survTMB::scoped_phase timer(timers, survTMB::phase_forward);
+          term += sub_tapes[i].func->Forward(0, par_i)[0];
+        }
       }
+
+      survTMB::scoped_phase timer(timers, survTMB::phase_reduction);
+      lb_red.reduce(&out);
+      return out;
     }
 
-    /* TODO: build this on request afterwards */
-    DATA_LOGICAL(sparse_hess);
-    if(sparse_hess){
-      /* to compute sparse Hessian
-       * TODO: use subgraph_jac_rev if CppAD gets updated */
-      VA_worker<ADddd> w(data, parameters);
-      vector<ADddd> x = w.get_args_va<ADddd>();
-      unsigned const n_vars = x.size();
-
-      /* record f */
-      CppAD::Independent(x);
-      vector<ADddd> y(1);
-      y[0] = w(x);
-      CppAD::ADFun<ADdd> f;
-      f.Dependent(x, y);
-      f.optimize();
-
-      /* record f'' */
-      vector<ADdd> xx(n_vars),
-                   wi(1);
-      for(unsigned i = 0; i < n_vars; ++i)
-        xx[i] = CppAD::Value(x[i]);
-      CppAD::Independent(xx);
-      f.Forward(0, xx);
-      wi[0] = 1.;
-      vector<ADdd> yy = f.Reverse(1, wi);
-
-      CppAD::ADFun<ADd> df;
-      df.Dependent(xx, yy);
-      df.optimize();
-
-      /* record f'' but in a sparse manner. Thus, we first need to
-       * find the number of non-zero entries and their positions */
-      vector<bool> keepcol(n_vars);
-      for(unsigned i = 0; i < 2; ++i)
-        keepcol[i] = false;
-      for(unsigned i = 2; i < n_vars; ++i)
-        keepcol[i] = true;
-      df.my_init(keepcol);
-
-      auto keep_col = [&](unsigned const col){
-        return keepcol[col];
-      };
-      auto keep_row = [&](unsigned const row, unsigned const col){
-        return keep_col(col) and row >= col;
-      };
-
-      unsigned colisize,
-               n_non_zero(0); // Count number of non-zeros (m)
-      for(unsigned i = 0; i < df.colpattern.size(); i++){
-        colisize = df.colpattern[i].size();
-        if(keep_col(i))
-          for(unsigned j = 0; j < colisize; j++)
-            n_non_zero += keep_row(df.colpattern[i][j], i);
-      }
+    /* CppAD needs its own vector but it is shared by the threads */
+    CppAD::vector<double> const &parv = set_par_full(par);
+    unsigned const n_blocks = funcs.size();
+    lb_red.resize(n_blocks, 1L);
+#ifdef _OPENMP
+#pragma omp parallel for if(n_blocks > 1L)
+#endif
+    for(unsigned i = 0; i < n_blocks; ++i){
+      survTMB::scoped_atomic_slot atomic_slot(timers);
+      survTMB::scoped_phase timer(timers, survTMB::phase_forward);
+      *lb_red.block(i) = funcs[i]->Forward(0, parv)[0];
+    }
+
+    survTMB::scoped_phase timer(timers, survTMB::phase_reduction);
+    lb_red.reduce(&out);
+    return out;
+  }
+
+  /* evaluates the gradient and writes it to out. Both par and out must
+   * have get_n_para() elements */
+  void eval_grad(double const *par, double * const out){
+    ensure_recorded();
+    if(!sub_tapes.empty()){
+      unsigned const n_tapes = sub_tapes.size();
+      grad_red.resize(n_threads, n_shared);
+      std::vector<eval_workspace> &wks = get_workspaces(n_threads);
 
-      // Allocate index vectors of non-zero pairs
-      vector<int> row_idx(n_non_zero);
-      vector<int> col_idx(n_non_zero);
-      // Prepare reverse sweep for Hessian columns
-      vector<ADd> u(n_vars);
-      vector<ADd> v(n_vars);
-      for(unsigned i = 0; i < n_vars; i++)
-        v[i] = 0.0;
-      vector<ADd> xxx(n_vars);
-      for(unsigned i = 0; i < n_vars; i++)
-        xxx[i]  = CppAD::Value(CppAD::Value(xx[i]));
-      vector<ADd> yyy(n_non_zero);
-
-      // Do sweeps and fill in non-zero index pairs
-      CppAD::Independent(xxx);
-      df.Forward(0, xxx);
-
-      unsigned idx(0);
-      for(unsigned i = 0; i < n_vars; i++){
-        if(keep_col(i)) {
-          df.myReverse(1, v, i /*range comp*/, u /*domain*/);
-          CppAD::vector<int> &icol = df.colpattern[i];
-
-          for(unsigned j = 0; j < icol.size(); j++){
-            if(keep_row(icol[j], i)){
-              row_idx[idx] = icol[j];
-              col_idx[idx] = i;
-              yyy    [idx] = u[icol[j]];
-              idx++;
-            }
+#ifdef _OPENMP
+#pragma omp parallel for if(n_threads > 1L) schedule(static, 1)
+#endif
+      for(unsigned t = 0; t < n_threads; ++t){
+        survTMB::scoped_atomic_slot atomic_slot(timers);
+        grad_red.zero(t);
+        double * const g_shared = grad_red.block(t);
+        eval_workspace &wk = wks[t];
+
+        for(unsigned i = t; i < n_tapes; i += n_threads){
+          sub_tape &st = sub_tapes[i];
+          set_sub_par(par, st, wk.par);
+          {
+            survTMB::scoped_phase timer(timers, survTMB::phase_forward);
+            st.func->Forward(0, wk.par);
           }
+          survTMB::scoped_phase timer(timers, survTMB::phase_reverse);
+          CppAD::vector<double> const grad_i = st.func->Reverse(1, wk.w);
+
+          /* the VA parameters are not shared between the tapes */
+          for(unsigned j = 0; j < st.va_size; ++j)
+            out[st.va_begin + j] = grad_i[n_shared + j];
+          for(unsigned j = 0; j < n_shared; ++j)
+            g_shared[j] += grad_i[j];
         }
       }
 
-      /* store output */
-      sparse_hess_dat.reset(new sparse_mat_data());
-      auto &shd = *sparse_hess_dat;
-      shd.ddf.Dependent(xxx, yyy);
-      shd.row_idx = std::move(row_idx);
-      shd.col_idx = std::move(col_idx);
+      survTMB::scoped_phase timer(timers, survTMB::phase_reduction);
+      grad_red.reduce(out, n_threads);
+      return;
+    }
+
+    /* only the elements which each block depends on are stored */
+    CppAD::vector<double> const &parv = set_par_full(par);
+    unsigned const n_blocks = funcs.size();
+    std::vector<eval_workspace> &wks = get_workspaces(n_blocks);
+
+#ifdef _OPENMP
+#pragma omp parallel for if(n_blocks > 1L)
+#endif
+    for(unsigned i = 0; i < n_blocks; ++i){
+      survTMB::scoped_atomic_slot atomic_slot(timers);
+      {
+        survTMB::scoped_phase timer(timers, survTMB::phase_forward);
+        funcs[i]->Forward(0, parv);
+      }
+      survTMB::scoped_phase timer(timers, survTMB::phase_reverse);
+      CppAD::vector<double> const grad_i = funcs[i]->Reverse(1, wks[i].w);
+      grad_sp_red.set_block(i, &grad_i[0]);
+    }
+
+    survTMB::scoped_phase timer(timers, survTMB::phase_reduction);
+    grad_sp_red.reduce(out, n_blocks);
+  }
+
+  /* replaces tobs, event, X, XD, and Z. The tapes in funcs are kept but
+   * the objects for the Hessian are made again on request. The dimensions
+   * and the grouping must not change */
+  void set_data(Rcpp::List new_data){
+    if(!rebind_data)
+      throw std::invalid_argument(
+          "VA_func::set_data: the object is made with rebind_data = FALSE");
+
+    Rcpp::List out = Rcpp::clone(data);
+    auto set_vec = [&](char const *name){
+      Rcpp::NumericVector const old_x = data[name],
+                                    x = new_data[name];
+      if(x.size() != old_x.size())
+        throw std::invalid_argument(
+            std::string("VA_func::set_data: invalid ") + name);
+      out[name] = Rcpp::clone(x);
+    };
+    auto set_mat = [&](char const *name){
+      Rcpp::NumericMatrix const old_x = data[name],
+                                    x = new_data[name];
+      if(x.nrow() != old_x.nrow() or x.ncol() != old_x.ncol())
+        throw std::invalid_argument(
+            std::string("VA_func::set_data: invalid ") + name);
+      out[name] = Rcpp::clone(x);
+    };
+    set_vec("tobs");
+    set_vec("event");
+    set_mat("X");
+    set_mat("XD");
+    set_mat("Z");
+
+    data = out;
+    set_data_args();
+
+    sparse_hess_dat.reset();
+  }
+
+private:
+  void build_sparse_hess(){
+    /* to compute sparse Hessian
+     * TODO: use subgraph_jac_rev if CppAD gets updated */
+    setup_parallel_ad setup_ADd(n_threads);
+#ifdef _OPENMP
+    if(n_threads > 1L)
+      CppAD::parallel_ad<ADdd>();
+#endif
+
+    VA_worker<ADddd> w(data, parameters);
+    sparse_hess_dat.reset(new survTMB::sparse_hess_dat(w.n_blocks));
+    auto &shd = *sparse_hess_dat;
+
+    /* record a tape for each block. The first two parameters are eps and
+     * kappa */
+#ifdef _OPENMP
+#pragma omp parallel for if(w.n_blocks > 1L)
+#endif
+    for(unsigned b = 0; b < w.n_blocks; ++b){
+      survTMB::scoped_phase timer(timers, survTMB::phase_taping);
+      shd.record_block(
+        b, w.get_args_va<ADddd>(),
+        [&](vector<ADddd> &x){ return w(x); }, 2L);
     }
+
+    shd.merge();
   }
 };
 
+/* element function to use with the partially separable optimizer. The
+ * global parameters are the shared parameters without eps and kappa */
+class sub_tape_efunc {
+  VA_func::sub_tape *st;
+  std::size_t n_shared;
+  vector<double> args = vector<double>(n_shared + st->va_size),
+                    w = vector<double>(1);
+
+  void set_args(double const *g, double const *p){
+    std::copy(g, g + n_shared - 2L, args.data() + 2L);
+    std::copy(p, p + st->va_size, args.data() + n_shared);
+  }
+
+public:
+  sub_tape_efunc(VA_func::sub_tape &st, std::size_t const n_shared,
+                 double const eps, double const kappa):
+  st(&st), n_shared(n_shared) {
+    args[0] = eps;
+    args[1] = kappa;
+    w[0] = 1;
+  }
+
+  std::size_t n_private() const {
+    return st->va_size;
+  }
+
+  double func(double const *g, double const *p){
+    set_args(g, p);
+    return st->func->Forward(0, args)[0];
+  }
+
+  double grad(double const *g, double const *p, double *gr){
+    double const out = func(g, p);
+    vector<double> const grad_i = st->func->Reverse(1, w);
+    std::copy(grad_i.data() + 2L, grad_i.data() + grad_i.size(), gr);
+    return out;
+  }
+};
+
+/* returns the phase timers and the atomic function timers of each thread
+ * which has been used */
+Rcpp::List phase_timers_to_R(survTMB::phase_timers const &timers){
+  using Rcpp::Named;
+  std::vector<int> p_thread, a_thread;
+  std::vector<std::string> p_phase, a_name;
+  std::vector<double> p_count, p_time, a_count, a_time;
+
+  auto const &slots = timers.get_slots();
+  for(std::size_t t = 0; t < slots.size(); ++t){
+    auto const &s = slots[t];
+    for(unsigned p = 0; p < survTMB::n_phase_types; ++p)
+      if(s.count[p] > 0){
+        p_thread.emplace_back(t);
+        p_phase .emplace_back(
+          survTMB::phase_name(static_cast<survTMB::phase_type>(p)));
+        p_count .emplace_back(s.count[p]);
+        p_time  .emplace_back(s.time[p]);
+      }
+
+    for(auto const &a : s.atomics){
+      a_thread.emplace_back(t);
+      a_name  .emplace_back(a.name);
+      a_count .emplace_back(a.count);
+      a_time  .emplace_back(a.time);
+    }
+  }
+
+  return Rcpp::List::create(
+    Named("phases") = Rcpp::DataFrame::create(
+      Named("thread") = p_thread, Named("phase") = p_phase,
+      Named("count") = p_count, Named("time") = p_time,
+      Named("stringsAsFactors") = false),
+    Named("atomics") = Rcpp::DataFrame::create(
+      Named("thread") = a_thread, Named("name") = a_name,
+      Named("count") = a_count, Named("time") = a_time,
+      Named("stringsAsFactors") = false));
+}
+
+/* returns the columns of par as parameter vectors */
+std::vector<vector<double> > get_par_cols
+  (Rcpp::NumericMatrix par, size_t const n_para, char const *caller){
+  if((size_t)par.nrow() != n_para)
+    throw std::invalid_argument(std::string(caller) + ": invalid par");
+
+  size_t const n_points = par.ncol();
+  std::vector<vector<double> > out;
+  out.reserve(n_points);
+  for(size_t i = 0; i < n_points; ++i){
+    vector<double> par_i(n_para);
+    std::copy(&par(0, i), &par(0, i) + n_para, par_i.data());
+    out.emplace_back(std::move(par_i));
+  }
+
+  return out;
+}
+
 } // namespace
 
 // [[Rcpp::export(rng = false)]]
@@ -292,7 +822,11 @@ SEXP get_VA_funcs
   unsigned const n_threads(data["n_threads"]);
   setup_parallel_ad setup_ADd(n_threads);
 
-  return Rcpp::XPtr<VA_func>(new VA_func(data, parameters));
+  /* the tapes are recorded on the first evaluation if defer_taping is
+   * true */
+  bool const defer = data.containsElementNamed("defer_taping") ?
+    Rcpp::as<bool>(data["defer_taping"]) : false;
+  return Rcpp::XPtr<VA_func>(new VA_func(data, parameters, defer));
 }
 
 // [[Rcpp::export(rng = false)]]
@@ -301,101 +835,409 @@ double VA_funcs_eval_lb
   shut_up();
 
   Rcpp::XPtr<VA_func > ptr(p);
-  std::vector<std::unique_ptr<CppAD::ADFun<double> > > &funcs = ptr->funcs;
-  vector<double> parv = get_vec<double>(par);
+  Rcpp::NumericVector parv(par);
   if((size_t)parv.size() != ptr->get_n_para())
     throw std::invalid_argument("VA_funcs_eval_lb: invalid par");
 
+  return ptr->eval_lb(&parv[0]);
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::NumericVector VA_funcs_eval_grad
+  (SEXP p, SEXP par){
+  shut_up();
+
+  Rcpp::XPtr<VA_func> ptr(p);
+  Rcpp::NumericVector parv(par);
+  if((size_t)parv.size() != ptr->get_n_para())
+    throw std::invalid_argument("VA_funcs_eval_grad: invalid par");
+
+  Rcpp::NumericVector out(parv.size());
+  ptr->eval_grad(&parv[0], &out[0]);
+  return out;
+}
+
+// [[Rcpp::export(rng = false)]]
+double VA_funcs_tape_size(SEXP p){
+  Rcpp::XPtr<VA_func> ptr(p);
+  return ptr->tape_size();
+}
+
+/* returns the size of each tape, the memory used by the Taylor coefficients
+ * and sparsity patterns, and the memory held by each thread */
+// [[Rcpp::export(rng = false)]]
+Rcpp::List VA_funcs_tape_info(SEXP p){
+  Rcpp::XPtr<VA_func> ptr(p);
+  return ptr->get_tape_info().to_R();
+}
+
+/* returns the time in seconds and the number of calls of each phase and
+ * atomic function for each thread */
+// [[Rcpp::export(rng = false)]]
+Rcpp::List VA_funcs_get_timers(SEXP p){
+  Rcpp::XPtr<VA_func> ptr(p);
+  return phase_timers_to_R(ptr->timers);
+}
+
+// [[Rcpp::export(rng = false)]]
+void VA_funcs_reset_timers(SEXP p){
+  Rcpp::XPtr<VA_func> ptr(p);
+  ptr->timers.reset();
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::NumericVector VA_funcs_eval_lb_batch
+  (SEXP p, Rcpp::NumericMatrix par){
+  shut_up();
+
+  Rcpp::XPtr<VA_func > ptr(p);
+  ptr->ensure_recorded();
+  std::vector<std::unique_ptr<CppAD::ADFun<double> > > &funcs = ptr->funcs;
+  std::vector<vector<double> > const pars =
+    get_par_cols(par, ptr->get_n_para(), "VA_funcs_eval_lb_batch");
+  unsigned const n_points = pars.size();
+
+  /* each block stores one term for each point */
+  survTMB::block_reducer &red = ptr->lb_red;
+  Rcpp::NumericVector out(n_points);
+  if(n_points < 1L)
+    return out;
+
+  if(!ptr->sub_tapes.empty()){
+    std::vector<VA_func::sub_tape> &sub_tapes = ptr->sub_tapes;
+    unsigned const n_tapes   = sub_tapes.size(),
+                   n_threads = ptr->n_threads;
+    red.resize(n_threads, n_points);
+    std::vector<VA_func::eval_workspace> &wks =
+      ptr->get_workspaces(n_threads);
+#ifdef _OPENMP
+#pragma omp parallel for if(n_threads > 1L) schedule(static, 1)
+#endif
+    for(unsigned t = 0; t < n_threads; ++t){
+      red.zero(t);
+      double * const terms = red.block(t);
+      CppAD::vector<double> &par_i = wks[t].par;
+      for(unsigned i = t; i < n_tapes; i += n_threads)
+        for(unsigned j = 0; j < n_points; ++j){
+          ptr->set_sub_par(pars[j].data(), sub_tapes[i], par_i);
+          terms[j] += sub_tapes[i].func->Forward(0, par_i)[0];
+        }
+    }
+
+    red.reduce(&out[0], n_threads);
+    return out;
+  }
+
+  /* the full tapes may also take the data as arguments */
+  std::vector<CppAD::vector<double> > pars_full;
+  pars_full.reserve(n_points);
+  for(auto &x : pars)
+    pars_full.emplace_back(ptr->get_par_full(x.data()));
+
   unsigned const n_blocks = ptr->funcs.size();
-  double out(0);
+  red.resize(n_blocks, n_points);
 #ifdef _OPENMP
-#pragma omp parallel for if(n_blocks > 1L) firstprivate(parv) reduction(+:out)
+#pragma omp parallel for if(n_blocks > 1L)
 #endif
-  for(unsigned i = 0; i < n_blocks; ++i)
-    out += funcs[i]->Forward(0, parv)[0];
+  for(unsigned i = 0; i < n_blocks; ++i){
+    double * const terms = red.block(i);
+    for(unsigned j = 0; j < n_points; ++j)
+      terms[j] = funcs[i]->Forward(0, pars_full[j])[0];
+  }
 
+  red.reduce(&out[0], n_blocks);
   return out;
 }
 
 // [[Rcpp::export(rng = false)]]
-Rcpp::NumericVector VA_funcs_eval_grad
-  (SEXP p, SEXP par){
+Rcpp::NumericMatrix VA_funcs_eval_grad_batch
+  (SEXP p, Rcpp::NumericMatrix par){
   shut_up();
 
   Rcpp::XPtr<VA_func> ptr(p);
+  ptr->ensure_recorded();
   std::vector<std::unique_ptr<CppAD::ADFun<double> > > &funcs = ptr->funcs;
-  vector<double> parv = get_vec<double>(par);
-  if((size_t)parv.size() != ptr->get_n_para())
-    throw std::invalid_argument("VA_funcs_eval_grad: invalid par");
+  std::vector<vector<double> > const pars =
+    get_par_cols(par, ptr->get_n_para(), "VA_funcs_eval_grad_batch");
+  unsigned const n_points = pars.size();
+  std::size_t const n = ptr->get_n_para();
+  Rcpp::NumericMatrix out(n, n_points);
+  if(n_points < 1L)
+    return out;
+  double * const o = &out[0];
+
+  if(!ptr->sub_tapes.empty()){
+    /* each thread stores the shared elements for all the points */
+    std::vector<VA_func::sub_tape> &sub_tapes = ptr->sub_tapes;
+    survTMB::block_reducer &red = ptr->grad_red;
+    unsigned const n_tapes   = sub_tapes.size(),
+                   n_shared  = ptr->get_n_shared(),
+                   n_threads = ptr->n_threads;
+    red.resize(n_threads, n_shared * n_points);
+    std::vector<VA_func::eval_workspace> &wks =
+      ptr->get_workspaces(n_threads);
 
+#ifdef _OPENMP
+#pragma omp parallel for if(n_threads > 1L) schedule(static, 1)
+#endif
+    for(unsigned t = 0; t < n_threads; ++t){
+      red.zero(t);
+      VA_func::eval_workspace &wk = wks[t];
+
+      for(unsigned i = t; i < n_tapes; i += n_threads){
+        VA_func::sub_tape &st = sub_tapes[i];
+        for(unsigned k = 0; k < n_points; ++k){
+          ptr->set_sub_par(pars[k].data(), st, wk.par);
+          st.func->Forward(0, wk.par);
+          CppAD::vector<double> const grad_i = st.func->Reverse(1, wk.w);
+
+          double * const o_k = o + k * n,
+                 * const g_shared = red.block(t) + k * n_shared;
+          for(unsigned j = 0; j < st.va_size; ++j)
+            o_k[st.va_begin + j] = grad_i[n_shared + j];
+          for(unsigned j = 0; j < n_shared; ++j)
+            g_shared[j] += grad_i[j];
+        }
+      }
+    }
+
+    /* the shared elements are reduced and then copied to the output */
+    std::vector<double> shared(n_shared * n_points);
+    red.reduce(shared.data(), n_threads);
+    for(unsigned k = 0; k < n_points; ++k)
+      std::copy(shared.data() + k * n_shared,
+                shared.data() + (k + 1L) * n_shared, o + k * n);
+    return out;
+  }
+
+  /* use one parallel region where the threads evaluate the blocks for each
+   * point and one thread reduces the gradient */
+  survTMB::sparse_block_reducer &sp_red = ptr->grad_sp_red;
   unsigned const n_blocks = ptr->funcs.size();
-  vector<double> grad(parv.size());
-  grad.setZero();
+  std::vector<CppAD::vector<double> > pars_full;
+  pars_full.reserve(n_points);
+  for(auto &x : pars)
+    pars_full.emplace_back(ptr->get_par_full(x.data()));
 
 #ifdef _OPENMP
-#pragma omp parallel for if(n_blocks > 1L) firstprivate(parv)
+#pragma omp parallel if(n_blocks > 1L)
 #endif
-  for(unsigned i = 0; i < n_blocks; ++i){
-    funcs[i]->Forward(0, parv);
+  {
     vector<double> w(1);
     w[0] = 1;
 
-    vector<double> grad_i = funcs[i]->Reverse(1, w);
+    for(unsigned k = 0; k < n_points; ++k){
 #ifdef _OPENMP
-    /* TODO: replace with a reduction */
-#pragma omp critical
+#pragma omp for
 #endif
-    grad += grad_i;
-  }
+      for(unsigned i = 0; i < n_blocks; ++i){
+        funcs[i]->Forward(0, pars_full[k]);
+        vector<double> const grad_i = funcs[i]->Reverse(1, w);
+        sp_red.set_block(i, grad_i.data());
+      }
 
-  std::size_t const n = grad.size();
-  Rcpp::NumericVector out(n);
-  for(unsigned i = 0; i < n; ++i)
-    out[i] = grad[i];
+#ifdef _OPENMP
+#pragma omp single
+#endif
+      sp_red.reduce(o + k * n);
+    }
+  }
 
   return out;
 }
 
+// [[Rcpp::export(rng = false)]]
+void VA_funcs_set_data(SEXP p, Rcpp::List data){
+  Rcpp::XPtr<VA_func> ptr(p);
+  ptr->set_data(data);
+}
+
 // [[Rcpp::export(rng = false)]]
 Rcpp::NumericMatrix VA_funcs_eval_hess
   (SEXP p, SEXP par){
   shut_up();
 
   Rcpp::XPtr<VA_func > ptr(p);
-  if(!ptr->grads)
-    throw std::invalid_argument(
-        "VA_funcs_eval_hess: no ADFun objects to compute the Hessian");
-
-  std::vector<std::unique_ptr<CppAD::ADFun<double> > >
-    &grads = *ptr->grads;
-
   vector<double> parv = get_vec<double>(par);
   if((size_t)parv.size() != ptr->get_n_para())
     throw std::invalid_argument("VA_funcs_eval_hess: invalid par");
 
-  unsigned const n_blocks = grads.size(),
-                 n_vars   = parv.size();
-  vector<double> hess(n_vars * n_vars);
-  hess.setZero();
+  /* column k of the Hessian is the Hessian-vector product with the k'th
+   * unit vector. They are computed with the tapes of the lower bound */
+  ptr->ensure_recorded();
+  unsigned const n_vars = parv.size();
+  survTMB::block_reducer &red = ptr->hess_red;
+  Rcpp::NumericMatrix out(n_vars, n_vars);
+
+  if(!ptr->sub_tapes.empty()){
+    /* the sub-tapes only depend on the shared parameters and their own VA
+     * parameters. Thus, only the block of the shared parameters is summed
+     * over the threads */
+    std::vector<VA_func::sub_tape> &sub_tapes = ptr->sub_tapes;
+    unsigned const n_tapes   = sub_tapes.size(),
+                   n_shared  = ptr->get_n_shared(),
+                   n_threads = ptr->n_threads;
+    red.resize(n_threads, n_shared * n_shared);
+    std::vector<VA_func::eval_workspace> &wks =
+      ptr->get_workspaces(n_threads);
+    double * const o = &out[0];
 
 #ifdef _OPENMP
-#pragma omp parallel for if(n_blocks > 1L) firstprivate(parv)
+#pragma omp parallel for if(n_threads > 1L) schedule(static, 1)
+#endif
+    for(unsigned t = 0; t < n_threads; ++t){
+      red.zero(t);
+      double * const h_shared = red.block(t);
+      VA_func::eval_workspace &wk = wks[t];
+
+      for(unsigned i = t; i < n_tapes; i += n_threads){
+        VA_func::sub_tape &st = sub_tapes[i];
+        ptr->set_sub_par(parv.data(), st, wk.par);
+        std::size_t const n_loc = wk.par.size();
+        wk.dir.resize(n_loc);
+        wk.hv .resize(n_loc);
+        for(std::size_t k = 0; k < n_loc; ++k)
+          wk.dir[k] = 0;
+        st.func->Forward(0, wk.par);
+
+        /* maps an index on the sub-tape to the index in the output */
+        auto const out_idx = [&](std::size_t const k){
+          return k < n_shared ? k : st.va_begin + k - n_shared;
+        };
+        for(std::size_t k = 0; k < n_loc; ++k){
+          wk.dir[k] = 1;
+          survTMB::hess_vec_fwd_rev(*st.func, wk.dir, wk.w, &wk.hv[0], n_loc);
+          wk.dir[k] = 0;
+
+          double * const o_k = o + out_idx(k) * n_vars;
+          for(std::size_t j = 0; j < n_loc; ++j)
+            if(k < n_shared and j < n_shared)
+              h_shared[k * n_shared + j] += wk.hv[j];
+            else
+              o_k[out_idx(j)] = wk.hv[j];
+        }
+      }
+    }
+
+    std::vector<double> shared(n_shared * n_shared);
+    red.reduce(shared.data(), n_threads);
+    for(unsigned k = 0; k < n_shared; ++k)
+      std::copy(shared.data() + k * n_shared,
+                shared.data() + (k + 1L) * n_shared, o + k * n_vars);
+    return out;
+  }
+
+  std::vector<std::unique_ptr<CppAD::ADFun<double> > > &funcs = ptr->funcs;
+  CppAD::vector<double> const &par_full = ptr->set_par_full(parv.data());
+  unsigned const n_blocks = funcs.size();
+  red.resize(n_blocks, n_vars * n_vars);
+  std::vector<VA_func::eval_workspace> &wks = ptr->get_workspaces(n_blocks);
+
+#ifdef _OPENMP
+#pragma omp parallel for if(n_blocks > 1L)
 #endif
   for(unsigned i = 0; i < n_blocks; ++i){
-    vector<double> hess_i = grads[i]->Jacobian(parv);
+    /* the direction is zero for the data if they are arguments */
+    CppAD::vector<double> &dir = wks[i].dir;
+    dir.resize(par_full.size());
+    for(std::size_t k = 0; k < dir.size(); ++k)
+      dir[k] = 0;
+
+    funcs[i]->Forward(0, par_full);
+    double * const h = red.block(i);
+    for(unsigned k = 0; k < n_vars; ++k){
+      dir[k] = 1;
+      survTMB::hess_vec_fwd_rev(
+        *funcs[i], dir, wks[i].w, h + k * n_vars, n_vars);
+      dir[k] = 0;
+    }
+  }
+
+  red.reduce(&out[0], n_blocks);
+
+  return out;
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::NumericVector VA_funcs_eval_hess_vec
+  (SEXP p, SEXP par, SEXP v){
+  shut_up();
+
+  Rcpp::XPtr<VA_func > ptr(p);
+  vector<double> parv = get_vec<double>(par),
+                   vv = get_vec<double>(v);
+  if((size_t)parv.size() != ptr->get_n_para())
+    throw std::invalid_argument("VA_funcs_eval_hess_vec: invalid par");
+  if(vv.size() != parv.size())
+    throw std::invalid_argument("VA_funcs_eval_hess_vec: invalid v");
+
+  /* the Hessian-vector product is found with a first order forward sweep
+   * and a second order reverse sweep on the tapes of the lower bound */
+  ptr->ensure_recorded();
+  unsigned const n_vars = parv.size();
+  survTMB::block_reducer &red = ptr->hess_vec_red;
+  Rcpp::NumericVector out(n_vars);
+
+  if(!ptr->sub_tapes.empty()){
+    std::vector<VA_func::sub_tape> &sub_tapes = ptr->sub_tapes;
+    unsigned const n_tapes   = sub_tapes.size(),
+                   n_shared  = ptr->get_n_shared(),
+                   n_threads = ptr->n_threads;
+    red.resize(n_threads, n_shared);
+    std::vector<VA_func::eval_workspace> &wks =
+      ptr->get_workspaces(n_threads);
+    double * const o = &out[0];
+
 #ifdef _OPENMP
-    /* TODO: replace with a reduction */
-#pragma omp critical
+#pragma omp parallel for if(n_threads > 1L) schedule(static, 1)
 #endif
-    hess += hess_i;
+    for(unsigned t = 0; t < n_threads; ++t){
+      red.zero(t);
+      double * const hv_shared = red.block(t);
+      VA_func::eval_workspace &wk = wks[t];
+
+      for(unsigned i = t; i < n_tapes; i += n_threads){
+        VA_func::sub_tape &st = sub_tapes[i];
+        ptr->set_sub_par(parv.data(), st, wk.par);
+        ptr->set_sub_par(vv  .data(), st, wk.dir);
+        wk.hv.resize(wk.par.size());
+        st.func->Forward(0, wk.par);
+        survTMB::hess_vec_fwd_rev(
+          *st.func, wk.dir, wk.w, &wk.hv[0], wk.hv.size());
+
+        /* the VA parameters are not shared between the tapes */
+        for(unsigned j = 0; j < st.va_size; ++j)
+          o[st.va_begin + j] = wk.hv[n_shared + j];
+        for(unsigned j = 0; j < n_shared; ++j)
+          hv_shared[j] += wk.hv[j];
+      }
+    }
+
+    red.reduce(o, n_threads);
+    return out;
   }
 
-  Rcpp::NumericMatrix out(n_vars, n_vars);
-  double       *o = &out[0];
-  double const *g = &hess[0];
-  for(unsigned j = 0; j < n_vars; ++j)
-    for(unsigned i = 0; i < n_vars; ++i, ++o, ++g)
-      *o = *g;
+  /* the direction is zero for the data if they are arguments */
+  std::vector<std::unique_ptr<CppAD::ADFun<double> > > &funcs = ptr->funcs;
+  CppAD::vector<double> const &par_full = ptr->set_par_full(parv.data());
+  CppAD::vector<double> v_full(par_full.size());
+  for(std::size_t i = 0; i < v_full.size(); ++i)
+    v_full[i] = i < n_vars ? vv[i] : 0.;
+
+  unsigned const n_blocks = funcs.size();
+  red.resize(n_blocks, n_vars);
+  std::vector<VA_func::eval_workspace> &wks = ptr->get_workspaces(n_blocks);
+
+#ifdef _OPENMP
+#pragma omp parallel for if(n_blocks > 1L)
+#endif
+  for(unsigned i = 0; i < n_blocks; ++i){
+    funcs[i]->Forward(0, par_full);
+    survTMB::hess_vec_fwd_rev(
+      *funcs[i], v_full, wks[i].w, red.block(i), n_vars);
+  }
+
+  red.reduce(&out[0], n_blocks);
 
   return out;
 }
@@ -407,16 +1249,12 @@ Rcpp::List VA_funcs_eval_hess_sparse
   shut_up();
 
   Rcpp::XPtr<VA_func > ptr(p);
-  if(!ptr->sparse_hess_dat)
-    throw std::invalid_argument(
-        "VA_funcs_eval_hess_sparse: no object to compute the sparse Hessian");
-
   vector<double> parv = get_vec<double>(par);
   if((size_t)parv.size() != ptr->get_n_para())
     throw std::invalid_argument("VA_funcs_eval_hess_sparse: invalid par");
 
-  auto &shd = *ptr->sparse_hess_dat;
-  vector<double> val = shd.ddf.Forward(0, parv);
+  auto &shd = ptr->get_sparse_hess_dat();
+  vector<double> val = shd(parv);
 
   auto get_integer_vec = [&](vector<int> x){
     unsigned const n = x.size();
@@ -435,6 +1273,174 @@ Rcpp::List VA_funcs_eval_hess_sparse
 
   return Rcpp::List::create(
     Named("val")     = get_numeric_vec(val),
-    Named("row_idx") = get_integer_vec(shd.row_idx),
-    Named("col_idx") = get_integer_vec(shd.col_idx));
+    Named("row_idx") = get_integer_vec(shd.get_row_idx()),
+    Named("col_idx") = get_integer_vec(shd.get_col_idx()));
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::List VA_funcs_psqn
+  (SEXP p, SEXP par, double const rel_eps, unsigned const max_it,
+   unsigned const max_cg, double const c1, double const gr_tol){
+  using Rcpp::Named;
+  shut_up();
+
+  Rcpp::XPtr<VA_func > ptr(p);
+  ptr->ensure_recorded();
+  if(ptr->sub_tapes.empty())
+    throw std::invalid_argument(
+        "VA_funcs_psqn: requires tapes for chunks of groups (n_grp_per_tape > 0)");
+
+  vector<double> parv = get_vec<double>(par);
+  if((size_t)parv.size() != ptr->get_n_para())
+    throw std::invalid_argument("VA_funcs_psqn: invalid par");
+  if(rel_eps <= 0 or c1 <= 0 or c1 >= 1)
+    throw std::invalid_argument("VA_funcs_psqn: invalid rel_eps or c1");
+
+  std::size_t const n_shared = ptr->get_n_shared();
+  std::vector<sub_tape_efunc> funcs;
+  funcs.reserve(ptr->sub_tapes.size());
+  for(auto &st : ptr->sub_tapes)
+    funcs.emplace_back(st, n_shared, parv[0], parv[1]);
+
+  psqn::optimizer<sub_tape_efunc> opt(
+      std::move(funcs), n_shared - 2L, ptr->n_threads);
+
+  /* the VA parameters of the chunks are stored consecutively after the
+   * shared parameters */
+  psqn::optim_info const info =
+    opt.optim(parv.data() + 2L, rel_eps, max_it, max_cg, c1, gr_tol);
+
+  Rcpp::NumericVector par_out(parv.size());
+  std::copy(parv.data(), parv.data() + parv.size(), &par_out[0]);
+
+  return Rcpp::List::create(
+    Named("par")    = par_out,
+    Named("value")  = info.value,
+    Named("info")   = static_cast<int>(info.info),
+    Named("counts") = Rcpp::IntegerVector::create(
+      Named("function") = static_cast<int>(info.n_eval),
+      Named("gradient") = static_cast<int>(info.n_grad),
+      Named("cg")       = static_cast<int>(info.n_cg),
+      Named("iter")     = static_cast<int>(info.n_iter)));
+}
+
+namespace {
+/* throws an error if there is an error message */
+void throw_batch_errors
+  (std::vector<std::string> const &errs, char const *caller){
+  for(std::size_t i = 0; i < errs.size(); ++i)
+    if(!errs[i].empty())
+      throw std::runtime_error(
+          std::string(caller) + ": error for model " +
+            std::to_string(i + 1L) + ": " + errs[i]);
+}
+
+/* returns the pointers of a list of VA_func XPtrs and checks that each
+ * object uses one thread */
+std::vector<VA_func*> get_VA_func_ptrs(Rcpp::List ptrs, char const *caller){
+  std::vector<VA_func*> out;
+  out.reserve(ptrs.size());
+  for(R_xlen_t i = 0; i < ptrs.size(); ++i){
+    Rcpp::XPtr<VA_func> ptr(Rcpp::as<SEXP>(ptrs[i]));
+    if(ptr->n_threads != 1L)
+      throw std::invalid_argument(
+          std::string(caller) + ": the models must be made with n_threads = 1");
+    out.emplace_back(ptr.get());
+  }
+  return out;
+}
+} // namespace
+
+/**
+ maximizes the lower bound of many independent models in parallel with the
+ partially separable quasi-Newton method. Each model is optimized by one
+ thread. See VA_funcs_psqn for the other arguments.
+
+ Args:
+   ptrs: list of VA_func objects made with n_threads = 1 and
+         n_grp_per_tape > 0.
+   pars: list with the starting values of each model.
+   n_threads: number of models to optimize in parallel.
+ */
+// [[Rcpp::export(rng = false)]]
+Rcpp::List VA_funcs_psqn_batch
+  (Rcpp::List ptrs, Rcpp::List pars, double const rel_eps,
+   unsigned const max_it, unsigned const max_cg, double const c1,
+   double const gr_tol, unsigned const n_threads){
+  using Rcpp::Named;
+  shut_up();
+
+  std::vector<VA_func*> funcs = get_VA_func_ptrs(ptrs, "VA_funcs_psqn_batch");
+  std::size_t const n_models = funcs.size();
+  if(static_cast<std::size_t>(pars.size()) != n_models)
+    throw std::invalid_argument("VA_funcs_psqn_batch: invalid pars");
+  if(rel_eps <= 0 or c1 <= 0 or c1 >= 1)
+    throw std::invalid_argument(
+        "VA_funcs_psqn_batch: invalid rel_eps or c1");
+
+  std::vector<vector<double> > parvs;
+  parvs.reserve(n_models);
+  for(std::size_t i = 0; i < n_models; ++i){
+    if(!funcs[i]->has_sub_tapes())
+      throw std::invalid_argument(
+          "VA_funcs_psqn_batch: requires tapes for chunks of groups (n_grp_per_tape > 0)");
+    parvs.emplace_back(get_vec<double>(pars[i]));
+    if(static_cast<std::size_t>(parvs.back().size()) !=
+         funcs[i]->get_n_para())
+      throw std::invalid_argument("VA_funcs_psqn_batch: invalid pars");
+  }
+
+  std::vector<psqn::optim_info> infos(n_models);
+  std::vector<std::string> errs(n_models);
+  {
+    setup_parallel_ad setup_ADd(n_threads);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(dynamic) \
+  if(n_threads > 1L)
+#endif
+    for(std::size_t i = 0; i < n_models; ++i){
+      try {
+        VA_func &f = *funcs[i];
+        f.record();
+
+        vector<double> &parv = parvs[i];
+        std::size_t const n_shared = f.get_n_shared();
+        std::vector<sub_tape_efunc> efuncs;
+        efuncs.reserve(f.sub_tapes.size());
+        for(auto &st : f.sub_tapes)
+          efuncs.emplace_back(st, n_shared, parv[0], parv[1]);
+
+        psqn::optimizer<sub_tape_efunc> opt(
+            std::move(efuncs), n_shared - 2L, 1L);
+        infos[i] = opt.optim(
+          parv.data() + 2L, rel_eps, max_it, max_cg, c1, gr_tol);
+      } catch(std::exception const &e) {
+        errs[i] = e.what();
+      }
+    }
+  }
+
+  for(auto f : funcs)
+    f->release_worker();
+  throw_batch_errors(errs, "VA_funcs_psqn_batch");
+
+  Rcpp::List out(n_models);
+  for(std::size_t i = 0; i < n_models; ++i){
+    vector<double> const &parv = parvs[i];
+    psqn::optim_info const &info = infos[i];
+    Rcpp::NumericVector par_out(parv.size());
+    std::copy(parv.data(), parv.data() + parv.size(), &par_out[0]);
+
+    out[i] = Rcpp::List::create(
+      Named("par")    = par_out,
+      Named("value")  = info.value,
+      Named("info")   = static_cast<int>(info.info),
+      Named("counts") = Rcpp::IntegerVector::create(
+        Named("function") = static_cast<int>(info.n_eval),
+        Named("gradient") = static_cast<int>(info.n_grad),
+        Named("cg")       = static_cast<int>(info.n_cg),
+        Named("iter")     = static_cast<int>(info.n_iter)));
+  }
+
+  return out;
 }
@@ -0,0 +1,96 @@
+#ifndef ATOMIC_REGISTRY_H
+#define ATOMIC_REGISTRY_H
+
+#include "tmb_includes.h"
+#include "index-cache.h"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace survTMB {
+
+/* CppAD::atomic_base<Base> has a static list of all atomic functions which
+ * is written to in the destructor. See
+ *   https://github.com/kaskr/adcomp/blob/07678703541b81966f18f134d7d7cbf5df9e3345/TMB/inst/include/cppad/local/atomic_base.hpp#L59
+ *
+ * Thus, the list has to be constructed before a static cache of atomic
+ * functions such that the list is destructed after the cache. The list is
+ * shared between all atomic functions with the same base type so it is
+ * enough to construct one object. */
+template<class Base>
+bool construct_atomic_list(){
+  struct dummy final : public CppAD::atomic_base<Base> {
+    dummy(): CppAD::atomic_base<Base>("survTMB atomic list") { }
+  };
+  dummy const obj;
+  return true;
+}
+
+/* returns an atomic function indexed by n = 1, 2, ... from a process-wide
+ * registry for each atomic function type. The object is created with
+ * create on the first call with a given n. Look ups do not lock and can be
+ * made in parallel but new objects cannot be created in parallel as CppAD
+ * does not allow this.
+ *
+ * The objects must remain in scope while all CppAD::ADFun objects which
+ * use them are in use. Thus, they are never destructed before the
+ * program exits.
+ *
+ * Args:
+ *   Atomic: the atomic function.
+ *   Base: the base type of the atomic function.
+ *   n: index of the object. Typically the number of quadrature nodes.
+ *   name: name used in error messages.
+ *   create: function which returns a pointer to a new object.
+ */
+template<class Atomic, class Base, class Create>
+Atomic& get_cached_atomic(unsigned const n, char const *name,
+                          Create create){
+  if(n == 0L)
+    throw std::invalid_argument(
+        std::string(name) + "::get_cached: invalid n (zero)");
+
+  /* the order matters. See construct_atomic_list */
+  static bool const list_is_constructed = construct_atomic_list<Base>();
+  static index_cache<Atomic> cached_values;
+  (void)list_is_constructed;
+
+  Atomic * const out = cached_values.find(n);
+  if(out)
+    return *out;
+
+  if(CppAD::thread_alloc::in_parallel())
+    throw std::runtime_error(
+        std::string(name) + "::get_cached called in parallel mode");
+
+  return cached_values.get(n, create);
+}
+
+/* returns at least n elements of working memory which is private to the
+ * calling thread. The memory is allocated once for each thread and Tag and
+ * is only increased in size when needed. This avoids allocations in each
+ * call to the forward and reverse functions of atomic functions. Separate
+ * tags must be used by functions which may call each other. The pointer is
+ * valid until the next call with a larger n on the same thread */
+template<class Tag, class T = double>
+T * thread_scratch(std::size_t const n){
+  /* pad the memory to avoid false sharing of cache lines between
+   * threads */
+  constexpr std::size_t pad = 64L / sizeof(T) + 1L;
+  static thread_local std::unique_ptr<T[]> mem;
+  static thread_local std::size_t mem_size(0L);
+
+  if(mem_size < n){
+    std::size_t const new_size = std::max<std::size_t>(n, 2L * mem_size);
+    mem.reset(new T[new_size + pad]);
+    mem_size = new_size;
+  }
+
+  return mem.get();
+}
+
+} // namespace survTMB
+
+#endif
@@ -44,4 +44,18 @@ get_basis(arma::vec const &coefs) {
   return std::unique_ptr<pol>(new pol(alpha, norm2));
 }
 
+/** evaluates the basis at each element of x. Column i of out is the basis
+    at x[i]. The virtual eval_batch is used such that all the spline bases
+    use their batched evaluation */
+template<class Basis>
+void eval_basis_batch(Basis const &basis, arma::mat &out, arma::vec const &x){
+  basis.eval_batch(out, x);
+}
+
+inline void eval_basis_batch
+  (poly::orth_poly const &basis, arma::mat &out, arma::vec const &x){
+  basis.eval(x, out);
+  arma::inplace_trans(out);
+}
+
 #endif
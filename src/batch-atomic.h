@@ -0,0 +1,228 @@
+#ifndef BATCH_ATOMIC_H
+#define BATCH_ATOMIC_H
+
+#include "tmb_includes.h"
+#include "atomic-registry.h"
+#include "phase-timers.h"
+#include <cstddef>
+#include <stdexcept>
+
+namespace survTMB {
+
+/* atomic function which evaluates a scalar atomic function with one output
+ * for m tuples of inputs in one call. This yields one node on the tape
+ * instead of m nodes. The inputs are stored as
+ * (x_{11}, ..., x_{1k}, x_{21}, ..., x_{2k}, ..., x_{mk}) where k is the
+ * number of inputs of the scalar function and the outputs are
+ * (f(x_1), ..., f(x_m)).
+ *
+ * Args:
+ *   Type: base type.
+ *   Atomic: the scalar atomic function. It must have a static member n_in
+ *           with the number of inputs, get_cached(n), timer_name() which
+ *           returns the name used by survTMB::phase_timers, a member
+ *           function
+ *           double value(double const *x) which returns the function value,
+ *           and a member function
+ *           void derivs(Type const *x, Type *gr, Type *hess) which computes
+ *           the gradient and, if hess is not a nullptr, the Hessian in
+ *           column-major order.
+ */
+template<class Type, class Atomic>
+class batch_atomic : public CppAD::atomic_base<Type> {
+  static constexpr std::size_t n_in = Atomic::n_in;
+  Atomic const &scalar;
+
+public:
+  batch_atomic(char const *name, unsigned const n):
+  CppAD::atomic_base<Type>(name), scalar(Atomic::get_cached(n)) {
+    this->option(CppAD::atomic_base<Type>::bool_sparsity_enum);
+  }
+
+  /* returns a cached value to use in computations as the object must remain
+   * in scope while all CppAD::ADfun functions are still in use. */
+  static batch_atomic& get_cached(unsigned const n){
+    return get_cached_atomic<batch_atomic, Type>(
+      n, "batch_atomic<Type, Atomic>", [&]{
+        return new batch_atomic("batch_atomic<Type, Atomic>", n);
+      });
+  }
+
+  virtual bool forward(std::size_t p, std::size_t q,
+                       const CppAD::vector<bool> &vx,
+                       CppAD::vector<bool> &vy,
+                       const CppAD::vector<Type> &tx,
+                       CppAD::vector<Type> &ty){
+    if(q > 2)
+      return false;
+
+    std::size_t const nq = q + 1L,
+                       m = ty.size() / nq;
+    /* the count is the number of evaluations of the scalar function */
+    survTMB::scoped_atomic_timer timer(Atomic::timer_name(), m);
+    if(p == 0){
+      double x[n_in];
+      for(std::size_t i = 0; i < m; ++i){
+        for(std::size_t j = 0; j < n_in; ++j)
+          x[j] = asDouble(tx[(i * n_in + j) * nq]);
+        ty[i * nq] = Type(scalar.value(x));
+      }
+
+      /* set variable flags */
+      if (vx.size() > 0)
+        for(std::size_t i = 0; i < m; ++i){
+          bool anyvx = false;
+          for(std::size_t j = 0; j < n_in; ++j)
+            anyvx |= vx[i * n_in + j];
+          vy[i] = anyvx;
+        }
+    }
+    if(q < 1)
+      return true;
+
+    Type x[n_in], gr[n_in], hess[n_in * n_in];
+    for(std::size_t i = 0; i < m; ++i){
+      std::size_t const i_x = i * n_in;
+      for(std::size_t j = 0; j < n_in; ++j)
+        x[j] = tx[(i_x + j) * nq];
+      scalar.derivs(x, gr, q > 1 ? hess : nullptr);
+
+      for(std::size_t k = p < 1L ? 1L : p; k <= q; ++k){
+        Type out(0.);
+        for(std::size_t j = 0; j < n_in; ++j)
+          out += gr[j] * tx[(i_x + j) * nq + k];
+
+        if(k == 2L){
+          Type quad(0.);
+          for(std::size_t j = 0; j < n_in; ++j){
+            Type hv(0.);
+            for(std::size_t l = 0; l < n_in; ++l)
+              hv += hess[j + l * n_in] * tx[(i_x + l) * nq + 1L];
+            quad += tx[(i_x + j) * nq + 1L] * hv;
+          }
+          out += Type(.5) * quad;
+        }
+
+        ty[i * nq + k] = out;
+      }
+    }
+
+    return true;
+  }
+
+  virtual bool reverse(std::size_t q, const CppAD::vector<Type> &tx,
+                       const CppAD::vector<Type> &ty,
+                       CppAD::vector<Type> &px,
+                       const CppAD::vector<Type> &py){
+    if(q > 1)
+      return false;
+
+    std::size_t const nq = q + 1L,
+                       m = ty.size() / nq;
+    /* the count is the number of evaluations of the scalar function */
+    survTMB::scoped_atomic_timer timer(Atomic::timer_name(), m);
+    Type x[n_in], gr[n_in], hess[n_in * n_in];
+    for(std::size_t i = 0; i < m; ++i){
+      std::size_t const i_x = i * n_in;
+      for(std::size_t j = 0; j < n_in; ++j)
+        x[j] = tx[(i_x + j) * nq];
+      scalar.derivs(x, gr, q > 0 ? hess : nullptr);
+
+      if(q == 0L){
+        for(std::size_t j = 0; j < n_in; ++j)
+          px[i_x + j] = py[i] * gr[j];
+        continue;
+      }
+
+      for(std::size_t j = 0; j < n_in; ++j){
+        Type hv(0.);
+        for(std::size_t l = 0; l < n_in; ++l)
+          hv += hess[j + l * n_in] * tx[(i_x + l) * 2L + 1L];
+
+        px[(i_x + j) * 2L     ] = py[i * 2L] * gr[j] + py[i * 2L + 1L] * hv;
+        px[(i_x + j) * 2L + 1L] = py[i * 2L + 1L] * gr[j];
+      }
+    }
+
+    return true;
+  }
+
+  /* the Jacobian and the Hessian are block diagonal with one dense block
+   * for each output */
+  virtual bool for_sparse_jac(size_t q, const CppAD::vector<bool>& r,
+                              CppAD::vector<bool>& s) {
+    std::size_t const m = s.size() / q;
+    for(std::size_t i = 0; i < m; ++i)
+      for(std::size_t k = 0; k < q; ++k){
+        bool any(false);
+        for(std::size_t j = 0; j < n_in and !any; ++j)
+          any = r[(i * n_in + j) * q + k];
+        s[i * q + k] = any;
+      }
+
+    return true;
+  }
+
+  virtual bool rev_sparse_jac(size_t q, const CppAD::vector<bool>& rt,
+                              CppAD::vector<bool>& st) {
+    std::size_t const m = rt.size() / q;
+    for(std::size_t i = 0; i < m; ++i)
+      for(std::size_t j = 0; j < n_in; ++j)
+        for(std::size_t k = 0; k < q; ++k)
+          st[(i * n_in + j) * q + k] = rt[i * q + k];
+
+    return true;
+  }
+
+  virtual bool rev_sparse_hes(const CppAD::vector<bool>& vx,
+                              const CppAD::vector<bool>& s,
+                              CppAD::vector<bool>& t, size_t q,
+                              const CppAD::vector<bool>& r,
+                              const CppAD::vector<bool>& u,
+                              CppAD::vector<bool>& v) {
+    std::size_t const m = s.size();
+    for(std::size_t i = 0; i < m; ++i){
+      std::size_t const i_x = i * n_in;
+      for(std::size_t j = 0; j < n_in; ++j)
+        t[i_x + j] = s[i];
+
+      /* V = f'(x)^T U + s f''(x) R for each block */
+      for(std::size_t k = 0; k < q; ++k){
+        bool any_r(false);
+        if(s[i])
+          for(std::size_t j = 0; j < n_in and !any_r; ++j)
+            any_r = r[(i_x + j) * q + k];
+
+        bool const vk = u[i * q + k] or any_r;
+        for(std::size_t j = 0; j < n_in; ++j)
+          v[(i_x + j) * q + k] = vk;
+      }
+    }
+
+    return true;
+  }
+};
+
+/* evaluates the scalar atomic function for each tuple in x using one
+ * batch_atomic call. x has the memory layout described above */
+template<class Atomic, class Type>
+vector<AD<Type> > eval_batch_atomic
+  (vector<AD<Type> > const &x, unsigned const n){
+  auto &functor = batch_atomic<Type, Atomic>::get_cached(n);
+
+  std::size_t const m = x.size() / Atomic::n_in;
+  CppAD::vector<AD<Type> > tx(x.size()), ty(m);
+  for(std::size_t i = 0; i < tx.size(); ++i)
+    tx[i] = x[i];
+
+  functor(tx, ty);
+
+  vector<AD<Type> > out(m);
+  for(std::size_t i = 0; i < m; ++i)
+    out[i] = ty[i];
+  return out;
+}
+
+} // namespace survTMB
+
+#endif
@@ -0,0 +1,226 @@
+#include "gva-utils.h"
+#include "snva-utils.h"
+#include "splines.h"
+#include "orth_poly.h"
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <vector>
+
+/* benchmarks of the C++ kernels which cannot be called from R. The
+ * benchmarks of the functions which can be called from R are in
+ * inst/benchmarks/run-benchmarks.R which also calls bench_cpp_kernels. */
+
+namespace {
+using bench_clock = std::chrono::steady_clock;
+
+/* holds the run times in seconds of each benchmark */
+class bench_res {
+  std::vector<std::string> name;
+  std::vector<int> n, n_rep;
+  std::vector<double> min, median, mean;
+
+public:
+  /* the results are written to this such that the computations cannot be
+   * removed by the compiler */
+  double sink = 0.;
+
+  /* calls f once as a warm-up and then n_rep_i times */
+  template<class F>
+  void run(std::string const &name_i, unsigned const n_i,
+           unsigned const n_rep_i, F f){
+    sink += f();
+
+    std::vector<double> times(n_rep_i);
+    for(auto &t : times){
+      auto const start = bench_clock::now();
+      sink += f();
+      t = std::chrono::duration<double>(bench_clock::now() - start).count();
+    }
+
+    std::sort(times.begin(), times.end());
+    name  .emplace_back(name_i);
+    n     .emplace_back(n_i);
+    n_rep .emplace_back(n_rep_i);
+    min   .emplace_back(times.front());
+    median.emplace_back(times[times.size() / 2L]);
+    mean  .emplace_back(
+        std::accumulate(times.begin(), times.end(), 0.) / times.size());
+  }
+
+  Rcpp::DataFrame to_data_frame() const {
+    using Rcpp::Named;
+    return Rcpp::DataFrame::create(
+      Named("name") = name, Named("n") = n, Named("n_rep") = n_rep,
+      Named("min") = min, Named("median") = median, Named("mean") = mean,
+      Named("stringsAsFactors") = false);
+  }
+};
+
+/* returns n equally spaced points in [lb, ub] */
+std::vector<double> get_grid
+  (unsigned const n, double const lb, double const ub){
+  std::vector<double> out(n);
+  double const by = n > 1L ? (ub - lb) / (n - 1L) : 0.;
+  for(unsigned i = 0; i < n; ++i)
+    out[i] = lb + i * by;
+  return out;
+}
+
+using ADd = AD<double>;
+
+/* records a tape of the sum of f(x) and benchmarks a zero order forward
+ * sweep and a first order reverse sweep */
+template<class F>
+void bench_tape
+  (bench_res &res, std::string const &name, unsigned const n,
+   unsigned const n_rep, std::vector<double> const &x_val, F f){
+  vector<ADd> x(x_val.size());
+  for(std::size_t i = 0; i < x_val.size(); ++i)
+    x[i] = x_val[i];
+
+  CppAD::Independent(x);
+  vector<ADd> y(1);
+  y[0] = f(x);
+  CppAD::ADFun<double> func(x, y);
+  func.optimize();
+
+  vector<double> xx(x_val.size());
+  std::copy(x_val.begin(), x_val.end(), xx.data());
+  vector<double> w(1);
+  w[0] = 1;
+
+  res.run(name + " (forward)", n, n_rep, [&]{
+    return func.Forward(0, xx)[0];
+  });
+  res.run(name + " (forward and reverse)", n, n_rep, [&]{
+    func.Forward(0, xx);
+    return func.Reverse(1, w)[0];
+  });
+}
+} // namespace
+
+/**
+ benchmarks the Gauss-Hermite quadrature atomic functions, the SNVA atomic
+ functions, and the basis evaluations.
+
+ Args:
+   n: number of evaluations of the atomic functions and number of points at
+      which the bases are evaluated.
+   n_nodes: number of quadrature nodes.
+   n_rep: number of replications of each benchmark.
+   n_knots: number of interior knots of the splines and the degree of the
+            orthogonal polynomial.
+
+ Returns:
+   a data.frame with the minimum, median, and mean time in seconds.
+ */
+// [[Rcpp::export(rng = false)]]
+Rcpp::DataFrame bench_cpp_kernels
+  (unsigned const n, unsigned const n_nodes = 20L,
+   unsigned const n_rep = 100L, unsigned const n_knots = 3L){
+  if(n < 1L)
+    throw std::invalid_argument("bench_cpp_kernels: invalid n");
+  else if(n_nodes < 1L)
+    throw std::invalid_argument("bench_cpp_kernels: invalid n_nodes");
+  else if(n_rep < 1L)
+    throw std::invalid_argument("bench_cpp_kernels: invalid n_rep");
+  else if(n_knots < 1L)
+    throw std::invalid_argument("bench_cpp_kernels: invalid n_knots");
+
+  bench_res res;
+  std::vector<double> const mu    = get_grid(n, -3,  3),
+                            sigma = get_grid(n, .1,  2),
+                            rho   = get_grid(n, -2,  2);
+
+  /* the Gauss-Hermite quadrature used in the GVA */
+  {
+    using namespace GaussHermite::GVA;
+    std::vector<double> x(mu);
+    x.insert(x.end(), sigma.begin(), sigma.end());
+
+    auto set_args = [&](vector<ADd> const &args, vector<ADd> &m,
+                        vector<ADd> &s){
+      m = args.head(n);
+      s = args.tail(n);
+    };
+
+    bench_tape(res, "GVA mlogit_integral", n, n_rep, x,
+               [&](vector<ADd> const &args){
+      vector<ADd> m, s;
+      set_args(args, m, s);
+      return mlogit_integral(m, s, n_nodes).sum();
+    });
+    bench_tape(res, "GVA probit_integral", n, n_rep, x,
+               [&](vector<ADd> const &args){
+      vector<ADd> m, s;
+      set_args(args, m, s);
+      return probit_integral(m, s, n_nodes).sum();
+    });
+  }
+
+  /* the atomic functions used in the SNVA */
+  {
+    using namespace GaussHermite::SNVA;
+    std::vector<double> x(mu);
+    x.insert(x.end(), sigma.begin(), sigma.end());
+    x.insert(x.end(), rho  .begin(), rho  .end());
+
+    auto set_args = [&](vector<ADd> const &args, vector<ADd> &m,
+                        vector<ADd> &s, vector<ADd> &r){
+      m = args.head(n);
+      s = args.segment(n, n);
+      r = args.tail(n);
+    };
+
+    bench_tape(res, "SNVA mlogit_integral", n, n_rep, x,
+               [&](vector<ADd> const &args){
+      vector<ADd> m, s, r;
+      set_args(args, m, s, r);
+      return mlogit_integral(m, s, r, n_nodes).sum();
+    });
+    bench_tape(res, "SNVA probit_integral", n, n_rep, x,
+               [&](vector<ADd> const &args){
+      vector<ADd> m, s, r;
+      set_args(args, m, s, r);
+      return probit_integral(m, s, r, n_nodes).sum();
+    });
+    bench_tape(res, "SNVA entropy_term", n, n_rep, sigma,
+               [&](vector<ADd> const &args){
+      ADd out(0.);
+      for(int i = 0; i < args.size(); ++i)
+        out += entropy_term(args[i], n_nodes);
+      return out;
+    });
+  }
+
+  /* the bases */
+  {
+    arma::vec const x(get_grid(n, 0., 2.)),
+                   bk = { 0., 2. },
+                   ik = arma::linspace(0., 2., n_knots + 2L).subvec(
+                     1L, n_knots);
+
+    splines::ns const ns_basis(bk, ik, true);
+    splines::bs const bs_basis(bk, ik, true);
+    arma::mat out;
+    res.run("ns eval_batch", n, n_rep, [&]{
+      ns_basis.eval_batch(out, x);
+      return out[0];
+    });
+    res.run("bs eval_batch", n, n_rep, [&]{
+      bs_basis.eval_batch(out, x);
+      return out[0];
+    });
+
+    arma::mat X;
+    auto const poly_basis = poly::orth_poly::get_poly_basis(x, n_knots, X);
+    res.run("orth_poly eval", n, n_rep, [&]{
+      poly_basis.eval(x, out);
+      return out[0];
+    });
+  }
+
+  return res.to_data_frame();
+}
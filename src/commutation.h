@@ -0,0 +1,55 @@
+#ifndef COMMUTATION_H
+#define COMMUTATION_H
+
+#include <cstddef>
+
+namespace survTMB {
+
+/* The commutation matrix K_(n, m) is the (nm) x (nm) permutation matrix
+ * such that K vec(A) = vec(A^T) for an n x m matrix A. Row i * m + j of K
+ * has a one in column j * n + i. The functions below use the permutation
+ * rather than the matrix.
+ *
+ * Returns the column with a one in row r. */
+inline std::size_t commutation_index
+  (std::size_t const n, std::size_t const m, std::size_t const r){
+  return (r % m) * n + r / m;
+}
+
+/* sets out to K x. out and x must not overlap */
+template<class T>
+void commutation_vec
+  (std::size_t const n, std::size_t const m, T const *x, T *out){
+  for(std::size_t i = 0; i < n; ++i)
+    for(std::size_t j = 0; j < m; ++j)
+      *out++ = x[j * n + i];
+}
+
+/* sets out to K A where A is a (nm) x n_cols matrix in column-major order.
+ * out and A must not overlap */
+template<class T>
+void commutation_lhs
+  (std::size_t const n, std::size_t const m, T const *A,
+   std::size_t const n_cols, T *out){
+  std::size_t const nm = n * m;
+  for(std::size_t k = 0; k < n_cols; ++k, A += nm, out += nm)
+    commutation_vec(n, m, A, out);
+}
+
+/* sets out to A K^T where A is a n_rows x (nm) matrix in column-major
+ * order. out and A must not overlap */
+template<class T>
+void commutation_rhs_t
+  (std::size_t const n, std::size_t const m, T const *A,
+   std::size_t const n_rows, T *out){
+  std::size_t const nm = n * m;
+  for(std::size_t r = 0; r < nm; ++r, out += n_rows){
+    T const *a = A + commutation_index(n, m, r) * n_rows;
+    for(std::size_t k = 0; k < n_rows; ++k)
+      out[k] = a[k];
+  }
+}
+
+} // namespace survTMB
+
+#endif
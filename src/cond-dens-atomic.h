@@ -0,0 +1,270 @@
+#ifndef COND_DENS_ATOMIC_H
+#define COND_DENS_ATOMIC_H
+
+#include "tmb_includes.h"
+#include "batch-atomic.h"
+#include <cmath>
+#include <cstddef>
+
+namespace survTMB {
+
+/* the conditional density terms of the observed outcomes used in the GVA and
+ * the SNVA. With h = etaD * exp(a) where a depends on the link function, the
+ * term is
+ *
+ *   event * log(h) - H                             if h >= eps
+ *   event * log(eps) - H - kappa * h^2             otherwise
+ *
+ * The term is recorded as one atomic function for all the observations of a
+ * cluster rather than as a subgraph for each observation. The inputs of each
+ * observation are
+ *
+ *   (eta, etaD, event, var, H, eps, kappa)
+ *
+ * where eta is the fixed effects plus the mean of the random effect term and
+ * var is the variance of the random effect term.
+ *
+ * The link classes have a static function a which returns a given the inputs
+ * and a static function da which sets the derivatives of a with respect to
+ * eta, var, and H and the second derivative with respect to eta. All other
+ * second order derivatives are zero. */
+namespace cond_dens_idx {
+constexpr std::size_t eta = 0L, etaD = 1L, event = 2L, var = 3L, H = 4L,
+                      eps = 5L, kappa = 6L, n_in = 7L;
+} // namespace cond_dens_idx
+
+/* PH (log-log) link. a = eta */
+struct cond_dens_ph {
+  static char const * timer_name(){
+    return "cond_dens PH";
+  }
+
+  template<class Type>
+  static Type a(Type const *x){
+    return x[cond_dens_idx::eta];
+  }
+
+  template<class Type>
+  static void da(Type const *x, Type *d, Type &d_eta_eta){
+    d[0] = Type(1.);
+    d[1] = Type(0.);
+    d[2] = Type(0.);
+    d_eta_eta = Type(0.);
+  }
+};
+
+/* PO (-logit) link. a = eta - H */
+struct cond_dens_po {
+  static char const * timer_name(){
+    return "cond_dens PO";
+  }
+
+  template<class Type>
+  static Type a(Type const *x){
+    return x[cond_dens_idx::eta] - x[cond_dens_idx::H];
+  }
+
+  template<class Type>
+  static void da(Type const *x, Type *d, Type &d_eta_eta){
+    d[0] = Type(1.);
+    d[1] = Type(0.);
+    d[2] = Type(-1.);
+    d_eta_eta = Type(0.);
+  }
+};
+
+/* probit (-probit) link. a = -log(2 pi) / 2 - eta^2 / 2 - var / 2 + H */
+struct cond_dens_probit {
+  static char const * timer_name(){
+    return "cond_dens probit";
+  }
+
+  template<class Type>
+  static Type a(Type const *x){
+    Type const &eta = x[cond_dens_idx::eta];
+    return Type(-log(2 * M_PI) / 2.) - eta * eta / Type(2.) -
+      x[cond_dens_idx::var] / Type(2.) + x[cond_dens_idx::H];
+  }
+
+  template<class Type>
+  static void da(Type const *x, Type *d, Type &d_eta_eta){
+    d[0] = -x[cond_dens_idx::eta];
+    d[1] = Type(-.5);
+    d[2] = Type(1.);
+    d_eta_eta = Type(-1.);
+  }
+};
+
+/* the scalar function used with survTMB::batch_atomic */
+template<class Link>
+class cond_dens_kernel {
+public:
+  static constexpr std::size_t n_in = cond_dens_idx::n_in;
+
+  static char const * timer_name(){
+    return Link::timer_name();
+  }
+
+  /* the object has no state so n is not used */
+  static cond_dens_kernel const& get_cached(unsigned const){
+    static cond_dens_kernel const out = cond_dens_kernel();
+    return out;
+  }
+
+  static double value(double const *x){
+    using namespace cond_dens_idx;
+    double const h = x[etaD] * std::exp(Link::a(x));
+    if(h >= x[eps])
+      return x[event] * std::log(h) - x[H];
+    return x[event] * std::log(x[eps]) - x[H] - x[kappa] * h * h;
+  }
+
+  /* computes the gradient and, if hess is not a nullptr, the Hessian in
+   * column-major order. Both branches are computed and the result is
+   * selected with a conditional expression such that tapes of the
+   * derivatives are valid at other values of the inputs */
+  template<class Type>
+  void derivs(Type const *x, Type * const gr, Type * const hess) const {
+    using namespace cond_dens_idx;
+    constexpr std::size_t n = n_in;
+    /* the inputs which a depends on */
+    std::size_t const a_idx[3] = { eta, var, H };
+
+    Type const zero(0.),
+                  s = exp(Link::a(x)),
+                 &D = x[etaD],
+                 &e = x[event],
+               &k_x = x[kappa],
+                  h = D * s,
+               h_sq = h * h,
+                  q = k_x * h_sq;
+    Type d_a[3], d_eta_eta;
+    Link::da(x, d_a, d_eta_eta);
+
+    /* the gradients and Hessians of the two branches */
+    Type g_ok[n], g_low[n], h_ok[n * n], h_low[n * n];
+    for(std::size_t i = 0; i < n; ++i){
+      g_ok [i] = zero;
+      g_low[i] = zero;
+    }
+
+    /* log(h) >= log(eps) branch */
+    g_ok[etaD] = e / D;
+    for(std::size_t k = 0; k < 3; ++k)
+      g_ok[a_idx[k]] = e * d_a[k];
+    g_ok[H    ] -= Type(1.);
+    g_ok[event]  = log(D) + Link::a(x);
+
+    /* the other branch */
+    for(std::size_t k = 0; k < 3; ++k)
+      g_low[a_idx[k]] = -Type(2.) * q * d_a[k];
+    g_low[etaD ]  = -Type(2.) * k_x * D * s * s;
+    g_low[H    ] -= Type(1.);
+    g_low[event]  = log(x[eps]);
+    g_low[eps  ]  = e / x[eps];
+    g_low[kappa]  = -h_sq;
+
+    for(std::size_t i = 0; i < n; ++i)
+      gr[i] = CppAD::CondExpGe(h, x[eps], g_ok[i], g_low[i]);
+
+    if(!hess)
+      return;
+
+    for(std::size_t i = 0; i < n * n; ++i){
+      h_ok [i] = zero;
+      h_low[i] = zero;
+    }
+    auto set_sym = [&](Type *m, std::size_t const i, std::size_t const j,
+                       Type const &val){
+      m[i + j * n] = val;
+      m[j + i * n] = val;
+    };
+
+    /* log(h) >= log(eps) branch */
+    set_sym(h_ok, eta , eta , e * d_eta_eta);
+    set_sym(h_ok, etaD, etaD, -e / (D * D));
+    set_sym(h_ok, etaD, event, Type(1.) / D);
+    for(std::size_t k = 0; k < 3; ++k)
+      set_sym(h_ok, a_idx[k], event, d_a[k]);
+
+    /* the other branch. The Hessian is minus the Hessian of kappa * h^2 and
+     * the terms from event * log(eps) */
+    Type const two_q(Type(2.) * q),
+              s_sq(s * s);
+    for(std::size_t k = 0; k < 3; ++k){
+      for(std::size_t l = 0; l <= k; ++l)
+        set_sym(h_low, a_idx[k], a_idx[l],
+                -Type(2.) * two_q * d_a[k] * d_a[l]);
+      set_sym(h_low, a_idx[k], etaD , -Type(4.) * k_x * D * s_sq * d_a[k]);
+      set_sym(h_low, a_idx[k], kappa, -Type(2.) * h_sq * d_a[k]);
+    }
+    h_low[eta + eta * n] -= two_q * d_eta_eta;
+    set_sym(h_low, etaD , etaD , -Type(2.) * k_x * s_sq);
+    set_sym(h_low, etaD , kappa, -Type(2.) * D * s_sq);
+    set_sym(h_low, event, eps  , Type(1.) / x[eps]);
+    set_sym(h_low, eps  , eps  , -e / (x[eps] * x[eps]));
+
+    for(std::size_t i = 0; i < n * n; ++i)
+      hess[i] = CppAD::CondExpGe(h, x[eps], h_ok[i], h_low[i]);
+  }
+};
+
+template<class Type>
+using ph_cond_dens_atomic =
+  batch_atomic<Type, cond_dens_kernel<cond_dens_ph> >;
+template<class Type>
+using po_cond_dens_atomic =
+  batch_atomic<Type, cond_dens_kernel<cond_dens_po> >;
+template<class Type>
+using probit_cond_dens_atomic =
+  batch_atomic<Type, cond_dens_kernel<cond_dens_probit> >;
+
+/* interleaves the inputs as required by survTMB::batch_atomic */
+template<class Type>
+vector<Type> cond_dens_input
+  (vector<Type> const &eta, vector<Type> const &etaD,
+   vector<Type> const &event, vector<Type> const &var,
+   vector<Type> const &H, Type const &eps, Type const &kappa){
+  constexpr std::size_t n_in = cond_dens_idx::n_in;
+  vector<Type> x(n_in * eta.size());
+  for(int i = 0; i < eta.size(); ++i){
+    Type * const xi = &x[n_in * i];
+    xi[cond_dens_idx::eta  ] = eta  [i];
+    xi[cond_dens_idx::etaD ] = etaD [i];
+    xi[cond_dens_idx::event] = event[i];
+    xi[cond_dens_idx::var  ] = var  [i];
+    xi[cond_dens_idx::H    ] = H    [i];
+    xi[cond_dens_idx::eps  ] = eps;
+    xi[cond_dens_idx::kappa] = kappa;
+  }
+  return x;
+}
+
+/* returns the conditional density terms of each observation. The AD version
+ * only adds one node to the tape */
+template<class Link, class Type>
+vector<AD<Type> > cond_dens
+  (vector<AD<Type> > const &eta, vector<AD<Type> > const &etaD,
+   vector<AD<Type> > const &event, vector<AD<Type> > const &var,
+   vector<AD<Type> > const &H, AD<Type> const &eps,
+   AD<Type> const &kappa){
+  return eval_batch_atomic<cond_dens_kernel<Link> >(
+    cond_dens_input(eta, etaD, event, var, H, eps, kappa), 1L);
+}
+
+template<class Link>
+vector<double> cond_dens
+  (vector<double> const &eta, vector<double> const &etaD,
+   vector<double> const &event, vector<double> const &var,
+   vector<double> const &H, double const eps, double const kappa){
+  vector<double> const x =
+    cond_dens_input(eta, etaD, event, var, H, eps, kappa);
+  vector<double> out(eta.size());
+  for(int i = 0; i < out.size(); ++i)
+    out[i] = cond_dens_kernel<Link>::value(&x[cond_dens_idx::n_in * i]);
+  return out;
+}
+
+} // namespace survTMB
+
+#endif
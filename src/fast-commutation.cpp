@@ -1,4 +1,5 @@
 #include <Rcpp.h>
+#include "commutation.h"
 
 Rcpp::NumericMatrix get_commutation_unequal
   (unsigned const n, unsigned const m){
@@ -44,6 +45,17 @@ Rcpp::NumericMatrix get_commutation(unsigned const n, unsigned const m){
   return get_commutation_unequal(n, m);
 }
 
+/* returns the permutation of the commutation matrix as a one-based index
+ * such that K x is x[perm] and K A K^T is A[perm, perm] in R */
+// [[Rcpp::export(rng = false)]]
+Rcpp::IntegerVector get_commutation_perm(unsigned const n, unsigned const m){
+  std::size_t const nm = n * m;
+  Rcpp::IntegerVector out(nm);
+  for(std::size_t r = 0; r < nm; ++r)
+    out[r] = survTMB::commutation_index(n, m, r) + 1L;
+  return out;
+}
+
 /*** R
 options(digits = 3)
 
@@ -21,13 +21,8 @@
 
 #include "fastgl.h"
 #include "cassert"
-#include <array>
-#include <memory>
 #include "tmb_includes.h"
-
-#ifdef _OPENMP
-#include "omp.h"
-#endif
+#include "index-cache.h"
 
 // Anonymous namespace for non-public functions
 namespace {
@@ -374,32 +369,13 @@ template<class Type>
 std::vector<QuadPair<Type> > const& GLPairsCached(size_t const n){
   using ele_type = std::vector<QuadPair<Type> >;
 
-  constexpr std::size_t n_cache = fastglCachedMaxArg();
-  if(n > n_cache or n == 0l)
-    throw std::invalid_argument(
-        "GLPairsCached: invalid n (too large or zero)");
-
-  static std::array<std::unique_ptr<ele_type>, n_cache>
-    cached_values;
-
-  unsigned const idx = n - 1L;
-  bool has_value = cached_values[idx].get();
-
-  if(has_value)
-    return *cached_values[idx];
-
-#ifdef _OPENMP
-#pragma omp critical (GLPairsCached)
-{
-#endif
-  has_value = cached_values[idx].get();
-  if(!has_value)
-    cached_values[idx].reset(new ele_type(GetGLPairs<Type>(n)));
-#ifdef _OPENMP
-}
-#endif
+  if(n == 0l)
+    throw std::invalid_argument("GLPairsCached: invalid n (zero)");
 
-return *cached_values[idx];
+  static survTMB::index_cache<ele_type> cached_values;
+  return cached_values.get(n, [&]{
+    return new ele_type(GetGLPairs<Type>(n));
+  });
 }
 
 using ADd   = CppAD::AD<double>;
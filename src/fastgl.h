@@ -54,12 +54,10 @@ struct QuadPair {
 // Compute a node-weight pair:
 QuadPair<double> GLPair(size_t const n, size_t const k);
 
+// Returns cached node-weight pairs. The function is thread-safe and does not
+// lock once the rule with n nodes is computed.
 template<class Type>
 std::vector<QuadPair<Type> > const& GLPairsCached(size_t const);
-
-constexpr size_t fastglCachedMaxArg(){
-  return 100L;
-}
 } // namespace fastgl
 
 #endif
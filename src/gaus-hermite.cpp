@@ -26,8 +26,7 @@
 #include "gaus-hermite.h"
 #include <cmath>
 #include <math.h>
-#include <array>
-#include <memory>
+#include "index-cache.h"
 
 #include <Rconfig.h>
 #include <R_ext/BLAS.h>
@@ -39,10 +38,6 @@
 #endif
 #include <R_ext/Lapack.h>
 
-#ifdef _OPENMP
-#include "omp.h"
-#endif
-
 namespace GaussHermite {
 using std::vector;
 using std::abs;
@@ -258,32 +253,13 @@ HermiteData<double> GaussHermiteData(unsigned const n) {
 
 template<class Type>
 HermiteData<Type> const& GaussHermiteDataCached(unsigned const n){
-  constexpr std::size_t n_cache = GaussHermiteDataCachedMaxArg();
-  if(n > n_cache or n == 0l)
-    throw std::invalid_argument(
-        "GaussHermiteDataCached: invalid n (too large or zero)");
-
-  static std::array<std::unique_ptr<HermiteData<Type> >, n_cache>
-    cached_values;
-
-  unsigned const idx = n - 1L;
-  bool has_value = cached_values[idx].get();
-
-  if(has_value)
-    return *cached_values[idx];
-
-#ifdef _OPENMP
-#pragma omp critical (GHQCache)
-{
-#endif
-  has_value = cached_values[idx].get();
-  if(!has_value)
-    cached_values[idx].reset(new HermiteData<Type>(GaussHermiteData(n)));
-#ifdef _OPENMP
-}
-#endif
+  if(n == 0l)
+    throw std::invalid_argument("GaussHermiteDataCached: invalid n (zero)");
 
-  return *cached_values[idx];
+  static survTMB::index_cache<HermiteData<Type> > cached_values;
+  return cached_values.get(n, [&]{
+    return new HermiteData<Type>(GaussHermiteData(n));
+  });
 }
 
 using ADd   = CppAD::AD<double>;
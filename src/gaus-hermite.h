@@ -26,13 +26,11 @@ struct HermiteData {
 
 HermiteData<double> GaussHermiteData(unsigned const);
 
+/* returns cached nodes and weights. The function is thread-safe and does not
+ * lock once the rule with n nodes is computed */
 template<class Type>
 HermiteData<Type> const& GaussHermiteDataCached(unsigned const);
 
-constexpr std::size_t GaussHermiteDataCachedMaxArg(){
-  return 100L;
-}
-
 } // namespace GaussHermite
 
 #endif
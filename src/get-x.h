@@ -131,8 +131,14 @@ vector<Tout> get_args_va
 inline bool is_in_parallel(){
   return static_cast<bool>(omp_in_parallel());
 }
+/* the thread number in the outermost parallel region. The regions of an
+ * object which uses one thread are inactive when it is used inside a
+ * parallel region e.g. when many models are fitted in parallel. Then the id
+ * of the enclosing outer thread is returned such that each fit uses its own
+ * CppAD::thread_alloc slot. Zero is returned outside parallel regions */
 inline size_t get_thread_num(){
-  return static_cast<size_t>(omp_get_thread_num());
+  int const out = omp_get_ancestor_thread_num(1);
+  return out < 0 ? 0L : static_cast<size_t>(out);
 }
 #endif
 
@@ -0,0 +1,163 @@
+#ifndef GSM_DESIGN_H
+#define GSM_DESIGN_H
+
+#define INCLUDE_RCPP
+#include "tmb_includes.h"
+#include <cstddef>
+
+namespace gsm_objs {
+/** tag type to store the design matrices as compressed sparse column
+ matrices. */
+struct sparse_storage { };
+
+namespace design {
+/** columns [i_start, i_start + n_blk) of a sparse matrix. */
+struct sp_col_block {
+  arma::sp_mat const &M;
+  std::size_t const i_start, n_blk;
+};
+
+/** the matrix type used to store the design matrices and the type of a
+ block of columns. */
+template<class Storage>
+struct traits {
+  using mat  = arma::Mat<Storage>;
+  using view = arma::mat;
+};
+template<>
+struct traits<sparse_storage> {
+  using mat  = arma::sp_mat;
+  using view = sp_col_block;
+};
+
+/** makes sure that the CSC arrays of a sparse matrix are up to date. */
+inline void sync(arma::mat    const&) { }
+inline void sync(arma::fmat   const&) { }
+inline void sync(arma::sp_mat const &M) {
+  M.sync();
+}
+
+/** returns columns [i_start, i_start + n_blk) of M. The memory of M is
+ used if it is stored in double precision or as a sparse matrix.
+ Otherwise, the columns are converted and stored in mem which must have at
+ least n_blk columns */
+inline arma::mat col_block
+  (arma::mat const &M, std::size_t const i_start, std::size_t const n_blk,
+   arma::mat&){
+  return arma::mat(const_cast<double*>(M.colptr(i_start)), M.n_rows,
+                   n_blk, false, true);
+}
+inline arma::mat col_block
+  (arma::fmat const &M, std::size_t const i_start, std::size_t const n_blk,
+   arma::mat &mem){
+  arma::mat out(mem.memptr(), M.n_rows, n_blk, false, true);
+  float const *m = M.colptr(i_start);
+  double *o = out.memptr();
+  for(std::size_t i = 0, n_ele = M.n_rows * n_blk; i < n_ele; ++i)
+    *o++ = *m++;
+  return out;
+}
+inline sp_col_block col_block
+  (arma::sp_mat const &M, std::size_t const i_start,
+   std::size_t const n_blk, arma::mat&){
+  return { M, i_start, n_blk };
+}
+
+/** adds V^T x to out. */
+inline void add_t_prod
+  (arma::mat const &V, arma::vec const &x, double * const out){
+  arma::vec o(out, V.n_cols, false, true);
+  o += V.t() * x;
+}
+inline void add_t_prod
+  (sp_col_block const &V, arma::vec const &x, double * const out){
+  arma::sp_mat const &M = V.M;
+  for(std::size_t j = 0; j < V.n_blk; ++j){
+    std::size_t const col = V.i_start + j;
+    double o(0.);
+    for(auto k = M.col_ptrs[col]; k < M.col_ptrs[col + 1L]; ++k)
+      o += M.values[k] * x[M.row_indices[k]];
+    out[j] += o;
+  }
+}
+
+/** adds V w to out. */
+inline void add_prod
+  (arma::mat const &V, double const * const w, arma::vec &out){
+  out += V * arma::vec(const_cast<double*>(w), V.n_cols, false, true);
+}
+inline void add_prod
+  (sp_col_block const &V, double const * const w, arma::vec &out){
+  arma::sp_mat const &M = V.M;
+  for(std::size_t j = 0; j < V.n_blk; ++j){
+    std::size_t const col = V.i_start + j;
+    for(auto k = M.col_ptrs[col]; k < M.col_ptrs[col + 1L]; ++k)
+      out[M.row_indices[k]] += w[j] * M.values[k];
+  }
+}
+
+/** returns the columns of V times w using the memory in mem. */
+inline arma::mat scale_cols
+  (arma::mat const &V, double const * const w, arma::mat &mem){
+  arma::mat out(mem.memptr(), V.n_rows, V.n_cols, false, true);
+  for(std::size_t j = 0; j < V.n_cols; ++j){
+    double const * m = V.colptr(j);
+    double *o = out.colptr(j);
+    for(std::size_t k = 0; k < V.n_rows; ++k)
+      *o++ = w[j] * *m++;
+  }
+  return out;
+}
+
+/** adds A diag(w) B^T to out. mem must have at least as many elements as
+ A */
+inline void add_cross
+  (arma::mat const &A, arma::mat const &B, double const * const w,
+   arma::mat &mem, arma::mat &out){
+  out += scale_cols(A, w, mem) * B.t();
+}
+inline void add_cross
+  (sp_col_block const &A, sp_col_block const &B, double const * const w,
+   arma::mat&, arma::mat &out){
+  arma::sp_mat const &MA = A.M,
+                     &MB = B.M;
+  for(std::size_t j = 0; j < A.n_blk; ++j){
+    std::size_t const col = A.i_start + j;
+    for(auto ka = MA.col_ptrs[col]; ka < MA.col_ptrs[col + 1L]; ++ka){
+      double const fa = w[j] * MA.values[ka];
+      std::size_t const ra = MA.row_indices[ka];
+      for(auto kb = MB.col_ptrs[col]; kb < MB.col_ptrs[col + 1L]; ++kb)
+        out(ra, MB.row_indices[kb]) += fa * MB.values[kb];
+    }
+  }
+}
+
+/** subtracts A diag(w)^2 A^T from out. mem must have at least as many
+ elements as A */
+inline void sub_sq_cross
+  (arma::mat const &A, double const * const w, arma::mat &mem,
+   arma::mat &out){
+  arma::mat const Aw = scale_cols(A, w, mem);
+  out -= Aw * Aw.t();
+}
+inline void sub_sq_cross
+  (sp_col_block const &A, double const * const w, arma::mat&,
+   arma::mat &out){
+  arma::sp_mat const &M = A.M;
+  for(std::size_t j = 0; j < A.n_blk; ++j){
+    std::size_t const col = A.i_start + j;
+    double const w_sq = w[j] * w[j];
+    if(w_sq == 0)
+      continue;
+    for(auto k1 = M.col_ptrs[col]; k1 < M.col_ptrs[col + 1L]; ++k1){
+      double const f1 = w_sq * M.values[k1];
+      std::size_t const r1 = M.row_indices[k1];
+      for(auto k2 = M.col_ptrs[col]; k2 < M.col_ptrs[col + 1L]; ++k2)
+        out(r1, M.row_indices[k2]) -= f1 * M.values[k2];
+    }
+  }
+}
+} // namespace design
+} // namespace gsm_objs
+
+#endif
@@ -0,0 +1,421 @@
+#ifndef GSM_DEVICE_H
+#define GSM_DEVICE_H
+
+#include "gsm.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* the computations are offloaded with OpenMP target regions if
+ * SURVTMB_OMP_TARGET is defined. Otherwise, the same code is run on the
+ * host */
+#if defined(SURVTMB_OMP_TARGET) && !defined(_OPENMP)
+#error "SURVTMB_OMP_TARGET requires OpenMP"
+#endif
+
+namespace gsm_objs {
+namespace device {
+#ifdef SURVTMB_OMP_TARGET
+#pragma omp declare target
+#endif
+/* families which can be called on a device. They have the same member
+ * functions as the families in gsm.h but do not call R */
+
+/** PH link function. */
+struct ph {
+  double const eta, exp_eta;
+
+  ph(double const eta): eta(eta), exp_eta(std::exp(eta)) { }
+
+  double g_log   () const { return -exp_eta; }
+  double gp      () const { return -std::exp(eta - exp_eta); }
+  double gp_g    () const { return -exp_eta; }
+  double gpp_gp  () const { return 1. - exp_eta; }
+  double d_gp_g  () const { return -exp_eta; }
+  double d_gpp_gp() const { return -exp_eta; }
+};
+
+/** negative-logit link function. */
+struct logit {
+  double const eta, exp_eta, exp_eta_p1;
+  bool const too_large;
+
+  logit(double const eta):
+  eta(eta), exp_eta(std::exp(eta)), exp_eta_p1(1. + exp_eta),
+  too_large(eta > 30) { }
+
+  double g_log() const {
+    return too_large ? -eta : -std::log(exp_eta_p1);
+  }
+  double gp() const {
+    return too_large ? 0. : -exp_eta / exp_eta_p1 / exp_eta_p1;
+  }
+  double gp_g() const {
+    return too_large ? -1. : -exp_eta / exp_eta_p1;
+  }
+  double gpp_gp() const {
+    return too_large ? -1. : -(exp_eta - 1.) / exp_eta_p1;
+  }
+  double d_gp_g() const {
+    return too_large ? 0. : -exp_eta / exp_eta_p1 / exp_eta_p1;
+  }
+  double d_gpp_gp() const {
+    return too_large ? 0. : -2. * exp_eta / exp_eta_p1 / exp_eta_p1;
+  }
+};
+
+/** probit link function. log(Phi(-eta)) is computed with erfc and with an
+ asymptotic expansion in the right tail where erfc underflows. */
+struct probit {
+  double const eta, dnrm_log, pnrm_log;
+
+  static double get_dnrm_log(double const x){
+    return -.5 * x * x - 0.918938533204672741780329736406; // log(2 pi) / 2
+  }
+  static double get_pnrm_log(double const x){
+    if(x > 30){
+      /* log(Phi(-x)) for large x */
+      double const x_sq_inv = 1. / (x * x);
+      return get_dnrm_log(x) - std::log(x) + std::log(
+        1. + x_sq_inv * (-1. + x_sq_inv * (3. + x_sq_inv *
+          (-15. + x_sq_inv * 105.))));
+    }
+    return x < 0 ? std::log1p(-.5 * std::erfc(-x * M_SQRT1_2)) :
+                   std::log  ( .5 * std::erfc( x * M_SQRT1_2));
+  }
+
+  probit(double const eta):
+  eta(eta), dnrm_log(get_dnrm_log(eta)), pnrm_log(get_pnrm_log(eta)) { }
+
+  double g_log   () const { return pnrm_log; }
+  double gp      () const { return -std::exp(dnrm_log); }
+  double gp_g    () const { return -std::exp(dnrm_log - pnrm_log); }
+  double gpp_gp  () const { return -eta; }
+  double d_gp_g  () const {
+    double const log_gp_g = dnrm_log - pnrm_log;
+    return eta * std::exp(log_gp_g) - std::exp(2 * log_gp_g);
+  }
+  double d_gpp_gp() const { return -1.; }
+};
+
+/** the data and the parameters used for a single observation. The
+ design matrices are stacked as [X; XD; Z] and element (k, i) is at
+ k * n + i such that consecutive observations use consecutive memory. */
+struct obs_data {
+  double const *dat, *y, *offset_eta, *offset_etaD, *par;
+  size_t n, n_b, n_g;
+  double eps, kappa, eps_log;
+  bool do_grad, do_hess;
+};
+
+/** adds the log-likelihood, gradient, and Hessian terms of observation i.
+ The same terms are computed as in gsm<Family, Storage>::eval. The lower
+ triangle of the Hessian is stored in packed row-major order. */
+template<class Fam>
+inline void add_obs
+  (obs_data const &d, size_t const i, double &ll, double * const gr,
+   double * const he){
+  size_t const n = d.n, n_b = d.n_b, n_g = d.n_g, n_p = n_b + n_g;
+  double const * const x  = d.dat + i,
+               * const xd = x + n_b * n,
+               * const z  = xd + n_b * n,
+               * const beta = d.par,
+               * const gamma = d.par + n_b;
+
+  double eta = d.offset_eta[i], eta_p = d.offset_etaD[i];
+  for(size_t k = 0; k < n_b; ++k){
+    eta   += x [k * n] * beta[k];
+    eta_p += xd[k * n] * beta[k];
+  }
+  for(size_t k = 0; k < n_g; ++k)
+    eta += z[k * n] * gamma[k];
+
+  Fam const fam(eta);
+  double const haz = -fam.gp_g() * eta_p;
+  bool const valid = haz > d.eps,
+          is_event = d.y[i] > 0;
+
+  /* the log-likelihood term */
+  if(is_event)
+    ll += valid ? std::log(-fam.gp() * eta_p) : d.eps_log + fam.g_log();
+  else
+    ll += fam.g_log();
+  if(!valid){
+    double const delta = haz - d.eps;
+    ll -= d.kappa * delta * delta;
+  }
+
+  /* returns the element of the stacked [X; Z] */
+  auto get_xz = [&](size_t const k){
+    return k < n_b ? x[k * n] : z[(k - n_b) * n];
+  };
+
+  /* the gradient terms */
+  if(d.do_grad){
+    double f_x, f_xd;
+    if(is_event and valid){
+      f_x  = fam.gpp_gp();
+      f_xd = 1. / eta_p;
+    } else {
+      f_x  = fam.gp_g();
+      f_xd = 0.;
+    }
+    if(!valid){
+      double const fac = -2. * d.kappa * (haz - d.eps);
+      f_x  -= fac * fam.d_gp_g() * eta_p;
+      f_xd -= fac * fam.gp_g();
+    }
+
+    for(size_t k = 0; k < n_b; ++k)
+      gr[k] += f_x * x[k * n] + f_xd * xd[k * n];
+    for(size_t k = 0; k < n_g; ++k)
+      gr[k + n_b] += f_x * z[k * n];
+  }
+
+  /* the Hessian terms */
+  if(d.do_hess){
+    double w_x, w_xd;
+    if(is_event){
+      w_x  = valid ? fam.d_gpp_gp() : 0.;
+      w_xd = valid ? 1. / eta_p     : 0.;
+    } else {
+      w_x  = fam.d_gp_g();
+      w_xd = 0.;
+    }
+
+    double *h = he;
+    for(size_t r = 0; r < n_p; ++r){
+      double const xz_r = w_x * get_xz(r),
+                   xd_r = r < n_b ? w_xd * w_xd * xd[r * n] : 0.;
+      for(size_t c = 0; c <= r; ++c, ++h){
+        *h += xz_r * get_xz(c);
+        if(c < n_b)
+          *h -= xd_r * xd[c * n];
+      }
+    }
+  }
+}
+#ifdef SURVTMB_OMP_TARGET
+#pragma omp end declare target
+#endif
+
+/** maps the families in gsm.h to those used on the device. */
+template<class Family> struct family;
+template<> struct family<gsm_ph    > { using type = ph;     };
+template<> struct family<gsm_logit > { using type = logit;  };
+template<> struct family<gsm_probit> { using type = probit; };
+} // namespace device
+
+/**
+ computes the log-likelihood, the gradient, and the Hessian like gsm but
+ with OpenMP target offloading if the package is compiled with
+ SURVTMB_OMP_TARGET. The design matrices, the outcomes, and the offsets are
+ copied to the device once in the constructor and are kept there until the
+ object is destructed. Only the parameters are copied to the device and the
+ log-likelihood, the gradient, and the packed lower triangle of the Hessian
+ are copied back in each evaluation. The reductions are made on the device.
+
+ Without SURVTMB_OMP_TARGET, the same loop is run on the host with n_threads
+ threads. The design matrices are stored with consecutive observations in
+ consecutive memory as this is the favorable layout on the device. Thus,
+ the other storage types are faster on the host.
+ */
+template<class Family>
+class gsm_device final : public gsm_base {
+  using fam_type = typename device::family<Family>::type;
+
+  size_t const n, n_b, n_g, n_p = n_b + n_g,
+               n_hess = (n_p * (n_p + 1L)) / 2L;
+  /* the stacked design matrices [X; XD; Z] with observations in
+   * consecutive memory */
+  std::vector<double> dat;
+  std::vector<double> const y, offset_eta, offset_etaD;
+  double const eps, kappa;
+  unsigned const n_threads;
+
+  static std::vector<double> get_dat
+    (arma::mat const &X, arma::mat const &XD, arma::mat const &Z){
+    size_t const n = X.n_cols, n_b = X.n_rows, n_g = Z.n_rows;
+    std::vector<double> out((2L * n_b + n_g) * n);
+    double *o = out.data();
+    for(arma::mat const *M : { &X, &XD, &Z })
+      for(size_t k = 0; k < M->n_rows; ++k)
+        for(size_t i = 0; i < n; ++i)
+          *o++ = M->at(k, i);
+    return out;
+  }
+
+  static std::vector<double> to_vec(arma::vec const &x){
+    return std::vector<double>(x.begin(), x.end());
+  }
+
+public:
+  gsm_device(arma::mat const &X, arma::mat const &XD, arma::mat const &Z,
+             arma::vec const &y, double const eps, double const kappa,
+             unsigned const n_threads, arma::vec const &offset_eta,
+             arma::vec const &offset_etaD):
+  n(X.n_cols), n_b(X.n_rows), n_g(Z.n_rows), y(to_vec(y)),
+  offset_eta(to_vec(offset_eta)), offset_etaD(to_vec(offset_etaD)),
+  eps(eps), kappa(kappa), n_threads(n_threads) {
+    /* checks */
+    if(XD.n_rows != n_b or XD.n_cols != n)
+      throw std::invalid_argument("gsm_device: invalid XD");
+    else if(Z.n_cols != n)
+      throw std::invalid_argument("gsm_device: invalid Z");
+    else if(y.n_elem != n)
+      throw std::invalid_argument("gsm_device: invalid y");
+    else if(kappa < 0)
+      throw std::invalid_argument("gsm_device: invalid kappa");
+    else if(eps < 0)
+      throw std::invalid_argument("gsm_device: invalid eps");
+    else if(n_threads < 1)
+      throw std::invalid_argument("gsm_device: invalid n_threads");
+    else if(offset_eta.n_elem != n)
+      throw std::invalid_argument("gsm_device: invalid offset_eta");
+    else if(offset_etaD.n_elem != n)
+      throw std::invalid_argument("gsm_device: invalid offset_etaD");
+
+    dat = get_dat(X, XD, Z);
+
+#ifdef SURVTMB_OMP_TARGET
+    double const *d_ptr = dat.data(), *y_ptr = this->y.data(),
+                 *o_ptr = this->offset_eta.data(),
+                *od_ptr = this->offset_etaD.data();
+    size_t const n_dat = dat.size();
+#pragma omp target enter data map(to: d_ptr[0:n_dat], y_ptr[0:n], \
+  o_ptr[0:n], od_ptr[0:n])
+#endif
+  }
+
+  gsm_device(gsm_device const&) = delete;
+  gsm_device& operator=(gsm_device const&) = delete;
+
+  ~gsm_device(){
+#ifdef SURVTMB_OMP_TARGET
+    double const *d_ptr = dat.data(), *y_ptr = y.data(),
+                 *o_ptr = offset_eta.data(), *od_ptr = offset_etaD.data();
+    size_t const n_dat = dat.size();
+#pragma omp target exit data map(delete: d_ptr[0:n_dat], y_ptr[0:n], \
+  o_ptr[0:n], od_ptr[0:n])
+#endif
+  }
+
+  double log_likelihood
+  (arma::vec const &beta, arma::vec const &gamma) const {
+    return eval(beta, gamma, 0L).log_lik;
+  }
+
+  arma::vec grad
+  (arma::vec const &beta, arma::vec const &gamma) const {
+    return eval(beta, gamma, 1L).grad;
+  }
+
+  arma::mat hess
+  (arma::vec const &beta, arma::vec const &gamma) const {
+    return eval(beta, gamma, 2L).hess;
+  }
+
+  unsigned get_n_threads() const {
+    return n_threads;
+  }
+
+  gsm_eval_res eval
+  (arma::vec const &beta, arma::vec const &gamma,
+   unsigned const order) const {
+    if(beta.n_elem != n_b)
+      throw std::invalid_argument("gsm_device: invalid beta");
+    else if(gamma.n_elem != n_g)
+      throw std::invalid_argument("gsm_device: invalid gamma");
+
+    bool const do_grad = order > 0L,
+               do_hess = order > 1L;
+    std::vector<double> par(std::max<size_t>(n_p, 1L));
+    std::copy(beta .begin(), beta .end(), par.begin());
+    std::copy(gamma.begin(), gamma.end(), par.begin() + n_b);
+
+    /* the arrays have at least one element to avoid zero-length array
+     * sections in the reductions */
+    size_t const n_gr = do_grad ? std::max<size_t>(n_p   , 1L) : 1L,
+                 n_he = do_hess ? std::max<size_t>(n_hess, 1L) : 1L;
+    std::vector<double> gr_v(n_gr, 0.), he_v(n_he, 0.);
+
+    double const *d_ptr = dat.data(), *y_ptr = y.data(),
+                 *o_ptr = offset_eta.data(), *od_ptr = offset_etaD.data(),
+               *par_ptr = par.data();
+    size_t const n_par = par.size(), n_loc = n, n_b_loc = n_b,
+                 n_g_loc = n_g;
+    double const eps_loc = eps, kappa_loc = kappa, eps_log = std::log(eps);
+    double ll(0.);
+    double * const gr = gr_v.data(),
+           * const he = he_v.data();
+
+#ifdef SURVTMB_OMP_TARGET
+    /* the data are already on the device. The pointers to the data are
+     * translated to device pointers as they are used in the region without
+     * being mapped. The obs_data object is created on the device as the
+     * pointers in a mapped object are not translated */
+#pragma omp target teams distribute parallel for \
+  map(to: par_ptr[0:n_par]) map(tofrom: ll, gr[0:n_gr], he[0:n_he]) \
+  reduction(+:ll) reduction(+:gr[0:n_gr]) reduction(+:he[0:n_he])
+    for(size_t i = 0; i < n_loc; ++i){
+      device::obs_data const d {
+        d_ptr, y_ptr, o_ptr, od_ptr, par_ptr, n_loc, n_b_loc, n_g_loc,
+        eps_loc, kappa_loc, eps_log, do_grad, do_hess };
+      device::add_obs<fam_type>(d, i, ll, gr, he);
+    }
+#else
+    (void)n_par;
+    device::obs_data const d {
+      d_ptr, y_ptr, o_ptr, od_ptr, par_ptr, n_loc, n_b_loc, n_g_loc,
+      eps_loc, kappa_loc, eps_log, do_grad, do_hess };
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads)
+    {
+#endif
+    double ll_loc(0.);
+    std::vector<double> gr_loc(n_gr, 0.), he_loc(n_he, 0.);
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(size_t i = 0; i < n; ++i)
+      device::add_obs<fam_type>(d, i, ll_loc, gr_loc.data(), he_loc.data());
+
+#ifdef _OPENMP
+#pragma omp critical
+      {
+#endif
+    ll += ll_loc;
+    for(size_t k = 0; k < n_gr; ++k)
+      gr[k] += gr_loc[k];
+    for(size_t k = 0; k < n_he; ++k)
+      he[k] += he_loc[k];
+#ifdef _OPENMP
+      }
+    }
+#endif
+#endif
+
+    gsm_eval_res out;
+    out.log_lik = ll;
+    if(do_grad)
+      out.grad = arma::vec(gr_v.data(), n_p);
+    if(do_hess){
+      arma::mat &h = out.hess;
+      h.set_size(n_p, n_p);
+      double const *hi = he_v.data();
+      for(size_t r = 0; r < n_p; ++r)
+        for(size_t c = 0; c <= r; ++c, ++hi)
+          h(r, c) = h(c, r) = *hi;
+    }
+
+    return out;
+  }
+};
+} // namespace gsm_objs
+
+#endif
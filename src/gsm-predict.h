@@ -0,0 +1,149 @@
+#ifndef GSM_PREDICT_H
+#define GSM_PREDICT_H
+
+#define INCLUDE_RCPP
+#include "tmb_includes.h"
+#include "gaus-hermite.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace gsm_objs {
+/** computes predictions from a mixed generalized survival model on a grid
+ of subjects and time points. The linear predictor of subject i at time t is
+
+   eta = x_i^T gamma + b(t)^T omega + z_i^T u
+
+ where u ~ N(0, Sigma). Thus, z_i^T u is univariate normal and the random
+ effects are integrated out with Gauss-Hermite quadrature. The time-invariant
+ part and the baseline are computed once for each subject and each time
+ point such that only the link function is evaluated on the grid.
+
+ The design matrices are [# coefficients] x [# subjects] and
+ [# coefficients] x [# time points]. n_nodes must be positive. */
+template<class Family>
+class gsm_predictor {
+  size_t const n_sub, n_t;
+  /** x_i^T gamma, b(t)^T omega, and b'(t)^T omega */
+  arma::vec const eta_x, eta_b, etaD;
+  /** the standard deviation of z_i^T u */
+  arma::vec const sds;
+  GaussHermite::HermiteData<double> const &xw;
+
+  static arma::vec get_sds(arma::mat const &Z, arma::mat const &Sigma){
+    arma::vec out(Z.n_cols);
+    if(Z.n_rows < 1L){
+      out.zeros();
+      return out;
+    }
+
+    for(size_t i = 0; i < Z.n_cols; ++i){
+      double const var = arma::dot(Z.col(i), Sigma * Z.col(i));
+      out[i] = var > 0 ? std::sqrt(var) : 0.;
+    }
+    return out;
+  }
+
+public:
+  gsm_predictor
+  (arma::mat const &X, arma::mat const &Z, arma::mat const &B,
+   arma::mat const &BD, arma::vec const &gamma, arma::vec const &omega,
+   arma::mat const &Sigma, unsigned const n_nodes):
+  n_sub(X.n_cols), n_t(B.n_cols), eta_x(X.t() * gamma),
+  eta_b(B.t() * omega), etaD(BD.t() * omega), sds(get_sds(Z, Sigma)),
+  xw(GaussHermite::GaussHermiteDataCached<double>(n_nodes)) {
+    if(X.n_rows != gamma.n_elem)
+      throw std::invalid_argument("gsm_predictor(): invalid X or gamma");
+    else if(B.n_rows != omega.n_elem or BD.n_rows != B.n_rows or
+              BD.n_cols != n_t)
+      throw std::invalid_argument("gsm_predictor(): invalid B or BD");
+    else if(Z.n_cols != n_sub or Sigma.n_rows != Z.n_rows or
+              Sigma.n_cols != Z.n_rows)
+      throw std::invalid_argument("gsm_predictor(): invalid Z or Sigma");
+  }
+
+  size_t n_subjects() const {
+    return n_sub;
+  }
+  size_t n_times() const {
+    return n_t;
+  }
+
+  /** computes the marginal hazard, the cumulative hazard, and the survival
+   function at a given linear predictor without the random effects, its
+   derivative with respect to time, and the standard deviation of the
+   random effect term. The marginal survival function is
+
+     S = int g(eta + s) phi(s; 0, sd^2) ds
+
+   and the marginal hazard is the marginal density divided by S. The
+   quadrature terms are summed on the log scale for numerical stability.
+   wk_mem must have at least 2 x [# quadrature nodes] elements. */
+  void eval_point(double const eta, double const eta_d, double const sd,
+                  double &haz, double &cum_haz, double &surv,
+                  double * const wk_mem) const {
+    if(sd <= 0){
+      Family const fam(eta);
+      haz = -fam.gp_g() * eta_d;
+      cum_haz = -fam.g_log();
+      surv = std::exp(-cum_haz);
+      return;
+    }
+
+    std::size_t const n_nodes = xw.x.size();
+    double const mult = std::sqrt(2.) * sd,
+             log_norm = -.5 * std::log(M_PI);
+
+    /* the maximum of the log terms */
+    double max_log = -std::numeric_limits<double>::infinity();
+    double * const log_terms = wk_mem,
+           * const haz_terms = wk_mem + n_nodes;
+    for(std::size_t k = 0; k < n_nodes; ++k){
+      Family const fam(eta + mult * xw.x[k]);
+      log_terms[k] = std::log(xw.w[k]) + log_norm + fam.g_log();
+      haz_terms[k] = -fam.gp_g();
+      max_log = std::max(max_log, log_terms[k]);
+    }
+
+    double surv_scaled(0.), dens_scaled(0.);
+    for(std::size_t k = 0; k < n_nodes; ++k){
+      double const term = std::exp(log_terms[k] - max_log);
+      surv_scaled += term;
+      dens_scaled += term * haz_terms[k];
+    }
+
+    haz = dens_scaled / surv_scaled * eta_d;
+    cum_haz = -(std::log(surv_scaled) + max_log);
+    surv = std::exp(-cum_haz);
+  }
+
+  /** computes the predictions for all subjects and time points. The output
+   arrays must have n_subjects() x n_times() elements and the results are
+   stored in column-major order with a row for each subject. The
+   computation is parallel over the subjects. */
+  void predict(double * const haz, double * const cum_haz,
+               double * const surv, unsigned const n_threads) const {
+    R_xlen_t const n_sub_i = n_sub;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(static) \
+  if(n_threads > 1L)
+#endif
+    for(R_xlen_t i = 0; i < n_sub_i; ++i){
+      std::vector<double> wk_mem(2L * xw.x.size());
+      for(size_t j = 0; j < n_t; ++j){
+        size_t const idx = i + j * n_sub;
+        eval_point(eta_x[i] + eta_b[j], etaD[j], sds[i], haz[idx],
+                   cum_haz[idx], surv[idx], wk_mem.data());
+      }
+    }
+  }
+};
+} // namespace gsm_objs
+
+#endif
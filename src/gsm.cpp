@@ -1,4 +1,7 @@
 #include "gsm.h"
+#include "gsm-predict.h"
+#include "gsm-device.h"
+#include <cmath>
 
 namespace gsm_objs {
 double gsm_probit::g_log() const {
@@ -75,14 +78,234 @@ double gsm_logit::d_gpp_gp() const {
   return eta > logit_too_large ? 0 : -2. * exp_eta / exp_eta_p1 / exp_eta_p1;
 }
 
-template<class T>
+gsm_fit_res gsm_base::fit(arma::vec beta, arma::vec gamma,
+                          gsm_fit_control const &ctrl) const {
+  arma::uword const n_b = beta.n_elem,
+                    n_p = n_b + gamma.n_elem;
+  gsm_fit_res out;
+  out.n_iter = 0L;
+  out.n_eval = 1L;
+  out.convergence = 1L;
+  out.eval = eval(beta, gamma, 2L);
+  if(!std::isfinite(out.eval.log_lik))
+    throw std::invalid_argument(
+        "gsm_base::fit: non-finite log-likelihood at the starting values");
+
+  /* returns true if the relative change is small or the gradient is close
+   * to zero */
+  auto small_grad = [&]{
+    return n_p < 1L or arma::abs(out.eval.grad).max() < ctrl.gr_tol;
+  };
+  auto has_converged = [&](double const old_ll, double const new_ll){
+    return std::abs(new_ll - old_ll) <
+      ctrl.reltol * (std::abs(old_ll) + ctrl.reltol) or small_grad();
+  };
+  if(small_grad()){
+    out.convergence = 0L;
+    out.beta = std::move(beta);
+    out.gamma = std::move(gamma);
+    return out;
+  }
+
+  /* maximum number of shifts of the diagonal of the negative Hessian */
+  constexpr unsigned const max_shifts = 60L;
+  arma::vec par = arma::join_cols(beta, gamma),
+            par_new(n_p), dir(n_p);
+  arma::mat neg_hess(n_p, n_p), chol_fac(n_p, n_p);
+  for(; out.n_iter < ctrl.maxit; ){
+    ++out.n_iter;
+    arma::vec const &gr = out.eval.grad;
+
+    /* find the Newton direction. A multiple of the identity matrix is added
+     * to the negative Hessian until it is positive definite */
+    neg_hess = -out.eval.hess;
+    if(!neg_hess.is_finite()){
+      out.convergence = 3L;
+      break;
+    }
+    double const diag_max = std::max(1., arma::abs(neg_hess.diag()).max());
+    double shift(0.);
+    bool found_dir(false);
+    for(unsigned k = 0; k < max_shifts; ++k){
+      if(shift > 0)
+        neg_hess.diag() += shift;
+      if(arma::chol(chol_fac, neg_hess)){
+        found_dir = true;
+        break;
+      }
+      if(shift > 0)
+        neg_hess.diag() -= shift;
+      shift = shift > 0 ? 4 * shift : 1e-8 * diag_max;
+    }
+    if(!found_dir){
+      out.convergence = 3L;
+      break;
+    }
+    dir = arma::solve(arma::trimatu(chol_fac),
+                      arma::solve(arma::trimatl(chol_fac.t()), gr));
+
+    /* backtracking line search with the Armijo condition */
+    double const old_ll = out.eval.log_lik,
+                   d_ll = arma::dot(gr, dir);
+    constexpr double const c1 = 1e-4;
+    double step(1.);
+    bool found_step(false);
+    gsm_eval_res new_eval;
+    for(unsigned k = 0; k <= ctrl.max_halv; ++k, step /= 2){
+      par_new = par + step * dir;
+      /* the first step is typically accepted so the Hessian is computed
+       * in the same pass */
+      new_eval = eval(par_new.head(n_b), par_new.tail(n_p - n_b),
+                      k < 1L ? 2L : 0L);
+      ++out.n_eval;
+      if(std::isfinite(new_eval.log_lik) and
+           new_eval.log_lik >= old_ll + c1 * step * d_ll){
+        found_step = true;
+        break;
+      }
+    }
+
+    if(!found_step){
+      out.convergence = 2L;
+      break;
+    }
+    if(new_eval.hess.n_elem < 1L){
+      new_eval = eval(par_new.head(n_b), par_new.tail(n_p - n_b), 2L);
+      ++out.n_eval;
+    }
+
+    par = par_new;
+    out.eval = std::move(new_eval);
+    if(has_converged(old_ll, out.eval.log_lik)){
+      out.convergence = 0L;
+      break;
+    }
+  }
+
+  out.beta  = par.head(n_b);
+  out.gamma = par.tail(n_p - n_b);
+  return out;
+}
+
+/** creates a gsm object. storage is "double" to copy the design matrices,
+ "view" to use R's memory, "float" to store them in single precision,
+ "sparse" to store them as sparse matrices, or "device" to use gsm_device. */
+template<class Family>
 Rcpp::XPtr<gsm_base> create_gsm_obj(
-    arma::mat const &X, arma::mat const &XD, arma::mat const &Z,
+    Rcpp::NumericMatrix X, Rcpp::NumericMatrix XD, Rcpp::NumericMatrix Z,
     arma::vec const &y, double const eps, double const kappa,
     unsigned const n_threads, arma::vec const &offset_eta,
-    arma::vec const &offset_etaD){
-  return Rcpp::XPtr<gsm_base>(new T(X, XD, Z, y, eps, kappa, n_threads,
-                                    offset_eta, offset_etaD));
+    arma::vec const &offset_etaD, std::string const &storage){
+  auto get_view = [](Rcpp::NumericMatrix &M){
+    return arma::mat(M.begin(), M.nrow(), M.ncol(), false, true);
+  };
+  auto get_copy = [](Rcpp::NumericMatrix &M){
+    return arma::mat(M.begin(), M.nrow(), M.ncol());
+  };
+
+  if(storage == "double"){
+    using T = gsm<Family, double>;
+    return Rcpp::XPtr<gsm_base>(new T(
+        get_copy(X), get_copy(XD), get_copy(Z), y, eps, kappa, n_threads,
+        offset_eta, offset_etaD));
+
+  } else if(storage == "view"){
+    using T = gsm<Family, double>;
+    Rcpp::XPtr<gsm_base> out(new T(
+        get_view(X), get_view(XD), get_view(Z), y, eps, kappa, n_threads,
+        offset_eta, offset_etaD));
+    /* R would otherwise be allowed to modify the matrices in place */
+    MARK_NOT_MUTABLE(static_cast<SEXP>(X));
+    MARK_NOT_MUTABLE(static_cast<SEXP>(XD));
+    MARK_NOT_MUTABLE(static_cast<SEXP>(Z));
+    out->keep_alive = Rcpp::List::create(X, XD, Z);
+    return out;
+
+  } else if(storage == "float"){
+    using T = gsm<Family, float>;
+    return Rcpp::XPtr<gsm_base>(new T(
+        arma::conv_to<arma::fmat>::from(get_view(X)),
+        arma::conv_to<arma::fmat>::from(get_view(XD)),
+        arma::conv_to<arma::fmat>::from(get_view(Z)), y, eps, kappa,
+        n_threads, offset_eta, offset_etaD));
+
+  } else if(storage == "sparse"){
+    using T = gsm<Family, sparse_storage>;
+    return Rcpp::XPtr<gsm_base>(new T(
+        arma::sp_mat(get_view(X)), arma::sp_mat(get_view(XD)),
+        arma::sp_mat(get_view(Z)), y, eps, kappa, n_threads, offset_eta,
+        offset_etaD));
+
+  } else if(storage == "device"){
+    using T = gsm_device<Family>;
+    return Rcpp::XPtr<gsm_base>(new T(
+        get_view(X), get_view(XD), get_view(Z), y, eps, kappa, n_threads,
+        offset_eta, offset_etaD));
+
+  }
+
+  throw std::invalid_argument("get_gsm_pointer: storage not implemented");
+  return Rcpp::XPtr<gsm_base>();
+}
+
+/** source of chunks which calls an R function with the one-based index of
+ the chunk. The function must return a list with the design matrices X, XD,
+ and Z as in get_gsm_pointer, the outcome y, and the offsets offset_eta and
+ offset_etaD. The offsets may have length zero. The memory of the returned
+ objects is used directly. */
+class r_chunk_source final : public gsm_chunk_source {
+  Rcpp::Function const get_chunk;
+  size_t const n_chunks_v;
+
+public:
+  r_chunk_source(Rcpp::Function get_chunk, size_t const n_chunks):
+  get_chunk(get_chunk), n_chunks_v(n_chunks) { }
+
+  size_t n_chunks() const {
+    return n_chunks_v;
+  }
+
+  gsm_chunk get(size_t const i) const {
+    Rcpp::List dat = get_chunk(static_cast<int>(i + 1L));
+    Rcpp::NumericMatrix X  = dat["X"],
+                        XD = dat["XD"],
+                        Z  = dat["Z"];
+    Rcpp::NumericVector y           = dat["y"],
+                        offset_eta  = dat["offset_eta"],
+                        offset_etaD = dat["offset_etaD"];
+
+    auto get_view = [](Rcpp::NumericMatrix &M){
+      return arma::mat(M.begin(), M.nrow(), M.ncol(), false, true);
+    };
+    auto get_vec = [](Rcpp::NumericVector &x, size_t const n){
+      if(x.size() < 1L)
+        return arma::vec(n, arma::fill::zeros);
+      return arma::vec(x.begin(), x.size(), false, true);
+    };
+
+    size_t const n = X.ncol();
+    gsm_chunk out;
+    out.X = get_view(X);
+    out.XD = get_view(XD);
+    out.Z = get_view(Z);
+    out.y = get_vec(y, n);
+    out.offset_eta = get_vec(offset_eta, n);
+    out.offset_etaD = get_vec(offset_etaD, n);
+    /* the elements may be converted copies of those in dat */
+    out.keep_alive = Rcpp::List::create(X, XD, Z, y, offset_eta, offset_etaD);
+    return out;
+  }
+};
+
+template<class Family>
+Rcpp::XPtr<gsm_base> create_gsm_chunked_obj(
+    Rcpp::Function get_chunk, unsigned const n_chunks, unsigned const n_b,
+    unsigned const n_g, double const eps, double const kappa,
+    unsigned const n_threads){
+  std::unique_ptr<gsm_chunk_source> source(
+      new r_chunk_source(get_chunk, n_chunks));
+  return Rcpp::XPtr<gsm_base>(new gsm_chunked<Family>(
+      std::move(source), n_b, n_g, eps, kappa, n_threads));
 }
 } // namespace gsm_objs
 
@@ -91,24 +314,47 @@ using namespace gsm_objs;
 /** returns an XPtr to the abstract base class. */
 // [[Rcpp::export(rng = false)]]
 SEXP get_gsm_pointer(
-    arma::mat const &X, arma::mat const &XD, arma::mat const &Z,
+    Rcpp::NumericMatrix X, Rcpp::NumericMatrix XD, Rcpp::NumericMatrix Z,
     arma::vec const &y, double const eps, double const kappa,
     std::string const &link, unsigned const n_threads,
-    arma::vec const &offset_eta, arma::vec const &offset_etaD){
+    arma::vec const &offset_eta, arma::vec const &offset_etaD,
+    std::string const &storage = "double"){
   if(link == "probit")
-    return create_gsm_obj<gsm<gsm_probit> >(
-        X, XD, Z, y, eps, kappa, n_threads, offset_eta, offset_etaD);
+    return create_gsm_obj<gsm_probit>(
+        X, XD, Z, y, eps, kappa, n_threads, offset_eta, offset_etaD, storage);
   else if(link == "PH")
-    return create_gsm_obj<gsm<gsm_ph    > >(
-        X, XD, Z, y, eps, kappa, n_threads, offset_eta, offset_etaD);
+    return create_gsm_obj<gsm_ph    >(
+        X, XD, Z, y, eps, kappa, n_threads, offset_eta, offset_etaD, storage);
   else if(link == "PO")
-    return create_gsm_obj<gsm<gsm_logit > >(
-          X, XD, Z, y, eps, kappa, n_threads, offset_eta, offset_etaD);
+    return create_gsm_obj<gsm_logit >(
+        X, XD, Z, y, eps, kappa, n_threads, offset_eta, offset_etaD, storage);
 
   throw std::invalid_argument("get_gsm_pointer: link not implemented");
   return SEXP();
 }
 
+/** returns an XPtr to the abstract base class for an object which passes
+ over chunks of observations returned by get_chunk. See r_chunk_source. */
+// [[Rcpp::export(rng = false)]]
+SEXP get_gsm_chunked_pointer(
+    Rcpp::Function get_chunk, unsigned const n_chunks, unsigned const n_b,
+    unsigned const n_g, double const eps, double const kappa,
+    std::string const &link, unsigned const n_threads){
+  if(link == "probit")
+    return create_gsm_chunked_obj<gsm_probit>(
+      get_chunk, n_chunks, n_b, n_g, eps, kappa, n_threads);
+  else if(link == "PH")
+    return create_gsm_chunked_obj<gsm_ph    >(
+      get_chunk, n_chunks, n_b, n_g, eps, kappa, n_threads);
+  else if(link == "PO")
+    return create_gsm_chunked_obj<gsm_logit >(
+      get_chunk, n_chunks, n_b, n_g, eps, kappa, n_threads);
+
+  throw std::invalid_argument(
+      "get_gsm_chunked_pointer: link not implemented");
+  return SEXP();
+}
+
 /** evaluates the log-likelihood. */
 // [[Rcpp::export(rng = false)]]
 double gsm_eval_ll(SEXP ptr, arma::vec const &beta, arma::vec const &gamma){
@@ -131,3 +377,174 @@ arma::mat gsm_eval_hess
   Rcpp::XPtr<gsm_base> obj(ptr);
   return obj->hess(beta, gamma);
 }
+
+/** evaluates the log-likelihood, the gradient if order > 0, and the Hessian
+ if order > 1 in one pass over the data. */
+// [[Rcpp::export(rng = false)]]
+Rcpp::List gsm_eval
+  (SEXP ptr, arma::vec const &beta, arma::vec const &gamma,
+   unsigned const order){
+  using Rcpp::Named;
+  Rcpp::XPtr<gsm_base> obj(ptr);
+  gsm_eval_res const res = obj->eval(beta, gamma, order);
+
+  if(order < 1L)
+    return Rcpp::List::create(Named("log_lik") = res.log_lik);
+  else if(order < 2L)
+    return Rcpp::List::create(Named("log_lik") = res.log_lik,
+                              Named("grad")    = res.grad);
+  return Rcpp::List::create(Named("log_lik") = res.log_lik,
+                            Named("grad")    = res.grad,
+                            Named("hess")    = res.hess);
+}
+
+/** maximizes the log-likelihood with a damped Newton method. */
+// [[Rcpp::export(rng = false)]]
+Rcpp::List gsm_newton_fit
+  (SEXP ptr, arma::vec const &beta, arma::vec const &gamma,
+   unsigned const maxit, double const reltol, double const gr_tol,
+   unsigned const max_halv){
+  using Rcpp::Named;
+  Rcpp::XPtr<gsm_base> obj(ptr);
+  gsm_fit_control ctrl;
+  ctrl.maxit = maxit;
+  ctrl.reltol = reltol;
+  ctrl.gr_tol = gr_tol;
+  ctrl.max_halv = max_halv;
+
+  gsm_fit_res const res = obj->fit(beta, gamma, ctrl);
+  return Rcpp::List::create(
+    Named("beta") = res.beta, Named("gamma") = res.gamma,
+    Named("log_lik") = res.eval.log_lik, Named("grad") = res.eval.grad,
+    Named("hess") = res.eval.hess, Named("n_iter") = res.n_iter,
+    Named("n_eval") = res.n_eval, Named("convergence") = res.convergence);
+}
+
+/**
+ maximizes the log-likelihood of many independent models in parallel with
+ the damped Newton method. Each model is fitted by one thread so the models
+ should be made with n_threads = 1. See gsm_newton_fit for the other
+ arguments.
+
+ Args:
+   ptrs: list of pointers from get_gsm_pointer.
+   betas: list with the starting values of beta of each model.
+   gammas: list with the starting values of gamma of each model.
+   n_threads: number of models to fit in parallel.
+ */
+// [[Rcpp::export(rng = false)]]
+Rcpp::List gsm_newton_fit_batch
+  (Rcpp::List ptrs, Rcpp::List betas, Rcpp::List gammas,
+   unsigned const maxit, double const reltol, double const gr_tol,
+   unsigned const max_halv, unsigned const n_threads){
+  using Rcpp::Named;
+  R_xlen_t const n_models = ptrs.size();
+  if(betas.size() != n_models)
+    throw std::invalid_argument("gsm_newton_fit_batch: invalid betas");
+  else if(gammas.size() != n_models)
+    throw std::invalid_argument("gsm_newton_fit_batch: invalid gammas");
+  else if(n_threads < 1L)
+    throw std::invalid_argument("gsm_newton_fit_batch: invalid n_threads");
+
+  /* copy the R objects on the main thread */
+  std::vector<gsm_base const*> objs;
+  std::vector<arma::vec> beta_vals, gamma_vals;
+  objs.reserve(n_models);
+  beta_vals.reserve(n_models);
+  gamma_vals.reserve(n_models);
+  for(R_xlen_t i = 0; i < n_models; ++i){
+    Rcpp::XPtr<gsm_base> obj(Rcpp::as<SEXP>(ptrs[i]));
+    if(!obj->is_thread_safe())
+      throw std::invalid_argument(
+          "gsm_newton_fit_batch: chunked models are not supported");
+    else if(obj->get_n_threads() != 1L)
+      throw std::invalid_argument(
+          "gsm_newton_fit_batch: the models must be made with n_threads = 1");
+
+    objs.emplace_back(obj.get());
+    beta_vals .emplace_back(Rcpp::as<arma::vec>(betas [i]));
+    gamma_vals.emplace_back(Rcpp::as<arma::vec>(gammas[i]));
+  }
+
+  gsm_fit_control ctrl;
+  ctrl.maxit = maxit;
+  ctrl.reltol = reltol;
+  ctrl.gr_tol = gr_tol;
+  ctrl.max_halv = max_halv;
+
+  std::vector<gsm_fit_res> res(n_models);
+  std::vector<std::string> errs(n_models);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n_threads) schedule(dynamic) \
+  if(n_threads > 1L)
+#endif
+  for(R_xlen_t i = 0; i < n_models; ++i){
+    try {
+      res[i] = objs[i]->fit(beta_vals[i], gamma_vals[i], ctrl);
+    } catch(std::exception const &e) {
+      errs[i] = e.what();
+    }
+  }
+
+  for(R_xlen_t i = 0; i < n_models; ++i)
+    if(!errs[i].empty())
+      throw std::runtime_error(
+          "gsm_newton_fit_batch: error for model " + std::to_string(i + 1L) +
+            ": " + errs[i]);
+
+  Rcpp::List out(n_models);
+  for(R_xlen_t i = 0; i < n_models; ++i){
+    gsm_fit_res const &r = res[i];
+    out[i] = Rcpp::List::create(
+      Named("beta") = r.beta, Named("gamma") = r.gamma,
+      Named("log_lik") = r.eval.log_lik, Named("grad") = r.eval.grad,
+      Named("hess") = r.eval.hess, Named("n_iter") = r.n_iter,
+      Named("n_eval") = r.n_eval, Named("convergence") = r.convergence);
+  }
+  return out;
+}
+
+namespace {
+template<class Family>
+Rcpp::List mgsm_predict_T
+  (arma::mat const &X, arma::mat const &Z, arma::mat const &B,
+   arma::mat const &BD, arma::vec const &gamma, arma::vec const &omega,
+   arma::mat const &Sigma, unsigned const n_nodes,
+   unsigned const n_threads){
+  using Rcpp::Named;
+  gsm_predictor<Family> const obj(X, Z, B, BD, gamma, omega, Sigma, n_nodes);
+
+  Rcpp::NumericMatrix haz(obj.n_subjects(), obj.n_times()),
+                  cum_haz(obj.n_subjects(), obj.n_times()),
+                     surv(obj.n_subjects(), obj.n_times());
+  obj.predict(&haz[0], &cum_haz[0], &surv[0], n_threads);
+
+  return Rcpp::List::create(
+    Named("hazard") = haz, Named("cum_haz") = cum_haz,
+    Named("surv") = surv);
+}
+} // namespace
+
+/** computes the marginal hazard, the cumulative hazard, and the survival
+ function on a grid of subjects and time points. */
+// [[Rcpp::export(rng = false)]]
+Rcpp::List mgsm_predict
+  (arma::mat const &X, arma::mat const &Z, arma::mat const &B,
+   arma::mat const &BD, arma::vec const &gamma, arma::vec const &omega,
+   arma::mat const &Sigma, std::string const &link, unsigned const n_nodes,
+   unsigned const n_threads){
+  if(n_nodes < 1L)
+    throw std::invalid_argument("mgsm_predict: invalid n_nodes");
+
+  if(link == "probit")
+    return mgsm_predict_T<gsm_probit>(
+      X, Z, B, BD, gamma, omega, Sigma, n_nodes, n_threads);
+  else if(link == "PH")
+    return mgsm_predict_T<gsm_ph    >(
+      X, Z, B, BD, gamma, omega, Sigma, n_nodes, n_threads);
+  else if(link == "PO")
+    return mgsm_predict_T<gsm_logit >(
+      X, Z, B, BD, gamma, omega, Sigma, n_nodes, n_threads);
+
+  throw std::invalid_argument("mgsm_predict: link not implemented");
+}
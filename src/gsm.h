@@ -3,28 +3,49 @@
 
 #define INCLUDE_RCPP
 #include "tmb_includes.h"
+#include "gsm-design.h"
 #include <limits>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <memory>
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
 namespace gsm_objs {
-/** evalutes the dot product between an arma::vec and double range without
- bounds checks. */
-inline double arma_dot(const arma::vec &x, double const *y){
-  double out(0.);
-  for(auto &xi : x)
-    out += xi * *y++;
-  return out;
-}
-
-/** adds a double range times a scalar to an arma::vec without bounds
- checks. */
-inline void arma_inplace_add(arma::vec &x, double const f, double const *y){
-  for(auto &xi : x)
-    xi += f * *y++;
-}
+/** output of gsm_base::eval. The gradient and the Hessian are empty if
+ they are not computed. */
+struct gsm_eval_res {
+  double log_lik;
+  arma::vec grad;
+  arma::mat hess;
+};
+
+/** control parameters for gsm_base::fit. */
+struct gsm_fit_control {
+  /** maximum number of Newton iterations. */
+  unsigned maxit = 100L;
+  /** relative convergence threshold for the log-likelihood. */
+  double reltol = 1e-10;
+  /** convergence threshold for the largest absolute gradient entry. */
+  double gr_tol = 1e-8;
+  /** maximum number of step halvings in each iteration. */
+  unsigned max_halv = 30L;
+};
+
+/** output of gsm_base::fit. convergence is zero if the method converged,
+ one if the maximum number of iterations is reached, two if no step
+ increased the log-likelihood, and three if the Hessian is not finite or no
+ Newton direction is found. eval contains the log-likelihood, the
+ gradient, and the Hessian at the final estimates. */
+struct gsm_fit_res {
+  arma::vec beta, gamma;
+  gsm_eval_res eval;
+  unsigned n_iter, n_eval;
+  int convergence;
+};
 
 /** abstract base class to return to R. */
 class gsm_base {
@@ -33,6 +54,27 @@ public:
   (arma::vec const&, arma::vec const&) const = 0;
   virtual arma::vec grad(arma::vec const&, arma::vec const&) const = 0;
   virtual arma::mat hess(arma::vec const&, arma::vec const&) const = 0;
+  /** computes the log-likelihood and the gradient if order > 0 and the
+   Hessian if order > 1 in one pass over the data. */
+  virtual gsm_eval_res eval
+  (arma::vec const&, arma::vec const&, unsigned const) const = 0;
+
+  /** maximizes the log-likelihood with a damped Newton method using the
+   analytic Hessian starting at beta and gamma. */
+  gsm_fit_res fit(arma::vec beta, arma::vec gamma,
+                  gsm_fit_control const &ctrl) const;
+
+  /** returns the number of threads used in the evaluations. */
+  virtual unsigned get_n_threads() const = 0;
+  /** returns true if the object does not call R in the evaluations and can
+   be used by other threads than the main thread. */
+  virtual bool is_thread_safe() const {
+    return true;
+  }
+
+  /** R objects which must be kept alive e.g. because the design matrices
+   use their memory. */
+  Rcpp::List keep_alive;
 
   virtual ~gsm_base() = default;
 };
@@ -52,11 +94,15 @@ public:
 
  This allows one to cache certian values. The design matrices needs to be
  [# coefficients] x [# observations]. Z is for the time invariant
- covariates.
+ covariates. The design matrices are stored as dense matrices with the
+ Storage type which is either double or float or as sparse matrices if
+ Storage is sparse_storage. All computations are in double precision.
  */
-template<class Family>
+template<class Family, class Storage = double>
 class gsm final : public gsm_base {
-  arma::mat const X, XD, Z;
+  using storage_mat = typename design::traits<Storage>::mat;
+  using block_view  = typename design::traits<Storage>::view;
+  storage_mat const X, XD, Z;
   arma::vec const y;
   size_t const n = X.n_cols,
              n_b = X.n_rows,
@@ -73,17 +119,73 @@ class gsm final : public gsm_base {
       throw std::invalid_argument("gsm: invalid gamma");
   }
 
+  /* the observations are processed in blocks of this size. The linear
+   * predictors and the gradient terms of a block are computed with
+   * matrix-vector products and the families are evaluated in a loop over
+   * contiguous memory */
+  static constexpr size_t block_size = 64L;
+
+  size_t n_blocks() const {
+    return (n + block_size - 1L) / block_size;
+  }
+
+  /* the design matrices for a block of observations */
+  struct block_views {
+    block_view X, XD, Z;
+  };
+
+  /* memory to convert the design matrices of a block if they are stored in
+   * single precision */
+  struct block_mem {
+    arma::mat X, XD, Z;
+
+    block_mem(size_t const n_b, size_t const n_g){
+      if(std::is_same<Storage, float>::value){
+        X .set_size(n_b, block_size);
+        XD.set_size(n_b, block_size);
+        Z .set_size(n_g, block_size);
+      }
+    }
+  };
+
+  block_views get_block_views
+  (size_t const i_start, size_t const n_blk, block_mem &mem) const {
+    return { design::col_block(X , i_start, n_blk, mem.X ),
+             design::col_block(XD, i_start, n_blk, mem.XD),
+             design::col_block(Z , i_start, n_blk, mem.Z ) };
+  }
+
+  /* sets the first n_blk elements of eta and eta_p to the linear predictor
+   * and its derivative for observations [i_start, i_start + n_blk) */
+  void set_eta_block
+  (arma::vec const &beta, arma::vec const &gamma, size_t const i_start,
+   size_t const n_blk, block_views const &v, arma::vec &eta,
+   arma::vec &eta_p) const {
+    size_t const i_end = i_start + n_blk - 1L;
+    eta  .head(n_blk) = offset_eta .subvec(i_start, i_end);
+    eta_p.head(n_blk) = offset_etaD.subvec(i_start, i_end);
+    if(n_b > 0){
+      design::add_t_prod(v.X , beta , eta  .memptr());
+      design::add_t_prod(v.XD, beta , eta_p.memptr());
+    }
+    if(n_g > 0)
+      design::add_t_prod(v.Z , gamma, eta  .memptr());
+  }
+
 public:
-  gsm(arma::mat const &X, arma::mat const &XD, arma::mat const &Z,
+  /* the design matrices are moved. Thus, matrices which use auxiliary
+   * memory can be passed to avoid a copy */
+  gsm(storage_mat X, storage_mat XD, storage_mat Z,
       arma::vec const &y, double const eps, double const kappa,
       unsigned const n_threads, arma::vec const &offset_eta,
       arma::vec const &offset_etaD):
-  X(X), XD(XD), Z(Z), y(y), eps(eps), kappa(kappa), n_threads(n_threads),
-  offset_eta(offset_eta), offset_etaD(offset_etaD) {
+  X(std::move(X)), XD(std::move(XD)), Z(std::move(Z)), y(y), eps(eps),
+  kappa(kappa), n_threads(n_threads), offset_eta(offset_eta),
+  offset_etaD(offset_etaD) {
     /* checks */
-    if(XD.n_rows != n_b or XD.n_cols != n)
+    if(this->XD.n_rows != n_b or this->XD.n_cols != n)
       throw std::invalid_argument("gsm: invalid XD");
-    else if(Z.n_cols != n)
+    else if(this->Z.n_cols != n)
       throw std::invalid_argument("gsm: invalid Z");
     else if(y.n_elem != n)
       throw std::invalid_argument("gsm: invalid y");
@@ -98,6 +200,10 @@ public:
     else if(offset_etaD.n_elem != n)
       throw std::invalid_argument("gsm: invalid offset_etaD");
 
+    design::sync(this->X);
+    design::sync(this->XD);
+    design::sync(this->Z);
+
 #ifdef _OPENMP
     omp_set_num_threads(n_threads);
 #endif
@@ -105,183 +211,313 @@ public:
 
   double log_likelihood
   (arma::vec const &beta, arma::vec const &gamma) const {
-    check_params(beta, gamma);
-
-    double out(0.);
-#ifdef _OPENMP
-#pragma omp parallel for num_threads(n_threads) schedule(static) \
-    reduction(+:out)
-#endif
-    for(size_t i = 0; i < n; ++i){
-      double const * const xi  = X .colptr(i),
-                   * const xdi = XD.colptr(i),
-                   * const zi  = Z .colptr(i);
-      double const eta =
-        arma_dot(beta, xi) + arma_dot(gamma, zi) + offset_eta[i];
-      Family fam(eta);
-      double const eta_p = arma_dot(beta, xdi) + offset_etaD[i],
-                     haz = -fam.gp_g() * eta_p;
-      bool const valid = haz > eps;
-
-
-      if(y[i] > 0)
-        if(__builtin_expect(valid, 1))
-          out += log(-fam.gp() * eta_p);
-        else
-          out += eps_log + fam.g_log();
-      else
-        out += fam.g_log();
+    return eval(beta, gamma, 0L).log_lik;
+  }
 
-      if(__builtin_expect(valid, 1))
-        continue;
+  arma::vec grad
+  (arma::vec const &beta, arma::vec const &gamma) const {
+    return eval(beta, gamma, 1L).grad;
+  }
 
-      double const delta = haz - eps;
-      out -= kappa * delta * delta;
-    }
+  arma::mat hess
+  (arma::vec const &beta, arma::vec const &gamma) const {
+    return eval(beta, gamma, 2L).hess;
+  }
 
-    return out;
+  unsigned get_n_threads() const {
+    return n_threads;
   }
 
-  arma::vec grad
-  (arma::vec const &beta, arma::vec const &gamma) const {
+  gsm_eval_res eval
+  (arma::vec const &beta, arma::vec const &gamma,
+   unsigned const order) const {
     check_params(beta, gamma);
-    arma::vec out(n_b + n_g, arma::fill::zeros),
-               db(out.begin()      , n_b, false),
-               dg(out.begin() + n_b, n_g, false);
+    bool const do_grad = order > 0L,
+               do_hess = order > 1L;
+
+    double ll(0.);
+    arma::vec db, dg;
+    arma::mat bm, gm, gbm;
+    if(do_grad){
+      db.zeros(n_b);
+      dg.zeros(n_g);
+    }
+    if(do_hess){
+      bm .zeros(n_b, n_b);
+      gm .zeros(n_g, n_g);
+      gbm.zeros(n_g, n_b);
+    }
 
+    size_t const n_blks = n_blocks();
 #ifdef _OPENMP
 #pragma omp parallel num_threads(n_threads)
     {
 #endif
-    arma::vec db_loc(n_b, arma::fill::zeros),
-              dg_loc(n_g, arma::fill::zeros);
+    double ll_loc(0.);
+    arma::vec db_loc, dg_loc,
+              eta(block_size), eta_p(block_size),
+              /* factors in the gradient for the X and Z columns and for the
+               * XD columns */
+              f_x, f_xd,
+              /* weights in the Hessian for the X and Z columns and the
+               * square root of the weights for the XD columns */
+              w_x, w_xd;
+    arma::mat bm_loc, gm_loc, gbm_loc,
+              /* memory for the scaled columns of a block */
+              xw_mem, zw_mem, xdw_mem;
+    block_mem b_mem(n_b, n_g);
+    if(do_grad){
+      db_loc.zeros(n_b);
+      dg_loc.zeros(n_g);
+      f_x .set_size(block_size);
+      f_xd.set_size(block_size);
+    }
+    if(do_hess){
+      bm_loc .zeros(n_b, n_b);
+      gm_loc .zeros(n_g, n_g);
+      gbm_loc.zeros(n_g, n_b);
+      w_x .set_size(block_size);
+      w_xd.set_size(block_size);
+      xw_mem .set_size(n_b, block_size);
+      zw_mem .set_size(n_g, block_size);
+      xdw_mem.set_size(n_b, block_size);
+    }
+
 #ifdef _OPENMP
 #pragma omp for schedule(static)
 #endif
-    for(size_t i = 0; i < n; ++i){
-      double const * const xi  = X .colptr(i),
-                   * const xdi = XD.colptr(i),
-                   * const zi  = Z .colptr(i);
-      double const eta =
-          arma_dot(beta, xi) + arma_dot(gamma, zi) + offset_eta[i];
-      Family fam(eta);
-      double const eta_p = arma_dot(beta, xdi) + offset_etaD[i],
-                     haz = -fam.gp_g() * eta_p;
-      bool const valid = haz > eps;
-
-      if(y[i] > 0){
-        if(__builtin_expect(valid, 1)){
-          double const f = fam.gpp_gp();
-          arma_inplace_add(db_loc, f         , xi);
-          arma_inplace_add(dg_loc, f         , zi);
-          arma_inplace_add(db_loc, 1. / eta_p, xdi);
-
-        } else {
-          double const fac = fam.gp_g();
-          arma_inplace_add(db_loc, fac, xi);
-          arma_inplace_add(dg_loc, fac, zi);
+    for(size_t b = 0; b < n_blks; ++b){
+      size_t const i_start = b * block_size,
+                     n_blk = std::min(block_size, n - i_start);
+      block_views const v = get_block_views(i_start, n_blk, b_mem);
+      set_eta_block(beta, gamma, i_start, n_blk, v, eta, eta_p);
+      double const * const yb = y.memptr() + i_start;
+
+      for(size_t j = 0; j < n_blk; ++j){
+        Family fam(eta[j]);
+        double const haz = -fam.gp_g() * eta_p[j];
+        bool const valid = haz > eps,
+                is_event = yb[j] > 0;
+
+        /* the log-likelihood term */
+        if(is_event)
+          if(__builtin_expect(valid, 1))
+            ll_loc += log(-fam.gp() * eta_p[j]);
+          else
+            ll_loc += eps_log + fam.g_log();
+        else
+          ll_loc += fam.g_log();
 
+        if(!__builtin_expect(valid, 1)){
+          double const delta = haz - eps;
+          ll_loc -= kappa * delta * delta;
         }
-      } else {
-        double const fac = fam.gp_g();
-        arma_inplace_add(db_loc, fac, xi);
-        arma_inplace_add(dg_loc, fac, zi);
 
+        /* the gradient terms */
+        if(do_grad){
+          if(is_event and __builtin_expect(valid, 1)){
+            f_x [j] = fam.gpp_gp();
+            f_xd[j] = 1. / eta_p[j];
+
+          } else {
+            f_x [j] = fam.gp_g();
+            f_xd[j] = 0.;
+
+          }
+
+          if(!__builtin_expect(valid, 1)){
+            double const fac = -2. * kappa * (haz - eps);
+            f_x [j] -= fac * fam.d_gp_g() * eta_p[j];
+            f_xd[j] -= fac * fam.gp_g();
+          }
+        }
+
+        /* the Hessian terms */
+        if(do_hess){
+          if(is_event){
+            if(__builtin_expect(valid, 1)){
+              w_x [j] = fam.d_gpp_gp();
+              w_xd[j] = 1. / eta_p[j];
+
+            } else {
+              w_x [j] = 0.;
+              w_xd[j] = 0.;
+
+            }
+          } else {
+            w_x [j] = fam.d_gp_g();
+            w_xd[j] = 0.;
+
+          }
+        }
       }
 
-      if(__builtin_expect(valid, 1))
-        continue;
+      if(do_grad){
+        if(n_b > 0){
+          design::add_prod(v.X , f_x .memptr(), db_loc);
+          design::add_prod(v.XD, f_xd.memptr(), db_loc);
+        }
+        if(n_g > 0)
+          design::add_prod(v.Z , f_x .memptr(), dg_loc);
+      }
 
-      double const fac = -2. * kappa * (haz - eps),
-                    f1 = -fac * fam.d_gp_g() * eta_p,
-                    f2 = -fac * fam.gp_g();
-      arma_inplace_add(db_loc, f1, xi);
-      arma_inplace_add(dg_loc, f1, zi);
-      arma_inplace_add(db_loc, f2, xdi);
+      if(do_hess){
+        /* weighted cross products. The XD term has non-negative weights
+         * and is a rank-k update */
+        if(n_g > 0){
+          design::add_cross(v.Z, v.Z, w_x.memptr(), zw_mem, gm_loc);
+          if(n_b > 0)
+            design::add_cross(v.Z, v.X, w_x.memptr(), zw_mem, gbm_loc);
+        }
+        if(n_b > 0){
+          design::add_cross(v.X, v.X, w_x.memptr(), xw_mem, bm_loc);
+          design::sub_sq_cross(v.XD, w_xd.memptr(), xdw_mem, bm_loc);
+        }
+      }
     }
 
 #ifdef _OPENMP
 #pragma omp critical
       {
 #endif
-    db += db_loc;
-    dg += dg_loc;
+    ll += ll_loc;
+    if(do_grad){
+      db += db_loc;
+      dg += dg_loc;
+    }
+    if(do_hess){
+      bm  += bm_loc;
+      gm  += gm_loc;
+      gbm += gbm_loc;
+    }
 #ifdef _OPENMP
       }
     }
 #endif
 
+    gsm_eval_res out;
+    out.log_lik = ll;
+    if(do_grad)
+      out.grad = arma::join_cols(db, dg);
+    if(do_hess){
+      arma::mat &he = out.hess;
+      he.set_size(n_b + n_g, n_b + n_g);
+      if(n_b > 0)
+        he.submat(0  , 0  , n_b - 1      , n_b - 1      ) = bm;
+      if(n_g > 0)
+        he.submat(n_b, n_b, n_b + n_g - 1, n_b + n_g - 1) = gm;
+      if(n_b > 0 and n_g > 0)
+        he.submat(n_b, 0  , n_b + n_g - 1, n_b - 1      ) = gbm;
+      he = arma::symmatl(he);
+    }
+
     return out;
   }
+};
 
-  arma::mat hess
+template<class Family, class Storage>
+constexpr size_t gsm<Family, Storage>::block_size;
+
+/** a chunk of observations used by gsm_chunked. The design matrices are as
+ in gsm and may use auxiliary memory. */
+struct gsm_chunk {
+  arma::mat X, XD, Z;
+  arma::vec y, offset_eta, offset_etaD;
+  /** R objects which must be kept alive while the chunk is used. */
+  Rcpp::List keep_alive;
+};
+
+/** abstract base class for a source of chunks of observations. */
+class gsm_chunk_source {
+public:
+  virtual size_t n_chunks() const = 0;
+  /** returns chunk i. Only called from the main thread. */
+  virtual gsm_chunk get(size_t const i) const = 0;
+
+  virtual ~gsm_chunk_source() = default;
+};
+
+/**
+ computes the log-likelihood, the gradient, and the Hessian by passing over
+ chunks of observations. Only one chunk is kept at a time so the memory
+ scales with the chunk size and not with the number of observations. Each
+ chunk is processed like in gsm.
+ */
+template<class Family>
+class gsm_chunked final : public gsm_base {
+  std::unique_ptr<gsm_chunk_source> const source;
+  size_t const n_b, n_g;
+  double const eps, kappa;
+  unsigned const n_threads;
+
+public:
+  gsm_chunked(std::unique_ptr<gsm_chunk_source> source,
+              size_t const n_b, size_t const n_g, double const eps,
+              double const kappa, unsigned const n_threads):
+  source(std::move(source)), n_b(n_b), n_g(n_g), eps(eps), kappa(kappa),
+  n_threads(n_threads) {
+    if(!this->source)
+      throw std::invalid_argument("gsm_chunked: no source");
+  }
+
+  double log_likelihood
   (arma::vec const &beta, arma::vec const &gamma) const {
-    check_params(beta, gamma);
-    arma::mat bm(n_b, n_b, arma::fill::zeros),
-              gm(n_g, n_g, arma::fill::zeros),
-             gbm(n_g, n_b, arma::fill::zeros);
+    return eval(beta, gamma, 0L).log_lik;
+  }
 
-#ifdef _OPENMP
-#pragma omp parallel num_threads(n_threads)
-  {
-#endif
-    arma::mat bm_loc(n_b, n_b, arma::fill::zeros),
-              gm_loc(n_g, n_g, arma::fill::zeros),
-             gbm_loc(n_g, n_b, arma::fill::zeros);
-#ifdef _OPENMP
-#pragma omp for schedule(static)
-#endif
-    for(size_t i = 0; i < n; ++i){
-      double const * const xi  = X .colptr(i),
-                   * const xdi = XD.colptr(i),
-                   * const zi  = Z .colptr(i);
-      double const eta =
-        arma_dot(beta, xi) + arma_dot(gamma, zi) + offset_eta[i];
-      Family fam(eta);
-      double const eta_p = arma_dot(beta, xdi) + offset_etaD[i],
-                     haz = -fam.gp_g() * eta_p;
-      bool const valid = haz > eps;
-
-      if(y[i] > 0){
-        if(__builtin_expect(valid, 1)){
-          double const f = fam.d_gpp_gp();
-          /* TODO: do something smarter */
-          bm_loc  += (f * X.col(i)) * X.col(i).t();
-          gm_loc  += (f * Z.col(i)) * Z.col(i).t();
-          gbm_loc += (f * Z.col(i)) * X.col(i).t();
-          bm_loc  -= (XD.col(i) / (eta_p * eta_p)) * XD.col(i).t();
+  arma::vec grad
+  (arma::vec const &beta, arma::vec const &gamma) const {
+    return eval(beta, gamma, 1L).grad;
+  }
 
-        }
-      } else {
-        /* TODO: do something smarter */
-        double const f = fam.d_gp_g();
-        bm_loc  += (f * X.col(i)) * X.col(i).t();
-        gm_loc  += (f * Z.col(i)) * Z.col(i).t();
-        gbm_loc += (f * Z.col(i)) * X.col(i).t();
+  arma::mat hess
+  (arma::vec const &beta, arma::vec const &gamma) const {
+    return eval(beta, gamma, 2L).hess;
+  }
 
-      }
-    }
+  unsigned get_n_threads() const {
+    return n_threads;
+  }
 
-#ifdef _OPENMP
-#pragma omp critical
-      {
-#endif
-    bm  += bm_loc;
-    gm  += gm_loc;
-    gbm += gbm_loc;
-#ifdef _OPENMP
-      }
+  /** the chunks are from R. */
+  bool is_thread_safe() const {
+    return false;
+  }
+
+  gsm_eval_res eval
+  (arma::vec const &beta, arma::vec const &gamma,
+   unsigned const order) const {
+    if(beta.n_elem != n_b)
+      throw std::invalid_argument("gsm_chunked: invalid beta");
+    else if(gamma.n_elem != n_g)
+      throw std::invalid_argument("gsm_chunked: invalid gamma");
+
+    gsm_eval_res out;
+    out.log_lik = 0.;
+    if(order > 0L)
+      out.grad.zeros(n_b + n_g);
+    if(order > 1L)
+      out.hess.zeros(n_b + n_g, n_b + n_g);
+
+    size_t const n_chunks = source->n_chunks();
+    for(size_t i = 0; i < n_chunks; ++i){
+      gsm_chunk c = source->get(i);
+      if(c.X.n_rows != n_b or c.Z.n_rows != n_g)
+        throw std::invalid_argument("gsm_chunked: invalid chunk");
+
+      gsm<Family, double> const obj(
+          std::move(c.X), std::move(c.XD), std::move(c.Z), c.y, eps, kappa,
+          n_threads, c.offset_eta, c.offset_etaD);
+      gsm_eval_res const res = obj.eval(beta, gamma, order);
+
+      out.log_lik += res.log_lik;
+      if(order > 0L)
+        out.grad += res.grad;
+      if(order > 1L)
+        out.hess += res.hess;
     }
-#endif
 
-    arma::mat out(n_b + n_g, n_b + n_g);
-    if(n_b > 0)
-      out.submat(0  , 0  , n_b - 1      , n_b - 1      ) = bm;
-    if(n_g > 0)
-      out.submat(n_b, n_b, n_b + n_g - 1, n_b + n_g - 1) = gm;
-    if(n_b > 0 and n_g > 0)
-      out.submat(n_b, 0  , n_b + n_g - 1, n_b - 1      ) = gbm;
-    return arma::symmatl(out);
+    return out;
   }
 };
 
@@ -1,12 +1,10 @@
 #ifndef GVA_UTILS_H
 #define GVA_UTILS_H
 
-#ifndef M_1_SQRT_2PI
-#define M_1_SQRT_2PI	0.398942280401432677939946059934	/* 1/sqrt(2pi) */
-#endif
-
 #include "gaus-hermite.h"
 #include "pnorm-log.h"
+#include "taylor-utils.h"
+#include "batch-atomic.h"
 
 namespace GaussHermite {
 namespace GVA {
@@ -29,6 +27,10 @@ namespace GVA {
 struct mlogit_fam {
   static double const too_large;
 
+  static char const * timer_name(){
+    return "GVA mlogit_integral";
+  }
+
   static double g(double const &eta) {
     return eta > too_large ? eta : log(1 + exp(eta));
   }
@@ -43,14 +45,20 @@ struct mlogit_fam {
   static double gp(double const &eta) {
     return eta > too_large ? 1 : 1. / (1. + exp(-eta));
   }
+
+  template<typename T>
+  static T gpp(T const &eta){
+    T const p = gp(eta);
+    return p * (T(1.) - p);
+  }
 };
 
 /* atomic function to perform Gauss–Hermite quadrature.
  *
  * Args:
  *   Type: base type.
- *   Fam: class with two static function: g is the integrand and gp is the
- *        derivative.
+ *   Fam: class with three static function: g is the integrand, gp is the
+ *        derivative, and gpp is the second derivative.
  */
 template <class Type, class Fam>
 class integral_atomic : public CppAD::atomic_base<Type> {
@@ -59,6 +67,14 @@ class integral_atomic : public CppAD::atomic_base<Type> {
   HermiteData<Type>   const &xw_type   = GaussHermiteDataCached<Type>  (n);
 
 public:
+  /* number of inputs. Used by survTMB::batch_atomic */
+  static constexpr std::size_t n_in = 2L;
+
+  /* name used by survTMB::phase_timers */
+  static char const * timer_name(){
+    return Fam::timer_name();
+  }
+
   integral_atomic(char const *name, unsigned const n):
   CppAD::atomic_base<Type>(name), n(n) {
     this->option(CppAD::atomic_base<Type>::bool_sparsity_enum);
@@ -78,68 +94,144 @@ public:
     return out;
   }
 
+  /* computes the gradient and, if hess is not a nullptr, the Hessian in
+   * column-major order */
+  void derivs(Type const mu, Type const sigma, Type * const gr,
+              Type * const hess) const {
+    Type const mult = Type(M_SQRT2),
+                sig = mult * sigma;
+    gr[0] = Type(0.);
+    gr[1] = Type(0.);
+    if(hess)
+      for(unsigned i = 0; i < 4; ++i)
+        hess[i] = Type(0.);
+
+    for(unsigned i = 0; i < xw_type.x.size(); ++i){
+      Type const node = mu + sig * xw_type.x[i],
+                 term = xw_type.w[i] * Fam::gp(node),
+                   mx = mult * xw_type.x[i];
+      gr[0] +=      term;
+      gr[1] += mx * term;
+
+      if(hess){
+        Type const term2 = xw_type.w[i] * Fam::gpp(node);
+        hess[0] +=           term2;
+        hess[1] += mx *      term2;
+        hess[3] += mx * mx * term2;
+      }
+    }
+
+    Type const fac(sqrt(M_1_PI));
+    gr[0] *= fac;
+    gr[1] *= fac;
+    if(hess){
+      hess[0] *= fac;
+      hess[1] *= fac;
+      hess[3] *= fac;
+      hess[2]  = hess[1];
+    }
+  }
+
+  /* versions used by survTMB::batch_atomic with x = (mu, sigma) */
+  double value(double const *x) const {
+    return comp(x[0], M_SQRT2 * x[1], xw_double);
+  }
+  void derivs(Type const *x, Type * const gr, Type * const hess) const {
+    derivs(x[0], x[1], gr, hess);
+  }
+
   virtual bool forward(std::size_t p, std::size_t q,
                        const CppAD::vector<bool> &vx,
                        CppAD::vector<bool> &vy,
                        const CppAD::vector<Type> &tx,
                        CppAD::vector<Type> &ty){
-    if(q > 0)
+    survTMB::scoped_atomic_timer timer(timer_name());
+    if(q > 2)
       return false;
 
-    ty[0] = Type(
-      comp(asDouble(tx[0]), M_SQRT2 * asDouble(tx[1]), xw_double));
-
-    /* set variable flags */
-    if (vx.size() > 0) {
-      bool anyvx = false;
-      for (std::size_t i = 0; i < vx.size(); i++)
-        anyvx |= vx[i];
-      for (std::size_t i = 0; i < vy.size(); i++)
-        vy[i] = anyvx;
+    std::size_t const nq = q + 1L;
+    if(p == 0){
+      ty[0] = Type(
+        comp(asDouble(tx[0]), M_SQRT2 * asDouble(tx[nq]), xw_double));
+
+      /* set variable flags */
+      if (vx.size() > 0) {
+        bool anyvx = false;
+        for (std::size_t i = 0; i < vx.size(); i++)
+          anyvx |= vx[i];
+        for (std::size_t i = 0; i < vy.size(); i++)
+          vy[i] = anyvx;
+      }
     }
+    if(q < 1)
+      return true;
+
+    Type gr[2], hess[4], wk[4];
+    derivs(tx[0], tx[nq], gr, q > 1 ? hess : nullptr);
+    auto hess_vec = [&](Type const *d, Type *o){
+      o[0] = hess[0] * d[0] + hess[2] * d[1];
+      o[1] = hess[1] * d[0] + hess[3] * d[1];
+    };
 
-    return true;
+    return survTMB::taylor_forward(p, q, 2L, gr, hess_vec, tx, ty, wk);
   }
 
   virtual bool reverse(std::size_t q, const CppAD::vector<Type> &tx,
                        const CppAD::vector<Type> &ty,
                        CppAD::vector<Type> &px,
                        const CppAD::vector<Type> &py){
-    if(q > 0)
+    survTMB::scoped_atomic_timer timer(timer_name());
+    if(q > 1)
       return false;
 
-    Type const mu = tx[0],
-             mult = Type(M_SQRT2),
-              sig = mult * tx[1];
-    px[0] = Type(0.);
-    px[1] = Type(0.);
-    for(unsigned i = 0; i < xw_type.x.size(); ++i){
-      Type const node = mu + sig * xw_type.x[i],
-                 term = xw_type.w[i] * Fam::gp(node);
-      px[0] +=                  term;
-      px[1] += mult * xw_type.x[i] * term;
+    std::size_t const nq = q + 1L;
+    Type gr[2], hess[4], wk[4];
+    derivs(tx[0], tx[nq], gr, q > 0 ? hess : nullptr);
+    auto hess_vec = [&](Type const *d, Type *o){
+      o[0] = hess[0] * d[0] + hess[2] * d[1];
+      o[1] = hess[1] * d[0] + hess[3] * d[1];
+    };
 
-    }
-
-    px[0] *= Type(sqrt(M_1_PI)) * py[0];
-    px[1] *= Type(sqrt(M_1_PI)) * py[0];
+    return survTMB::taylor_reverse(q, 2L, gr, hess_vec, tx, px, py, wk);
+  }
 
-    return true;
+  virtual bool for_sparse_jac(size_t q, const CppAD::vector<bool>& r,
+                              CppAD::vector<bool>& s) {
+    return survTMB::one_output_for_sparse_jac(q, r, s);
   }
 
   virtual bool rev_sparse_jac(size_t q, const CppAD::vector<bool>& rt,
                               CppAD::vector<bool>& st) {
-    bool anyrt = false;
-    for (std::size_t i = 0; i < rt.size(); i++)
-      anyrt |= rt[i];
-    for (std::size_t i = 0; i < st.size(); i++)
-      st[i] = anyrt;
-    return true;
+    return survTMB::one_output_rev_sparse_jac(q, rt, st);
+  }
+
+  virtual bool rev_sparse_hes(const CppAD::vector<bool>& vx,
+                              const CppAD::vector<bool>& s,
+                              CppAD::vector<bool>& t, size_t q,
+                              const CppAD::vector<bool>& r,
+                              const CppAD::vector<bool>& u,
+                              CppAD::vector<bool>& v) {
+    return survTMB::one_output_rev_sparse_hes(s, t, q, r, u, v);
   }
 };
 
 template<class Type>
 using mlogit_integral_atomic = integral_atomic<Type, mlogit_fam>;
+template<class Type>
+using mlogit_integral_batch_atomic =
+  survTMB::batch_atomic<Type, mlogit_integral_atomic<Type> >;
+
+/* interleaves mu and sigma as required by survTMB::batch_atomic */
+template<class Type>
+vector<Type> integral_batch_input
+  (vector<Type> const &mu, vector<Type> const &sigma){
+  vector<Type> x(2L * mu.size());
+  for(int i = 0; i < mu.size(); ++i){
+    x[2L * i     ] = mu   [i];
+    x[2L * i + 1L] = sigma[i];
+  }
+  return x;
+}
 
 template<class Type>
 AD<Type> mlogit_integral
@@ -167,6 +259,24 @@ Type mlogit_integral
   return mlogit_integral(mu_use, sigma, n);
 }
 
+/* vector versions which adds one node to the tape for all the elements */
+template<class Type>
+vector<AD<Type> > mlogit_integral
+  (vector<AD<Type> > const &mu, vector<AD<Type> > const &sigma,
+   unsigned const n){
+  return survTMB::eval_batch_atomic<mlogit_integral_atomic<Type> >(
+    integral_batch_input(mu, sigma), n);
+}
+
+inline vector<double> mlogit_integral
+  (vector<double> const &mu, vector<double> const &sigma,
+   unsigned const n){
+  vector<double> out(mu.size());
+  for(int i = 0; i < mu.size(); ++i)
+    out[i] = mlogit_integral(mu[i], sigma[i], n);
+  return out;
+}
+
 /* Makes an approximation of
  l(\mu,\sigma) =
  \int\phi(x;\mu,\sigma^2)
@@ -175,6 +285,10 @@ Type mlogit_integral
  with (non-adaptive) Gauss–Hermite quadrature
 */
 struct probit_fam {
+  static char const * timer_name(){
+    return "GVA probit_integral";
+  }
+
   static double g(double const &eta) {
     return - atomic::Rmath::Rf_pnorm5(eta, 0, 1, 1, 1);
   }
@@ -186,19 +300,23 @@ struct probit_fam {
     return - exp(pdf - cdf);
   }
   static double gp(double const &eta) {
-    if(eta > -10){
-      auto const cdf = atomic::Rmath::Rf_pnorm5(eta, 0, 1, 1, 0);
-      return - M_1_SQRT_2PI * exp(-eta * eta * .5) / cdf;
-    }
+    return - inv_mills_ratio(eta);
+  }
 
-    double const cdf = atomic::Rmath::Rf_pnorm5(eta, 0, 1, 1, 1),
-                 pdf = - eta * eta * .5;
-    return - M_1_SQRT_2PI * exp(pdf - cdf);
+  /* uses that the derivative of phi(x) / Phi(x) is
+   * -phi(x) / Phi(x) * (x + phi(x) / Phi(x)) */
+  template<typename T>
+  static T gpp(T const &eta){
+    T const d1 = gp(eta);
+    return - d1 * (eta - d1);
   }
 };
 
 template<class Type>
 using probit_integral_atomic = integral_atomic<Type, probit_fam>;
+template<class Type>
+using probit_integral_batch_atomic =
+  survTMB::batch_atomic<Type, probit_integral_atomic<Type> >;
 
 template<class Type>
 AD<Type> probit_integral
@@ -230,6 +348,24 @@ Type probit_integral
   return probit_integral(k - mu, sigma, n);
 }
 
+/* vector versions which adds one node to the tape for all the elements */
+template<class Type>
+vector<AD<Type> > probit_integral
+  (vector<AD<Type> > const &mu, vector<AD<Type> > const &sigma,
+   unsigned const n){
+  return survTMB::eval_batch_atomic<probit_integral_atomic<Type> >(
+    integral_batch_input(mu, sigma), n);
+}
+
+inline vector<double> probit_integral
+  (vector<double> const &mu, vector<double> const &sigma,
+   unsigned const n){
+  vector<double> out(mu.size());
+  for(int i = 0; i < mu.size(); ++i)
+    out[i] = probit_integral(mu[i], sigma[i], n);
+  return out;
+}
+
 } // namespace GVA
 } // namespace GaussHermite
 
@@ -1,6 +1,8 @@
 #include "gva.h"
 #include "gva-utils.h"
+#include "cond-dens-atomic.h"
 #include "utils.h"
+#include "taping-arena.h"
 
 using namespace survTMB;
 using GaussHermite::GVA::mlogit_integral;
@@ -33,16 +35,48 @@ struct GVA_cond_dens_data {
   Type const &event, Type const &va_mean, Type const &va_sd,   \
   Type const &va_var
 
+/* arguments to compute the cumulative hazard terms, H, for a set of
+ * observations. The operator() which takes H as the last argument computes
+ * the conditional density terms afterwards. The vector versions of the
+ * integrals only add one node to the tape */
+#define GVA_CUM_HAZ_ARGS                                       \
+  vector<Type> const &eta_fix, vector<Type> const &va_mean,    \
+  vector<Type> const &va_sd, vector<Type> const &va_var
+
+/* arguments to compute the conditional density terms of a set of
+ * observations with one node on the tape given H. eta is the fixed effects
+ * plus the mean of the random effect term */
+#define GVA_COND_DENS_VEC_ARGS                                 \
+  vector<Type> const &eta, vector<Type> const &etaD_fix,       \
+  vector<Type> const &event, vector<Type> const &va_var,       \
+  vector<Type> const &H
+
 /* computes the conditional density term for the PH (log-log) link
  * function */
 template<class Type>
 struct ph final : public GVA_cond_dens_data<Type> {
   using GVA_cond_dens_data<Type>::GVA_cond_dens_data;
 
+  vector<Type> cum_haz(GVA_CUM_HAZ_ARGS) const {
+    vector<Type> out(eta_fix.size());
+    for(int i = 0; i < out.size(); ++i)
+      out[i] = exp(eta_fix[i] + va_mean[i] + va_var[i] / this->two);
+    return out;
+  }
+
+  vector<Type> cond_dens(GVA_COND_DENS_VEC_ARGS) const {
+    return survTMB::cond_dens<survTMB::cond_dens_ph>(
+      eta, etaD_fix, event, va_var, H, this->eps, this->kappa);
+  }
+
   Type operator()(GVA_COND_DENS_ARGS) const {
+    Type const H = exp(eta_fix + va_mean + va_var / this->two);
+    return operator()(eta_fix, etaD_fix, event, va_mean, va_sd, va_var, H);
+  }
+
+  Type operator()(GVA_COND_DENS_ARGS, Type const &H) const {
     Type const eta = eta_fix  + va_mean,
                 h = etaD_fix * exp(eta),
-                H = exp(eta + va_var / this->two),
            if_low = event * this->eps_log - H - h * h * this->kappa,
            if_ok  = event * log(h)  - H;
 
@@ -56,10 +90,23 @@ template<class Type>
 struct po final : public GVA_cond_dens_data<Type> {
   using GVA_cond_dens_data<Type>::GVA_cond_dens_data;
 
+  vector<Type> cum_haz(GVA_CUM_HAZ_ARGS) const {
+    vector<Type> const mu_use = va_mean + eta_fix;
+    return mlogit_integral(mu_use, va_sd, this->n_nodes);
+  }
+
+  vector<Type> cond_dens(GVA_COND_DENS_VEC_ARGS) const {
+    return survTMB::cond_dens<survTMB::cond_dens_po>(
+      eta, etaD_fix, event, va_var, H, this->eps, this->kappa);
+  }
+
   Type operator()(GVA_COND_DENS_ARGS) const {
+    Type const H = mlogit_integral(va_mean, va_sd, eta_fix, this->n_nodes);
+    return operator()(eta_fix, etaD_fix, event, va_mean, va_sd, va_var, H);
+  }
+
+  Type operator()(GVA_COND_DENS_ARGS, Type const &H) const {
     Type const eta = eta_fix + va_mean,
-                 H = mlogit_integral(
-                   va_mean, va_sd, eta_fix, this->n_nodes),
                  h = etaD_fix * exp(eta - H),
             if_low = event * this->eps_log - H - h * h * this->kappa,
             if_ok  = event * log(h)  - H;
@@ -74,9 +121,23 @@ template<class Type>
 struct probit : public GVA_cond_dens_data<Type> {
   using GVA_cond_dens_data<Type>::GVA_cond_dens_data;
 
+  vector<Type> cum_haz(GVA_CUM_HAZ_ARGS) const {
+    vector<Type> const mu_use = -eta_fix - va_mean;
+    return probit_integral(mu_use, va_sd, this->n_nodes);
+  }
+
+  vector<Type> cond_dens(GVA_COND_DENS_VEC_ARGS) const {
+    return survTMB::cond_dens<survTMB::cond_dens_probit>(
+      eta, etaD_fix, event, va_var, H, this->eps, this->kappa);
+  }
+
   Type operator()(GVA_COND_DENS_ARGS) const {
-    Type const H = probit_integral(va_mean, va_sd, -eta_fix, this->n_nodes),
-            diff = eta_fix + va_mean,
+    Type const H = probit_integral(va_mean, va_sd, -eta_fix, this->n_nodes);
+    return operator()(eta_fix, etaD_fix, event, va_mean, va_sd, va_var, H);
+  }
+
+  Type operator()(GVA_COND_DENS_ARGS, Type const &H) const {
+    Type const diff = eta_fix + va_mean,
                h = etaD_fix * exp(
                  this->mlog_2_pi_half - diff * diff / this->two -
                    va_var / this->two + H),
@@ -88,6 +149,8 @@ struct probit : public GVA_cond_dens_data<Type> {
 };
 
 #undef GVA_COND_DENS_ARGS
+#undef GVA_CUM_HAZ_ARGS
+#undef GVA_COND_DENS_VEC_ARGS
 
 template<class Type, template <class> class Accumlator>
 void GVA_comp(COMMON_ARGS(Type, Accumlator), vector<Type> const &theta_VA,
@@ -103,15 +166,18 @@ void GVA_comp(COMMON_ARGS(Type, Accumlator), vector<Type> const &theta_VA,
    * instead of using solve... */
   Type log_det_vcov;
   matrix<Type> vcov_inv;
-  vcov_inv = atomic::matinvpd(vcov, log_det_vcov);
+  vcov_inv = inv_pd(vcov, log_det_vcov);
 
   /* get objects from VA distribution */
   unsigned const  dt = (rng_dim * (rng_dim + 1L)) / 2L,
             n_groups = theta_VA.size() / (rng_dim + dt);
-  std::vector<vecT >         va_means;
-  std::vector<matrix<Type> > va_vcovs;
-  va_means.reserve(n_groups);
-  va_vcovs.reserve(n_groups);
+  /* the containers use the taping arena while a tape is recorded */
+  arena_vector<vecT >         va_means;
+  arena_vector<matrix<Type> > va_vcovs;
+  arena_vector<Type>          va_logdets;
+  va_means  .reserve(n_groups);
+  va_vcovs  .reserve(n_groups);
+  va_logdets.reserve(n_groups);
   {
     Type const *t = &theta_VA[0];
     for(unsigned g = 0; g < n_groups; ++g){
@@ -121,69 +187,110 @@ void GVA_comp(COMMON_ARGS(Type, Accumlator), vector<Type> const &theta_VA,
         mean_vec[i] = *t++;
       va_means.emplace_back(move(mean_vec));
 
-      /* insert new covariance matrix */
-      va_vcovs.emplace_back(get_vcov_from_trian(t, rng_dim));
+      /* insert new covariance matrix and its log determinant which only
+       * requires the log standard deviations */
+      va_vcovs  .emplace_back(get_vcov_from_trian(t, rng_dim));
+      va_logdets.emplace_back(get_logdet_from_trian(t, rng_dim));
       t += dt;
     }
   }
 
-  /* assign constant and fixed effects objects */
-  vector<Type> const eta_fix  = X  * b,
-                     etaD_fix = XD * b;
+  /* assign the fixed effects objects for the rows of this region */
+  bool const is_in_parallel = CppAD::thread_alloc::in_parallel();
+  region_balancer const regions =
+    get_grp_regions(grp_size, *result.obj, is_in_parallel);
+  vector<Type> const eta_fix  = sparse_mat_vec(
+                       X , b, grp_size, regions, *result.obj, is_in_parallel),
+                     etaD_fix = sparse_mat_vec(
+                       XD, b, grp_size, regions, *result.obj, is_in_parallel);
 
   /* handle terms from conditional density of observed outcomes */
-  bool const is_in_parallel = CppAD::thread_alloc::in_parallel();
-#define MAIN_LOOP(func)                                        \
+#define MAIN_LOOP(func, DIM)                                   \
   {                                                            \
+    using small_vec = Eigen::Matrix<Type, DIM, 1>;             \
+    using small_mat = Eigen::Matrix<Type, DIM, DIM>;           \
+    /* declared once to reuse the memory with Dynamic */       \
+    small_vec va_mu, z;                                        \
+    small_mat va_var;                                          \
     unsigned i = 0;                                            \
     for(unsigned g = 0; g < grp_size.size(); ++g){             \
       unsigned const n_members = grp_size[g];                  \
       /* is this our cluster? */                               \
-      if(is_in_parallel and !is_my_region(*result.obj)){       \
-        i += n_members;                                        \
-        result.obj->parallel_region();                         \
-        continue;                                              \
+      if(is_in_parallel){                                      \
+        set_region(*result.obj, regions[g]);                   \
+        if(!is_my_region(*result.obj)){                        \
+          i += n_members;                                      \
+          continue;                                            \
+        }                                                      \
       }                                                        \
                                                                \
       /* get VA parameters */                                  \
-      vecT const &va_mu          = va_means[g];                \
-      matrix<Type> const &va_var = va_vcovs[g];                \
+      va_mu  = va_means[g].matrix();                           \
+      va_var = va_vcovs[g];                                    \
                                                                \
-      /* compute conditional density terms from outcomes */    \
-      unsigned const end = n_members + i;                      \
-      Type terms(0);                                           \
-      for(; i < end; ++i){                                     \
-        vecT const z = Z.row(i);                               \
-        Type const err_mean = vec_dot(z, va_mu),               \
-                   err_var  = quad_form_sym(z, va_var),        \
-                   err_sd   = sqrt(err_var);                   \
-                                                               \
-        terms += func(                                         \
-          eta_fix[i], etaD_fix[i], event[i], err_mean, err_sd, \
-          err_var);                                            \
+      /* compute the cumulative hazard terms in one call */    \
+      vecT err_mean(n_members), err_sd(n_members),             \
+           err_var(n_members), eta(n_members);                 \
+      for(unsigned j = 0; j < n_members; ++j){                 \
+        z = Z.row(i + j).transpose();                          \
+        err_mean[j] = vec_dot(z, va_mu);                       \
+        err_var [j] = quad_form_sym(z, va_var);                \
+        err_sd  [j] = sqrt(err_var[j]);                        \
+        eta     [j] = eta_fix[i + j];                          \
       }                                                        \
+      vecT const H =                                           \
+        func.cum_haz(eta, err_mean, err_sd, err_var);          \
                                                                \
-      result -= terms;                                         \
+      /* compute conditional density terms from outcomes in    \
+       * one call */                                           \
+      vecT const eta_all = eta + err_mean,                     \
+                 etaD    = etaD_fix.segment(i, n_members),     \
+                 ev      = event   .segment(i, n_members);     \
+      result -=                                                \
+        func.cond_dens(eta_all, etaD, ev, err_var, H).sum();   \
+      i += n_members;                                          \
     }                                                          \
   }
 
+  /* use vectors and matrices with a fixed size for small dimensions */
+#define DIM_LOOP(func)                                         \
+  switch(rng_dim){                                             \
+  case 1L:                                                     \
+    MAIN_LOOP(func, 1);                                        \
+    break;                                                     \
+  case 2L:                                                     \
+    MAIN_LOOP(func, 2);                                        \
+    break;                                                     \
+  case 3L:                                                     \
+    MAIN_LOOP(func, 3);                                        \
+    break;                                                     \
+  case 4L:                                                     \
+    MAIN_LOOP(func, 4);                                        \
+    break;                                                     \
+  default:                                                     \
+    MAIN_LOOP(func, Eigen::Dynamic);                           \
+  }
+
   if(link == "PH"){
     ph<Type> const func(eps, kappa, n_nodes);
-    MAIN_LOOP(func);
+    DIM_LOOP(func);
 
   } else if (link == "PO"){
     po<Type> const func(eps, kappa, n_nodes);
-    MAIN_LOOP(func);
+    DIM_LOOP(func);
 
   } else if (link == "probit"){
     probit<Type> const func(eps, kappa, n_nodes);
-    MAIN_LOOP(func);
+    DIM_LOOP(func);
 
   } else
     error("'%s' not implemented", link.c_str());
 
+#undef DIM_LOOP
 #undef MAIN_LOOP
 
+  if(is_in_parallel)
+    set_region(*result.obj, regions.rest());
   if(!is_my_region(*result.obj))
     /* only have to add one more term so just return */
     return;
@@ -195,8 +302,7 @@ void GVA_comp(COMMON_ARGS(Type, Accumlator), vector<Type> const &theta_VA,
     va_cov_sum.setZero();
 
     for(unsigned g = 0; g < n_groups; ++g){
-      lb_term +=
-        atomic::logdet(va_vcovs[g]) - quad_form_sym(va_means[g], vcov_inv);
+      lb_term += va_logdets[g] - quad_form_sym(va_means[g], vcov_inv);
       va_cov_sum += va_vcovs[g];
 
     }
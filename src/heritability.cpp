@@ -1,7 +1,15 @@
 #define INCLUDE_RCPP
 #include "tmb_includes.h"
 #include "get-x.h"
+#include "parallel-utils.h"
+#include "hess-utils.h"
+#include "tape-info.h"
+#include "taping-arena.h"
 #include "snva-utils.h"
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <memory>
 
 namespace {
 using namespace GaussHermite::SNVA;
@@ -24,6 +32,148 @@ vector<Tout> get_args(vector<T> const &omega, vector<T> const &beta,
   return out;
 }
 
+/* simultaneous diagonalization of the correlation matrices of a cluster.
+ * If is_diag is true then vecs^T C_i vecs = diag(vals[i]) for all the
+ * correlation matrices with vecs^T C_1 vecs = I. Thus, the inverse of
+ * sigma = sum_i a_i C_i is vecs diag(1 / d) vecs^T and its log determinant
+ * is log_det_base + sum_k log(d_k) where d = sum_i a_i vals[i] and
+ * log_det_base is the log determinant of C_1.
+ *
+ * This is always possible with one or two correlation matrices if C_1 is
+ * positive definite. */
+struct cor_mats_eig {
+  bool is_diag = false;
+  matrix<double> vecs;
+  std::vector<vector<double> > vals;
+  double log_det_base = 0.;
+};
+
+inline cor_mats_eig get_cor_mats_eig
+  (std::vector<matrix<double> > const &mats){
+  cor_mats_eig out;
+  std::size_t const n_mats = mats.size();
+  if(n_mats < 1L)
+    return out;
+
+  int const n = mats[0].rows();
+  if(n < 1L)
+    return out;
+  for(auto &m : mats)
+    if(m.rows() != n or m.cols() != n)
+      /* handled elsewhere */
+      return out;
+
+  Eigen::LLT<Eigen::MatrixXd> const llt(mats[0]);
+  if(llt.info() != Eigen::Success)
+    return out;
+  Eigen::GeneralizedSelfAdjointEigenSolver<Eigen::MatrixXd> const es(
+      n_mats > 1L ? mats[1] : mats[0], mats[0]);
+  if(es.info() != Eigen::Success)
+    return out;
+
+  out.vecs = es.eigenvectors();
+  out.vals.reserve(n_mats);
+  for(auto &m : mats){
+    matrix<double> const d = out.vecs.transpose() * m * out.vecs;
+    double const tol =
+      1e-8 * std::max(1., d.diagonal().cwiseAbs().maxCoeff());
+    for(int j = 0; j < n; ++j)
+      for(int i = 0; i < n; ++i)
+        if(i != j and std::abs(d(i, j)) > tol)
+          /* not simultaneously diagonalizable */
+          return cor_mats_eig();
+
+    out.vals.emplace_back(d.diagonal());
+  }
+
+  auto const L = llt.matrixL();
+  for(int i = 0; i < n; ++i)
+    out.log_det_base += 2 * log(L(i, i));
+  out.is_diag = true;
+  return out;
+}
+
+/* the correlation matrices of a cluster and their eigenbasis */
+template<class Type>
+struct cor_structure {
+  std::vector<matrix<double> > const cor_mats_dbl;
+  std::vector<matrix<Type> > const cor_mats = ([&](){
+    std::vector<matrix<Type> > out;
+    out.reserve(cor_mats_dbl.size());
+    for(auto &x : cor_mats_dbl)
+      out.emplace_back(x.template cast<Type>());
+    return out;
+  })();
+  /* used to avoid factorizing the covariance matrix of the cluster */
+  cor_mats_eig const cor_eig = get_cor_mats_eig(cor_mats_dbl);
+
+  cor_structure(std::vector<matrix<double> > mats):
+  cor_mats_dbl(std::move(mats)) { }
+};
+
+/* stores each distinct set of correlation matrices once. Clusters with
+ * identical correlation matrices, like all monozygotic twin pairs, share
+ * the matrices, the eigenbasis, and the terms computed from them in each
+ * evaluation of the lower bound */
+template<class Type>
+class cor_pool {
+  std::vector<cor_structure<Type> > structures;
+  std::unordered_multimap<std::size_t, std::size_t> hash_to_idx;
+
+  static std::size_t get_hash(std::vector<matrix<double> > const &mats){
+    std::size_t out = std::hash<std::size_t>()(mats.size());
+    auto combine = [&](std::size_t const h){
+      out ^= h + 0x9e3779b9 + (out << 6) + (out >> 2);
+    };
+    for(auto &m : mats){
+      combine(std::hash<int>()(m.rows()));
+      combine(std::hash<int>()(m.cols()));
+      for(int i = 0; i < m.size(); ++i)
+        combine(std::hash<double>()(m.data()[i]));
+    }
+    return out;
+  }
+
+  static bool is_equal(std::vector<matrix<double> > const &x,
+                       std::vector<matrix<double> > const &y){
+    if(x.size() != y.size())
+      return false;
+    for(std::size_t i = 0; i < x.size(); ++i)
+      if(x[i].rows() != y[i].rows() or x[i].cols() != y[i].cols() or
+           x[i] != y[i])
+        return false;
+    return true;
+  }
+
+public:
+  /* returns the index of the correlation matrices in the list and adds them
+   * if they are not already in the pool */
+  std::size_t get_idx(Rcpp::List list_w_cor_mats){
+    std::vector<matrix<double> > mats;
+    mats.reserve(list_w_cor_mats.size());
+    for(auto x : list_w_cor_mats)
+      mats.emplace_back(get_mat<double>(x));
+
+    std::size_t const h = get_hash(mats);
+    auto const range = hash_to_idx.equal_range(h);
+    for(auto it = range.first; it != range.second; ++it)
+      if(is_equal(structures[it->second].cor_mats_dbl, mats))
+        return it->second;
+
+    std::size_t const idx = structures.size();
+    structures.emplace_back(std::move(mats));
+    hash_to_idx.emplace(h, idx);
+    return idx;
+  }
+
+  cor_structure<Type> const & operator[](std::size_t const idx) const {
+    return structures[idx];
+  }
+  std::size_t size() const {
+    return structures.size();
+  }
+};
+
 /* object to hold the data for a given cluster */
 template<class Type>
 struct cluster_data {
@@ -35,20 +185,13 @@ struct cluster_data {
   const DATA_MATRIX(XD);
   const DATA_MATRIX(Z);
 
-  std::vector<matrix<Type> > const cor_mats = ([&](){
-    Rcpp::List list_w_cor_mats = data["cor_mats"];
-
-    std::vector<matrix<Type> > out;
-    out.reserve(list_w_cor_mats.size());
-    for(auto x : list_w_cor_mats)
-      out.emplace_back(get_mat<Type>(x));
-
-    return out;
-  })();
+  /* index of the correlation matrices in the cor_pool */
+  std::size_t const cor_idx;
 
   size_t const n_members = y.size();
 
-  cluster_data(Rcpp::List data): data(data) {
+  cluster_data(Rcpp::List data, cor_pool<Type> &pool):
+  data(data), cor_idx(pool.get_idx(data["cor_mats"])) {
     if((size_t)event.size() != n_members)
       throw std::invalid_argument("cluster_data<Type>: invalid event");
     else if((size_t)X.cols()  != n_members)
@@ -57,7 +200,7 @@ struct cluster_data {
       throw std::invalid_argument("cluster_data<Type>: invalid XD");
     else if((size_t)Z.cols() != n_members)
       throw std::invalid_argument("cluster_data<Type>: invalid Z");
-    for(auto &V : cor_mats)
+    for(auto &V : pool[cor_idx].cor_mats_dbl)
       if((size_t)V.rows() != n_members or (size_t)V.cols() != n_members)
         throw std::invalid_argument("cluster_data<Type>: invalid cor_mats");
 
@@ -69,13 +212,16 @@ template<class Type>
 class VA_worker {
   Rcpp::List data, parameters;
 
+  /* must be declared before c_data */
+  cor_pool<Type> cor_mats_pool;
+
   std::vector<cluster_data<Type> > const c_data = ([&](){
     Rcpp::List c_data_R = data["c_data"];
 
     std::vector<cluster_data<Type> > out;
     out.reserve(c_data_R.size());
     for(auto x : c_data_R)
-      out.emplace_back(Rcpp::List(x));
+      out.emplace_back(Rcpp::List(x), cor_mats_pool);
 
     return out;
   })();
@@ -132,7 +278,7 @@ public:
           throw std::invalid_argument("VA_worker<Type>: invalid c_data (X)");
         else if(x.Z.rows() != beta.size())
           throw std::invalid_argument("VA_worker<Type>: invalid c_data (Z)");
-        else if(x.cor_mats.size() != n_mats)
+        else if(cor_mats_pool[x.cor_idx].cor_mats.size() != n_mats)
           throw std::invalid_argument(
               "VA_worker<Type>: invalid c_data (cor_mats)");
         else if((size_t)x.XD.rows() != d_o)
@@ -152,7 +298,36 @@ public:
     return ::get_args<Tout, Type>(omega, beta, log_sds, va_par);
   }
 
+  /* returns the number of VA parameters of each cluster. They are after
+   * the n_pars - sum(sizes) model parameters in the order of the
+   * clusters */
+  std::vector<size_t> get_va_sizes() const {
+    std::vector<size_t> out;
+    out.reserve(n_clusters);
+    for(auto &c_dat : c_data){
+      size_t const n_ele = c_dat.n_members;
+      out.emplace_back(2L * n_ele + (n_ele * (n_ele + 1L)) / 2L);
+    }
+    return out;
+  }
+
   Type operator()(vector<Type> &args) const {
+    if(link == "PH")
+      return eval<ph>(args);
+    else if(link == "PO")
+      return eval<po>(args);
+    else if(link == "probit")
+      return eval<probit>(args);
+
+    error("'%s' not implemented", link.c_str());
+    return Type(0.);
+  }
+
+private:
+  /* evaluates the lower bound. CondDens is the class for the conditional
+   * density terms of the link function */
+  template<template <class> class CondDens>
+  Type eval(vector<Type> &args) const {
     /* assign constant */
     Type const sqrt_2_pi(sqrt(M_2_PI)),
                      one(1.),
@@ -182,8 +357,8 @@ public:
                          return out;
                          })();
 
-    /* handle VA pars */
-    std::vector<SNVA_MD_input<Type> > ava_par;
+    /* handle VA pars. The memory is from the arena while taping */
+    survTMB::arena_vector<SNVA_MD_input<Type> > ava_par;
     ava_par.reserve(c_data.size());
     for(auto &c_dat : c_data){
       size_t const n_ele = c_dat.n_members,
@@ -194,14 +369,34 @@ public:
     }
 
     survTMB::accumulator_mock<Type> result;
+    /* terms which only depend on the correlation matrices and the variance
+     * parameters. They are computed once for each distinct set of
+     * correlation matrices of the clusters handled by this thread */
+    struct cor_terms {
+      bool is_set = false;
+      Type log_det_sigma;
+      matrix<Type> sigma_inv;
+    };
+    std::vector<cor_terms> cor_cache(cor_mats_pool.size());
+
     bool const is_in_parallel = CppAD::thread_alloc::in_parallel();
-    ph    <Type>     ph_func(eps, kappa, n_nodes);
-    po    <Type>     po_func(eps, kappa, n_nodes);
-    probit<Type> probit_func(eps, kappa, n_nodes);
+    /* the cost of each cluster is dominated by the inversion of the
+     * n_members x n_members covariance matrix */
+    survTMB::region_balancer const regions = ([&](){
+      std::vector<double> costs(n_clusters);
+      for(size_t g = 0; g < n_clusters; ++g){
+        double const n_members = c_data[g].n_members;
+        costs[g] = n_members * n_members * n_members;
+      }
+      return survTMB::region_balancer(
+        costs, is_in_parallel ? get_n_regions(*result.obj) : 1L);
+    })();
+    CondDens<Type> const func(eps, kappa, n_nodes);
     for(size_t g = 0; g < n_clusters; ++g){
-      if(is_in_parallel and !is_my_region(*result.obj)){
-        result.obj->parallel_region();
-        continue;
+      if(is_in_parallel){
+        set_region(*result.obj, regions[g]);
+        if(!is_my_region(*result.obj))
+          continue;
       }
 
       /* compute objects needed for the variational distribution */
@@ -209,12 +404,10 @@ public:
       vector<Type> const &mu = ava_par[g].va_mus[0],
                         &rho = ava_par[g].va_rhos[0];
 
-      vector<Type> const delta = ([&](){
-        vector<Type> out = lambda * rho;
-        Type const denom = sqrt(one + vec_dot(out, rho));
-        out /= denom;
-        return out;
-      })();
+      /* rho^T lambda rho is also used in the entropy term */
+      vector<Type> delta = lambda * rho;
+      Type const rho_quad = vec_dot(delta, rho);
+      delta /= sqrt(one + rho_quad);
 
       /* add terms from each cluster member */
       Type term(0.);
@@ -235,20 +428,9 @@ public:
                   eta_fix = vec_dot(aomega, x) + vec_dot(abeta, z),
                  etaD_fix = vec_dot(aomega, xd);
 
-        if(link == "PH")
-          term += ph_func(
-            eta_fix, etaD_fix, c_dat.event[i], mu[i], sd, rho, d, sd_sq,
-            dist_mean, dist_var);
-        else if(link == "PO")
-          term += po_func(
-            eta_fix, etaD_fix, c_dat.event[i], mu[i], sd, rho, d, sd_sq,
-            dist_mean, dist_var);
-        else if(link == "probit")
-          term += probit_func(
-            eta_fix, etaD_fix, c_dat.event[i], mu[i], sd, rho, d, sd_sq,
-            dist_mean, dist_var);
-        else
-          error("'%s' not implemented", link.c_str());
+        term += func(
+          eta_fix, etaD_fix, c_dat.event[i], mu[i], sd, rho, d, sd_sq,
+          dist_mean, dist_var);
 
         // TODO: delete
         // Rcpp::Rcout << asDouble(term) << ": "
@@ -267,24 +449,58 @@ public:
       // TODO: delete
       // Rcpp::Rcout << "Term: " << asDouble(term) << '\t';
 
-      /* add prior and entropy terms */
-      matrix<Type> sigma(n_members, n_members);
-      sigma.setZero();
-      for(int i = 0; i < a_var.size(); ++i)
-        sigma += a_var[i] * c_dat.cor_mats[i];
+      /* add prior and entropy terms. We need mu^T sigma^(-1) mu,
+       * tr(lambda sigma^(-1)), mu^T sigma^(-1) delta, and the log
+       * determinant of sigma */
+      cor_structure<Type> const &cor = cor_mats_pool[c_dat.cor_idx];
+      cor_mats_eig const &eig = cor.cor_eig;
+      cor_terms &ct = cor_cache[c_dat.cor_idx];
+      if(!ct.is_set){
+        if(eig.is_diag){
+          /* use the precomputed eigenbasis. sigma^{-1} = V diag(1 / d) V^T
+           * is only formed once for the clusters which share the
+           * correlation matrices */
+          ct.log_det_sigma = Type(eig.log_det_base);
+          vector<Type> d_inv(n_members);
+          for(size_t k = 0; k < n_members; ++k){
+            Type d_k(0.);
+            for(int i = 0; i < a_var.size(); ++i)
+              d_k += a_var[i] * Type(eig.vals[i][k]);
+            ct.log_det_sigma += log(d_k);
+            d_inv[k] = one / d_k;
+          }
+
+          ct.sigma_inv.resize(n_members, n_members);
+          for(size_t j = 0; j < n_members; ++j)
+            for(size_t i = j; i < n_members; ++i){
+              Type val(0.);
+              for(size_t k = 0; k < n_members; ++k)
+                val += Type(eig.vecs(i, k) * eig.vecs(j, k)) * d_inv[k];
+              ct.sigma_inv(i, j) = val;
+              ct.sigma_inv(j, i) = val;
+            }
+
+        } else {
+          matrix<Type> sigma(n_members, n_members);
+          sigma.setZero();
+          for(int i = 0; i < a_var.size(); ++i)
+            sigma += a_var[i] * cor.cor_mats[i];
+          ct.sigma_inv = survTMB::inv_pd(sigma, ct.log_det_sigma);
+        }
+        ct.is_set = true;
+      }
 
-      Type log_det_sigma;
-      matrix<Type> const sigma_inv = atomic::matinvpd(sigma, log_det_sigma);
-      vector<Type> va_rho_scaled =
-        matrix<Type>(lambda.llt().matrixU()) * rho;
-      va_rho_scaled += small;
+      /* O(n_members^2) for each cluster */
+      Type const &log_det_sigma = ct.log_det_sigma;
+      Type const mu_quad       = quad_form_sym(mu, ct.sigma_inv),
+                 lambda_trace  = mat_mult_trace(lambda, ct.sigma_inv),
+                 mu_delta_quad = quad_form(mu, ct.sigma_inv, delta);
 
       term += (
-        atomic::logdet(lambda) - quad_form_sym(mu, sigma_inv)
-          - mat_mult_trace(lambda, sigma_inv) - log_det_sigma
+        ava_par[g].va_logdets[0] - mu_quad - lambda_trace - log_det_sigma
           + Type(n_members)) / two;
-      term -= sqrt_2_pi * quad_form(mu, sigma_inv, delta) + type_M_LN2
-        + entropy_term(vec_dot(va_rho_scaled, va_rho_scaled), n_nodes);
+      term -= sqrt_2_pi * mu_delta_quad + type_M_LN2
+        + entropy_term(rho_quad + small, n_nodes);
 
       // TODO: delete
       // Rcpp::Rcout << "w/ prior: " << asDouble(term) << '\n';
@@ -298,26 +514,161 @@ public:
 
 class VA_func {
   using ADd   = CppAD::AD<double>;
-  using ADdd  = CppAD::AD<ADd>;
-  using ADddd = CppAD::AD<ADdd>;
   template<class Type>
   using ADFun = CppAD::ADFun<Type>;
 
   size_t n_pars;
+  /* number of model parameters and the number of VA parameters of each
+   * cluster */
+  size_t n_global;
+  std::vector<size_t> va_sizes;
 
 public:
   size_t get_n_pars() const {
     return n_pars;
   }
 
-  std::vector<std::unique_ptr<ADFun<double> > >   funcs;
+  std::vector<std::unique_ptr<ADFun<double> > > funcs;
+
+  /* buffers used to sum the output from the blocks */
+  survTMB::block_reducer lb_red, grad_red, hess_vec_red, hess_red;
+
+  /* evaluates the lower bound. par points to get_n_pars() elements */
+  double eval_lb(double const *par){
+    /* CppAD needs its own vector but it is shared by the threads */
+    vector<double> parv(n_pars);
+    std::copy(par, par + n_pars, parv.data());
+
+    unsigned const n_blocks = funcs.size();
+    lb_red.resize(n_blocks, 1L);
+#ifdef _OPENMP
+#pragma omp parallel for if(n_blocks > 1L) schedule(static, 1)
+#endif
+    for(unsigned i = 0; i < n_blocks; ++i)
+      *lb_red.block(i) = funcs[i]->Forward(0, parv)[0];
+
+    double out(0);
+    lb_red.reduce(&out);
+    return out;
+  }
+
+  /* evaluates the gradient and writes it to out. Both par and out must
+   * have get_n_pars() elements */
+  void eval_grad(double const *par, double * const out){
+    vector<double> parv(n_pars);
+    std::copy(par, par + n_pars, parv.data());
+
+    unsigned const n_blocks = funcs.size();
+    grad_red.resize(n_blocks, n_pars);
+
+#ifdef _OPENMP
+#pragma omp parallel for if(n_blocks > 1L) schedule(static, 1)
+#endif
+    for(unsigned i = 0; i < n_blocks; ++i){
+      funcs[i]->Forward(0, parv);
+      vector<double> w(1);
+      w[0] = 1;
+
+      vector<double> const grad_i = funcs[i]->Reverse(1, w);
+      std::copy(grad_i.data(), grad_i.data() + n_pars, grad_red.block(i));
+    }
+
+    grad_red.reduce(out, n_blocks);
+  }
+
+  /* computes the non-zero entries in the lower triangle of the Hessian in
+   * column-major order. The VA parameters of different clusters do not
+   * interact. Thus, the Hessian is found with a Hessian-vector product on
+   * the tapes of the lower bound for each model parameter and for each
+   * index of the VA parameters which is shared by all the clusters. The
+   * cross terms between the model parameters and the VA parameters are taken
+   * from the former */
+  void eval_hess_sparse
+    (double const *par, std::vector<int> &row_idx, std::vector<int> &col_idx,
+     std::vector<double> &vals){
+    vector<double> parv(n_pars);
+    std::copy(par, par + n_pars, parv.data());
+
+    size_t const max_va = va_sizes.empty() ?
+      0L : *std::max_element(va_sizes.begin(), va_sizes.end()),
+                  n_dir = n_global + max_va;
+    unsigned const n_blocks = funcs.size();
+    hess_red.resize(n_blocks, n_dir * n_pars);
+
+#ifdef _OPENMP
+#pragma omp parallel for if(n_blocks > 1L) schedule(static, 1)
+#endif
+    for(unsigned i = 0; i < n_blocks; ++i){
+      funcs[i]->Forward(0, parv);
+      vector<double> dir(n_pars), w(1);
+      w[0] = 1;
+      double * const out = hess_red.block(i);
+      for(size_t d = 0; d < n_dir; ++d){
+        dir.setZero();
+        if(d < n_global)
+          dir[d] = 1;
+        else {
+          size_t const k = d - n_global;
+          size_t va_start = n_global;
+          for(auto const n_va : va_sizes){
+            if(k < n_va)
+              dir[va_start + k] = 1;
+            va_start += n_va;
+          }
+        }
+
+        survTMB::hess_vec_fwd_rev(
+          *funcs[i], dir, w, out + d * n_pars, n_pars);
+      }
+    }
+
+    std::vector<double> hess_cols(n_dir * n_pars);
+    hess_red.reduce(hess_cols.data(), n_blocks);
+
+    /* the model parameters */
+    size_t n_ele = (n_global * (n_global + 1L)) / 2L +
+      n_global * (n_pars - n_global);
+    for(auto const n_va : va_sizes)
+      n_ele += (n_va * (n_va + 1L)) / 2L;
+    row_idx.clear();
+    col_idx.clear();
+    vals.clear();
+    row_idx.reserve(n_ele);
+    col_idx.reserve(n_ele);
+    vals.reserve(n_ele);
+
+    for(size_t j = 0; j < n_global; ++j)
+      for(size_t i = j; i < n_pars; ++i){
+        row_idx.emplace_back(i);
+        col_idx.emplace_back(j);
+        vals.emplace_back(hess_cols[j * n_pars + i]);
+      }
+
+    /* the blocks of the VA parameters */
+    size_t va_start = n_global;
+    for(auto const n_va : va_sizes){
+      for(size_t k = 0; k < n_va; ++k){
+        double const *h = hess_cols.data() + (n_global + k) * n_pars;
+        for(size_t l = k; l < n_va; ++l){
+          row_idx.emplace_back(va_start + l);
+          col_idx.emplace_back(va_start + k);
+          vals.emplace_back(h[va_start + l]);
+        }
+      }
+      va_start += n_va;
+    }
+  }
 
-  VA_func(Rcpp::List data, Rcpp::List parameters){
+  VA_func(Rcpp::List data, Rcpp::List parameters) {
     {
       /* to compute function and gradient */
       VA_worker<ADd> w(data, parameters);
       funcs.resize(w.n_blocks);
       n_pars = w.n_pars;
+      va_sizes = w.get_va_sizes();
+      n_global = n_pars;
+      for(auto const n_va : va_sizes)
+        n_global -= n_va;
       vector<ADd> args = w.get_args<ADd>();
 
 #ifdef _OPENMP
@@ -326,11 +677,14 @@ public:
       for(unsigned i = 0; i < w.n_blocks; ++i){
         funcs[i].reset(new ADFun<double>());
 
-        CppAD::Independent(args);
-        vector<ADd> y(1);
-        y[0] = w(args);
+        {
+          survTMB::scoped_taping_arena arena;
+          CppAD::Independent(args);
+          vector<ADd> y(1);
+          y[0] = w(args);
 
-        funcs[i]->Dependent(args, y);
+          funcs[i]->Dependent(args, y);
+        }
         funcs[i]->optimize();
       }
     }
@@ -354,26 +708,11 @@ double herita_funcs_eval_lb(SEXP p, SEXP par){
   shut_up();
 
   Rcpp::XPtr<VA_func > ptr(p);
-  std::vector<std::unique_ptr<CppAD::ADFun<double> > > &funcs = ptr->funcs;
-  vector<double> parv = get_vec<double>(par);
+  Rcpp::NumericVector parv(par);
   if((size_t)parv.size() != ptr->get_n_pars())
     throw std::invalid_argument("herita_funcs_eval_lb: invalid par");
 
-  unsigned const n_blocks = ptr->funcs.size();
-  double out(0);
-#ifdef _OPENMP
-#pragma omp parallel for ordered if(n_blocks > 1L) firstprivate(parv)  schedule(static, 1)
-#endif
-  for(unsigned i = 0; i < n_blocks; ++i){
-    double const term = funcs[i]->Forward(0, parv)[0];
-#ifdef _OPENMP
-    /* TODO: replace with a reduction */
-#pragma omp ordered
-#endif
-    out += term;
-  }
-
-  return out;
+  return ptr->eval_lb(&parv[0]);
 }
 
 // [[Rcpp::export(rng = false)]]
@@ -381,35 +720,76 @@ Rcpp::NumericVector herita_funcs_eval_grad(SEXP p, SEXP par){
   shut_up();
 
   Rcpp::XPtr<VA_func > ptr(p);
-  std::vector<std::unique_ptr<CppAD::ADFun<double> > > &funcs = ptr->funcs;
-  vector<double> parv = get_vec<double>(par);
+  Rcpp::NumericVector parv(par);
   if((size_t)parv.size() != ptr->get_n_pars())
     throw std::invalid_argument("herita_funcs_eval_grad: invalid par");
 
-  unsigned const n_blocks = ptr->funcs.size();
-  vector<double> grad(parv.size());
-  grad.setZero();
+  Rcpp::NumericVector out(parv.size());
+  ptr->eval_grad(&parv[0], &out[0]);
+  return out;
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::NumericVector herita_funcs_eval_hess_vec(SEXP p, SEXP par, SEXP v){
+  shut_up();
+
+  Rcpp::XPtr<VA_func > ptr(p);
+  vector<double> parv = get_vec<double>(par),
+                   vv = get_vec<double>(v);
+  if((size_t)parv.size() != ptr->get_n_pars())
+    throw std::invalid_argument("herita_funcs_eval_hess_vec: invalid par");
+  if(vv.size() != parv.size())
+    throw std::invalid_argument("herita_funcs_eval_hess_vec: invalid v");
+
+  /* a first order forward sweep and a second order reverse sweep on the
+   * tapes of the lower bound yield the Hessian-vector product */
+  std::vector<std::unique_ptr<CppAD::ADFun<double> > > &funcs = ptr->funcs;
+  unsigned const n_blocks = funcs.size();
+  std::size_t const n = parv.size();
+  survTMB::block_reducer &red = ptr->hess_vec_red;
+  red.resize(n_blocks, n);
 
 #ifdef _OPENMP
-#pragma omp parallel for ordered if(n_blocks > 1L) firstprivate(parv) schedule(static, 1)
+#pragma omp parallel for if(n_blocks > 1L) schedule(static, 1)
 #endif
   for(unsigned i = 0; i < n_blocks; ++i){
-    funcs[i]->Forward(0, parv);
     vector<double> w(1);
     w[0] = 1;
-
-    vector<double> grad_i = funcs[i]->Reverse(1, w);
-#ifdef _OPENMP
-    /* TODO: replace with a reduction */
-#pragma omp ordered
-#endif
-    grad += grad_i;
+    funcs[i]->Forward(0, parv);
+    survTMB::hess_vec_fwd_rev(*funcs[i], vv, w, red.block(i), n);
   }
 
-  std::size_t const n = grad.size();
   Rcpp::NumericVector out(n);
-  for(unsigned i = 0; i < n; ++i)
-    out[i] = grad[i];
-
+  red.reduce(&out[0], n_blocks);
   return out;
 }
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::List herita_funcs_eval_hess_sparse(SEXP p, SEXP par){
+  shut_up();
+
+  Rcpp::XPtr<VA_func > ptr(p);
+  Rcpp::NumericVector parv(par);
+  if((size_t)parv.size() != ptr->get_n_pars())
+    throw std::invalid_argument("herita_funcs_eval_hess_sparse: invalid par");
+
+  std::vector<int> row_idx, col_idx;
+  std::vector<double> vals;
+  ptr->eval_hess_sparse(&parv[0], row_idx, col_idx, vals);
+
+  return Rcpp::List::create(
+    Rcpp::Named("row_idx") = Rcpp::wrap(row_idx),
+    Rcpp::Named("col_idx") = Rcpp::wrap(col_idx),
+    Rcpp::Named("val")     = Rcpp::wrap(vals));
+}
+
+/* returns the size of each tape, the memory used by the Taylor coefficients
+ * and sparsity patterns, and the memory held by each thread */
+// [[Rcpp::export(rng = false)]]
+Rcpp::List herita_funcs_tape_info(SEXP p){
+  Rcpp::XPtr<VA_func> ptr(p);
+
+  survTMB::tape_info out;
+  out.add("lb", ptr->funcs);
+  return out.to_R();
+}
@@ -0,0 +1,218 @@
+#ifndef HESS_UTILS_H
+#define HESS_UTILS_H
+
+#include "tmb_includes.h"
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <utility>
+
+namespace survTMB {
+
+/* class to compute the sparse Hessian of a sum of terms. There is a tape for
+ * the non-zero entries in the lower triangle of the Hessian of the terms of
+ * each block. The output is merged into one pattern in column-major order
+ * and the blocks are summed in a fixed order. */
+class sparse_hess_dat {
+  using ADd   = CppAD::AD<double>;
+  using ADdd  = CppAD::AD<ADd>;
+  using ADddd = CppAD::AD<ADdd>;
+
+public:
+  /* sparse Hessian of the terms of one block */
+  struct block_data {
+    vector<int> row_idx, col_idx;
+    /* index of each non-zero entry in the merged output */
+    std::vector<std::size_t> out_idx;
+    CppAD::ADFun<double> ddf;
+    vector<double> val;
+  };
+
+private:
+  std::vector<block_data> blocks;
+
+  /* merged indices of the non-zero entries in column-major order */
+  vector<int> row_idx, col_idx;
+
+public:
+  sparse_hess_dat(std::size_t const n_blocks): blocks(n_blocks) { }
+
+  std::size_t get_n_blocks() const {
+    return blocks.size();
+  }
+  block_data const & get_block(std::size_t const b) const {
+    return blocks[b];
+  }
+  vector<int> const & get_row_idx() const {
+    return row_idx;
+  }
+  vector<int> const & get_col_idx() const {
+    return col_idx;
+  }
+
+  /* records the tape for block b. f is called with the independent
+   * variables and returns the terms of the block. The Hessian entries of the
+   * first n_skip variables are not computed. May be called in parallel for
+   * different blocks */
+  template<class F>
+  void record_block(std::size_t const b, vector<ADddd> x, F f,
+                    std::size_t const n_skip = 0L){
+    unsigned const n_vars = x.size();
+
+    /* record f */
+    CppAD::Independent(x);
+    vector<ADddd> y(1);
+    y[0] = f(x);
+    CppAD::ADFun<ADdd> func;
+    func.Dependent(x, y);
+    func.optimize();
+
+    /* record f' */
+    vector<ADdd> xx(n_vars),
+                 wi(1);
+    for(unsigned i = 0; i < n_vars; ++i)
+      xx[i] = CppAD::Value(x[i]);
+    CppAD::Independent(xx);
+    func.Forward(0, xx);
+    wi[0] = 1.;
+    vector<ADdd> yy = func.Reverse(1, wi);
+
+    CppAD::ADFun<ADd> df;
+    df.Dependent(xx, yy);
+    df.optimize();
+
+    /* record f'' but in a sparse manner. Thus, we first need to
+     * find the number of non-zero entries and their positions */
+    vector<bool> keepcol(n_vars);
+    for(unsigned i = 0; i < n_vars; ++i)
+      keepcol[i] = i >= n_skip;
+    df.my_init(keepcol);
+
+    auto keep_col = [&](unsigned const col){
+      return keepcol[col];
+    };
+    auto keep_row = [&](unsigned const row, unsigned const col){
+      return keep_col(col) and row >= col;
+    };
+
+    unsigned colisize,
+             n_non_zero(0); // Count number of non-zeros (m)
+    for(unsigned i = 0; i < df.colpattern.size(); i++){
+      colisize = df.colpattern[i].size();
+      if(keep_col(i))
+        for(unsigned j = 0; j < colisize; j++)
+          n_non_zero += keep_row(df.colpattern[i][j], i);
+    }
+
+    // Allocate index vectors of non-zero pairs
+    vector<int> b_row_idx(n_non_zero);
+    vector<int> b_col_idx(n_non_zero);
+    // Prepare reverse sweep for Hessian columns
+    vector<ADd> u(n_vars);
+    vector<ADd> v(n_vars);
+    for(unsigned i = 0; i < n_vars; i++)
+      v[i] = 0.0;
+    vector<ADd> xxx(n_vars);
+    for(unsigned i = 0; i < n_vars; i++)
+      xxx[i]  = CppAD::Value(CppAD::Value(xx[i]));
+    vector<ADd> yyy(n_non_zero);
+
+    // Do sweeps and fill in non-zero index pairs
+    CppAD::Independent(xxx);
+    df.Forward(0, xxx);
+
+    unsigned idx(0);
+    for(unsigned i = 0; i < n_vars; i++){
+      if(keep_col(i)) {
+        df.myReverse(1, v, i /*range comp*/, u /*domain*/);
+        CppAD::vector<int> &icol = df.colpattern[i];
+
+        for(unsigned j = 0; j < icol.size(); j++){
+          if(keep_row(icol[j], i)){
+            b_row_idx[idx] = icol[j];
+            b_col_idx[idx] = i;
+            yyy      [idx] = u[icol[j]];
+            idx++;
+          }
+        }
+      }
+    }
+
+    /* store output */
+    block_data &bd = blocks[b];
+    bd.ddf.Dependent(xxx, yyy);
+    bd.ddf.optimize();
+    bd.row_idx = std::move(b_row_idx);
+    bd.col_idx = std::move(b_col_idx);
+  }
+
+  /* merges the non-zero entries of the blocks. Must be called after all
+   * blocks are recorded */
+  void merge(){
+    std::vector<std::pair<int, int> > entries;
+    for(auto const &bd : blocks)
+      for(int i = 0; i < bd.row_idx.size(); ++i)
+        entries.emplace_back(bd.col_idx[i], bd.row_idx[i]);
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()),
+                  entries.end());
+
+    std::size_t const n_non_zero = entries.size();
+    row_idx.resize(n_non_zero);
+    col_idx.resize(n_non_zero);
+    for(std::size_t i = 0; i < n_non_zero; ++i){
+      col_idx[i] = entries[i].first;
+      row_idx[i] = entries[i].second;
+    }
+
+    for(auto &bd : blocks){
+      std::size_t const n = bd.row_idx.size();
+      bd.out_idx.resize(n);
+      for(std::size_t i = 0; i < n; ++i)
+        bd.out_idx[i] = std::lower_bound(
+          entries.begin(), entries.end(),
+          std::make_pair(bd.col_idx[i], bd.row_idx[i])) - entries.begin();
+    }
+  }
+
+  /* returns the non-zero entries of the lower triangle of the Hessian in the
+   * order given by get_row_idx and get_col_idx */
+  vector<double> operator()(vector<double> const &par){
+    unsigned const n_blocks = blocks.size();
+#ifdef _OPENMP
+#pragma omp parallel for if(n_blocks > 1L) firstprivate(par)
+#endif
+    for(unsigned i = 0; i < n_blocks; ++i)
+      blocks[i].val = blocks[i].ddf.Forward(0, par);
+
+    /* sum the blocks in a fixed order */
+    vector<double> out(row_idx.size());
+    out.setZero();
+    for(auto const &bd : blocks)
+      for(std::size_t j = 0; j < bd.out_idx.size(); ++j)
+        out[bd.out_idx[j]] += bd.val[j];
+
+    return out;
+  }
+};
+
+/* sets out to the first n_out elements of the Hessian of the output of func
+ * times the direction v. Forward(0) must have been called at the point of
+ * interest and w must have one element which is one. A first order forward
+ * sweep followed by a second order reverse sweep is used so the tape of the
+ * function itself suffices and no nested AD types are needed */
+template<class Vec>
+void hess_vec_fwd_rev
+  (CppAD::ADFun<double> &func, Vec const &v, Vec const &w,
+   double * const out, std::size_t const n_out){
+  func.Forward(1, v);
+  /* dw[2 * j] is the gradient and dw[2 * j + 1] is the Hessian times v as
+   * in ADFun::Hessian */
+  Vec const dw = func.Reverse(2, w);
+  for(std::size_t j = 0; j < n_out; ++j)
+    out[j] = dw[2L * j + 1L];
+}
+
+} // namespace survTMB
+
+#endif
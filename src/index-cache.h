@@ -0,0 +1,111 @@
+#ifndef INDEX_CACHE_H
+#define INDEX_CACHE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+namespace survTMB {
+
+/* cache of objects indexed by n = 1, 2, ... without an upper bound. The
+ * objects are created on the first call with a given n and are never
+ * changed afterwards.
+ *
+ * Look ups do not lock. The objects are published with release semantics and
+ * read with acquire semantics. Two threads may create the same object at the
+ * same time in which case one of them is discarded. The pointers to the
+ * objects are stored in chunks with 1, 2, 4, ... elements so existing
+ * objects never move. */
+template<class T>
+class index_cache {
+  using slot = std::atomic<T*>;
+  static constexpr std::size_t n_chunks =
+    std::numeric_limits<std::size_t>::digits;
+
+  std::array<std::atomic<slot*>, n_chunks> chunks;
+
+  /* returns floor(log2(n)) */
+  static std::size_t chunk_idx(std::size_t n){
+    std::size_t out(0L);
+    for(; n > 1L; n >>= 1L)
+      ++out;
+    return out;
+  }
+
+  slot& get_slot(std::size_t const n){
+    std::size_t const ci = chunk_idx(n),
+                    size = std::size_t(1L) << ci;
+    slot *c = chunks[ci].load(std::memory_order_acquire);
+    if(!c){
+      std::unique_ptr<slot[]> new_c(new slot[size]);
+      for(std::size_t i = 0; i < size; ++i)
+        new_c[i].store(nullptr, std::memory_order_relaxed);
+
+      /* c is set to the chunk of another thread if it fails */
+      if(chunks[ci].compare_exchange_strong(
+          c, new_c.get(), std::memory_order_acq_rel,
+          std::memory_order_acquire))
+        c = new_c.release();
+    }
+
+    return c[n - size];
+  }
+
+public:
+  index_cache() {
+    for(auto &c : chunks)
+      c.store(nullptr, std::memory_order_relaxed);
+  }
+
+  index_cache(index_cache const&) = delete;
+  index_cache& operator=(index_cache const&) = delete;
+
+  ~index_cache(){
+    for(std::size_t ci = 0; ci < n_chunks; ++ci){
+      slot *c = chunks[ci].load(std::memory_order_acquire);
+      if(!c)
+        continue;
+
+      std::size_t const size = std::size_t(1L) << ci;
+      for(std::size_t i = 0; i < size; ++i)
+        delete c[i].load(std::memory_order_acquire);
+      delete[] c;
+    }
+  }
+
+  /* returns a pointer to the object for index n or a nullptr if it has not
+   * been created */
+  T* find(std::size_t const n){
+    if(n == 0L)
+      return nullptr;
+    return get_slot(n).load(std::memory_order_acquire);
+  }
+
+  /* returns the object for index n. create is called to get a pointer to a
+   * new object if there is no object */
+  template<class Create>
+  T& get(std::size_t const n, Create create){
+    if(n == 0L)
+      throw std::invalid_argument("index_cache::get: n is zero");
+
+    slot &s = get_slot(n);
+    T *out = s.load(std::memory_order_acquire);
+    if(out)
+      return *out;
+
+    std::unique_ptr<T> new_obj(create());
+    /* out is set to the object of another thread if it fails */
+    if(s.compare_exchange_strong(
+        out, new_obj.get(), std::memory_order_acq_rel,
+        std::memory_order_acquire))
+      return *new_obj.release();
+    return *out;
+  }
+};
+
+} // namespace survTMB
+
+#endif
@@ -49,6 +49,77 @@ RcppExport SEXP _survTMB_VA_funcs_eval_grad(SEXP pSEXP, SEXP parSEXP) {
   return rcpp_result_gen;
   END_RCPP
 }
+// VA_funcs_tape_size
+double VA_funcs_tape_size(SEXP p);
+RcppExport SEXP _survTMB_VA_funcs_tape_size(SEXP pSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  rcpp_result_gen = Rcpp::wrap(VA_funcs_tape_size(p));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// VA_funcs_tape_info
+Rcpp::List VA_funcs_tape_info(SEXP p);
+RcppExport SEXP _survTMB_VA_funcs_tape_info(SEXP pSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  rcpp_result_gen = Rcpp::wrap(VA_funcs_tape_info(p));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// VA_funcs_get_timers
+Rcpp::List VA_funcs_get_timers(SEXP p);
+RcppExport SEXP _survTMB_VA_funcs_get_timers(SEXP pSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  rcpp_result_gen = Rcpp::wrap(VA_funcs_get_timers(p));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// VA_funcs_reset_timers
+void VA_funcs_reset_timers(SEXP p);
+RcppExport SEXP _survTMB_VA_funcs_reset_timers(SEXP pSEXP) {
+  BEGIN_RCPP
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  VA_funcs_reset_timers(p);
+  return R_NilValue;
+  END_RCPP
+}
+// VA_funcs_eval_lb_batch
+Rcpp::NumericVector VA_funcs_eval_lb_batch(SEXP p, Rcpp::NumericMatrix par);
+RcppExport SEXP _survTMB_VA_funcs_eval_lb_batch(SEXP pSEXP, SEXP parSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< Rcpp::NumericMatrix >::type par(parSEXP);
+  rcpp_result_gen = Rcpp::wrap(VA_funcs_eval_lb_batch(p, par));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// VA_funcs_eval_grad_batch
+Rcpp::NumericMatrix VA_funcs_eval_grad_batch(SEXP p, Rcpp::NumericMatrix par);
+RcppExport SEXP _survTMB_VA_funcs_eval_grad_batch(SEXP pSEXP, SEXP parSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< Rcpp::NumericMatrix >::type par(parSEXP);
+  rcpp_result_gen = Rcpp::wrap(VA_funcs_eval_grad_batch(p, par));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// VA_funcs_set_data
+void VA_funcs_set_data(SEXP p, Rcpp::List data);
+RcppExport SEXP _survTMB_VA_funcs_set_data(SEXP pSEXP, SEXP dataSEXP) {
+  BEGIN_RCPP
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< Rcpp::List >::type data(dataSEXP);
+  VA_funcs_set_data(p, data);
+  return R_NilValue;
+  END_RCPP
+}
 // VA_funcs_eval_hess
 Rcpp::NumericMatrix VA_funcs_eval_hess(SEXP p, SEXP par);
 RcppExport SEXP _survTMB_VA_funcs_eval_hess(SEXP pSEXP, SEXP parSEXP) {
@@ -60,6 +131,18 @@ RcppExport SEXP _survTMB_VA_funcs_eval_hess(SEXP pSEXP, SEXP parSEXP) {
   return rcpp_result_gen;
   END_RCPP
 }
+// VA_funcs_eval_hess_vec
+Rcpp::NumericVector VA_funcs_eval_hess_vec(SEXP p, SEXP par, SEXP v);
+RcppExport SEXP _survTMB_VA_funcs_eval_hess_vec(SEXP pSEXP, SEXP parSEXP, SEXP vSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type par(parSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type v(vSEXP);
+  rcpp_result_gen = Rcpp::wrap(VA_funcs_eval_hess_vec(p, par, v));
+  return rcpp_result_gen;
+  END_RCPP
+}
 // VA_funcs_eval_hess_sparse
 Rcpp::List VA_funcs_eval_hess_sparse(SEXP p, SEXP par);
 RcppExport SEXP _survTMB_VA_funcs_eval_hess_sparse(SEXP pSEXP, SEXP parSEXP) {
@@ -71,6 +154,52 @@ RcppExport SEXP _survTMB_VA_funcs_eval_hess_sparse(SEXP pSEXP, SEXP parSEXP) {
   return rcpp_result_gen;
   END_RCPP
 }
+// VA_funcs_psqn
+Rcpp::List VA_funcs_psqn(SEXP p, SEXP par, double const rel_eps, unsigned const max_it, unsigned const max_cg, double const c1, double const gr_tol);
+RcppExport SEXP _survTMB_VA_funcs_psqn(SEXP pSEXP, SEXP parSEXP, SEXP rel_epsSEXP, SEXP max_itSEXP, SEXP max_cgSEXP, SEXP c1SEXP, SEXP gr_tolSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type par(parSEXP);
+  Rcpp::traits::input_parameter< double const >::type rel_eps(rel_epsSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type max_it(max_itSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type max_cg(max_cgSEXP);
+  Rcpp::traits::input_parameter< double const >::type c1(c1SEXP);
+  Rcpp::traits::input_parameter< double const >::type gr_tol(gr_tolSEXP);
+  rcpp_result_gen = Rcpp::wrap(VA_funcs_psqn(p, par, rel_eps, max_it, max_cg, c1, gr_tol));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// VA_funcs_psqn_batch
+Rcpp::List VA_funcs_psqn_batch(Rcpp::List ptrs, Rcpp::List pars, double const rel_eps, unsigned const max_it, unsigned const max_cg, double const c1, double const gr_tol, unsigned const n_threads);
+RcppExport SEXP _survTMB_VA_funcs_psqn_batch(SEXP ptrsSEXP, SEXP parsSEXP, SEXP rel_epsSEXP, SEXP max_itSEXP, SEXP max_cgSEXP, SEXP c1SEXP, SEXP gr_tolSEXP, SEXP n_threadsSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< Rcpp::List >::type ptrs(ptrsSEXP);
+  Rcpp::traits::input_parameter< Rcpp::List >::type pars(parsSEXP);
+  Rcpp::traits::input_parameter< double const >::type rel_eps(rel_epsSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type max_it(max_itSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type max_cg(max_cgSEXP);
+  Rcpp::traits::input_parameter< double const >::type c1(c1SEXP);
+  Rcpp::traits::input_parameter< double const >::type gr_tol(gr_tolSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_threads(n_threadsSEXP);
+  rcpp_result_gen = Rcpp::wrap(VA_funcs_psqn_batch(ptrs, pars, rel_eps, max_it, max_cg, c1, gr_tol, n_threads));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// bench_cpp_kernels
+Rcpp::DataFrame bench_cpp_kernels(unsigned const n, unsigned const n_nodes, unsigned const n_rep, unsigned const n_knots);
+RcppExport SEXP _survTMB_bench_cpp_kernels(SEXP nSEXP, SEXP n_nodesSEXP, SEXP n_repSEXP, SEXP n_knotsSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< unsigned const >::type n(nSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_nodes(n_nodesSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_rep(n_repSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_knots(n_knotsSEXP);
+  rcpp_result_gen = Rcpp::wrap(bench_cpp_kernels(n, n_nodes, n_rep, n_knots));
+  return rcpp_result_gen;
+  END_RCPP
+}
 // get_gl_rule
 Rcpp::List get_gl_rule(unsigned const n);
 RcppExport SEXP _survTMB_get_gl_rule(SEXP nSEXP) {
@@ -92,14 +221,25 @@ RcppExport SEXP _survTMB_get_commutation(SEXP nSEXP, SEXP mSEXP) {
   return rcpp_result_gen;
   END_RCPP
 }
+// get_commutation_perm
+Rcpp::IntegerVector get_commutation_perm(unsigned const n, unsigned const m);
+RcppExport SEXP _survTMB_get_commutation_perm(SEXP nSEXP, SEXP mSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< unsigned const >::type n(nSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type m(mSEXP);
+  rcpp_result_gen = Rcpp::wrap(get_commutation_perm(n, m));
+  return rcpp_result_gen;
+  END_RCPP
+}
 // get_gsm_pointer
-SEXP get_gsm_pointer(arma::mat const& X, arma::mat const& XD, arma::mat const& Z, arma::vec const& y, double const eps, double const kappa, std::string const& link, unsigned const n_threads, arma::vec const& offset_eta, arma::vec const& offset_etaD);
-RcppExport SEXP _survTMB_get_gsm_pointer(SEXP XSEXP, SEXP XDSEXP, SEXP ZSEXP, SEXP ySEXP, SEXP epsSEXP, SEXP kappaSEXP, SEXP linkSEXP, SEXP n_threadsSEXP, SEXP offset_etaSEXP, SEXP offset_etaDSEXP) {
+SEXP get_gsm_pointer(Rcpp::NumericMatrix X, Rcpp::NumericMatrix XD, Rcpp::NumericMatrix Z, arma::vec const& y, double const eps, double const kappa, std::string const& link, unsigned const n_threads, arma::vec const& offset_eta, arma::vec const& offset_etaD, std::string const& storage);
+RcppExport SEXP _survTMB_get_gsm_pointer(SEXP XSEXP, SEXP XDSEXP, SEXP ZSEXP, SEXP ySEXP, SEXP epsSEXP, SEXP kappaSEXP, SEXP linkSEXP, SEXP n_threadsSEXP, SEXP offset_etaSEXP, SEXP offset_etaDSEXP, SEXP storageSEXP) {
   BEGIN_RCPP
   Rcpp::RObject rcpp_result_gen;
-  Rcpp::traits::input_parameter< arma::mat const& >::type X(XSEXP);
-  Rcpp::traits::input_parameter< arma::mat const& >::type XD(XDSEXP);
-  Rcpp::traits::input_parameter< arma::mat const& >::type Z(ZSEXP);
+  Rcpp::traits::input_parameter< Rcpp::NumericMatrix >::type X(XSEXP);
+  Rcpp::traits::input_parameter< Rcpp::NumericMatrix >::type XD(XDSEXP);
+  Rcpp::traits::input_parameter< Rcpp::NumericMatrix >::type Z(ZSEXP);
   Rcpp::traits::input_parameter< arma::vec const& >::type y(ySEXP);
   Rcpp::traits::input_parameter< double const >::type eps(epsSEXP);
   Rcpp::traits::input_parameter< double const >::type kappa(kappaSEXP);
@@ -107,7 +247,25 @@ RcppExport SEXP _survTMB_get_gsm_pointer(SEXP XSEXP, SEXP XDSEXP, SEXP ZSEXP, SE
   Rcpp::traits::input_parameter< unsigned const >::type n_threads(n_threadsSEXP);
   Rcpp::traits::input_parameter< arma::vec const& >::type offset_eta(offset_etaSEXP);
   Rcpp::traits::input_parameter< arma::vec const& >::type offset_etaD(offset_etaDSEXP);
-  rcpp_result_gen = Rcpp::wrap(get_gsm_pointer(X, XD, Z, y, eps, kappa, link, n_threads, offset_eta, offset_etaD));
+  Rcpp::traits::input_parameter< std::string const& >::type storage(storageSEXP);
+  rcpp_result_gen = Rcpp::wrap(get_gsm_pointer(X, XD, Z, y, eps, kappa, link, n_threads, offset_eta, offset_etaD, storage));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// get_gsm_chunked_pointer
+SEXP get_gsm_chunked_pointer(Rcpp::Function get_chunk, unsigned const n_chunks, unsigned const n_b, unsigned const n_g, double const eps, double const kappa, std::string const& link, unsigned const n_threads);
+RcppExport SEXP _survTMB_get_gsm_chunked_pointer(SEXP get_chunkSEXP, SEXP n_chunksSEXP, SEXP n_bSEXP, SEXP n_gSEXP, SEXP epsSEXP, SEXP kappaSEXP, SEXP linkSEXP, SEXP n_threadsSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< Rcpp::Function >::type get_chunk(get_chunkSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_chunks(n_chunksSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_b(n_bSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_g(n_gSEXP);
+  Rcpp::traits::input_parameter< double const >::type eps(epsSEXP);
+  Rcpp::traits::input_parameter< double const >::type kappa(kappaSEXP);
+  Rcpp::traits::input_parameter< std::string const& >::type link(linkSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_threads(n_threadsSEXP);
+  rcpp_result_gen = Rcpp::wrap(get_gsm_chunked_pointer(get_chunk, n_chunks, n_b, n_g, eps, kappa, link, n_threads));
   return rcpp_result_gen;
   END_RCPP
 }
@@ -147,6 +305,71 @@ RcppExport SEXP _survTMB_gsm_eval_hess(SEXP ptrSEXP, SEXP betaSEXP, SEXP gammaSE
   return rcpp_result_gen;
   END_RCPP
 }
+// gsm_eval
+Rcpp::List gsm_eval(SEXP ptr, arma::vec const& beta, arma::vec const& gamma, unsigned const order);
+RcppExport SEXP _survTMB_gsm_eval(SEXP ptrSEXP, SEXP betaSEXP, SEXP gammaSEXP, SEXP orderSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type ptr(ptrSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type beta(betaSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type gamma(gammaSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type order(orderSEXP);
+  rcpp_result_gen = Rcpp::wrap(gsm_eval(ptr, beta, gamma, order));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// gsm_newton_fit
+Rcpp::List gsm_newton_fit(SEXP ptr, arma::vec const& beta, arma::vec const& gamma, unsigned const maxit, double const reltol, double const gr_tol, unsigned const max_halv);
+RcppExport SEXP _survTMB_gsm_newton_fit(SEXP ptrSEXP, SEXP betaSEXP, SEXP gammaSEXP, SEXP maxitSEXP, SEXP reltolSEXP, SEXP gr_tolSEXP, SEXP max_halvSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type ptr(ptrSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type beta(betaSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type gamma(gammaSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type maxit(maxitSEXP);
+  Rcpp::traits::input_parameter< double const >::type reltol(reltolSEXP);
+  Rcpp::traits::input_parameter< double const >::type gr_tol(gr_tolSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type max_halv(max_halvSEXP);
+  rcpp_result_gen = Rcpp::wrap(gsm_newton_fit(ptr, beta, gamma, maxit, reltol, gr_tol, max_halv));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// gsm_newton_fit_batch
+Rcpp::List gsm_newton_fit_batch(Rcpp::List ptrs, Rcpp::List betas, Rcpp::List gammas, unsigned const maxit, double const reltol, double const gr_tol, unsigned const max_halv, unsigned const n_threads);
+RcppExport SEXP _survTMB_gsm_newton_fit_batch(SEXP ptrsSEXP, SEXP betasSEXP, SEXP gammasSEXP, SEXP maxitSEXP, SEXP reltolSEXP, SEXP gr_tolSEXP, SEXP max_halvSEXP, SEXP n_threadsSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< Rcpp::List >::type ptrs(ptrsSEXP);
+  Rcpp::traits::input_parameter< Rcpp::List >::type betas(betasSEXP);
+  Rcpp::traits::input_parameter< Rcpp::List >::type gammas(gammasSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type maxit(maxitSEXP);
+  Rcpp::traits::input_parameter< double const >::type reltol(reltolSEXP);
+  Rcpp::traits::input_parameter< double const >::type gr_tol(gr_tolSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type max_halv(max_halvSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_threads(n_threadsSEXP);
+  rcpp_result_gen = Rcpp::wrap(gsm_newton_fit_batch(ptrs, betas, gammas, maxit, reltol, gr_tol, max_halv, n_threads));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// mgsm_predict
+Rcpp::List mgsm_predict(arma::mat const& X, arma::mat const& Z, arma::mat const& B, arma::mat const& BD, arma::vec const& gamma, arma::vec const& omega, arma::mat const& Sigma, std::string const& link, unsigned const n_nodes, unsigned const n_threads);
+RcppExport SEXP _survTMB_mgsm_predict(SEXP XSEXP, SEXP ZSEXP, SEXP BSEXP, SEXP BDSEXP, SEXP gammaSEXP, SEXP omegaSEXP, SEXP SigmaSEXP, SEXP linkSEXP, SEXP n_nodesSEXP, SEXP n_threadsSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< arma::mat const& >::type X(XSEXP);
+  Rcpp::traits::input_parameter< arma::mat const& >::type Z(ZSEXP);
+  Rcpp::traits::input_parameter< arma::mat const& >::type B(BSEXP);
+  Rcpp::traits::input_parameter< arma::mat const& >::type BD(BDSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type gamma(gammaSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type omega(omegaSEXP);
+  Rcpp::traits::input_parameter< arma::mat const& >::type Sigma(SigmaSEXP);
+  Rcpp::traits::input_parameter< std::string const& >::type link(linkSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_nodes(n_nodesSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_threads(n_threadsSEXP);
+  rcpp_result_gen = Rcpp::wrap(mgsm_predict(X, Z, B, BD, gamma, omega, Sigma, link, n_nodes, n_threads));
+  return rcpp_result_gen;
+  END_RCPP
+}
 // get_herita_funcs
 SEXP get_herita_funcs(Rcpp::List data, Rcpp::List parameters);
 RcppExport SEXP _survTMB_get_herita_funcs(SEXP dataSEXP, SEXP parametersSEXP) {
@@ -180,9 +403,42 @@ RcppExport SEXP _survTMB_herita_funcs_eval_grad(SEXP pSEXP, SEXP parSEXP) {
   return rcpp_result_gen;
   END_RCPP
 }
+// herita_funcs_eval_hess_vec
+Rcpp::NumericVector herita_funcs_eval_hess_vec(SEXP p, SEXP par, SEXP v);
+RcppExport SEXP _survTMB_herita_funcs_eval_hess_vec(SEXP pSEXP, SEXP parSEXP, SEXP vSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type par(parSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type v(vSEXP);
+  rcpp_result_gen = Rcpp::wrap(herita_funcs_eval_hess_vec(p, par, v));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// herita_funcs_eval_hess_sparse
+Rcpp::List herita_funcs_eval_hess_sparse(SEXP p, SEXP par);
+RcppExport SEXP _survTMB_herita_funcs_eval_hess_sparse(SEXP pSEXP, SEXP parSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type par(parSEXP);
+  rcpp_result_gen = Rcpp::wrap(herita_funcs_eval_hess_sparse(p, par));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// herita_funcs_tape_info
+Rcpp::List herita_funcs_tape_info(SEXP p);
+RcppExport SEXP _survTMB_herita_funcs_tape_info(SEXP pSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  rcpp_result_gen = Rcpp::wrap(herita_funcs_tape_info(p));
+  return rcpp_result_gen;
+  END_RCPP
+}
 // joint_start_ll
-arma::vec joint_start_ll(arma::vec const& Y, arma::vec const& tstart, arma::vec const& tstop, arma::vec const& omega, arma::vec const& delta, arma::mat const& Z, unsigned const n_nodes, arma::vec const& coefs, bool const grad, bool const use_log, std::string const basis_type);
-RcppExport SEXP _survTMB_joint_start_ll(SEXP YSEXP, SEXP tstartSEXP, SEXP tstopSEXP, SEXP omegaSEXP, SEXP deltaSEXP, SEXP ZSEXP, SEXP n_nodesSEXP, SEXP coefsSEXP, SEXP gradSEXP, SEXP use_logSEXP, SEXP basis_typeSEXP) {
+arma::vec joint_start_ll(arma::vec const& Y, arma::vec const& tstart, arma::vec const& tstop, arma::vec const& omega, arma::vec const& delta, arma::mat const& Z, arma::ivec const& n_nodes, arma::vec const& coefs, bool const grad, bool const use_log, std::string const basis_type, unsigned const n_threads);
+RcppExport SEXP _survTMB_joint_start_ll(SEXP YSEXP, SEXP tstartSEXP, SEXP tstopSEXP, SEXP omegaSEXP, SEXP deltaSEXP, SEXP ZSEXP, SEXP n_nodesSEXP, SEXP coefsSEXP, SEXP gradSEXP, SEXP use_logSEXP, SEXP basis_typeSEXP, SEXP n_threadsSEXP) {
   BEGIN_RCPP
   Rcpp::RObject rcpp_result_gen;
   Rcpp::traits::input_parameter< arma::vec const& >::type Y(YSEXP);
@@ -191,12 +447,60 @@ RcppExport SEXP _survTMB_joint_start_ll(SEXP YSEXP, SEXP tstartSEXP, SEXP tstopS
   Rcpp::traits::input_parameter< arma::vec const& >::type omega(omegaSEXP);
   Rcpp::traits::input_parameter< arma::vec const& >::type delta(deltaSEXP);
   Rcpp::traits::input_parameter< arma::mat const& >::type Z(ZSEXP);
-  Rcpp::traits::input_parameter< unsigned const >::type n_nodes(n_nodesSEXP);
+  Rcpp::traits::input_parameter< arma::ivec const& >::type n_nodes(n_nodesSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type coefs(coefsSEXP);
+  Rcpp::traits::input_parameter< bool const >::type grad(gradSEXP);
+  Rcpp::traits::input_parameter< bool const >::type use_log(use_logSEXP);
+  Rcpp::traits::input_parameter< std::string const >::type basis_type(basis_typeSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_threads(n_threadsSEXP);
+  rcpp_result_gen = Rcpp::wrap(joint_start_ll(Y, tstart, tstop, omega, delta, Z, n_nodes, coefs, grad, use_log, basis_type, n_threads));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// get_joint_start_dat
+SEXP get_joint_start_dat(arma::vec const& Y, arma::vec const& tstart, arma::vec const& tstop, arma::mat const& Z, arma::ivec const& n_nodes, arma::vec const& coefs, bool const use_log, std::string const basis_type, unsigned const n_threads);
+RcppExport SEXP _survTMB_get_joint_start_dat(SEXP YSEXP, SEXP tstartSEXP, SEXP tstopSEXP, SEXP ZSEXP, SEXP n_nodesSEXP, SEXP coefsSEXP, SEXP use_logSEXP, SEXP basis_typeSEXP, SEXP n_threadsSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< arma::vec const& >::type Y(YSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type tstart(tstartSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type tstop(tstopSEXP);
+  Rcpp::traits::input_parameter< arma::mat const& >::type Z(ZSEXP);
+  Rcpp::traits::input_parameter< arma::ivec const& >::type n_nodes(n_nodesSEXP);
   Rcpp::traits::input_parameter< arma::vec const& >::type coefs(coefsSEXP);
+  Rcpp::traits::input_parameter< bool const >::type use_log(use_logSEXP);
+  Rcpp::traits::input_parameter< std::string const >::type basis_type(basis_typeSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_threads(n_threadsSEXP);
+  rcpp_result_gen = Rcpp::wrap(get_joint_start_dat(Y, tstart, tstop, Z, n_nodes, coefs, use_log, basis_type, n_threads));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// joint_start_ll_eval
+arma::vec joint_start_ll_eval(SEXP ptr, arma::vec const& omega, arma::vec const& delta, bool const grad);
+RcppExport SEXP _survTMB_joint_start_ll_eval(SEXP ptrSEXP, SEXP omegaSEXP, SEXP deltaSEXP, SEXP gradSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type ptr(ptrSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type omega(omegaSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type delta(deltaSEXP);
   Rcpp::traits::input_parameter< bool const >::type grad(gradSEXP);
+  rcpp_result_gen = Rcpp::wrap(joint_start_ll_eval(ptr, omega, delta, grad));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// joint_start_n_nodes
+arma::ivec joint_start_n_nodes(arma::vec const& tstart, arma::vec const& tstop, unsigned const n_nodes, arma::vec const& coefs, double const rel_tol, bool const use_log, std::string const basis_type);
+RcppExport SEXP _survTMB_joint_start_n_nodes(SEXP tstartSEXP, SEXP tstopSEXP, SEXP n_nodesSEXP, SEXP coefsSEXP, SEXP rel_tolSEXP, SEXP use_logSEXP, SEXP basis_typeSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< arma::vec const& >::type tstart(tstartSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type tstop(tstopSEXP);
+  Rcpp::traits::input_parameter< unsigned const >::type n_nodes(n_nodesSEXP);
+  Rcpp::traits::input_parameter< arma::vec const& >::type coefs(coefsSEXP);
+  Rcpp::traits::input_parameter< double const >::type rel_tol(rel_tolSEXP);
   Rcpp::traits::input_parameter< bool const >::type use_log(use_logSEXP);
   Rcpp::traits::input_parameter< std::string const >::type basis_type(basis_typeSEXP);
-  rcpp_result_gen = Rcpp::wrap(joint_start_ll(Y, tstart, tstop, omega, delta, Z, n_nodes, coefs, grad, use_log, basis_type));
+  rcpp_result_gen = Rcpp::wrap(joint_start_n_nodes(tstart, tstop, n_nodes, coefs, rel_tol, use_log, basis_type));
   return rcpp_result_gen;
   END_RCPP
 }
@@ -233,6 +537,116 @@ RcppExport SEXP _survTMB_joint_funcs_eval_grad(SEXP pSEXP, SEXP parSEXP) {
   return rcpp_result_gen;
   END_RCPP
 }
+// joint_funcs_eval_lb_incremental
+double joint_funcs_eval_lb_incremental(SEXP p, SEXP par);
+RcppExport SEXP _survTMB_joint_funcs_eval_lb_incremental(SEXP pSEXP, SEXP parSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type par(parSEXP);
+  rcpp_result_gen = Rcpp::wrap(joint_funcs_eval_lb_incremental(p, par));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// joint_funcs_eval_grad_subset
+Rcpp::NumericVector joint_funcs_eval_grad_subset(SEXP p, SEXP par, Rcpp::IntegerVector indices);
+RcppExport SEXP _survTMB_joint_funcs_eval_grad_subset(SEXP pSEXP, SEXP parSEXP, SEXP indicesSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type par(parSEXP);
+  Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type indices(indicesSEXP);
+  rcpp_result_gen = Rcpp::wrap(joint_funcs_eval_grad_subset(p, par, indices));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// joint_funcs_eval_hess_vec
+Rcpp::NumericVector joint_funcs_eval_hess_vec(SEXP p, SEXP par, SEXP v);
+RcppExport SEXP _survTMB_joint_funcs_eval_hess_vec(SEXP pSEXP, SEXP parSEXP, SEXP vSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type par(parSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type v(vSEXP);
+  rcpp_result_gen = Rcpp::wrap(joint_funcs_eval_hess_vec(p, par, v));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// joint_funcs_eval_hess
+Rcpp::NumericMatrix joint_funcs_eval_hess(SEXP p, SEXP par);
+RcppExport SEXP _survTMB_joint_funcs_eval_hess(SEXP pSEXP, SEXP parSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type par(parSEXP);
+  rcpp_result_gen = Rcpp::wrap(joint_funcs_eval_hess(p, par));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// joint_funcs_eval_hess_sparse
+Rcpp::List joint_funcs_eval_hess_sparse(SEXP p, SEXP par);
+RcppExport SEXP _survTMB_joint_funcs_eval_hess_sparse(SEXP pSEXP, SEXP parSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type par(parSEXP);
+  rcpp_result_gen = Rcpp::wrap(joint_funcs_eval_hess_sparse(p, par));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// joint_funcs_tape_info
+Rcpp::List joint_funcs_tape_info(SEXP p);
+RcppExport SEXP _survTMB_joint_funcs_tape_info(SEXP pSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  rcpp_result_gen = Rcpp::wrap(joint_funcs_tape_info(p));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// get_laplace_native
+SEXP get_laplace_native(Rcpp::List data, Rcpp::List parameters);
+RcppExport SEXP _survTMB_get_laplace_native(SEXP dataSEXP, SEXP parametersSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< Rcpp::List >::type data(dataSEXP);
+  Rcpp::traits::input_parameter< Rcpp::List >::type parameters(parametersSEXP);
+  rcpp_result_gen = Rcpp::wrap(get_laplace_native(data, parameters));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// laplace_native_eval_fn
+double laplace_native_eval_fn(SEXP p, SEXP par);
+RcppExport SEXP _survTMB_laplace_native_eval_fn(SEXP pSEXP, SEXP parSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type par(parSEXP);
+  rcpp_result_gen = Rcpp::wrap(laplace_native_eval_fn(p, par));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// laplace_native_eval_grad
+Rcpp::NumericVector laplace_native_eval_grad(SEXP p, SEXP par);
+RcppExport SEXP _survTMB_laplace_native_eval_grad(SEXP pSEXP, SEXP parSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  Rcpp::traits::input_parameter< SEXP >::type par(parSEXP);
+  rcpp_result_gen = Rcpp::wrap(laplace_native_eval_grad(p, par));
+  return rcpp_result_gen;
+  END_RCPP
+}
+// laplace_native_get_modes
+Rcpp::NumericMatrix laplace_native_get_modes(SEXP p);
+RcppExport SEXP _survTMB_laplace_native_get_modes(SEXP pSEXP) {
+  BEGIN_RCPP
+  Rcpp::RObject rcpp_result_gen;
+  Rcpp::traits::input_parameter< SEXP >::type p(pSEXP);
+  rcpp_result_gen = Rcpp::wrap(laplace_native_get_modes(p));
+  return rcpp_result_gen;
+  END_RCPP
+}
 // get_orth_poly
 List get_orth_poly(arma::vec const& x, unsigned const degree);
 RcppExport SEXP _survTMB_get_orth_poly(SEXP xSEXP, SEXP degreeSEXP) {
@@ -258,14 +672,6 @@ RcppExport SEXP _survTMB_predict_orth_poly(SEXP xSEXP, SEXP alphaSEXP, SEXP norm
   return rcpp_result_gen;
   END_RCPP
 }
-// fix_atomic_seqfault
-void fix_atomic_seqfault();
-RcppExport SEXP _survTMB_fix_atomic_seqfault() {
-  BEGIN_RCPP
-  fix_atomic_seqfault();
-  return R_NilValue;
-  END_RCPP
-}
 // setup_atomic_cache
 void setup_atomic_cache(size_t const n_nodes, std::string const type, std::string const link);
 RcppExport SEXP _survTMB_setup_atomic_cache(SEXP n_nodesSEXP, SEXP typeSEXP, SEXP linkSEXP) {
@@ -288,24 +694,56 @@ static const R_CallMethodDef CallEntries[] = {
   {"_survTMB_get_VA_funcs", (DL_FUNC) &_survTMB_get_VA_funcs, 2},
   {"_survTMB_VA_funcs_eval_lb", (DL_FUNC) &_survTMB_VA_funcs_eval_lb, 2},
   {"_survTMB_VA_funcs_eval_grad", (DL_FUNC) &_survTMB_VA_funcs_eval_grad, 2},
+  {"_survTMB_VA_funcs_tape_size", (DL_FUNC) &_survTMB_VA_funcs_tape_size, 1},
+  {"_survTMB_VA_funcs_tape_info", (DL_FUNC) &_survTMB_VA_funcs_tape_info, 1},
+  {"_survTMB_VA_funcs_get_timers", (DL_FUNC) &_survTMB_VA_funcs_get_timers, 1},
+  {"_survTMB_VA_funcs_reset_timers", (DL_FUNC) &_survTMB_VA_funcs_reset_timers, 1},
+  {"_survTMB_VA_funcs_eval_lb_batch", (DL_FUNC) &_survTMB_VA_funcs_eval_lb_batch, 2},
+  {"_survTMB_VA_funcs_eval_grad_batch", (DL_FUNC) &_survTMB_VA_funcs_eval_grad_batch, 2},
+  {"_survTMB_VA_funcs_set_data", (DL_FUNC) &_survTMB_VA_funcs_set_data, 2},
   {"_survTMB_VA_funcs_eval_hess", (DL_FUNC) &_survTMB_VA_funcs_eval_hess, 2},
+  {"_survTMB_VA_funcs_eval_hess_vec", (DL_FUNC) &_survTMB_VA_funcs_eval_hess_vec, 3},
   {"_survTMB_VA_funcs_eval_hess_sparse", (DL_FUNC) &_survTMB_VA_funcs_eval_hess_sparse, 2},
+  {"_survTMB_VA_funcs_psqn", (DL_FUNC) &_survTMB_VA_funcs_psqn, 7},
+  {"_survTMB_VA_funcs_psqn_batch", (DL_FUNC) &_survTMB_VA_funcs_psqn_batch, 8},
+  {"_survTMB_bench_cpp_kernels", (DL_FUNC) &_survTMB_bench_cpp_kernels, 4},
   {"_survTMB_get_gl_rule", (DL_FUNC) &_survTMB_get_gl_rule, 1},
-  {"_survTMB_joint_start_ll", (DL_FUNC) &_survTMB_joint_start_ll, 11},
+  {"_survTMB_joint_start_ll", (DL_FUNC) &_survTMB_joint_start_ll, 12},
+  {"_survTMB_get_joint_start_dat", (DL_FUNC) &_survTMB_get_joint_start_dat, 9},
+  {"_survTMB_joint_start_ll_eval", (DL_FUNC) &_survTMB_joint_start_ll_eval, 4},
+  {"_survTMB_joint_start_n_nodes", (DL_FUNC) &_survTMB_joint_start_n_nodes, 7},
   {"_survTMB_get_joint_funcs", (DL_FUNC) &_survTMB_get_joint_funcs, 2},
   {"_survTMB_joint_funcs_eval_lb", (DL_FUNC) &_survTMB_joint_funcs_eval_lb, 2},
   {"_survTMB_joint_funcs_eval_grad", (DL_FUNC) &_survTMB_joint_funcs_eval_grad, 2},
+  {"_survTMB_joint_funcs_eval_lb_incremental", (DL_FUNC) &_survTMB_joint_funcs_eval_lb_incremental, 2},
+  {"_survTMB_joint_funcs_eval_grad_subset", (DL_FUNC) &_survTMB_joint_funcs_eval_grad_subset, 3},
+  {"_survTMB_joint_funcs_eval_hess_vec", (DL_FUNC) &_survTMB_joint_funcs_eval_hess_vec, 3},
+  {"_survTMB_joint_funcs_eval_hess", (DL_FUNC) &_survTMB_joint_funcs_eval_hess, 2},
+  {"_survTMB_joint_funcs_eval_hess_sparse", (DL_FUNC) &_survTMB_joint_funcs_eval_hess_sparse, 2},
+  {"_survTMB_joint_funcs_tape_info", (DL_FUNC) &_survTMB_joint_funcs_tape_info, 1},
+  {"_survTMB_get_laplace_native", (DL_FUNC) &_survTMB_get_laplace_native, 2},
+  {"_survTMB_laplace_native_eval_fn", (DL_FUNC) &_survTMB_laplace_native_eval_fn, 2},
+  {"_survTMB_laplace_native_eval_grad", (DL_FUNC) &_survTMB_laplace_native_eval_grad, 2},
+  {"_survTMB_laplace_native_get_modes", (DL_FUNC) &_survTMB_laplace_native_get_modes, 1},
   {"_survTMB_get_commutation", (DL_FUNC) &_survTMB_get_commutation, 2},
-  {"_survTMB_get_gsm_pointer", (DL_FUNC) &_survTMB_get_gsm_pointer, 10},
+  {"_survTMB_get_commutation_perm", (DL_FUNC) &_survTMB_get_commutation_perm, 2},
+  {"_survTMB_get_gsm_pointer", (DL_FUNC) &_survTMB_get_gsm_pointer, 11},
+  {"_survTMB_get_gsm_chunked_pointer", (DL_FUNC) &_survTMB_get_gsm_chunked_pointer, 8},
   {"_survTMB_gsm_eval_ll", (DL_FUNC) &_survTMB_gsm_eval_ll, 3},
   {"_survTMB_gsm_eval_grad", (DL_FUNC) &_survTMB_gsm_eval_grad, 3},
   {"_survTMB_gsm_eval_hess", (DL_FUNC) &_survTMB_gsm_eval_hess, 3},
+  {"_survTMB_gsm_eval", (DL_FUNC) &_survTMB_gsm_eval, 4},
+  {"_survTMB_gsm_newton_fit", (DL_FUNC) &_survTMB_gsm_newton_fit, 7},
+  {"_survTMB_gsm_newton_fit_batch", (DL_FUNC) &_survTMB_gsm_newton_fit_batch, 8},
+  {"_survTMB_mgsm_predict", (DL_FUNC) &_survTMB_mgsm_predict, 10},
   {"_survTMB_get_herita_funcs", (DL_FUNC) &_survTMB_get_herita_funcs, 2},
   {"_survTMB_herita_funcs_eval_lb", (DL_FUNC) &_survTMB_herita_funcs_eval_lb, 2},
   {"_survTMB_herita_funcs_eval_grad", (DL_FUNC) &_survTMB_herita_funcs_eval_grad, 2},
+  {"_survTMB_herita_funcs_eval_hess_vec", (DL_FUNC) &_survTMB_herita_funcs_eval_hess_vec, 3},
+  {"_survTMB_herita_funcs_eval_hess_sparse", (DL_FUNC) &_survTMB_herita_funcs_eval_hess_sparse, 2},
+  {"_survTMB_herita_funcs_tape_info", (DL_FUNC) &_survTMB_herita_funcs_tape_info, 1},
   {"_survTMB_get_orth_poly", (DL_FUNC) &_survTMB_get_orth_poly, 2},
   {"_survTMB_predict_orth_poly", (DL_FUNC) &_survTMB_predict_orth_poly, 3},
-  {"_survTMB_fix_atomic_seqfault", (DL_FUNC) &_survTMB_fix_atomic_seqfault, 0},
   {"_survTMB_setup_atomic_cache", (DL_FUNC) &_survTMB_setup_atomic_cache, 3},
   {"run_testthat_tests", (DL_FUNC) &run_testthat_tests, 0},
   {NULL, NULL, 0}
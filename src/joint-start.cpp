@@ -2,91 +2,212 @@
 #include "tmb_includes.h"
 #include "fastgl.h"
 #include "bases-wrapper.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
 
-template<class Basis>
-arma::vec joint_start_ll_inner
-  (arma::vec const &Y, arma::vec const &tstart, arma::vec const &tstop,
-   arma::vec const &omega, arma::vec const &delta, arma::mat const &Z,
-   unsigned const n_nodes, arma::vec const &coefs, bool const grad,
-   bool const use_log){
-  auto const basis = get_basis<Basis>(coefs);
-  bool const has_b = static_cast<bool>(basis.get());
-  size_t const dim_basis = has_b ? basis->get_n_basis() : 0L;
-  size_t const n_out = grad ? dim_basis  + delta.size() : 1L;
-  arma::vec out(n_out, arma::fill::zeros);
-  auto const &xw = fastgl::GLPairsCached<double>(n_nodes);
-  arma::vec wrk(dim_basis), term_v(n_out);
-
-  bool const has_delta = delta.n_elem > 0;
-  size_t const o_idx_start = 0L,
-                 o_idx_end = omega.n_elem - 1L,
-               g_idx_start = o_idx_end + 1L,
-                 g_idx_end = o_idx_end + delta.n_elem,
-                         n = Y.n_elem;
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
+namespace {
+/* data for joint_start_ll which do not depend on the parameters. The basis
+ * is evaluated at all the quadrature nodes once such that each evaluation
+ * of the log-likelihood only requires matrix-vector products and the
+ * exponential function. */
+class joint_start_dat {
+  /* the basis at each quadrature node */
+  arma::mat B_nodes;
+  /* the quadrature weights times the half length of the interval */
+  arma::vec w_nodes;
+  /* index of the first node of each observation and the number of nodes as
+   * the last element */
+  arma::uvec node_start;
+  arma::mat const Z;
+  /* the sum of the basis at the event times and the sum of the columns of
+   * Z of the observations with an event */
+  arma::vec event_omega, event_delta;
+  unsigned const n_threads;
+
+  static constexpr std::size_t block_size = 256L;
+
+public:
+  std::size_t const n_obs, n_basis, n_delta;
+
+  template<class Basis>
+  joint_start_dat
+    (Basis const *basis, arma::vec const &Y, arma::vec const &tstart,
+     arma::vec const &tstop, arma::mat const &Z,
+     arma::ivec const &n_nodes, bool const use_log,
+     unsigned const n_threads):
+    Z(Z), n_threads(std::max(n_threads, 1U)), n_obs(Y.n_elem),
+    n_basis(basis ? basis->get_n_basis() : 0L), n_delta(Z.n_rows) {
 #ifdef DO_CHECKS
-  if(tstart.n_elem != n)
-    throw std::invalid_argument("joint_start_ll: invalid tstart");
-  else if(tstop.n_elem != n)
-    throw std::invalid_argument("joint_start_ll: invalid tstop");
-  else if(Z.n_rows != delta.n_elem)
-    throw std::invalid_argument("joint_start_ll: invalid Z");
-  else if(omega.n_elem < 1L or omega.n_elem != basis->get_n_basis())
-    throw std::invalid_argument("joint_start_ll: invalid omega");
-  else if(n_nodes == 0L)
-    throw std::invalid_argument("joint_start_ll: invalid n_nodes");
+    if(tstart.n_elem != n_obs)
+      throw std::invalid_argument("joint_start_ll: invalid tstart");
+    else if(tstop.n_elem != n_obs)
+      throw std::invalid_argument("joint_start_ll: invalid tstop");
+    else if(n_delta > 0 and Z.n_cols != n_obs)
+      throw std::invalid_argument("joint_start_ll: invalid Z");
+    else if((n_nodes.n_elem != 1L and n_nodes.n_elem != n_obs) or
+              arma::any(n_nodes < 1L))
+      throw std::invalid_argument("joint_start_ll: invalid n_nodes");
 #endif
 
-  auto eval_basis = [&](double x){
-    if(use_log)
-      x = log(x);
-    if(has_b)
-      basis->operator()(wrk, x);
-  };
+    node_start.set_size(n_obs + 1L);
+    node_start[0] = 0L;
+    for(std::size_t i = 0; i < n_obs; ++i)
+      node_start[i + 1L] = node_start[i] +
+        (n_nodes.n_elem > 1L ? n_nodes[i] : n_nodes[0]);
 
-  for(size_t i = 0; i < n; ++i){
-    double term_s(0.);
-    if(grad)
-      term_v.zeros();
-    double const d1 = (tstop[i] - tstart[i]) / 2.,
-                 d2 = (tstop[i] + tstart[i]) / 2.,
-       fixed_effect = has_delta ? arma::dot(Z.col(i), delta) : 0.;
-    for(auto const &xwi : xw){
-      double const node = d1 * xwi.x + d2;
-      eval_basis(node);
-      double const g = xwi.weight * exp(arma::dot(wrk, omega));
-      if(grad){
-        term_v.subvec(o_idx_start, o_idx_end) -= g * wrk;
-        if(has_delta)
-          term_v.subvec(g_idx_start, g_idx_end) -= g * Z.col(i);
-      } else
-        term_s -= g;
+    /* find the nodes and the weights */
+    arma::vec nodes(node_start[n_obs]);
+    w_nodes.set_size(node_start[n_obs]);
+    for(std::size_t i = 0; i < n_obs; ++i){
+      double const d1 = (tstop[i] - tstart[i]) / 2.,
+                   d2 = (tstop[i] + tstart[i]) / 2.;
+      auto const &xw = fastgl::GLPairsCached<double>(
+        node_start[i + 1L] - node_start[i]);
+      std::size_t k = node_start[i];
+      for(auto const &xwi : xw){
+        double const node = d1 * xwi.x + d2;
+        nodes  [k  ] = use_log ? log(node) : node;
+        w_nodes[k++] = d1 * xwi.weight;
+      }
+    }
+
+    if(basis)
+      eval_basis_batch(*basis, B_nodes, nodes);
+
+    /* the terms from the events */
+    event_omega.zeros(n_basis);
+    event_delta.zeros(n_delta);
+    arma::vec wrk(n_basis);
+    for(std::size_t i = 0; i < n_obs; ++i)
+      if(Y[i] > 0){
+        if(basis){
+          basis->operator()(wrk, use_log ? log(tstop[i]) : tstop[i]);
+          event_omega += wrk;
+        }
+        if(n_delta > 0)
+          event_delta += Z.col(i);
+      }
+  }
+
+  /* returns the log-likelihood or the gradient */
+  arma::vec operator()(arma::vec const &omega, arma::vec const &delta,
+                       bool const grad) const {
+#ifdef DO_CHECKS
+    if(delta.n_elem != n_delta)
+      throw std::invalid_argument("joint_start_ll: invalid Z");
+    else if(omega.n_elem != n_basis)
+      throw std::invalid_argument("joint_start_ll: invalid omega");
+#endif
+
+    /* the terms from the events */
+    double ll = arma::dot(event_omega, omega) + arma::dot(event_delta, delta);
+    arma::vec d_omega, d_delta;
+    if(grad){
+      d_omega = event_omega;
+      d_delta = event_delta;
+    }
+
+    /* the terms from the cumulative hazard. The log hazard at the nodes of
+     * a block of observations is computed with one matrix-vector product */
+    std::size_t const n_blks = (n_obs + block_size - 1L) / block_size;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads) if(n_threads > 1L)
+    {
+#endif
+    double ll_loc(0.);
+    arma::vec d_omega_loc, d_delta_loc, g;
+    if(grad){
+      d_omega_loc.zeros(n_basis);
+      d_delta_loc.zeros(n_delta);
     }
 
-    if(grad)
-      term_v *= d1 * exp(fixed_effect);
-    else
-      term_s *= d1 * exp(fixed_effect);
-
-    if(Y[i] > 0){
-      eval_basis(tstop[i]);
-      if(grad){
-        term_v.subvec(o_idx_start, o_idx_end) += wrk;
-        if(has_delta)
-          term_v.subvec(g_idx_start, g_idx_end) += Z.col(i);
-      } else
-        term_s += fixed_effect + arma::dot(wrk, omega);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(std::size_t b = 0; b < n_blks; ++b){
+      std::size_t const i_start = b * block_size,
+                          i_end = std::min(i_start + block_size, n_obs),
+                        n_start = node_start[i_start],
+                          n_end = node_start[i_end];
+
+      if(n_basis > 0)
+        g = B_nodes.cols(n_start, n_end - 1L).t() * omega;
+      else
+        g.zeros(n_end - n_start);
+
+      for(std::size_t i = i_start; i < i_end; ++i){
+        double const fixed_effect =
+          n_delta > 0 ? exp(arma::dot(Z.col(i), delta)) : 1.;
+
+        double cum_haz(0.);
+        for(std::size_t k = node_start[i]; k < node_start[i + 1L]; ++k){
+          double &g_k = g[k - n_start];
+          g_k = w_nodes[k] * exp(g_k) * fixed_effect;
+          cum_haz += g_k;
+        }
+
+        ll_loc -= cum_haz;
+        if(grad and n_delta > 0)
+          d_delta_loc -= cum_haz * Z.col(i);
+      }
+
+      if(grad and n_basis > 0)
+        d_omega_loc -= B_nodes.cols(n_start, n_end - 1L) * g;
     }
 
-    if(grad)
-      out += term_v;
-    else
-      out += term_s;
+#ifdef _OPENMP
+#pragma omp critical
+    {
+#endif
+    ll += ll_loc;
+    if(grad){
+      d_omega += d_omega_loc;
+      d_delta += d_delta_loc;
+    }
+#ifdef _OPENMP
+    }
+    }
+#endif
+
+    if(!grad)
+      return arma::vec(1L).fill(ll);
+    return arma::join_cols(d_omega, d_delta);
   }
+};
 
-  return out;
+template<class Basis>
+joint_start_dat * get_joint_start_dat_inner
+  (arma::vec const &Y, arma::vec const &tstart, arma::vec const &tstop,
+   arma::mat const &Z, arma::ivec const &n_nodes, arma::vec const &coefs,
+   bool const use_log, unsigned const n_threads){
+  auto const basis = get_basis<Basis>(coefs);
+  return new joint_start_dat(basis.get(), Y, tstart, tstop, Z, n_nodes,
+                             use_log, n_threads);
 }
 
+joint_start_dat * get_joint_start_dat_ptr
+  (arma::vec const &Y, arma::vec const &tstart, arma::vec const &tstop,
+   arma::mat const &Z, arma::ivec const &n_nodes, arma::vec const &coefs,
+   bool const use_log, std::string const &basis_type,
+   unsigned const n_threads){
+  if     (basis_type == "ns")
+    return get_joint_start_dat_inner<splines::ns>
+      (Y, tstart, tstop, Z, n_nodes, coefs, use_log, n_threads);
+  else if(basis_type == "poly")
+    return get_joint_start_dat_inner<poly::orth_poly>
+      (Y, tstart, tstop, Z, n_nodes, coefs, use_log, n_threads);
+
+  throw std::invalid_argument(
+      "joint_start_ll: 'basis_type' not implemented");
+  return nullptr;
+}
+} // namespace
+
 /**
   Args:
     Y: zero/one vector with event indicators.
@@ -96,29 +217,137 @@ arma::vec joint_start_ll_inner
     omega: coefficients for the fixed effects.
     Z: design matrix.
     offsets: offsets.
-    n_nodes: integer with number of Gauss-Legendre quadrature nodes.
+    n_nodes: integer with number of Gauss-Legendre quadrature nodes or a
+             vector with the number of nodes for each observation.
     coefs: input for the basis.
     grad: logical for whether to compute the gradient og the log-likelihood.
     use_log: logical for whether to use log(time) in the basis.
     basis_type: string with the basis type.
+    n_threads: number of threads to use.
  */
 
 // [[Rcpp::export(rng = false)]]
 arma::vec joint_start_ll
   (arma::vec const &Y, arma::vec const &tstart, arma::vec const &tstop,
    arma::vec const &omega, arma::vec const &delta, arma::mat const &Z,
-   unsigned const n_nodes, arma::vec const &coefs,
-   bool const grad, bool const use_log, std::string const basis_type){
+   arma::ivec const &n_nodes, arma::vec const &coefs,
+   bool const grad, bool const use_log, std::string const basis_type,
+   unsigned const n_threads = 1L){
+  std::unique_ptr<joint_start_dat> dat(get_joint_start_dat_ptr(
+    Y, tstart, tstop, Z, n_nodes, coefs, use_log, basis_type, n_threads));
+  return (*dat)(omega, delta, grad);
+}
+
+/**
+  Returns a pointer to an object to evaluate joint_start_ll many times with
+  the same data. The basis is only evaluated at the quadrature nodes once.
+  See joint_start_ll for the arguments.
+ */
+
+// [[Rcpp::export(rng = false)]]
+SEXP get_joint_start_dat
+  (arma::vec const &Y, arma::vec const &tstart, arma::vec const &tstop,
+   arma::mat const &Z, arma::ivec const &n_nodes, arma::vec const &coefs,
+   bool const use_log, std::string const basis_type,
+   unsigned const n_threads = 1L){
+  return Rcpp::XPtr<joint_start_dat>(get_joint_start_dat_ptr(
+    Y, tstart, tstop, Z, n_nodes, coefs, use_log, basis_type, n_threads));
+}
+
+// [[Rcpp::export(rng = false)]]
+arma::vec joint_start_ll_eval
+  (SEXP ptr, arma::vec const &omega, arma::vec const &delta,
+   bool const grad){
+  Rcpp::XPtr<joint_start_dat> dat(ptr);
+  return (*dat)(omega, delta, grad);
+}
+
+template<class Basis>
+arma::ivec joint_start_n_nodes_inner
+  (arma::vec const &tstart, arma::vec const &tstop,
+   unsigned const n_nodes, arma::vec const &coefs, double const rel_tol,
+   bool const use_log){
+  auto const basis = get_basis<Basis>(coefs);
+  size_t const n = tstart.n_elem;
+  constexpr unsigned const n_nodes_min = 4L;
+  unsigned const n_start = std::min(n_nodes_min, n_nodes);
+  arma::ivec out(n);
+  if(!basis){
+    /* the integrand is constant */
+    out.fill(n_start);
+    return out;
+  } else if(rel_tol <= 0){
+    out.fill(n_nodes);
+    return out;
+  }
+
+#ifdef DO_CHECKS
+  if(tstop.n_elem != n)
+    throw std::invalid_argument("joint_start_n_nodes: invalid tstop");
+#endif
+
+  arma::vec wrk(basis->get_n_basis());
+  auto integrate = [&](double const lb, double const ub, unsigned const k){
+    double const d1 = (ub - lb) / 2.,
+                 d2 = (ub + lb) / 2.;
+    arma::vec out(wrk.n_elem, arma::fill::zeros);
+    for(auto const &xwi : fastgl::GLPairsCached<double>(k)){
+      double const node = d1 * xwi.x + d2;
+      basis->operator()(wrk, use_log ? log(node) : node);
+      out += xwi.weight * wrk;
+    }
+
+    return out;
+  };
+
+  for(size_t i = 0; i < n; ++i){
+    unsigned k = n_start;
+    arma::vec val = integrate(tstart[i], tstop[i], k);
+    while(k < n_nodes){
+      k = std::min(2U * k, n_nodes);
+      arma::vec const new_val = integrate(tstart[i], tstop[i], k);
+      bool const done =
+        arma::abs(new_val - val).max() <= rel_tol * arma::abs(new_val).max();
+      val = new_val;
+      if(done)
+        break;
+    }
+    out[i] = k;
+  }
+
+  return out;
+}
+
+/**
+  Selects the number of Gauss-Legendre quadrature nodes for each observation
+  in joint_start_ll. The number of nodes is doubled until the integrals of
+  the basis functions change by less than rel_tol relative to the largest
+  integral or n_nodes is reached. The selection does not depend on the
+  parameters so it only has to be done once.
+
+  Args:
+    tstart: left truncation time.
+    tstop: right-censoring time or event time.
+    n_nodes: integer with the maximum number of nodes.
+    coefs: input for the basis.
+    rel_tol: relative tolerance.
+    use_log: logical for whether to use log(time) in the basis.
+    basis_type: string with the basis type.
+ */
+
+// [[Rcpp::export(rng = false)]]
+arma::ivec joint_start_n_nodes
+  (arma::vec const &tstart, arma::vec const &tstop, unsigned const n_nodes,
+   arma::vec const &coefs, double const rel_tol, bool const use_log,
+   std::string const basis_type){
   if     (basis_type == "ns")
-    return(joint_start_ll_inner<splines::ns>
-             (Y, tstart, tstop, omega, delta, Z, n_nodes, coefs, grad,
-              use_log));
+    return(joint_start_n_nodes_inner<splines::ns>
+             (tstart, tstop, n_nodes, coefs, rel_tol, use_log));
   else if(basis_type == "poly")
-    return(joint_start_ll_inner<poly::orth_poly>
-             (Y, tstart, tstop, omega, delta, Z, n_nodes, coefs, grad,
-              use_log));
+    return(joint_start_n_nodes_inner<poly::orth_poly>
+             (tstart, tstop, n_nodes, coefs, rel_tol, use_log));
 
   throw std::invalid_argument(
-      "joint_start_ll: 'basis_type' not implemented");
-  return arma::vec();
+      "joint_start_n_nodes: 'basis_type' not implemented");
+  return arma::ivec();
 }
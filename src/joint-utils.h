@@ -5,12 +5,38 @@
 #include "tmb_includes.h"
 
 #include "fastgl.h"
+#include "bases-wrapper.h"
 #include "pnorm-log.h"
 #include "memory.h"
+#include "taylor-utils.h"
+#include "phase-timers.h"
+#include "atomic-registry.h"
+#include <memory>
+#include <algorithm>
+#include <cmath>
 
 namespace fastgl {
 namespace joint {
 
+/* the bases evaluated at the quadrature nodes of the rule of a subject and
+ * the bounds they are evaluated for. Each column is a node. The rule is not
+ * set if xw is a nullptr */
+struct node_bases {
+  double lb = 0., ub = 0.;
+  arma::mat b, g, m;
+  std::vector<QuadPair<double> > const *xw = nullptr;
+
+  size_t n_nodes() const {
+    return xw ? xw->size() : 0L;
+  }
+};
+
+/* the node bases of each subject. The bounds are fixed data in the joint
+ * model so the bases of a subject are only evaluated once. The object is
+ * shared by the integral objects of all the tapes and the bases are never
+ * removed */
+using subject_node_bases = std::vector<node_bases>;
+
 /*
   This function performs an approximation of
 
@@ -41,11 +67,13 @@ namespace joint {
  */
 template<class Type, class B, class G, class M>
 class snva_integral : public CppAD::atomic_base<Type> {
+  /* the maximum number of nodes and the relative tolerance used to select
+   * the rule for each pair of bounds. A fixed n_nodes point rule is used if
+   * rel_tol is not positive */
   size_t const n_nodes;
-  std::vector<QuadPair<double> > const& xw =
-    GLPairsCached<double>(n_nodes);
-  std::vector<QuadPair<Type> > const& xw_type =
-    GLPairsCached<Type>(n_nodes);
+  double const rel_tol;
+  /* the smallest rule used with an adaptive rule */
+  static constexpr size_t n_nodes_min = 4L;
 
   std::unique_ptr<B> const b;
   std::unique_ptr<G> const g;
@@ -64,11 +92,7 @@ class snva_integral : public CppAD::atomic_base<Type> {
   bool const use_log;
 
   /* objects needed for function evaluation */
-  mutable arma::vec fbi = arma::vec(dim_omega),
-                    fgi = arma::vec(dim_g),
-                    fmi = arma::vec(dim_m);
   mutable vector<double> fma = vector<double>(dim_U),
-                         fga = vector<double>(dim_B),
                       fomega = vector<double>(dim_omega),
                       falpha = vector<double>(dim_alpha),
                           fB = vector<double>(dim_B),
@@ -90,97 +114,456 @@ class snva_integral : public CppAD::atomic_base<Type> {
                         rk = vector<Type>(dim_U);
   mutable matrix<Type> rLambda = matrix<Type>(dim_U, dim_U);
 
-public:
-  snva_integral(char const *name, size_t const n_nodes,
-                B const *b_in, G const *g_in, M const *m_in,
-                size_t const dim_alpha, bool const use_log):
-  CppAD::atomic_base<Type>(name), n_nodes(n_nodes),
-  b(b_in ? new B(*b_in) : nullptr),
-  g(g_in ? new G(*g_in) : nullptr),
-  m(m_in ? new M(*m_in) : nullptr),
-  dim_alpha(dim_alpha),
-  use_log(use_log) {
-    this->option(CppAD::atomic_base<Type>::bool_sparsity_enum);
+  /* objects needed for higher order derivatives */
+  mutable vector<Type> dalpha = vector<Type>(dim_alpha),
+                           dB = vector<Type>(dim_B),
+                           dU = vector<Type>(dim_U),
+                           dk = vector<Type>(dim_U),
+                          dma = vector<Type>(dim_U),
+                          dga = vector<Type>(dim_B),
+                    lambda_ma = vector<Type>(dim_U),
+                   lambda_dma = vector<Type>(dim_U),
+                   dlambda_ma = vector<Type>(dim_U),
+                       grad_v = vector<Type>(n_ele()),
+                       hess_v = vector<Type>(n_ele());
+  mutable matrix<Type> dLambda = matrix<Type>(dim_U, dim_U);
+  mutable std::vector<Type> wk_mem = std::vector<Type>(4L * n_ele());
+
+  /* the bases of each subject. The index of the subject is the third
+   * input */
+  std::shared_ptr<subject_node_bases> const subject_bases;
+
+  /* evaluates the bases at the nodes of the n point rule */
+  node_bases eval_node_bases
+    (double const lb, double const ub, size_t const n) const {
+    node_bases out;
+    out.lb = lb;
+    out.ub = ub;
+    out.xw = &GLPairsCached<double>(n);
+    double const d1 = (ub - lb) / 2.,
+                 d2 = (ub + lb) / 2.;
+    std::vector<QuadPair<double> > const &xw = *out.xw;
+    arma::vec nodes(n);
+    for(size_t i = 0; i < n; ++i)
+      nodes[i] = d1 * xw[i].x + d2;
+
+    if(has_m)
+      eval_basis_batch(*m, out.m, nodes);
+    if(has_g)
+      eval_basis_batch(*g, out.g, nodes);
+    if(has_b){
+      if(use_log)
+        nodes = arma::log(nodes);
+      eval_basis_batch(*b, out.b, nodes);
+    }
+
+    return out;
   }
 
-  virtual bool forward(std::size_t p, std::size_t q,
-                       const CppAD::vector<bool> &vx,
-                       CppAD::vector<bool> &vy,
-                       const CppAD::vector<Type> &tx,
-                       CppAD::vector<Type> &ty){
-    if(q > 0)
-      return false;
+  /* returns the index of the subject in the input */
+  static size_t get_subject(CppAD::vector<Type> const &tx, size_t const nq){
+    return static_cast<size_t>(asDouble(tx[2L * nq]));
+  }
 
-    /* get parameters and integral bounds */
+  /* sets the bounds and the double objects with the parameters. The zero
+   * order Taylor coefficient of input j is tx[nq * j] */
+  void set_double_pars(CppAD::vector<Type> const &tx, size_t const nq,
+                       double &lb, double &ub) const {
+    size_t i(0L);
+    lb = asDouble(tx[nq * i++]),
+    ub = asDouble(tx[nq * i++]);
+    ++i; // the subject
+
+    auto set_vec = [&](vector<double> &x){
+      for(int j = 0; j < x.size(); ++j)
+        x[j] = asDouble(tx[nq * i++]);
+    };
+
+    if(has_b)
+      set_vec(fomega);
+    set_vec(falpha);
+    if(has_g)
+      set_vec(fB);
+    if(has_m){
+      set_vec(fU);
+      set_vec(fk);
+
+      for(size_t j = 0; j < dim_U; ++j)
+        for(size_t k = 0; k < dim_U; ++k)
+          fLambda(k, j) = asDouble(tx[nq * i++]);
+    }
+  }
+
+  /* approximates the integral with the parameters set by set_double_pars.
+   * The terms which are linear in the bases are computed for all nodes with
+   * matrix-vector products with the cached bases */
+  double eval_integral
+    (node_bases const &nb, double const lb, double const ub) const {
+    size_t const n = nb.n_nodes();
+    std::vector<QuadPair<double> > const &xw = *nb.xw;
+    double const d1 = (ub - lb) / 2.;
+    arma::vec const alpha_a(falpha.data(), dim_alpha, false, true);
+    /* use working memory which is private to this thread */
+    double * const wk = survTMB::thread_scratch<snva_integral>(3L * n);
+    arma::vec lin_term(wk        , n, false, true),
+                  ma_k(wk +     n, n, false, true),
+              pnrm_log(wk + 2L * n, n, false, true);
+    lin_term.zeros();
+    ma_k.zeros();
+    if(has_b)
+      lin_term += nb.b.t() *
+        arma::vec(fomega.data(), dim_omega, false, true);
+    if(has_g)
+      lin_term += nb.g.t() *
+        (arma::mat(fB.data(), dim_g, dim_alpha, false, true) * alpha_a);
+    if(has_m){
+      lin_term += nb.m.t() *
+        (arma::mat(fU.data(), dim_m, dim_alpha, false, true) * alpha_a);
+      ma_k = nb.m.t() *
+        (arma::mat(fk.data(), dim_m, dim_alpha, false, true) * alpha_a);
+    }
+
+    pnorm_log(ma_k.memptr(), pnrm_log.memptr(), n);
+
+    double out(0.);
+    for(size_t q_i = 0; q_i < n; ++q_i){
+      double v = pnrm_log[q_i] + lin_term[q_i];
+      if(has_m){
+        double const *mi = nb.m.colptr(q_i);
+        size_t i(0L);
+        for(size_t j = 0; j < dim_alpha; ++j)
+          for(size_t k = 0; k < dim_m; ++k)
+            fma[i++] = falpha[j] * mi[k];
+
+        v += .5 * quad_form_sym(fma, fLambda);
+      }
+
+      out += xw[q_i].weight * exp(v);
+    }
+
+    return has_m ? out * d1 * 2 : out * d1 * 4;
+  }
+
+  /* returns the bases of the subject in tx. The bases are evaluated and the
+   * rule is selected with the parameters in tx the first time the subject
+   * is used. With an adaptive rule, the number of nodes is doubled from
+   * n_nodes_min until the relative change of the integral is less than
+   * rel_tol or n_nodes is reached. The rule is never selected again. Thus,
+   * the approximation does not depend on the parameters in later calls and
+   * the derivatives are those of a fixed rule. The bases of a subject may
+   * be set by one thread at a time only */
+  node_bases const & get_node_bases
+    (double const lb, double const ub, CppAD::vector<Type> const &tx,
+     size_t const nq) const {
+    size_t const subject = get_subject(tx, nq);
+#ifdef DO_CHECKS
+    if(subject >= subject_bases->size())
+      throw std::runtime_error("get_node_bases: invalid subject");
+#endif
+    node_bases &out = (*subject_bases)[subject];
+    if(out.n_nodes() > 0){
+#ifdef DO_CHECKS
+      if(out.lb != lb or out.ub != ub)
+        throw std::runtime_error("get_node_bases: bounds changed");
+#endif
+      return out;
+    }
+
+    if(rel_tol <= 0 or n_nodes <= n_nodes_min)
+      return out = eval_node_bases(lb, ub, n_nodes);
+
+    double lb_tx, ub_tx;
+    set_double_pars(tx, nq, lb_tx, ub_tx);
+    size_t n = n_nodes_min;
+    node_bases nb = eval_node_bases(lb, ub, n);
+    double val = eval_integral(nb, lb, ub);
+    while(n < n_nodes){
+      n = std::min<size_t>(2L * n, n_nodes);
+      nb = eval_node_bases(lb, ub, n);
+      double const new_val = eval_integral(nb, lb, ub);
+      bool const done = std::abs(new_val - val) <= rel_tol * std::abs(new_val);
+      val = new_val;
+      if(done)
+        break;
+    }
+
+    return out = std::move(nb);
+  }
+
+  /* sets the Type vectors with the bases and the products with alpha at
+   * node i */
+  void set_node_bases(node_bases const &nb, size_t const i) const {
+    if(has_m){
+      double const *mi = nb.m.colptr(i);
+      for(size_t j = 0; j < dim_m; ++j)
+        rmi[j] = Type(mi[j]);
+
+      size_t l(0L);
+      for(size_t j = 0; j < dim_alpha; ++j)
+        for(size_t k = 0; k < dim_m; ++k)
+          rma[l++] = ralpha[j] * rmi[k];
+    }
+
+    if(has_g){
+      double const *gi = nb.g.colptr(i);
+      for(size_t j = 0; j < dim_g; ++j)
+        rgi[j] = Type(gi[j]);
+
+      size_t l(0L);
+      for(size_t j = 0; j < dim_alpha; ++j)
+        for(size_t k = 0; k < dim_g; ++k)
+          rga[l++] = ralpha[j] * rgi[k];
+    }
+
+    if(has_b){
+      double const *bi = nb.b.colptr(i);
+      for(size_t j = 0; j < dim_omega; ++j)
+        rbi[j] = Type(bi[j]);
+    }
+  }
+
+  /* the number of inputs */
+  size_t n_ele() const {
+    return 3L + dim_omega + dim_alpha + dim_B + dim_U * (2L + dim_U);
+  }
+
+  /* computes the gradient and, if dir is not a nullptr, the Hessian times
+   * dir. The bounds are treated as constants. The integrand is
+
+   \begin{align*}
+   h(o) &= 2\exp(v(o)) \\
+   v(o) &= \log\Phi(M_{\vec\alpha}(o)\vec k) +
+   \vec\omega^\top\vec b(o)
+   + G_{\vec\alpha}(o)\vec b
+   + M_{\vec\alpha}(o)\vec U
+   +\frac 12 M_{\vec\alpha}(o)\Lambda_i M_{\vec\alpha}(o)^\top
+   \end{align*}
+
+   such that the Hessian of the integrand is
+   h(o)(\nabla v(o)\nabla v(o)^\top + \nabla^2 v(o)). The first three
+   inputs are the bounds and the index of the subject. */
+  void derivs(CppAD::vector<Type> const &tx, size_t const nq, Type *gr,
+              Type const *dir, Type *hv) const {
+    size_t const n = n_ele();
     double lb, ub;
     {
       size_t i(0L);
-      lb = asDouble(tx[i++]),
-      ub = asDouble(tx[i++]);
+      lb = asDouble(tx[nq * i++]);
+      ub = asDouble(tx[nq * i++]);
+      ++i; // the subject
 
-      auto set_vec = [&](vector<double> &x){
+      auto set_vec = [&](vector<Type> &x){
         for(int j = 0; j < x.size(); ++j)
-          x[j] = asDouble(tx[i++]);
+          x[j] = tx[nq * i++];
       };
 
       if(has_b)
-        set_vec(fomega);
-      set_vec(falpha);
+        set_vec(romega);
+      set_vec(ralpha);
       if(has_g)
-        set_vec(fB);
+        set_vec(rB);
       if(has_m){
-        set_vec(fU);
-        set_vec(fk);
+        set_vec(rU);
+        set_vec(rk);
 
         for(size_t j = 0; j < dim_U; ++j)
           for(size_t k = 0; k < dim_U; ++k)
-            fLambda(k, j) = asDouble(tx[i++]);
+            rLambda(k, j) = tx[nq * i++];
       }
     }
 
-    /* perform an approximation of the integral */
-    double const d1 = (ub - lb) / 2.,
-                 d2 = (ub + lb) / 2.;
+    /* get the direction */
+    if(dir){
+      Type const *d = dir + 3L + dim_omega;
+      for(size_t j = 0; j < dim_alpha; ++j)
+        dalpha[j] = *d++;
+      for(size_t j = 0; j < dim_B; ++j)
+        dB[j] = *d++;
+      for(size_t j = 0; j < dim_U; ++j)
+        dU[j] = *d++;
+      for(size_t j = 0; j < dim_U; ++j)
+        dk[j] = *d++;
+      for(size_t j = 0; j < dim_U; ++j)
+        for(size_t k = 0; k < dim_U; ++k)
+          dLambda(k, j) = *d++;
+    }
 
-    double out(0.);
-    for(auto const &xwi : xw){
-      /* evalutes splines and related objects */
-      double const node = d1 * xwi.x + d2;
-      if(has_m){
-        m->operator()(fmi, node);
+    for(size_t i = 0; i < n; ++i)
+      gr[i] = Type(0.);
+    if(dir)
+      for(size_t i = 0; i < n; ++i)
+        hv[i] = Type(0.);
 
-        size_t i(0L);
-        for(size_t j = 0; j < dim_alpha; ++j)
-          for(size_t k = 0; k < dim_m; ++k)
-            fma[i++] = falpha[j] * fmi[k];
-      }
+    Type const ZERO(0.), ONE(1.), HALF(.5);
+    node_bases const &nb = get_node_bases(lb, ub, tx, nq);
+    std::vector<QuadPair<Type> > const &xw_type =
+      GLPairsCached<Type>(nb.n_nodes());
 
-      if(has_g){
-        g->operator()(fgi, node);
+    for(size_t q_i = 0; q_i < nb.n_nodes(); ++q_i){
+      QuadPair<Type> const &xwi = xw_type[q_i];
+      /* sets the splines and related objects */
+      set_node_bases(nb, q_i);
 
+      /* evaluate intermediary constants */
+      lambda_ma = rLambda * rma;
+      Type const ma_k = vec_dot(rma, rk),
+                   v1 = pnorm_log(ma_k),
+                   v2 = vec_dot(romega, rbi) +
+                     vec_dot(rga, rB) +
+                     vec_dot(rma, rU) +
+                     HALF * vec_dot(rma, lambda_ma),
+                   v3 = dnorm(ma_k, ZERO, ONE, 1L),
+            integrand = xwi.weight * exp(v1 + v2),
+                  psi = exp(v3 - v1);
+
+      /* the gradient of v */
+      Type *gv = &grad_v[0];
+      *gv++ = ZERO;
+      *gv++ = ZERO;
+      *gv++ = ZERO;
+      /* omega */
+      for(size_t j = 0; j < dim_omega; ++j)
+        *gv++ = rbi[j];
+      /* alpha */
+      {
+        size_t sm(0L), sg(0L);
+        for(size_t j = 0; j < dim_alpha; ++j){
+          Type term(0.);
+          for(size_t k = 0; k < dim_m; ++k, ++sm)
+            term += rmi[k] * (rU[sm] + lambda_ma[sm] + psi * rk[sm]);
+          for(size_t k = 0; k < dim_g; ++k, ++sg)
+            term += rgi[k] * rB[sg];
+          *gv++ = term;
+        }
+      }
+      /* B */
+      for(size_t j = 0; j < dim_B; ++j)
+        *gv++ = rga[j];
+      /* U */
+      for(size_t j = 0; j < dim_U; ++j)
+        *gv++ = rma[j];
+      /* k */
+      for(size_t j = 0; j < dim_U; ++j)
+        *gv++ = psi * rma[j];
+      /* Lambda */
+      for(size_t j = 0; j < dim_U; ++j)
+        for(size_t k = 0; k < dim_U; ++k)
+          *gv++ = HALF * rma[k] * rma[j];
+
+      for(size_t i = 0; i < n; ++i)
+        gr[i] += integrand * grad_v[i];
+
+      if(!dir)
+        continue;
+
+      /* the Hessian of v times the direction */
+      {
         size_t i(0L);
+        for(size_t j = 0; j < dim_alpha; ++j)
+          for(size_t k = 0; k < dim_m; ++k)
+            dma[i++] = dalpha[j] * rmi[k];
+        i = 0L;
         for(size_t j = 0; j < dim_alpha; ++j)
           for(size_t k = 0; k < dim_g; ++k)
-            fga[i++] = falpha[j] * fgi[k];
+            dga[i++] = dalpha[j] * rgi[k];
       }
-
-      if(has_b)
-        if(use_log)
-          b->operator()(fbi, log(node));
-        else
-          b->operator()(fbi,     node );
-
-      /* evalute integrand */
-      double const v1 = pnorm_log(vec_dot(fma, fk)),
-                   v2 = vec_dot(fomega, fbi) +
-                     vec_dot(fga, fB) +
-                     vec_dot(fma, fU) +
-                     .5 * quad_form_sym(fma, fLambda);
-
-      out += xwi.weight * exp(v1 + v2);
+      lambda_dma = rLambda * dma;
+      dlambda_ma = dLambda * rma;
+      dlambda_ma += (dLambda.transpose() * rma.matrix()).array();
+      dlambda_ma *= HALF;
+
+      Type const dt = vec_dot(dma, rk) + vec_dot(rma, dk),
+               dpsi = -psi * (ma_k + psi) * dt;
+
+      Type *hvv = &hess_v[0];
+      *hvv++ = ZERO;
+      *hvv++ = ZERO;
+      *hvv++ = ZERO;
+      /* omega */
+      for(size_t j = 0; j < dim_omega; ++j)
+        *hvv++ = ZERO;
+      /* alpha */
+      {
+        size_t sm(0L), sg(0L);
+        for(size_t j = 0; j < dim_alpha; ++j){
+          Type term(0.);
+          for(size_t k = 0; k < dim_m; ++k, ++sm)
+            term += rmi[k] * (
+              dU[sm] + dlambda_ma[sm] + lambda_dma[sm] + dpsi * rk[sm] +
+                psi * dk[sm]);
+          for(size_t k = 0; k < dim_g; ++k, ++sg)
+            term += rgi[k] * dB[sg];
+          *hvv++ = term;
+        }
+      }
+      /* B */
+      for(size_t j = 0; j < dim_B; ++j)
+        *hvv++ = dga[j];
+      /* U */
+      for(size_t j = 0; j < dim_U; ++j)
+        *hvv++ = dma[j];
+      /* k */
+      for(size_t j = 0; j < dim_U; ++j)
+        *hvv++ = dpsi * rma[j] + psi * dma[j];
+      /* Lambda */
+      for(size_t j = 0; j < dim_U; ++j)
+        for(size_t k = 0; k < dim_U; ++k)
+          *hvv++ = HALF * (dma[k] * rma[j] + rma[k] * dma[j]);
+
+      Type gv_dir(0.);
+      for(size_t i = 3L; i < n; ++i)
+        gv_dir += grad_v[i] * dir[i];
+      for(size_t i = 0; i < n; ++i)
+        hv[i] += integrand * (grad_v[i] * gv_dir + hess_v[i]);
     }
 
-    out *= has_m ? d1 * 2 : d1 * 4;
+    Type const mult = has_m ? Type(ub - lb) : 2 * Type(ub - lb);
+    for(size_t i = 3L; i < n; ++i)
+      gr[i] *= mult;
+    if(dir)
+      for(size_t i = 3L; i < n; ++i)
+        hv[i] *= mult;
+  }
+
+public:
+  /* name used by survTMB::phase_timers */
+  static char const * timer_name(){
+    return "joint snva_integral";
+  }
+
+  snva_integral(char const *name, size_t const n_nodes,
+                B const *b_in, G const *g_in, M const *m_in,
+                size_t const dim_alpha, bool const use_log,
+                double const rel_tol = 0,
+                std::shared_ptr<subject_node_bases> bases = nullptr):
+  CppAD::atomic_base<Type>(name), n_nodes(n_nodes), rel_tol(rel_tol),
+  b(b_in ? new B(*b_in) : nullptr),
+  g(g_in ? new G(*g_in) : nullptr),
+  m(m_in ? new M(*m_in) : nullptr),
+  dim_alpha(dim_alpha),
+  use_log(use_log),
+  subject_bases(bases ? bases : std::make_shared<subject_node_bases>(1L)) {
+    this->option(CppAD::atomic_base<Type>::bool_sparsity_enum);
+  }
+
+  virtual bool forward(std::size_t p, std::size_t q,
+                       const CppAD::vector<bool> &vx,
+                       CppAD::vector<bool> &vy,
+                       const CppAD::vector<Type> &tx,
+                       CppAD::vector<Type> &ty){
+    survTMB::scoped_atomic_timer timer(timer_name());
+    if(q > 2L)
+      return false;
+    size_t const nq = q + 1L;
+
+    if(p > 0L)
+      return higher_order_forward(p, q, tx, ty);
+
+    /* get parameters and integral bounds and perform an approximation of
+     * the integral */
+    double lb, ub;
+    set_double_pars(tx, nq, lb, ub);
+    double const out = eval_integral(get_node_bases(lb, ub, tx, nq), lb, ub);
 
     ty[0L] = Type(out);
 
@@ -193,15 +576,46 @@ public:
         vy[i] = anyvx;
     }
 
+    if(q > 0L)
+      return higher_order_forward(1L, q, tx, ty);
     return true;
   }
 
+  /* computes the Taylor coefficients of order p to q > 0 */
+  bool higher_order_forward(std::size_t const p, std::size_t const q,
+                            const CppAD::vector<Type> &tx,
+                            CppAD::vector<Type> &ty) const {
+    size_t const n = n_ele(),
+                nq = q + 1L;
+    Type * const gr = wk_mem.data(),
+         * const wk = gr + n;
+    derivs(tx, nq, gr, nullptr, nullptr);
+
+    auto hess_vec = [&](Type const *dir, Type *out){
+      derivs(tx, nq, wk + 2L * n, dir, out);
+    };
+    return survTMB::taylor_forward(p, q, n, gr, hess_vec, tx, ty, wk);
+  }
+
   virtual bool reverse(std::size_t q, const CppAD::vector<Type> &tx,
                        const CppAD::vector<Type> &ty,
                        CppAD::vector<Type> &px,
                        const CppAD::vector<Type> &py){
-    if(q > 0)
+    survTMB::scoped_atomic_timer timer(timer_name());
+    if(q > 1L)
       return false;
+    if(q > 0L){
+      size_t const n = n_ele(),
+                  nq = q + 1L;
+      Type * const gr = wk_mem.data(),
+           * const wk = gr + n;
+      derivs(tx, nq, gr, nullptr, nullptr);
+
+      auto hess_vec = [&](Type const *dir, Type *out){
+        derivs(tx, nq, wk + 2L * n, dir, out);
+      };
+      return survTMB::taylor_reverse(q, n, gr, hess_vec, tx, px, py, wk);
+    }
 
     /* get parameters and integral bounds */
     double lb, ub;
@@ -209,6 +623,7 @@ public:
       size_t i(0L);
       lb = asDouble(tx[i++]),
       ub = asDouble(tx[i++]);
+      ++i; // the subject
 
       auto set_vec = [&](vector<Type> &x){
         for(int j = 0; j < x.size(); ++j)
@@ -231,47 +646,18 @@ public:
     }
 
     /* perform an approximation of the integral */
-    Type const d1((ub - lb) / 2.);
-    double const d2 = (ub + lb) / 2.;
-
     for(size_t i = 0; i < px.size(); ++i)
       px[i] = Type(0.);
 
     Type const ZERO(0.), ONE(1.), HALF(.5);
+    node_bases const &nb = get_node_bases(lb, ub, tx, 1L);
+    std::vector<QuadPair<Type> > const &xw_type =
+      GLPairsCached<Type>(nb.n_nodes());
 
-    for(auto xwi : xw_type){
-      /* evalutes splines and related objects */
-      double const node = asDouble(d1 * xwi.x) + d2;
-      if(has_m){
-        m->operator()(fmi, node);
-        for(size_t i = 0; i < fmi.size(); ++i)
-          rmi[i] = Type(fmi[i]);
-
-        size_t i(0L);
-        for(size_t j = 0; j < dim_alpha; ++j)
-          for(size_t k = 0; k < dim_m; ++k)
-            rma[i++] = ralpha[j] * rmi[k];
-      }
-
-      if(has_g){
-        g->operator()(fgi, node);
-        for(size_t i = 0; i < fgi.size(); ++i)
-          rgi[i] = Type(fgi[i]);
-
-        size_t i(0L);
-        for(size_t j = 0; j < dim_alpha; ++j)
-          for(size_t k = 0; k < dim_g; ++k)
-            rga[i++] = ralpha[j] * rgi[k];
-      }
-
-      if(has_b){
-        if(use_log)
-          b->operator()(fbi, log(node));
-        else
-          b->operator()(fbi,     node );
-        for(size_t i = 0; i < fbi.size(); ++i)
-          rbi[i] = Type(fbi[i]);
-      }
+    for(size_t q_i = 0; q_i < nb.n_nodes(); ++q_i){
+      QuadPair<Type> const &xwi = xw_type[q_i];
+      /* sets the splines and related objects */
+      set_node_bases(nb, q_i);
 
       /* evaluate intermediary constants */
       vector<Type> lambda_ma = rLambda * rma;
@@ -287,7 +673,7 @@ public:
 
       /* add terms to gradient */
       {
-        size_t i(2L);
+        size_t i(3L);
         /* omega */
         for(size_t j = 0; j < dim_omega; ++j)
           px[i++] += integrand * rbi[j];
@@ -340,30 +726,41 @@ public:
 
     Type const mult =
       has_m ? Type(ub - lb) * py[0L] : 2 * Type(ub - lb) * py[0L];
-    for(size_t i = 2L; i < px.size(); ++i)
+    for(size_t i = 3L; i < px.size(); ++i)
       px[i] *= mult;
 
     return true;
   }
 
+  virtual bool for_sparse_jac(size_t q, const CppAD::vector<bool>& r,
+                              CppAD::vector<bool>& s) {
+    return survTMB::one_output_for_sparse_jac(q, r, s);
+  }
+
   virtual bool rev_sparse_jac(size_t q, const CppAD::vector<bool>& rt,
                               CppAD::vector<bool>& st) {
-    bool anyrt = false;
-    for (std::size_t i = 0; i < rt.size(); i++)
-      anyrt |= rt[i];
-    for (std::size_t i = 0; i < st.size(); i++)
-      st[i] = anyrt;
-    return true;
+    return survTMB::one_output_rev_sparse_jac(q, rt, st);
+  }
+
+  virtual bool rev_sparse_hes(const CppAD::vector<bool>& vx,
+                              const CppAD::vector<bool>& s,
+                              CppAD::vector<bool>& t, size_t q,
+                              const CppAD::vector<bool>& r,
+                              const CppAD::vector<bool>& u,
+                              CppAD::vector<bool>& v) {
+    return survTMB::one_output_rev_sparse_hes(s, t, q, r, u, v);
   }
 
+  /* returns the input vector. subject is the index of the subject in the
+   * object with the node bases */
   template<class T>
   CppAD::vector<AD<T> > get_x
-    (AD<T> const lb, AD<T> const ub,
+    (AD<T> const lb, AD<T> const ub, AD<T> const subject,
      vector<AD<T> > const &omega, vector<AD<T> > const &alpha,
      matrix<AD<T> > const &b_arg, vector<AD<T> > const &U,
      vector<AD<T> > const &k, matrix<AD<T> > const &Lambda) const {
     size_t const n_ele =
-      2L + dim_omega + dim_alpha + dim_B + dim_U * (2L + dim_U);
+      3L + dim_omega + dim_alpha + dim_B + dim_U * (2L + dim_U);
 #ifdef DO_CHECKS
     if(has_b and omega.size() != (int)dim_omega)
       throw std::runtime_error("get_x: invalid omega");
@@ -385,6 +782,7 @@ public:
     size_t i(0L);
     tx[i++] = lb;
     tx[i++] = ub;
+    tx[i++] = subject;
     auto add_vec = [&](vector<AD<T> > const &x){
       for(int j = 0; j < x.size(); ++j)
         tx[i++] = x[j];
@@ -1,10 +1,15 @@
 #define INCLUDE_RCPP
 #include "get-x.h"
+#include "parallel-utils.h"
+#include "hess-utils.h"
+#include "tape-info.h"
+#include "taping-arena.h"
 #include "utils.h"
 #include "joint-utils.h"
 #include "snva-utils.h"
 #include "convert-eigen-arma.h"
 #include <limits>
+#include <algorithm>
 #include "bases-wrapper.h"
 
 namespace {
@@ -32,11 +37,16 @@ public:
   virtual void eval_g_surv(arma::vec&, double const) const = 0;
   virtual void eval_m_surv(arma::vec&, double const) const = 0;
 
+  /** evaluates the bases at each element of a vector. Column i of the
+   output is the basis at element i. */
+  virtual void eval_g(arma::mat&, arma::vec const&) const = 0;
+  virtual void eval_m(arma::mat&, arma::vec const&) const = 0;
+
   /** returns the input vector to pass along to eval_int. */
   virtual vector<Type> get_x(
-      Type const, Type const, vector<Type> const&, vector<Type> const&,
-      matrix<Type> const&, vector<Type> const&, vector<Type> const&,
-      matrix<Type> const&) const = 0;
+      Type const, Type const, Type const, vector<Type> const&,
+      vector<Type> const&, matrix<Type> const&, vector<Type> const&,
+      vector<Type> const&, matrix<Type> const&) const = 0;
 
   /** evalutes the integral in the survival function.  */
   virtual Type eval_int(vector<Type> const&) = 0;
@@ -83,7 +93,8 @@ public:
     size_t const n_nodes, vector<Type> const &scoefs,
     vector<Type> const &gcoefs, vector<Type> const &mcoefs,
     size_t const n_y, bool const use_log, vector<Type> const& mcoefs_surv,
-    vector<Type> const& gcoefs_surv):
+    vector<Type> const& gcoefs_surv, double const int_rel_tol,
+    std::shared_ptr<fastgl::joint::subject_node_bases> node_bases):
   use_log(use_log),
   b(get_basis<Basis>(to_arma_vec(scoefs))),
   g(get_basis<Basis>(to_arma_vec(gcoefs))),
@@ -91,7 +102,7 @@ public:
   g_surv(get_basis<Basis>(to_arma_vec(gcoefs_surv))),
   m_surv(get_basis<Basis>(to_arma_vec(mcoefs_surv))),
   cum_haz("cum haz integral", n_nodes, b.get(), g_surv.get(), m_surv.get(),
-          n_y, use_log)
+          n_y, use_log, int_rel_tol, node_bases)
   {
     if((!has_g() and has_g_surv()) or (
         has_g_surv() and gcoefs.size() != gcoefs_surv.size()))
@@ -116,6 +127,12 @@ public:
   void eval_m(arma::vec &out, double const x) const {
     m->operator()(out, x);
   }
+  void eval_g(arma::mat &out, arma::vec const &x) const {
+    eval_basis_batch(*g, out, x);
+  }
+  void eval_m(arma::mat &out, arma::vec const &x) const {
+    eval_basis_batch(*m, out, x);
+  }
   void eval_g_surv(arma::vec &out, double const x) const {
     g_surv->operator()(out, x);
   }
@@ -124,11 +141,11 @@ public:
   }
 
   vector<Type> get_x(
-      Type const lb, Type const ub, vector<Type> const &omega,
-      vector<Type> const &alpha, matrix<Type> const &B,
-      vector<Type> const &U, vector<Type> const &k,
+      Type const lb, Type const ub, Type const subject,
+      vector<Type> const &omega, vector<Type> const &alpha,
+      matrix<Type> const &B, vector<Type> const &U, vector<Type> const &k,
       matrix<Type> const &lambda) const {
-    return cum_haz.get_x(lb, ub, omega, alpha, B, U, k, lambda);
+    return cum_haz.get_x(lb, ub, subject, omega, alpha, B, U, k, lambda);
   }
 
   Type eval_int(vector<Type> const &params) {
@@ -159,6 +176,106 @@ using pol = poly::orth_poly;
 template<class Type>
 using splines_n_cum_haz_pol = splines_n_cum_haz_T<Type, pol>;
 
+/**
+ cross products of the markers and the design matrix of the markers of each
+ group. The design matrix of an observation at time t is
+ W = (1, g(t)^T, m(t)^T)^T where the g and m terms are only included if the
+ bases are used. The bases only depend on the data so the cross products
+ are computed once and the taped operations in the marker terms do not
+ depend on the number of observations.
+ */
+struct marker_dat {
+  struct group_dat {
+    /* Y Y^T, W Y^T, and W W^T where Y is the markers of the group */
+    arma::mat YY, WY, WW;
+  };
+  std::vector<group_dat> groups;
+  /* number of rows in W and the index of the first m term */
+  size_t n_w, off_m;
+};
+
+template<class Basis>
+std::shared_ptr<marker_dat const> get_marker_dat_inner
+  (arma::mat const &markers, arma::ivec const &n_markers,
+   arma::vec const &m_time, arma::vec const &gcoefs,
+   arma::vec const &mcoefs){
+  auto const g = get_basis<Basis>(gcoefs),
+             m = get_basis<Basis>(mcoefs);
+  size_t const dim_g = g ? g->get_n_basis() : 0L,
+               dim_m = m ? m->get_n_basis() : 0L;
+
+  std::shared_ptr<marker_dat> out(new marker_dat());
+  out->n_w   = 1L + dim_g + dim_m;
+  out->off_m = 1L + dim_g;
+  out->groups.resize(n_markers.n_elem);
+
+  arma::mat W, G, M;
+  size_t marker_idx(0L);
+  for(size_t i = 0; i < n_markers.n_elem; ++i){
+    marker_dat::group_dat &gd = out->groups[i];
+    size_t const n_obs = n_markers[i];
+    if(n_obs < 1L){
+      gd.YY.zeros(markers.n_rows, markers.n_rows);
+      gd.WY.zeros(out->n_w, markers.n_rows);
+      gd.WW.zeros(out->n_w, out->n_w);
+      continue;
+    }
+
+    arma::vec const obs_times = m_time.subvec(
+      marker_idx, marker_idx + n_obs - 1L);
+    W.set_size(out->n_w, n_obs);
+    W.row(0).ones();
+    if(g){
+      eval_basis_batch(*g, G, obs_times);
+      W.rows(1L, dim_g) = G;
+    }
+    if(m){
+      eval_basis_batch(*m, M, obs_times);
+      W.rows(out->off_m, out->n_w - 1L) = M;
+    }
+
+    arma::mat const Y = markers.cols(marker_idx, marker_idx + n_obs - 1L);
+    gd.YY = Y * Y.t();
+    gd.WY = W * Y.t();
+    gd.WW = W * W.t();
+    marker_idx += n_obs;
+  }
+
+  return out;
+}
+
+template<class Type>
+std::shared_ptr<marker_dat const> get_marker_dat
+  (matrix<Type> const &markers, vector<int> const &n_markers,
+   vector<Type> const &m_time, vector<Type> const &gcoefs,
+   vector<Type> const &mcoefs, int const basis_type){
+  arma::mat markers_d(markers.rows(), markers.cols());
+  for(size_t j = 0; j < markers_d.n_cols; ++j)
+    for(size_t i = 0; i < markers_d.n_rows; ++i)
+      markers_d(i, j) = asDouble(markers(i, j));
+  arma::ivec n_markers_d(n_markers.size());
+  for(size_t i = 0; i < n_markers_d.n_elem; ++i)
+    n_markers_d[i] = n_markers[i];
+  auto to_vec = [](vector<Type> const &x){
+    arma::vec out(x.size());
+    for(size_t i = 0; i < out.n_elem; ++i)
+      out[i] = asDouble(x[i]);
+    return out;
+  };
+
+  if     (basis_type == INT_NS)
+    return get_marker_dat_inner<splines::ns>(
+      markers_d, n_markers_d, to_vec(m_time), to_vec(gcoefs),
+      to_vec(mcoefs));
+  else if(basis_type == INT_POLY)
+    return get_marker_dat_inner<poly::orth_poly>(
+      markers_d, n_markers_d, to_vec(m_time), to_vec(gcoefs),
+      to_vec(mcoefs));
+
+  throw std::invalid_argument("'basis_type' not implemented");
+  return nullptr;
+}
+
 template<class Type>
 class VA_worker {
   Rcpp::List data, parameters;
@@ -183,6 +300,10 @@ class VA_worker {
   const DATA_LOGICAL(sparse_hess);
   const DATA_LOGICAL(use_log);
   const DATA_INTEGER(n_nodes);
+  /* relative tolerance for the adaptive rule for the cumulative hazard. A
+   * fixed n_nodes point rule is used if it is not positive */
+  double const int_rel_tol = data.containsElementNamed("int_rel_tol") ?
+    Rcpp::as<double>(data["int_rel_tol"]) : 0.;
 
   const PARAMETER_MATRIX(gamma);
   const PARAMETER_MATRIX(B);
@@ -193,6 +314,8 @@ class VA_worker {
   const PARAMETER_VECTOR(alpha);
   const PARAMETER_VECTOR(va_par);
 
+  std::shared_ptr<marker_dat const> const mdat;
+
 public:
 #ifdef _OPENMP
   std::size_t const n_blocks = n_threads;
@@ -203,9 +326,16 @@ public:
 public:
   std::size_t const n_y = markers.rows();
 
+  /* returns the object with the node bases of each group to share between
+   * the integral objects */
+  std::shared_ptr<fastgl::joint::subject_node_bases> get_node_bases() const {
+    return std::make_shared<fastgl::joint::subject_node_bases>(n_groups);
+  }
+
   using cum_base_T = splines_n_cum_haz_base<Type>;
   std::vector<std::unique_ptr<cum_base_T> >
-    get_splines_n_cum_ints()
+    get_splines_n_cum_ints
+    (std::shared_ptr<fastgl::joint::subject_node_bases> node_bases)
     const {
     using output_T = std::unique_ptr<cum_base_T>;
 
@@ -215,11 +345,11 @@ public:
       if     (basis_type == INT_NS)
         out.emplace_back(new splines_n_cum_haz_ns<Type>(
             n_nodes, scoefs, gcoefs, mcoefs, n_y, use_log, mcoefs_surv,
-            gcoefs_surv));
+            gcoefs_surv, int_rel_tol, node_bases));
       else if(basis_type == INT_POLY)
         out.emplace_back(new splines_n_cum_haz_pol<Type>(
             n_nodes, scoefs, gcoefs, mcoefs, n_y, use_log, mcoefs_surv,
-            gcoefs_surv));
+            gcoefs_surv, int_rel_tol, node_bases));
       else
         throw std::invalid_argument("'basis_type' not implemented");
 
@@ -249,10 +379,18 @@ public:
                    n_pars =
                      gamma.rows() * gamma.cols() + B.rows() * B.cols() +
                      Psi.size() + Sigma.size() + delta.size() +
-                     omega.size() + alpha.size() + va_par.size();
-
-  VA_worker(Rcpp::List data, Rcpp::List parameters):
-    data(data), parameters(parameters) {
+                     omega.size() + alpha.size() + va_par.size(),
+                 /* number of parameters which all groups depend on */
+                 n_shared = n_pars - va_par.size(),
+                 /* number of VA parameters of each group */
+                 n_va_grp = n_groups > 0 ? va_par.size() / n_groups : 0L;
+
+  /* the marker data are computed if mdat_in is a nullptr */
+  VA_worker(Rcpp::List data, Rcpp::List parameters,
+            std::shared_ptr<marker_dat const> mdat_in = nullptr):
+    data(data), parameters(parameters),
+    mdat(mdat_in ? mdat_in : get_marker_dat(
+      markers, n_markers, m_time, gcoefs, mcoefs, basis_type)) {
 #ifdef _OPENMP
     omp_set_num_threads(n_threads);
 #endif
@@ -298,6 +436,8 @@ public:
       throw std::invalid_argument("VA_worker: invalid omega");
     else if((size_t)alpha.size() != n_y)
       throw std::invalid_argument("VA_worker: invalid alpha");
+    else if(n_va_grp * n_groups != (size_t)va_par.size())
+      throw std::invalid_argument("VA_worker: invalid va_par");
   }
 
   template<class Tout>
@@ -328,11 +468,49 @@ public:
     return out;
   }
 
+  std::shared_ptr<marker_dat const> get_marker_data() const {
+    return mdat;
+  }
+
+  /* returns the arguments for the tape of group g. These are the shared
+   * parameters followed by the VA parameters of the group */
+  template<class Tout>
+  vector<Tout> get_group_args(size_t const g) const {
+    vector<Tout> const all = get_concatenated_args<Tout>();
+    vector<Tout> out(n_shared + n_va_grp);
+    out << all.head(n_shared), all.segment(n_shared + g * n_va_grp, n_va_grp);
+    return out;
+  }
+
   Type operator()
     (vector<Type> &args,
      std::vector<std::unique_ptr<cum_base_T> > &splines_n_cum_ints)
     const {
-    if((size_t)args.size() != n_pars)
+    return eval(args, splines_n_cum_ints, 0L, n_groups, true);
+  }
+
+  /* computes the lower bound terms of groups [g_begin, g_end) including
+   * their share of the normalization constant. The arguments are the shared
+   * parameters followed by the VA parameters of the groups */
+  Type operator()
+    (vector<Type> &args,
+     std::vector<std::unique_ptr<cum_base_T> > &splines_n_cum_ints,
+     size_t const g_begin, size_t const g_end) const {
+    if(g_end > n_groups or g_begin >= g_end)
+      throw std::invalid_argument("VA_worker::operator(): invalid groups");
+    return eval(args, splines_n_cum_ints, g_begin, g_end, false);
+  }
+
+private:
+  /* the groups are split between the threads if use_regions is true and the
+   * method is called in parallel */
+  Type eval
+    (vector<Type> &args,
+     std::vector<std::unique_ptr<cum_base_T> > &splines_n_cum_ints,
+     size_t const g_begin, size_t const g_end, bool const use_regions)
+    const {
+    size_t const n_grp_sub = g_end - g_begin;
+    if((size_t)args.size() != n_shared + n_grp_sub * n_va_grp)
       throw std::invalid_argument("VA_worker::operator(): invalid args");
 
     /* assign the parameters from args */
@@ -365,7 +543,7 @@ public:
 
     auto const ava_par = ([&](){
       return GaussHermite::SNVA::SNVA_MD_theta_DP_to_DP(
-        a, va_par.size(), K);
+        a, n_grp_sub * n_va_grp, K);
     })();
 
     /* get the cumulative hazard integral object */
@@ -376,8 +554,9 @@ public:
       vector<Type> U(K), k(K);
       matrix<Type> Lambda(K, K);
 
-      return my_int.get_x(Type(1.) /* lb */, Type(2.) /* ub */, aomega,
-                          aalpha, aB, U, k, Lambda);
+      return my_int.get_x(Type(1.) /* lb */, Type(2.) /* ub */,
+                          Type(0.) /* subject */, aomega, aalpha, aB, U, k,
+                          Lambda);
     })();
 
     /* evaluates the cumulative hazard integral */
@@ -388,13 +567,15 @@ public:
                    has_g_surv = my_int.has_g_surv(),
                    has_m_surv = my_int.has_m_surv();
     auto comp_cum_haz = [&](
-      Type const lb, Type const ub, vector<Type> const &U,
-      vector<Type> const &k, matrix<Type> const &Lambda){
+      Type const lb, Type const ub, size_t const subject,
+      vector<Type> const &U, vector<Type> const &k,
+      matrix<Type> const &Lambda){
       cum_int_arg[0L] = lb;
       cum_int_arg[1L] = ub;
+      cum_int_arg[2L] = Type(static_cast<double>(subject));
 
       Type *x = &cum_int_arg[
-        2L + has_b * dim_b + n_y + has_g_surv * dim_g * n_y];
+        3L + has_b * dim_b + n_y + has_g_surv * dim_g * n_y];
       if(has_m_surv){
         for(size_t i = 0; i < K; ++i)
           *x++ = U[i];
@@ -410,24 +591,27 @@ public:
 
     /* compute other intermediaries */
     Type log_det_sigma;
-    matrix<Type> sigma_inv = atomic::matinvpd(aSigma, log_det_sigma);
+    matrix<Type> sigma_inv = survTMB::inv_pd(aSigma, log_det_sigma);
     Type log_det_psi;
-    matrix<Type> psi_inv = atomic::matinvpd(aPsi, log_det_psi);
+    matrix<Type> psi_inv = survTMB::inv_pd(aPsi, log_det_psi);
 
     Type const one(1.),
-              zero(0.),
               half(.5),
             two_pi(2. / M_PI),
        sqrt_two_pi(sqrt(two_pi)),
              small(std::numeric_limits<double>::epsilon());
 
     /* evaluate the lower bound */
-    survTMB::accumulator_mock<Type> result;
+    survTMB::accumulator_mock<Type> result(!use_regions);
     arma::vec b_wrk(has_b ? dim_b : 0L),
               g_wrk(has_g ? dim_g : 0L),
               m_wrk(has_m ? dim_m : 0L);
     size_t marker_idx(0L);
-    for(size_t g = 0; g < n_groups; ++g){
+    for(size_t g = 0; g < g_begin; ++g)
+      marker_idx += n_markers[g];
+    size_t const marker_begin = marker_idx;
+
+    for(size_t g = g_begin; g < g_end; ++g){
       /* is this our cluster? */
       if(is_in_parallel and !is_my_region(*result.obj)){
         result.obj->parallel_region();
@@ -436,30 +620,27 @@ public:
       }
 
       /* get VA parameters */
-      vector<Type> const  &va_mu = ava_par.va_mus[g],
-                         &va_rho = ava_par.va_rhos[g];
-      matrix<Type> const &Lambda = ava_par.va_lambdas[g];
+      vector<Type> const  &va_mu = ava_par.va_mus[g - g_begin],
+                         &va_rho = ava_par.va_rhos[g - g_begin];
+      matrix<Type> const &Lambda = ava_par.va_lambdas[g - g_begin];
 
       /* the term we add in the end */
       Type term(0.);
 
-      /* compute quantities needed later */
-      vector<Type> k = ([&](){
-        vector<Type> out = Lambda * va_rho;
-        Type denom = sqrt(one + vec_dot(va_rho, out));
-        for(int j = 0; j < out.size(); ++j)
-          out[j] /= denom;
-        return out;
-      })();
+      /* compute quantities needed later. rho^T Lambda rho is also used in
+       * the entropy term */
+      vector<Type> k = Lambda * va_rho;
+      Type const rho_quad = vec_dot(va_rho, k);
+      {
+        Type const denom = sqrt(one + rho_quad);
+        for(int j = 0; j < k.size(); ++j)
+          k[j] /= denom;
+      }
       vector<Type> const U_mean = va_mu + sqrt_two_pi * k;
 
       /* evaluate fixed time-invariant effect */
-      vector<Type> fix_invariant(n_y);
-      for(size_t j = 0; j < n_y; ++j){
-        fix_invariant[j] = zero;
-        for(size_t i = 0; i < n_fix; i++)
-          fix_invariant[j] += X(i, marker_idx) * agamma(i, j);
-      }
+      vector<Type> const fix_invariant =
+        (agamma.transpose() * X.col(marker_idx)).array();
 
       /* terms from the survival outcome */
       {
@@ -505,63 +686,62 @@ public:
 
         /* add term from survival probability */
         Type const f1 = exp(z_dot_d + alpha_fix_invariant),
-                   f2 = comp_cum_haz(lb, ub, va_mu, k, Lambda);
+                   f2 = comp_cum_haz(lb, ub, g, va_mu, k, Lambda);
         surv_term -= f1 * f2;
         term += surv_term;
       }
 
-      /* terms from marker */
-      {
-        Type marker_term(0.);
-        size_t const marker_end = marker_idx + n_markers[g];
-        for(; marker_idx < marker_end; ++marker_idx){
-          vector<Type> residual(n_y);
-          for(size_t i = 0; i < n_y; ++i)
-            residual[i] = markers(i, marker_idx) - fix_invariant[i];
-
-          double const obs_time_i = asDouble(m_time[marker_idx]);
-          if(has_g){
-            my_int.eval_g(g_wrk, obs_time_i);
-            vector<Type> const type_g_wrk = vec_eigen_arma<Type>(g_wrk);
-
-            for(size_t j = 0; j < n_y; ++j)
-              for(size_t i = 0; i < dim_g; ++i)
-                residual[j] -= aB(i, j) * type_g_wrk[i];
-          }
-
-          if(has_m){
-            my_int.eval_m(m_wrk, obs_time_i);
-            vector<Type> const type_m_wrk = vec_eigen_arma<Type>(m_wrk);
-
-            {
-              Type const *mu_i = &U_mean[0L];
-              for(size_t j = 0; j < n_y; ++j)
-                for(size_t i = 0; i < dim_m; ++i, ++mu_i)
-                  residual[j] -= *mu_i * type_m_wrk[i];
-            }
+      /* terms from marker. The taped operations only involve the
+       * precomputed cross products. Let R = Y - theta W be the residuals
+       * where theta = (fixed effects, B^T, U^T). Then the terms are
+       * -tr(Sigma^{-1} R R^T) / 2 and the terms from the variance of the
+       * random effects */
+      if(n_markers[g] > 0){
+        marker_dat::group_dat const &md = mdat->groups[g];
+        size_t const n_w = mdat->n_w,
+                   off_m = mdat->off_m;
+
+        matrix<Type> theta(n_y, n_w);
+        for(size_t j = 0; j < n_y; ++j){
+          theta(j, 0L) = fix_invariant[j];
+          if(has_g)
+            for(size_t i = 0; i < dim_g; ++i)
+              theta(j, 1L + i) = aB(i, j);
+          if(has_m)
+            for(size_t i = 0; i < dim_m; ++i)
+              theta(j, off_m + i) = U_mean[j * dim_m + i];
+        }
 
-            /* TODO: Do something smarter... */
-            matrix<Type> M(n_y, K);
-            M.setZero();
-            for(size_t i = 0; i < n_y; ++i){
-              Type const *m_i = &type_m_wrk[0L];
-              size_t const j_end =  (i + 1L) * dim_m;
-              for(size_t j = i * dim_m; j < j_end; ++j, ++m_i)
-                M(i, j) = *m_i;
+        matrix<Type> const WW = mat_eigen_arma<Type>(md.WW),
+                       theta_WY = theta * mat_eigen_arma<Type>(md.WY),
+                             RR = mat_eigen_arma<Type>(md.YY) - theta_WY
+                                - theta_WY.transpose()
+                                + theta * WW * theta.transpose();
+        Type marker_term = -half * mat_mult_trace(RR, sigma_inv);
+
+        if(has_m){
+          /* the sum of m(t)m(t)^T over the observations */
+          matrix<Type> const S = WW.block(off_m, off_m, dim_m, dim_m);
+          Type lambda_term(0.);
+          for(size_t b = 0; b < n_y; ++b){
+            vector<Type> const S_k_b =
+              (S * k.segment(b * dim_m, dim_m).matrix()).array();
+            for(size_t a = 0; a < n_y; ++a){
+              matrix<Type> const L_ab =
+                Lambda.block(a * dim_m, b * dim_m, dim_m, dim_m);
+              vector<Type> const k_a = k.segment(a * dim_m, dim_m);
+              lambda_term += sigma_inv(a, b) * (
+                mat_mult_trace(L_ab, S) - two_pi * vec_dot(k_a, S_k_b));
             }
-
-            matrix<Type> tmp_mat = M *  Lambda * M.transpose();
-            vector<Type> tmp_vec = M * k;
-            marker_term -=
-              half * (mat_mult_trace(tmp_mat, sigma_inv)
-                        - two_pi * quad_form_sym(tmp_vec, sigma_inv));
           }
-
-          marker_term -= half * quad_form_sym(residual, sigma_inv);
+          marker_term -= half * lambda_term;
         }
 
         term += marker_term;
+      }
+      marker_idx += n_markers[g];
 
+      {
         /* terms from the random effect prior */
         /* TODO: can be done smarter */
         Type prior_term = - half * (
@@ -574,12 +754,9 @@ public:
 
       /* add entropy terms*/
       {
-        Type misc_term = half * atomic::logdet(Lambda);
-        auto const llt_mat = Lambda.llt();
-        vector<Type> const va_rho_scaled =
-          (llt_mat.matrixU() * va_rho.matrix()).array() + small;
+        Type misc_term = half * ava_par.va_logdets[g - g_begin];
         misc_term -= GaussHermite::SNVA::entropy_term(
-          vec_dot(va_rho_scaled, va_rho_scaled), n_nodes);
+          rho_quad + small, n_nodes);
         term += misc_term;
       }
 
@@ -590,12 +767,13 @@ public:
       /* only have to add one more term so just return */
       return result;
 
+    size_t const n_obs_sub = marker_idx - marker_begin;
     Type norm_constant =
-      - Type(double(n_obs_marker * n_y) / 2. * log(2 * M_PI))
-      - Type(double(n_groups) / 2.) * log_det_psi
-      - Type(double(n_obs_marker) / 2.) * log_det_sigma
-      + Type(double(K * n_groups) / 2.)
-      - Type(double(n_groups) * M_LN2);
+      - Type(double(n_obs_sub * n_y) / 2. * log(2 * M_PI))
+      - Type(double(n_grp_sub) / 2.) * log_det_psi
+      - Type(double(n_obs_sub) / 2.) * log_det_sigma
+      + Type(double(K * n_grp_sub) / 2.)
+      - Type(double(n_grp_sub) * M_LN2);
 
     result += norm_constant;
 
@@ -610,7 +788,158 @@ class VA_func {
   template<class Type>
   using ADFun = CppAD::ADFun<Type>;
 
-  size_t n_pars;
+  size_t n_pars, n_shared, n_va_grp;
+  /* kept to make the gradient tapes on request */
+  Rcpp::List data, parameters;
+  unsigned n_threads = 1L;
+  /* the marker cross products which are shared by all the workers */
+  std::shared_ptr<marker_dat const> mdat;
+  /* the bases at the quadrature nodes of each group which are shared by
+   * the integral objects of all the tapes. The rules are selected and the
+   * bases are evaluated at the starting values in the constructor */
+  std::shared_ptr<fastgl::joint::subject_node_bases> node_bases;
+
+  /* tapes for each group used in the incremental evaluations. The
+   * arguments are the shared parameters followed by the VA parameters of
+   * the group. lb is the lower bound term at the parameters in inc_par if
+   * valid is true */
+  struct group_tape {
+    std::unique_ptr<ADFun<double> > func;
+    double lb = 0.;
+    bool valid = false;
+  };
+  std::vector<group_tape> group_tapes;
+  std::vector<double> inc_par;
+
+  void build_group_tapes(){
+    setup_parallel_ad setup_ADd(n_threads);
+    VA_worker<ADd> w(data, parameters, mdat);
+    splines_n_cum_ints_ADd_grp = w.get_splines_n_cum_ints(node_bases);
+    std::vector<group_tape> out(w.n_groups);
+
+    /* the integral objects have mutable workspaces. Thus, the tape of group
+     * g is recorded and evaluated by thread g % n_threads */
+#ifdef _OPENMP
+#pragma omp parallel for if(w.n_blocks > 1L) schedule(static, 1)
+#endif
+    for(unsigned t = 0; t < w.n_blocks; ++t)
+      for(size_t g = t; g < w.n_groups; g += w.n_blocks){
+        out[g].func.reset(new ADFun<double>());
+
+        vector<ADd> args = w.get_group_args<ADd>(g);
+        {
+          survTMB::scoped_taping_arena arena;
+          CppAD::Independent(args);
+          vector<ADd> y(1);
+          y[0] = w(args, splines_n_cum_ints_ADd_grp, g, g + 1L);
+
+          out[g].func->Dependent(args, y);
+        }
+        out[g].func->optimize();
+      }
+
+    group_tapes = std::move(out);
+    inc_par.assign(n_pars, std::numeric_limits<double>::quiet_NaN());
+  }
+
+  /* returns the groups which need to be evaluated at par in the incremental
+   * mode and updates the cached shared parameters. All groups are
+   * invalidated if a shared parameter changed */
+  std::vector<size_t> get_changed_groups(double const *par){
+    if(group_tapes.empty())
+      build_group_tapes();
+
+    if(!std::equal(par, par + n_shared, inc_par.begin())){
+      for(auto &gt : group_tapes)
+        gt.valid = false;
+      std::copy(par, par + n_shared, inc_par.begin());
+    }
+
+    std::vector<size_t> out;
+    for(size_t g = 0; g < group_tapes.size(); ++g){
+      size_t const va_begin = n_shared + g * n_va_grp;
+      if(!group_tapes[g].valid or !std::equal(
+          par + va_begin, par + va_begin + n_va_grp,
+          inc_par.begin() + va_begin))
+        out.emplace_back(g);
+    }
+    return out;
+  }
+
+  /* evaluates the tapes of the groups. The lower bound terms are cached and
+   * the gradient with respect to the shared parameters is summed in
+   * grad_shared if grad_shared is not a nullptr. The gradient of the VA
+   * parameters are written to grad_va which has space for all
+   * parameters */
+  void eval_groups(double const *par, std::vector<size_t> const &groups,
+                   double * const grad_shared, double * const grad_va){
+    size_t const n_eval = groups.size(),
+            n_tape_args = n_shared + n_va_grp;
+    bool const do_grad = grad_va;
+    if(do_grad)
+      grad_red.resize(n_threads, n_shared);
+
+#ifdef _OPENMP
+#pragma omp parallel for if(n_threads > 1L and n_eval > 1L) schedule(static, 1)
+#endif
+    for(unsigned t = 0; t < n_threads; ++t){
+      vector<double> args(n_tape_args), w(1);
+      w[0] = 1;
+      std::copy(par, par + n_shared, args.data());
+      if(do_grad)
+        grad_red.zero(t);
+
+      /* the tape of group g is evaluated by the thread which recorded it */
+      for(size_t const g : groups){
+        if(g % n_threads != t)
+          continue;
+        size_t const va_begin = n_shared + g * n_va_grp;
+        std::copy(par + va_begin, par + va_begin + n_va_grp,
+                  args.data() + n_shared);
+
+        group_tape &gt = group_tapes[g];
+        gt.lb = gt.func->Forward(0, args)[0];
+        if(do_grad){
+          vector<double> const grad_g = gt.func->Reverse(1, w);
+          double * const gs = grad_red.block(t);
+          for(size_t j = 0; j < n_shared; ++j)
+            gs[j] += grad_g[j];
+          std::copy(grad_g.data() + n_shared, grad_g.data() + n_tape_args,
+                    grad_va + va_begin);
+        }
+
+        std::copy(par + va_begin, par + va_begin + n_va_grp,
+                  inc_par.begin() + va_begin);
+        gt.valid = true;
+      }
+    }
+
+    if(do_grad)
+      grad_red.reduce(grad_shared, n_threads);
+  }
+
+  void build_sparse_hess(){
+    setup_parallel_ad setup_ADd(n_threads);
+#ifdef _OPENMP
+    if(n_threads > 1L)
+      CppAD::parallel_ad<ADdd>();
+#endif
+
+    VA_worker<ADddd> w(data, parameters, mdat);
+    splines_n_cum_ints_ADddd = w.get_splines_n_cum_ints(node_bases);
+    sparse_hess_dat.reset(new survTMB::sparse_hess_dat(w.n_blocks));
+    auto &shd = *sparse_hess_dat;
+
+#ifdef _OPENMP
+#pragma omp parallel for if(w.n_blocks > 1L)
+#endif
+    for(unsigned b = 0; b < w.n_blocks; ++b)
+      shd.record_block(
+        b, w.get_concatenated_args<ADddd>(),
+        [&](vector<ADddd> &x){ return w(x, splines_n_cum_ints_ADddd); });
+
+    shd.merge();
+  }
 
 public:
 
@@ -620,31 +949,161 @@ public:
 
   std::vector<std::unique_ptr<splines_n_cum_haz_base<ADd> > >
     splines_n_cum_ints_ADd;
+  std::vector<std::unique_ptr<splines_n_cum_haz_base<ADddd> > >
+    splines_n_cum_ints_ADddd;
+  std::vector<std::unique_ptr<splines_n_cum_haz_base<ADd> > >
+    splines_n_cum_ints_ADd_grp;
   std::vector<std::unique_ptr<ADFun<double> > > funcs;
+  std::unique_ptr<survTMB::sparse_hess_dat> sparse_hess_dat;
+
+  /* buffers used to sum the output from the blocks */
+  survTMB::block_reducer lb_red, grad_red, hess_red, hess_vec_red;
 
-  VA_func(Rcpp::List data, Rcpp::List parameters){
+  /* evaluates the lower bound. par points to get_n_pars() elements */
+  double eval_lb(double const *par){
+    /* CppAD needs its own vector but it is shared by the threads */
+    vector<double> parv(n_pars);
+    std::copy(par, par + n_pars, parv.data());
+
+    unsigned const n_blocks = funcs.size();
+    lb_red.resize(n_blocks, 1L);
+#ifdef _OPENMP
+#pragma omp parallel for if(n_blocks > 1L) schedule(static, 1)
+#endif
+    for(unsigned i = 0; i < n_blocks; ++i)
+      *lb_red.block(i) = funcs[i]->Forward(0, parv)[0];
+
+    double out(0);
+    lb_red.reduce(&out);
+    return out;
+  }
+
+  /* evaluates the gradient and writes it to out. Both par and out must
+   * have get_n_pars() elements */
+  void eval_grad(double const *par, double * const out){
+    vector<double> parv(n_pars);
+    std::copy(par, par + n_pars, parv.data());
+
+    unsigned const n_blocks = funcs.size();
+    grad_red.resize(n_blocks, n_pars);
+
+#ifdef _OPENMP
+#pragma omp parallel for if(n_blocks > 1L) schedule(static, 1)
+#endif
+    for(unsigned i = 0; i < n_blocks; ++i){
+      funcs[i]->Forward(0, parv);
+      vector<double> w(1);
+      w[0] = 1;
+
+      vector<double> const grad_i = funcs[i]->Reverse(1, w);
+      std::copy(grad_i.data(), grad_i.data() + n_pars, grad_red.block(i));
+    }
+
+    grad_red.reduce(out, n_blocks);
+  }
+
+  /* returns the object to compute the sparse Hessian. It is made if it does
+   * not exist */
+  survTMB::sparse_hess_dat & get_sparse_hess_dat(){
+    if(!sparse_hess_dat)
+      build_sparse_hess();
+    return *sparse_hess_dat;
+  }
+
+  /* evaluates the lower bound like eval_lb but only the terms of the
+   * groups whose parameters changed since the last incremental evaluation
+   * are computed. All groups are computed if a shared parameter changed */
+  double eval_lb_incremental(double const *par){
+    std::vector<size_t> const changed = get_changed_groups(par);
+    eval_groups(par, changed, nullptr, nullptr);
+
+    double out(0);
+    for(auto const &gt : group_tapes)
+      out += gt.lb;
+    return out;
+  }
+
+  /* computes the elements of the gradient in indices and writes them to
+   * out. Only the terms of the groups which the elements depend on are
+   * computed. These are all groups if a shared parameter is in indices */
+  void eval_grad_subset(double const *par, std::vector<size_t> const &indices,
+                        double * const out){
+    if(group_tapes.empty())
+      build_group_tapes();
+
+    bool any_shared(false);
+    std::vector<bool> needed(group_tapes.size(), false);
+    for(size_t idx : indices){
+      if(idx >= n_pars)
+        throw std::invalid_argument("eval_grad_subset: invalid indices");
+      if(idx < n_shared)
+        any_shared = true;
+      else
+        needed[(idx - n_shared) / n_va_grp] = true;
+    }
+
+    /* updates the cache of the shared parameters */
+    get_changed_groups(par);
+    std::vector<size_t> groups;
+    for(size_t g = 0; g < needed.size(); ++g)
+      if(any_shared or needed[g])
+        groups.emplace_back(g);
+
+    std::vector<double> grad(n_pars, 0.);
+    eval_groups(par, groups, grad.data(), grad.data());
+    for(size_t i = 0; i < indices.size(); ++i)
+      out[i] = grad[indices[i]];
+  }
+
+  /* adds the tapes used in the incremental evaluations */
+  void add_group_tapes(survTMB::tape_info &info) const {
+    for(size_t g = 0; g < group_tapes.size(); ++g)
+      info.add("group", g, *group_tapes[g].func);
+  }
+
+  VA_func(Rcpp::List data, Rcpp::List parameters):
+  data(data), parameters(parameters) {
     {
       /* to compute function and gradient */
       VA_worker<ADd> w(data, parameters);
-      splines_n_cum_ints_ADd = w.get_splines_n_cum_ints();
+      node_bases = w.get_node_bases();
+      splines_n_cum_ints_ADd = w.get_splines_n_cum_ints(node_bases);
+      mdat = w.get_marker_data();
       funcs.resize(w.n_blocks);
       n_pars = w.n_pars;
+      n_shared = w.n_shared;
+      n_va_grp = w.n_va_grp;
+      n_threads = w.n_blocks;
       vector<ADd> args = w.get_concatenated_args<ADd>();
 
+      /* select the rule and evaluate the node bases of each group once at
+       * the starting values before any tape is recorded. The rules are then
+       * fixed for the life of the tapes such that the lower bound is a
+       * smooth function of the parameters */
+      w(args, splines_n_cum_ints_ADd);
+
 #ifdef _OPENMP
 #pragma omp parallel for if(w.n_blocks > 1L) firstprivate(args)
 #endif
       for(unsigned i = 0; i < w.n_blocks; ++i){
         funcs[i].reset(new ADFun<double>());
 
-        CppAD::Independent(args);
-        vector<ADd> y(1);
-        y[0] = w(args, splines_n_cum_ints_ADd);
+        {
+          survTMB::scoped_taping_arena arena;
+          CppAD::Independent(args);
+          vector<ADd> y(1);
+          y[0] = w(args, splines_n_cum_ints_ADd);
 
-        funcs[i]->Dependent(args, y);
+          funcs[i]->Dependent(args, y);
+        }
         funcs[i]->optimize();
       }
     }
+
+    /* the Hessian objects are otherwise made on the first request */
+    DATA_LOGICAL(sparse_hess);
+    if(sparse_hess)
+      build_sparse_hess();
   }
 };
 } // namesapce
@@ -664,63 +1123,194 @@ double joint_funcs_eval_lb(SEXP p, SEXP par){
   shut_up();
 
   Rcpp::XPtr<VA_func > ptr(p);
-  std::vector<std::unique_ptr<CppAD::ADFun<double> > > &funcs = ptr->funcs;
-  vector<double> parv = get_vec<double>(par);
+  Rcpp::NumericVector parv(par);
   if((size_t)parv.size() != ptr->get_n_pars())
     throw std::invalid_argument("joint_funcs_eval_lb: invalid par");
 
-  unsigned const n_blocks = ptr->funcs.size();
-  double out(0);
+  return ptr->eval_lb(&parv[0]);
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::NumericVector joint_funcs_eval_grad(SEXP p, SEXP par){
+  shut_up();
+
+  Rcpp::XPtr<VA_func > ptr(p);
+  Rcpp::NumericVector parv(par);
+  if((size_t)parv.size() != ptr->get_n_pars())
+    throw std::invalid_argument("joint_funcs_eval_grad: invalid par");
+
+  Rcpp::NumericVector out(parv.size());
+  ptr->eval_grad(&parv[0], &out[0]);
+  return out;
+}
+
+/**
+ evaluates the lower bound like joint_funcs_eval_lb but only recomputes the
+ terms of the groups whose parameters changed since the last call. A tape
+ for each group is made on the first call.
+ */
+// [[Rcpp::export(rng = false)]]
+double joint_funcs_eval_lb_incremental(SEXP p, SEXP par){
+  shut_up();
+
+  Rcpp::XPtr<VA_func > ptr(p);
+  Rcpp::NumericVector parv(par);
+  if((size_t)parv.size() != ptr->get_n_pars())
+    throw std::invalid_argument(
+        "joint_funcs_eval_lb_incremental: invalid par");
+
+  return ptr->eval_lb_incremental(&parv[0]);
+}
+
+/**
+ returns the elements of the gradient in indices. Only the terms of the
+ groups which the elements depend on are computed.
+
+ Args:
+   indices: one-based indices of the elements of the gradient.
+ */
+// [[Rcpp::export(rng = false)]]
+Rcpp::NumericVector joint_funcs_eval_grad_subset
+  (SEXP p, SEXP par, Rcpp::IntegerVector indices){
+  shut_up();
+
+  Rcpp::XPtr<VA_func > ptr(p);
+  Rcpp::NumericVector parv(par);
+  size_t const n_pars = ptr->get_n_pars();
+  if((size_t)parv.size() != n_pars)
+    throw std::invalid_argument("joint_funcs_eval_grad_subset: invalid par");
+
+  std::vector<size_t> idx(indices.size());
+  for(R_xlen_t i = 0; i < indices.size(); ++i){
+    if(indices[i] < 1 or (size_t)indices[i] > n_pars)
+      throw std::invalid_argument(
+          "joint_funcs_eval_grad_subset: invalid indices");
+    idx[i] = indices[i] - 1L;
+  }
+
+  Rcpp::NumericVector out(idx.size());
+  if(idx.size() > 0)
+    ptr->eval_grad_subset(&parv[0], idx, &out[0]);
+  return out;
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::NumericVector joint_funcs_eval_hess_vec(SEXP p, SEXP par, SEXP v){
+  shut_up();
+
+  Rcpp::XPtr<VA_func > ptr(p);
+  vector<double> parv = get_vec<double>(par),
+                   vv = get_vec<double>(v);
+  if((size_t)parv.size() != ptr->get_n_pars())
+    throw std::invalid_argument("joint_funcs_eval_hess_vec: invalid par");
+  if(vv.size() != parv.size())
+    throw std::invalid_argument("joint_funcs_eval_hess_vec: invalid v");
+
+  /* a first order forward sweep and a second order reverse sweep on the
+   * tapes of the lower bound yield the Hessian-vector product */
+  std::vector<std::unique_ptr<CppAD::ADFun<double> > > &funcs = ptr->funcs;
+  unsigned const n_blocks = funcs.size();
+  std::size_t const n = parv.size();
+  survTMB::block_reducer &red = ptr->hess_vec_red;
+  red.resize(n_blocks, n);
+
 #ifdef _OPENMP
-/* #pragma omp parallel for if(n_blocks > 1L) firstprivate(parv) reduction(+:out) */
-#pragma omp parallel for ordered if(n_blocks > 1L) firstprivate(parv)  schedule(static, 1)
+#pragma omp parallel for if(n_blocks > 1L) schedule(static, 1)
 #endif
   for(unsigned i = 0; i < n_blocks; ++i){
-    double const term = funcs[i]->Forward(0, parv)[0];
-#ifdef _OPENMP
-    /* TODO: replace with a reduction */
-#pragma omp ordered
-#endif
-    out += term;
+    vector<double> w(1);
+    w[0] = 1;
+    funcs[i]->Forward(0, parv);
+    survTMB::hess_vec_fwd_rev(*funcs[i], vv, w, red.block(i), n);
   }
 
+  Rcpp::NumericVector out(n);
+  red.reduce(&out[0], n_blocks);
   return out;
 }
 
 // [[Rcpp::export(rng = false)]]
-Rcpp::NumericVector joint_funcs_eval_grad(SEXP p, SEXP par){
+Rcpp::NumericMatrix joint_funcs_eval_hess(SEXP p, SEXP par){
   shut_up();
 
   Rcpp::XPtr<VA_func > ptr(p);
-  std::vector<std::unique_ptr<CppAD::ADFun<double> > > &funcs = ptr->funcs;
   vector<double> parv = get_vec<double>(par);
   if((size_t)parv.size() != ptr->get_n_pars())
-    throw std::invalid_argument("joint_funcs_eval_grad: invalid par");
+    throw std::invalid_argument("joint_funcs_eval_hess: invalid par");
 
-  unsigned const n_blocks = ptr->funcs.size();
-  vector<double> grad(parv.size());
-  grad.setZero();
+  /* column k of the Hessian is the Hessian-vector product with the k'th
+   * unit vector. They are computed with the tapes of the lower bound */
+  std::vector<std::unique_ptr<CppAD::ADFun<double> > > &funcs = ptr->funcs;
+  unsigned const n_blocks = funcs.size(),
+                 n_vars   = parv.size();
+  survTMB::block_reducer &red = ptr->hess_red;
+  red.resize(n_blocks, n_vars * n_vars);
 
 #ifdef _OPENMP
-#pragma omp parallel for ordered if(n_blocks > 1L) firstprivate(parv) schedule(static, 1)
+#pragma omp parallel for if(n_blocks > 1L) schedule(static, 1)
 #endif
   for(unsigned i = 0; i < n_blocks; ++i){
-    funcs[i]->Forward(0, parv);
-    vector<double> w(1);
+    vector<double> w(1), dir(n_vars);
     w[0] = 1;
+    dir.setZero();
 
-    vector<double> grad_i = funcs[i]->Reverse(1, w);
-#ifdef _OPENMP
-    /* TODO: replace with a reduction */
-#pragma omp ordered
-#endif
-    grad += grad_i;
+    funcs[i]->Forward(0, parv);
+    double * const h = red.block(i);
+    for(unsigned k = 0; k < n_vars; ++k){
+      dir[k] = 1;
+      survTMB::hess_vec_fwd_rev(*funcs[i], dir, w, h + k * n_vars, n_vars);
+      dir[k] = 0;
+    }
   }
 
-  std::size_t const n = grad.size();
-  Rcpp::NumericVector out(n);
-  for(unsigned i = 0; i < n; ++i)
-    out[i] = grad[i];
-
+  Rcpp::NumericMatrix out(n_vars, n_vars);
+  red.reduce(&out[0], n_blocks);
   return out;
 }
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::List joint_funcs_eval_hess_sparse(SEXP p, SEXP par){
+  using Rcpp::Named;
+  shut_up();
+
+  Rcpp::XPtr<VA_func > ptr(p);
+  vector<double> parv = get_vec<double>(par);
+  if((size_t)parv.size() != ptr->get_n_pars())
+    throw std::invalid_argument("joint_funcs_eval_hess_sparse: invalid par");
+
+  auto &shd = ptr->get_sparse_hess_dat();
+  vector<double> const val = shd(parv);
+  vector<int> const &row_idx = shd.get_row_idx(),
+                    &col_idx = shd.get_col_idx();
+
+  std::size_t const n = val.size();
+  Rcpp::NumericVector val_out(n);
+  Rcpp::IntegerVector row_out(n), col_out(n);
+  for(std::size_t i = 0; i < n; ++i){
+    val_out[i] = val[i];
+    row_out[i] = row_idx[i];
+    col_out[i] = col_idx[i];
+  }
+
+  return Rcpp::List::create(
+    Named("val") = val_out, Named("row_idx") = row_out,
+    Named("col_idx") = col_out);
+}
+
+/* returns the size of each tape, the memory used by the Taylor coefficients
+ * and sparsity patterns, and the memory held by each thread */
+// [[Rcpp::export(rng = false)]]
+Rcpp::List joint_funcs_tape_info(SEXP p){
+  Rcpp::XPtr<VA_func> ptr(p);
+
+  survTMB::tape_info out;
+  out.add("lb", ptr->funcs);
+  if(ptr->sparse_hess_dat){
+    auto const &shd = *ptr->sparse_hess_dat;
+    for(std::size_t b = 0; b < shd.get_n_blocks(); ++b)
+      out.add("sparse_hess", b, shd.get_block(b).ddf);
+  }
+  ptr->add_group_tapes(out);
+
+  return out.to_R();
+}
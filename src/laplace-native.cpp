@@ -0,0 +1,462 @@
+#define INCLUDE_RCPP
+#include "get-x.h"
+#include "laplace.h"
+#include "dmvnorm_log.h"
+#include <memory>
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+using ADd   = CppAD::AD<double>;
+using ADdd  = CppAD::AD<ADd>;
+using ADddd = CppAD::AD<ADdd>;
+template<class Type>
+using ADFun = CppAD::ADFun<Type>;
+
+/* computes the log joint density of the outcomes and the random effects of
+ * one group. The arguments are eps, kappa, b, theta, and the random
+ * effects of the group */
+template<class Type>
+class laplace_group_worker {
+  Rcpp::List data, parameters;
+
+  SETUP_DATA;
+
+public:
+  std::size_t const n_b = b    .size(),
+                    n_t = theta.size(),
+               n_shared = 2L + n_b + n_t,
+                rng_dim = Z.cols(),
+                  n_arg = n_shared + rng_dim,
+               n_groups = grp_size.size();
+
+private:
+  survTMB::laplace_term_func<Type> const term_func =
+    survTMB::get_laplace_term_func<Type>(link);
+
+  /* index of the first observation in each group and the number of
+   * observations as the last element */
+  std::vector<std::size_t> const grp_start = ([&](){
+    std::vector<std::size_t> out(n_groups + 1L);
+    out[0] = 0L;
+    for(unsigned g = 0; g < n_groups; ++g)
+      out[g + 1L] = out[g] + grp_size[g];
+    return out;
+  })();
+
+public:
+  laplace_group_worker(Rcpp::List data, Rcpp::List parameters):
+  data(data), parameters(parameters) {
+    SETUP_DATA_CHECK;
+
+    data = Rcpp::List();
+    parameters = Rcpp::List();
+  }
+
+  /* returns the arguments with the random effects set to zero */
+  template<typename Tout>
+  vector<Tout> get_args() const {
+    vector<Tout> out(n_arg);
+    vector<Tout> const shared = ::get_args_va<Tout, Type>(
+      eps, kappa, b, theta, vector<Type>());
+    for(unsigned i = 0; i < n_shared; ++i)
+      out[i] = shared[i];
+    for(unsigned i = n_shared; i < n_arg; ++i)
+      out[i] = Tout(0.);
+    return out;
+  }
+
+  Type operator()(vector<Type> const &args, unsigned const g) const {
+    if((unsigned)args.size() != n_arg)
+      error("laplace_group_worker: invalid args length");
+    if(g >= n_groups)
+      error("laplace_group_worker: invalid group");
+
+    Type const eps_a = args[0],
+             kappa_a = args[1],
+             eps_log = log(eps_a);
+    vector<Type> const b_a     = args.segment(2L, n_b),
+                       theta_a = args.segment(2L + n_b, n_t);
+    matrix<Type> u(rng_dim, 1L);
+    for(unsigned k = 0; k < rng_dim; ++k)
+      u(k, 0) = args[n_shared + k];
+
+    auto const b_vec = b_a.matrix();
+    Type out(0.);
+    for(std::size_t i = grp_start[g]; i < grp_start[g + 1L]; ++i){
+      Type const eta  = (X .row(i) * b_vec)[0] + (Z.row(i) * u.col(0))[0],
+                 etaD = (XD.row(i) * b_vec)[0];
+      out += term_func(eta, etaD, event[i], eps_a, eps_log, kappa_a);
+    }
+
+    return out + survTMB::mult_var_dens(theta_a, u);
+  }
+};
+
+/* Laplace approximation which finds the modes of the random effects itself
+ * rather than using TMB's inner optimization. There is a tape for each group
+ * of the log joint density, its gradient, and the rows of the Hessian for
+ * the random effects. The modes are found with Newton's method with step
+ * halving starting at the previous modes. The gradient of the approximation
+ * is computed with implicit differentiation using one reverse sweep for each
+ * group. */
+class laplace_native {
+  std::size_t n_para, n_shared, rng_dim, n_arg;
+
+  /* index in the tape output of the gradient and the Hessian rows */
+  std::size_t idx_grad() const {
+    return 1L;
+  }
+  std::size_t idx_hess(std::size_t const k) const {
+    return 1L + n_arg + k * n_arg;
+  }
+
+  struct group_tape {
+    std::unique_ptr<ADFun<double> > func;
+    /* the mode from the last evaluation */
+    vector<double> mode;
+  };
+  std::vector<group_tape> tapes;
+
+  /* maximum number of Newton iterations and the relative tolerance */
+  static constexpr unsigned max_it = 100L;
+  static constexpr double rel_tol = 1e-10;
+
+  /* result for one group */
+  struct mode_result {
+    CppAD::vector<double> x, out;
+    Eigen::LLT<Eigen::MatrixXd> llt;
+    bool succeeded;
+  };
+
+  /* sets the gradient of the log joint density wrt. the random effects and
+   * the negative Hessian of the random effects */
+  void set_newton_terms
+    (CppAD::vector<double> const &out, Eigen::VectorXd &gr,
+     Eigen::MatrixXd &neg_hess) const {
+    for(unsigned k = 0; k < rng_dim; ++k){
+      gr[k] = out[idx_grad() + n_shared + k];
+      for(unsigned l = 0; l < rng_dim; ++l)
+        neg_hess(k, l) = -out[idx_hess(k) + n_shared + l];
+    }
+  }
+
+  /* finds the mode of the random effects for group g */
+  void find_mode(double const *par, unsigned const g, mode_result &res){
+    group_tape &tape = tapes[g];
+    CppAD::vector<double> &x = res.x, &out = res.out;
+    x.resize(n_arg);
+    std::copy(par, par + n_shared, &x[0]);
+    for(unsigned k = 0; k < rng_dim; ++k)
+      x[n_shared + k] = tape.mode[k];
+
+    out = tape.func->Forward(0, x);
+    Eigen::VectorXd gr(rng_dim);
+    Eigen::MatrixXd neg_hess(rng_dim, rng_dim);
+    CppAD::vector<double> x_new(n_arg);
+
+    /* true if the Taylor coefficients in the tape are at x */
+    bool tape_at_x(true);
+    res.succeeded = false;
+    for(unsigned it = 0; it < max_it and std::isfinite(out[0]); ++it){
+      set_newton_terms(out, gr, neg_hess);
+      res.llt.compute(neg_hess);
+      if(res.llt.info() != Eigen::Success){
+        /* use a scaled identity matrix instead */
+        double const scale = std::max(
+          neg_hess.diagonal().cwiseAbs().maxCoeff(), 1.);
+        neg_hess.setIdentity();
+        neg_hess *= scale;
+        res.llt.compute(neg_hess);
+      }
+
+      Eigen::VectorXd const step = res.llt.solve(gr);
+      double u_max(0.);
+      for(unsigned k = 0; k < rng_dim; ++k)
+        u_max = std::max(u_max, std::abs(x[n_shared + k]));
+      if(step.cwiseAbs().maxCoeff() < rel_tol * (1. + u_max)){
+        res.succeeded = true;
+        break;
+      }
+
+      /* step halving */
+      bool found_better(false);
+      double step_size(1.);
+      for(unsigned i = 0; i < 30L and !found_better; ++i, step_size /= 2){
+        std::copy(&x[0], &x[0] + n_shared, &x_new[0]);
+        for(unsigned k = 0; k < rng_dim; ++k)
+          x_new[n_shared + k] = x[n_shared + k] + step_size * step[k];
+
+        CppAD::vector<double> out_new = tape.func->Forward(0, x_new);
+        found_better = std::isfinite(out_new[0]) and
+          out_new[0] >= out[0] - rel_tol * (1. + std::abs(out[0]));
+        tape_at_x = found_better;
+        if(found_better){
+          std::swap(x, x_new);
+          std::swap(out, out_new);
+        }
+      }
+
+      if(!found_better)
+        break;
+    }
+
+    if(!tape_at_x)
+      out = tape.func->Forward(0, x);
+
+    set_newton_terms(out, gr, neg_hess);
+    res.llt.compute(neg_hess);
+    res.succeeded = res.llt.info() == Eigen::Success and
+      std::isfinite(out[0]);
+    if(res.succeeded)
+      for(unsigned k = 0; k < rng_dim; ++k)
+        tape.mode[k] = x[n_shared + k];
+  }
+
+  /* returns the log of the Laplace approximation for one group and the
+   * result of the mode search */
+  double eval_group(double const *par, unsigned const g, mode_result &res){
+    find_mode(par, g, res);
+    if(!res.succeeded)
+      return std::numeric_limits<double>::quiet_NaN();
+
+    auto const &L = res.llt.matrixLLT();
+    double log_det(0.);
+    for(unsigned k = 0; k < rng_dim; ++k)
+      log_det += 2 * log(L(k, k));
+
+    static double const log_2_pi = log(2 * M_PI);
+    return res.out[0] + .5 * rng_dim * log_2_pi - .5 * log_det;
+  }
+
+  /* adds the gradient of the log of the Laplace approximation for group g
+   * to gr. The mode must have been found already.
+   *
+   * Let A be the negative Hessian wrt. the random effects u at the mode and
+   * phi be the model parameters. Then the derivative of the mode is
+   * A^(-1)H_(u, phi) and the gradient is
+   *   d l / d phi - 1/2(t_phi + (A^(-1)t_u)^T H_(u, phi))
+   * where t is the gradient wrt. (phi, u) of tr(A^(-1)A(phi, u)) with A^(-1)
+   * held fixed */
+  void add_grad_group(unsigned const g, mode_result const &res,
+                      double * const gr) const {
+    Eigen::MatrixXd const A_inv = res.llt.solve(
+      Eigen::MatrixXd::Identity(rng_dim, rng_dim));
+
+    CppAD::vector<double> w(res.out.size());
+    std::fill(&w[0], &w[0] + w.size(), 0.);
+    for(unsigned k = 0; k < rng_dim; ++k)
+      for(unsigned l = 0; l < rng_dim; ++l)
+        w[idx_hess(k) + n_shared + l] = -A_inv(k, l);
+
+    CppAD::vector<double> const t = tapes[g].func->Reverse(1, w);
+    Eigen::VectorXd t_u(rng_dim);
+    for(unsigned k = 0; k < rng_dim; ++k)
+      t_u[k] = t[n_shared + k];
+    Eigen::VectorXd const v = A_inv * t_u;
+
+    for(unsigned j = 0; j < n_shared; ++j){
+      double v_H(0.);
+      for(unsigned k = 0; k < rng_dim; ++k)
+        v_H += v[k] * res.out[idx_hess(k) + j];
+
+      gr[j] += res.out[idx_grad() + j] - .5 * (t[j] + v_H);
+    }
+  }
+
+public:
+  unsigned n_threads = 1L;
+
+  std::size_t get_n_para() const {
+    return n_para;
+  }
+
+  laplace_native(Rcpp::List data, Rcpp::List parameters) {
+    /* needed to record the tapes in parallel */
+    setup_parallel_ad setup_ADd(Rcpp::as<unsigned>(data["n_threads"]));
+#ifdef _OPENMP
+    if(setup_ADd.nthreads > 1L)
+      CppAD::parallel_ad<ADdd>();
+#endif
+
+    laplace_group_worker<ADddd> w(data, parameters);
+    n_para   = w.n_shared;
+    n_shared = w.n_shared;
+    rng_dim  = w.rng_dim;
+    n_arg    = w.n_arg;
+#ifdef _OPENMP
+    n_threads = std::max(1, Rcpp::as<int>(data["n_threads"]));
+#endif
+
+    unsigned const n_groups = w.n_groups;
+    tapes.resize(n_groups);
+
+#ifdef _OPENMP
+#pragma omp parallel for if(n_threads > 1L) schedule(dynamic)
+#endif
+    for(unsigned g = 0; g < n_groups; ++g){
+      /* tape of the log joint density */
+      vector<ADddd> x = w.get_args<ADddd>();
+      CppAD::Independent(x);
+      vector<ADddd> y(1);
+      y[0] = w(x, g);
+      ADFun<ADdd> f_dens;
+      f_dens.Dependent(x, y);
+      f_dens.optimize();
+
+      /* tape of the density and its gradient */
+      vector<ADdd> xx(n_arg);
+      for(unsigned i = 0; i < n_arg; ++i)
+        xx[i] = CppAD::Value(x[i]);
+      CppAD::Independent(xx);
+      vector<ADdd> yy(1L + n_arg);
+      {
+        vector<ADdd> const val = f_dens.Forward(0, xx);
+        vector<ADdd> ww(1);
+        ww[0] = 1;
+        vector<ADdd> const gr = f_dens.Reverse(1, ww);
+        yy[0] = val[0];
+        for(unsigned i = 0; i < n_arg; ++i)
+          yy[1L + i] = gr[i];
+      }
+      ADFun<ADd> f_grad;
+      f_grad.Dependent(xx, yy);
+      f_grad.optimize();
+
+      /* tape of the density, its gradient, and the Hessian rows for the
+       * random effects */
+      vector<ADd> xxx(n_arg);
+      for(unsigned i = 0; i < n_arg; ++i)
+        xxx[i] = CppAD::Value(xx[i]);
+      CppAD::Independent(xxx);
+      vector<ADd> yyy(1L + n_arg + rng_dim * n_arg);
+      {
+        vector<ADd> const val = f_grad.Forward(0, xxx);
+        for(unsigned i = 0; i <= n_arg; ++i)
+          yyy[i] = val[i];
+
+        vector<ADd> ww(1L + n_arg);
+        for(unsigned k = 0; k < rng_dim; ++k){
+          ww.setZero();
+          ww[1L + n_shared + k] = 1;
+          vector<ADd> const hess_row = f_grad.Reverse(1, ww);
+          for(unsigned i = 0; i < n_arg; ++i)
+            yyy[idx_hess(k) + i] = hess_row[i];
+        }
+      }
+
+      group_tape &tape = tapes[g];
+      tape.func.reset(new ADFun<double>());
+      tape.func->Dependent(xxx, yyy);
+      tape.func->optimize();
+      tape.mode = vector<double>(rng_dim);
+      tape.mode.setZero();
+    }
+  }
+
+  /* returns the negative log of the Laplace approximation. The gradient is
+   * added to gr if it is not a nullptr */
+  double eval(double const *par, double * const gr){
+    std::size_t const n_groups = tapes.size();
+    std::vector<double> out_thread(n_threads, 0.);
+    std::vector<std::vector<double> > gr_thread;
+    if(gr)
+      gr_thread.assign(n_threads, std::vector<double>(n_para, 0.));
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(n_threads) if(n_threads > 1L)
+#endif
+    {
+#ifdef _OPENMP
+      std::size_t const t_idx = get_thread_num();
+#else
+      std::size_t const t_idx = 0L;
+#endif
+      mode_result res;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+      for(unsigned g = 0; g < n_groups; ++g){
+        out_thread[t_idx] -= eval_group(par, g, res);
+        if(gr and res.succeeded)
+          add_grad_group(g, res, gr_thread[t_idx].data());
+      }
+    }
+
+    double out(0.);
+    for(auto o : out_thread)
+      out += o;
+    if(gr){
+      std::fill(gr, gr + n_para, 0.);
+      for(auto const &gr_t : gr_thread)
+        for(unsigned j = 0; j < n_para; ++j)
+          gr[j] -= gr_t[j];
+    }
+
+    return out;
+  }
+
+  /* returns the modes from the last evaluation */
+  Rcpp::NumericMatrix get_modes() const {
+    Rcpp::NumericMatrix out(rng_dim, tapes.size());
+    for(unsigned g = 0; g < tapes.size(); ++g)
+      for(unsigned k = 0; k < rng_dim; ++k)
+        out(k, g) = tapes[g].mode[k];
+    return out;
+  }
+};
+
+} // namespace
+
+// [[Rcpp::export(rng = false)]]
+SEXP get_laplace_native
+  (Rcpp::List data, Rcpp::List parameters){
+  shut_up();
+
+  unsigned const n_threads(data["n_threads"]);
+  setup_parallel_ad setup_ADd(n_threads);
+
+  return Rcpp::XPtr<laplace_native>(new laplace_native(data, parameters));
+}
+
+// [[Rcpp::export(rng = false)]]
+double laplace_native_eval_fn
+  (SEXP p, SEXP par){
+  shut_up();
+
+  Rcpp::XPtr<laplace_native> ptr(p);
+  Rcpp::NumericVector parv(par);
+  if((size_t)parv.size() != ptr->get_n_para())
+    throw std::invalid_argument("laplace_native_eval_fn: invalid par");
+
+  return ptr->eval(&parv[0], nullptr);
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::NumericVector laplace_native_eval_grad
+  (SEXP p, SEXP par){
+  shut_up();
+
+  Rcpp::XPtr<laplace_native> ptr(p);
+  Rcpp::NumericVector parv(par);
+  if((size_t)parv.size() != ptr->get_n_para())
+    throw std::invalid_argument("laplace_native_eval_grad: invalid par");
+
+  Rcpp::NumericVector out(parv.size());
+  ptr->eval(&parv[0], &out[0]);
+  return out;
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::NumericMatrix laplace_native_get_modes(SEXP p){
+  Rcpp::XPtr<laplace_native> ptr(p);
+  return ptr->get_modes();
+}
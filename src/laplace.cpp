@@ -1,53 +1,9 @@
 #include "laplace.h"
 #include "dmvnorm_log.h"
 #include "utils.h"
-#include "pnorm-log.h"
-#include "utils.h"
 
 namespace survTMB {
 
-template<class Type>
-Type laplace_PH_terms
-  (Type const &eta, Type const &etaD, Type const &event,
-   Type const &eps, Type const &eps_log, Type const &kappa){
-  Type const H = exp(eta),
-             h = etaD * H,
-        if_low = event * eps_log - H - h * h * kappa,
-        if_ok  = event * log(h)  - H;
-  return CppAD::CondExpGe(h, eps, if_ok, if_low);
-}
-
-template<class Type>
-Type laplace_PO_terms
-  (Type const &eta, Type const &etaD, Type const &event,
-   Type const &eps, Type const &eps_log, Type const &kappa){
-  Type const too_large(30.),
-                   one(1.);
-
-  Type const H = CppAD::CondExpGe(
-    eta, too_large, eta, log(one + exp(eta))),
-             h = etaD * exp(eta - H),
-        if_low = event * eps_log - H - h * h * kappa,
-        if_ok  = event * log(h)  - H;
-  return CppAD::CondExpGe(h, eps, if_ok, if_low);
-}
-
-template<class Type>
-Type laplace_probit_terms
-  (Type const &eta, Type const &etaD, Type const &event,
-   Type const &eps, Type const &eps_log, Type const &kappa){
-  Type const tiny(std::numeric_limits<double>::epsilon()),
-             zero(0.),
-              one(1.);
-
-  Type const H = -pnorm_log(-eta),
-             h = etaD * dnorm(-eta, zero, one) /
-               (pnorm(-eta) + tiny),
-        if_low = event * eps_log - H - h * h * kappa,
-        if_ok  = event * log(h)  - H;
-  return CppAD::CondExpGe(h, eps, if_ok, if_low);
-}
-
 template<class Type>
 void laplace(COMMON_ARGS(Type, parallel_accumulator),
              matrix<Type> const &u){
@@ -67,18 +23,18 @@ void laplace(COMMON_ARGS(Type, parallel_accumulator),
   auto const b_vec = b.matrix().col(0);
 
   /* compute terms from conditional density */
-  typedef Type (*loop_func)(
-      Type const&, Type const&, Type const&,
-      Type const&, Type const&, Type const&);
+  using loop_func = laplace_term_func<Type>;
 
+  region_balancer const regions =
+    get_grp_regions(grp_size, *result.obj, true);
   auto cond_dens_loop = [&](loop_func func){
     unsigned i(0L);
     for(unsigned g = 0; g < grp_size.size(); ++g){
       unsigned const n_members = grp_size[g];
       /* do we need to anything on this thread? */
+      set_region(*result.obj, regions[g]);
       if(!is_my_region(*result.obj)){
         i += n_members;
-        result.obj->parallel_region();
         continue;
       }
 
@@ -113,16 +69,10 @@ void laplace(COMMON_ARGS(Type, parallel_accumulator),
     }
   };
 
-  if(link == "PH")
-    cond_dens_loop(laplace_PH_terms<Type>);
-  else if (link == "PO")
-    cond_dens_loop(laplace_PO_terms<Type>);
-  else if(link == "probit")
-    cond_dens_loop(laplace_probit_terms<Type>);
-  else
-    error("'%s' not implemented", link.c_str());
+  cond_dens_loop(get_laplace_term_func<Type>(link));
 
   /* log-likelihood terms from random effect density */
+  set_region(*result.obj, regions.rest());
   result -= mult_var_dens(theta, u);
 }
 
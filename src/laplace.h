@@ -3,8 +3,75 @@
 
 #include "tmb_includes.h"
 #include "common.h"
+#include "pnorm-log.h"
+#include <limits>
+#include <string>
 
 namespace survTMB {
+template<class Type>
+Type laplace_PH_terms
+  (Type const &eta, Type const &etaD, Type const &event,
+   Type const &eps, Type const &eps_log, Type const &kappa){
+  Type const H = exp(eta),
+             h = etaD * H,
+        if_low = event * eps_log - H - h * h * kappa,
+        if_ok  = event * log(h)  - H;
+  return CppAD::CondExpGe(h, eps, if_ok, if_low);
+}
+
+template<class Type>
+Type laplace_PO_terms
+  (Type const &eta, Type const &etaD, Type const &event,
+   Type const &eps, Type const &eps_log, Type const &kappa){
+  Type const too_large(30.),
+                   one(1.);
+
+  Type const H = CppAD::CondExpGe(
+    eta, too_large, eta, log(one + exp(eta))),
+             h = etaD * exp(eta - H),
+        if_low = event * eps_log - H - h * h * kappa,
+        if_ok  = event * log(h)  - H;
+  return CppAD::CondExpGe(h, eps, if_ok, if_low);
+}
+
+template<class Type>
+Type laplace_probit_terms
+  (Type const &eta, Type const &etaD, Type const &event,
+   Type const &eps, Type const &eps_log, Type const &kappa){
+  Type const tiny(std::numeric_limits<double>::epsilon()),
+             zero(0.),
+              one(1.);
+
+  Type const H = -pnorm_log(-eta),
+             h = etaD * dnorm(-eta, zero, one) /
+               (pnorm(-eta) + tiny),
+        if_low = event * eps_log - H - h * h * kappa,
+        if_ok  = event * log(h)  - H;
+  return CppAD::CondExpGe(h, eps, if_ok, if_low);
+}
+
+/* type of the functions above which compute the log conditional density of
+ * an outcome given the linear predictor, eta, and the derivative of the
+ * linear predictor with respect to time, etaD. */
+template<class Type>
+using laplace_term_func = Type (*)(
+    Type const&, Type const&, Type const&,
+    Type const&, Type const&, Type const&);
+
+/* returns the function above for a given link function */
+template<class Type>
+laplace_term_func<Type> get_laplace_term_func(std::string const &link){
+  if(link == "PH")
+    return laplace_PH_terms<Type>;
+  else if (link == "PO")
+    return laplace_PO_terms<Type>;
+  else if(link == "probit")
+    return laplace_probit_terms<Type>;
+
+  error("'%s' not implemented", link.c_str());
+  return nullptr;
+}
+
 /* Computes the log-likelihood for given random effects.
  *
  * Args:
@@ -18,6 +18,29 @@ void orth_poly::operator()(vec &out, double const x) const {
   out /= sqrt_norm2.subvec(1L, sqrt_norm2.n_elem - 1L);
 }
 
+void orth_poly::eval(vec const &x, mat &out) const {
+  size_t const n = x.n_elem,
+               m = get_n_basis();
+  out.set_size(n, m);
+  out.col(0).ones();
+
+  if(alpha.n_elem > 0L){
+    out.col(1) = x - alpha[0];
+    for(size_t c = 1; c < alpha.n_elem; c++){
+      double const a = alpha[c],
+                fac = norm2[c + 1L] / norm2[c],
+            * o_old = out.colptr(c - 1L),
+            * o_cur = out.colptr(c);
+      double * o_new = out.colptr(c + 1L);
+      for(size_t i = 0; i < n; ++i)
+        o_new[i] = (x[i] - a) * o_cur[i] - fac * o_old[i];
+    }
+  }
+
+  for(size_t c = 0; c < m; ++c)
+    out.col(c) /= sqrt_norm2[c + 1L];
+}
+
 orth_poly orth_poly::get_poly_basis(vec x, uword const degree, mat &X){
   size_t const n = x.n_elem,
               nc = degree + 1L;
@@ -85,14 +108,8 @@ List get_orth_poly
 arma::mat predict_orth_poly(arma::vec const &x, arma::vec const &alpha,
                             arma::vec const &norm2){
   orth_poly basis(alpha, norm2);
-  size_t const n = x.n_elem,
-               m = basis.get_n_basis();
-  arma::vec dum(m);
-  arma::mat out(n, m);
-  for(size_t i = 0; i < n; ++i){
-    basis(dum, x[i]);
-    out.row(i) = dum.t();
-  }
+  arma::mat out;
+  basis.eval(x, out);
 
   return out;
 }
@@ -31,6 +31,13 @@ struct orth_poly {
     return out;
   };
 
+  /**
+   evaluates the basis at each element of x. Row i of out is the basis at
+   x[i] such that the recurrence is computed for all points one column at a
+   time.
+   */
+  void eval(vec const &x, mat &out) const;
+
   /**
    behaves like poly(x, degree) though the output is not scaled to have unit
    norm buth rather a norm that scales like the number of samples and there
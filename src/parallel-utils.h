@@ -0,0 +1,230 @@
+#ifndef PARALLEL_UTILS_H
+#define PARALLEL_UTILS_H
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <utility>
+
+namespace survTMB {
+
+/* class to sum vectors from a fixed number of blocks. Each block gets its
+ * own preallocated buffer such that the blocks can be written to in
+ * parallel without any locks. The buffers are summed with a pairwise
+ * (tree) reduction in a fixed order such that the result does not depend
+ * on the scheduling nor the number of threads. The reduction is done in
+ * parallel over segments of the elements. */
+class block_reducer {
+  std::size_t n_blocks = 0L,
+              n_ele    = 0L;
+  std::vector<double> mem;
+
+  /* number of elements in each segment of the reduction */
+  static constexpr std::size_t seg_size = 1024L;
+
+public:
+  block_reducer() = default;
+  block_reducer(std::size_t const n_blocks, std::size_t const n_ele) {
+    resize(n_blocks, n_ele);
+  }
+
+  /* only reallocates if the dimensions change */
+  void resize(std::size_t const n_blocks_new, std::size_t const n_ele_new){
+    if(n_blocks_new == n_blocks and n_ele_new == n_ele)
+      return;
+
+    n_blocks = n_blocks_new;
+    n_ele    = n_ele_new;
+    mem.resize(n_blocks * n_ele);
+  }
+
+  std::size_t get_n_blocks() const {
+    return n_blocks;
+  }
+  std::size_t get_n_ele() const {
+    return n_ele;
+  }
+
+  /* returns a pointer to the buffer of block i */
+  double * block(std::size_t const i) {
+    return mem.data() + i * n_ele;
+  }
+
+  /* sets the buffer of block i to zero */
+  void zero(std::size_t const i) {
+    std::fill(block(i), block(i) + n_ele, 0.);
+  }
+
+  /* sums the buffers and writes the result to out. The buffers are
+   * overwritten */
+  void reduce(double * const out, unsigned const n_threads = 1L) {
+    if(n_blocks < 1L){
+      std::fill(out, out + n_ele, 0.);
+      return;
+    }
+
+    std::size_t const n_segs = (n_ele + seg_size - 1L) / seg_size;
+    double * const m = mem.data();
+    std::size_t const ne = n_ele,
+                      nb = n_blocks;
+
+#ifdef _OPENMP
+#pragma omp parallel for if(n_threads > 1L && n_segs > 1L) schedule(static)
+#endif
+    for(std::size_t s = 0; s < n_segs; ++s){
+      std::size_t const start = s * seg_size,
+                        len   = start + seg_size < ne ?
+                          seg_size : ne - start;
+
+      for(std::size_t stride = 1L; stride < nb; stride *= 2L)
+        for(std::size_t b = 0; b + stride < nb; b += 2L * stride){
+          double       * __restrict__ lhs = m +  b           * ne + start;
+          double const * __restrict__ rhs = m + (b + stride) * ne + start;
+          for(std::size_t j = 0; j < len; ++j)
+            lhs[j] += rhs[j];
+        }
+
+      std::copy(m + start, m + start + len, out + start);
+    }
+  }
+};
+
+/* class like block_reducer but where each block only depends on the first
+ * n_shared elements and some ranges of the remaining elements. Each block
+ * only stores these elements and the reduction is O(non-zero elements)
+ * rather than O(number of elements) for each block. */
+class sparse_block_reducer {
+public:
+  /* used to denote elements [begin, end) */
+  struct idx_range {
+    std::size_t begin, end;
+  };
+
+private:
+  std::size_t n_shared = 0L,
+              n_ele    = 0L;
+  /* ranges of each block after the shared elements and the position in the
+   * block's buffer where each range starts */
+  std::vector<std::vector<idx_range> > ranges;
+  std::vector<std::vector<std::size_t> > offsets;
+  std::vector<std::vector<double> > bufs;
+
+  /* number of elements in each segment of the reduction */
+  static constexpr std::size_t seg_size = 1024L;
+
+public:
+  sparse_block_reducer() = default;
+  sparse_block_reducer(std::size_t const n_shared, std::size_t const n_ele):
+  n_shared(n_shared), n_ele(n_ele) { }
+
+  /* returns the sorted and merged ranges of the elements which are true in
+   * pattern and which is not in the first n_shared elements */
+  static std::vector<idx_range> get_ranges
+    (std::vector<bool> const &pattern, std::size_t const n_shared){
+    std::vector<idx_range> out;
+    std::size_t const n = pattern.size();
+    for(std::size_t i = n_shared; i < n; ){
+      if(!pattern[i]){
+        ++i;
+        continue;
+      }
+
+      std::size_t const begin = i;
+      for(; i < n and pattern[i]; ++i);
+      out.push_back({ begin, i });
+    }
+
+    return out;
+  }
+
+  /* adds a block which depends on the given ranges */
+  void add_block(std::vector<idx_range> new_ranges){
+    std::vector<std::size_t> new_offsets;
+    new_offsets.reserve(new_ranges.size());
+    std::size_t n_own = n_shared;
+    for(auto const &r : new_ranges){
+      new_offsets.push_back(n_own);
+      n_own += r.end - r.begin;
+    }
+
+    ranges .emplace_back(std::move(new_ranges));
+    offsets.emplace_back(std::move(new_offsets));
+    bufs   .emplace_back(n_own);
+  }
+
+  std::size_t get_n_blocks() const {
+    return ranges.size();
+  }
+  std::size_t get_n_ele() const {
+    return n_ele;
+  }
+  /* number of elements stored for block i */
+  std::size_t get_n_own(std::size_t const i) const {
+    return bufs[i].size();
+  }
+  std::vector<idx_range> const & get_ranges(std::size_t const i) const {
+    return ranges[i];
+  }
+
+  /* copies the elements of block i from a dense vector with n_ele
+   * elements */
+  void set_block(std::size_t const i, double const * const dense){
+    double * const b = bufs[i].data();
+    std::copy(dense, dense + n_shared, b);
+
+    std::vector<idx_range> const &rs = ranges[i];
+    std::vector<std::size_t> const &os = offsets[i];
+    for(std::size_t k = 0; k < rs.size(); ++k)
+      std::copy(dense + rs[k].begin, dense + rs[k].end, b + os[k]);
+  }
+
+  /* sums the blocks in a fixed order and writes the result to out which
+   * has n_ele elements */
+  void reduce(double * const out, unsigned const n_threads = 1L) const {
+    std::size_t const n_blocks = ranges.size();
+
+    /* the shared elements */
+    std::fill(out, out + n_shared, 0.);
+    for(std::size_t i = 0; i < n_blocks; ++i){
+      double const * const b = bufs[i].data();
+      for(std::size_t j = 0; j < n_shared; ++j)
+        out[j] += b[j];
+    }
+
+    /* the remaining elements */
+    std::size_t const n_rest = n_ele - n_shared,
+                      n_segs = (n_rest + seg_size - 1L) / seg_size;
+#ifdef _OPENMP
+#pragma omp parallel for if(n_threads > 1L && n_segs > 1L) schedule(static)
+#endif
+    for(std::size_t s = 0; s < n_segs; ++s){
+      std::size_t const start = n_shared + s * seg_size,
+                        end   = std::min(start + seg_size, n_ele);
+      std::fill(out + start, out + end, 0.);
+
+      for(std::size_t i = 0; i < n_blocks; ++i){
+        std::vector<idx_range> const &rs = ranges[i];
+        std::vector<std::size_t> const &os = offsets[i];
+        double const * const b = bufs[i].data();
+
+        /* find the first range which ends after start */
+        auto r = std::upper_bound(
+          rs.begin(), rs.end(), start,
+          [](std::size_t const val, idx_range const &x){
+            return val < x.end;
+          });
+        for(; r != rs.end() and r->begin < end; ++r){
+          std::size_t const lb = std::max(r->begin, start),
+                            ub = std::min(r->end  , end);
+          double const *bi = b + os[r - rs.begin()] + (lb - r->begin);
+          for(std::size_t j = lb; j < ub; ++j, ++bi)
+            out[j] += *bi;
+        }
+      }
+    }
+  }
+};
+
+} // namespace survTMB
+
+#endif
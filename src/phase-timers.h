@@ -0,0 +1,188 @@
+#ifndef PHASE_TIMERS_H
+#define PHASE_TIMERS_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace survTMB {
+
+/* the phases which are timed */
+enum phase_type : unsigned {
+  phase_taping = 0L, phase_optimize, phase_forward, phase_reverse,
+  phase_reduction, n_phase_types
+};
+
+inline char const * phase_name(phase_type const p){
+  switch(p){
+  case phase_taping:    return "taping";
+  case phase_optimize:  return "optimize";
+  case phase_forward:   return "forward";
+  case phase_reverse:   return "reverse";
+  case phase_reduction: return "reduction";
+  default:
+    break;
+  }
+  return "unknown";
+}
+
+/* timers and counters of the main phases of the computations. Each thread
+ * writes to its own slot such that no locks are needed. The atomic functions
+ * write to the slot set for the calling thread with scoped_atomic_slot. */
+class phase_timers {
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct atomic_stats {
+    char const *name;
+    std::size_t count;
+    double time;
+  };
+
+  struct thread_slot {
+    std::array<double, n_phase_types> time;
+    std::array<std::size_t, n_phase_types> count;
+    /* there are few atomic functions so a linear search is fast */
+    std::vector<atomic_stats> atomics;
+    /* avoids false sharing between slots */
+    char padding[64];
+
+    thread_slot() {
+      reset();
+    }
+
+    void reset(){
+      time.fill(0.);
+      count.fill(0L);
+      atomics.clear();
+    }
+
+    void add_atomic(char const *name, std::size_t const n,
+                    double const elapsed){
+      for(auto &a : atomics)
+        if(a.name == name or std::strcmp(a.name, name) == 0){
+          a.count += n;
+          a.time  += elapsed;
+          return;
+        }
+      atomics.push_back({ name, n, elapsed });
+    }
+  };
+
+private:
+  std::vector<thread_slot> slots;
+
+public:
+  phase_timers():
+  slots(([]{
+#ifdef _OPENMP
+    int const n = omp_get_max_threads(),
+              m = omp_get_num_procs();
+    return static_cast<std::size_t>(n > m ? n : m);
+#else
+    return std::size_t(1L);
+#endif
+  })()) { }
+
+  /* returns the slot of the calling thread or a nullptr if there is no
+   * slot */
+  thread_slot * get_slot() {
+#ifdef _OPENMP
+    std::size_t const idx = omp_get_thread_num();
+#else
+    std::size_t const idx(0L);
+#endif
+    return idx < slots.size() ? &slots[idx] : nullptr;
+  }
+
+  std::vector<thread_slot> const & get_slots() const {
+    return slots;
+  }
+
+  void reset(){
+    for(auto &s : slots)
+      s.reset();
+  }
+
+  /* the slot which is used by the atomic functions on this thread */
+  static thread_slot *& atomic_slot(){
+    static thread_local thread_slot *out = nullptr;
+    return out;
+  }
+};
+
+/* adds the time in its scope to a phase */
+class scoped_phase {
+  phase_timers::thread_slot * const slot;
+  phase_type const phase;
+  phase_timers::clock::time_point const start = phase_timers::clock::now();
+
+public:
+  scoped_phase(phase_timers &timers, phase_type const phase):
+  slot(timers.get_slot()), phase(phase) { }
+
+  scoped_phase(scoped_phase const&) = delete;
+  scoped_phase& operator=(scoped_phase const&) = delete;
+
+  ~scoped_phase(){
+    if(!slot)
+      return;
+    slot->time[phase] += std::chrono::duration<double>(
+      phase_timers::clock::now() - start).count();
+    ++slot->count[phase];
+  }
+};
+
+/* sets the slot which is used by the atomic functions on this thread in its
+ * scope */
+class scoped_atomic_slot {
+  phase_timers::thread_slot * const old_slot = phase_timers::atomic_slot();
+
+public:
+  scoped_atomic_slot(phase_timers &timers) {
+    phase_timers::atomic_slot() = timers.get_slot();
+  }
+
+  scoped_atomic_slot(scoped_atomic_slot const&) = delete;
+  scoped_atomic_slot& operator=(scoped_atomic_slot const&) = delete;
+
+  ~scoped_atomic_slot(){
+    phase_timers::atomic_slot() = old_slot;
+  }
+};
+
+/* adds the time in its scope and n evaluations to an atomic function if a
+ * slot is set with scoped_atomic_slot. name must have static storage
+ * duration */
+class scoped_atomic_timer {
+  phase_timers::thread_slot * const slot = phase_timers::atomic_slot();
+  char const * const name;
+  std::size_t const n;
+  phase_timers::clock::time_point start;
+
+public:
+  scoped_atomic_timer(char const *name, std::size_t const n = 1L):
+  name(name), n(n) {
+    if(slot)
+      start = phase_timers::clock::now();
+  }
+
+  scoped_atomic_timer(scoped_atomic_timer const&) = delete;
+  scoped_atomic_timer& operator=(scoped_atomic_timer const&) = delete;
+
+  ~scoped_atomic_timer(){
+    if(slot)
+      slot->add_atomic(name, n, std::chrono::duration<double>(
+        phase_timers::clock::now() - start).count());
+  }
+};
+
+} // namespace survTMB
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef PNORM_ATOMIC_H
+#define PNORM_ATOMIC_H
+
+#include "tmb_includes.h"
+#include "atomic-registry.h"
+#include "taylor-utils.h"
+#include <cstddef>
+
+#ifndef M_1_SQRT_2PI
+#define M_1_SQRT_2PI	0.398942280401432677939946059934	/* 1/sqrt(2pi) */
+#endif
+
+namespace survTMB {
+
+/* atomic function for the CDF of the standard normal distribution. Unlike
+ * TMB's pnorm, it supports forward sweeps of order two and reverse sweeps of
+ * order one such that Hessian-vector products can be computed with
+ * Forward(1) and Reverse(2) on the tape. */
+template<class Type>
+class pnorm_std_atomic : public CppAD::atomic_base<Type> {
+public:
+  pnorm_std_atomic(char const *name):
+  CppAD::atomic_base<Type>(name) {
+    this->option(CppAD::atomic_base<Type>::bool_sparsity_enum);
+  }
+
+  /* returns a cached value to use in computations as the object must remain
+   * in scope while all CppAD::ADfun functions are still in use. */
+  static pnorm_std_atomic& get_cached(){
+    return get_cached_atomic<pnorm_std_atomic, Type>(
+      1L, "pnorm_std_atomic<Type>", [&]{
+        return new pnorm_std_atomic("pnorm_std_atomic<Type>");
+      });
+  }
+
+  /* the first derivative is phi(x) and the second is -x phi(x) */
+  static void derivs(Type const x, Type &gr, Type * const hess){
+    gr = Type(M_1_SQRT_2PI) * exp(-x * x / Type(2.));
+    if(hess)
+      *hess = -x * gr;
+  }
+
+  virtual bool forward(std::size_t p, std::size_t q,
+                       const CppAD::vector<bool> &vx,
+                       CppAD::vector<bool> &vy,
+                       const CppAD::vector<Type> &tx,
+                       CppAD::vector<Type> &ty){
+    if(q > 2)
+      return false;
+
+    if(p == 0){
+      ty[0] = Type(atomic::Rmath::Rf_pnorm5(asDouble(tx[0]), 0, 1, 1, 0));
+
+      /* set variable flags */
+      if (vx.size() > 0)
+        vy[0] = vx[0];
+    }
+    if(q < 1)
+      return true;
+
+    Type gr, hess, wk[2];
+    derivs(tx[0], gr, q > 1 ? &hess : nullptr);
+    auto hess_vec = [&](Type const *d, Type *o){
+      o[0] = hess * d[0];
+    };
+
+    return taylor_forward(p, q, 1L, &gr, hess_vec, tx, ty, wk);
+  }
+
+  virtual bool reverse(std::size_t q, const CppAD::vector<Type> &tx,
+                       const CppAD::vector<Type> &ty,
+                       CppAD::vector<Type> &px,
+                       const CppAD::vector<Type> &py){
+    if(q > 1)
+      return false;
+
+    Type gr, hess, wk[2];
+    derivs(tx[0], gr, q > 0 ? &hess : nullptr);
+    auto hess_vec = [&](Type const *d, Type *o){
+      o[0] = hess * d[0];
+    };
+
+    return taylor_reverse(q, 1L, &gr, hess_vec, tx, px, py, wk);
+  }
+
+  virtual bool for_sparse_jac(size_t q, const CppAD::vector<bool>& r,
+                              CppAD::vector<bool>& s) {
+    return one_output_for_sparse_jac(q, r, s);
+  }
+
+  virtual bool rev_sparse_jac(size_t q, const CppAD::vector<bool>& rt,
+                              CppAD::vector<bool>& st) {
+    return one_output_rev_sparse_jac(q, rt, st);
+  }
+
+  virtual bool rev_sparse_hes(const CppAD::vector<bool>& vx,
+                              const CppAD::vector<bool>& s,
+                              CppAD::vector<bool>& t, size_t q,
+                              const CppAD::vector<bool>& r,
+                              const CppAD::vector<bool>& u,
+                              CppAD::vector<bool>& v) {
+    return one_output_rev_sparse_hes(s, t, q, r, u, v);
+  }
+};
+
+/* computes the CDF of the standard normal distribution */
+template<class Type>
+AD<Type> pnorm_std(AD<Type> const x){
+  auto &functor = pnorm_std_atomic<Type>::get_cached();
+
+  CppAD::vector<AD<Type> > tx(1), ty(1);
+  tx[0] = x;
+
+  functor(tx, ty);
+  return ty[0];
+}
+
+inline double pnorm_std(double const x){
+  return atomic::Rmath::Rf_pnorm5(x, 0, 1, 1, 0);
+}
+
+} // namespace survTMB
+
+#endif
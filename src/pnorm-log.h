@@ -2,6 +2,11 @@
 #define PNORM_LOG_H
 
 #include "tmb_includes.h"
+#include <cstddef>
+
+#ifndef M_1_SQRT_2PI
+#define M_1_SQRT_2PI	0.398942280401432677939946059934	/* 1/sqrt(2pi) */
+#endif
 
 namespace atomic {
 /* Computes log CDF of standard normal distribution */
@@ -40,4 +45,41 @@ Type pnorm_log(Type q, Type  mean = 0., Type sd = 1.){
 VECTORIZE3_ttt(pnorm_log)
 VECTORIZE1_t  (pnorm_log)
 
+/* version for doubles which avoids the overhead of the atomic function */
+inline double pnorm_log(double q, double mean = 0., double sd = 1.){
+  return atomic::Rmath::Rf_pnorm5((q - mean) / sd, 0, 1, 1, 1);
+}
+
+/* Computes the inverse Mills ratio phi(x) / Phi(x) of the standard normal
+ * distribution. The log CDF is used in the lower tail */
+inline double inv_mills_ratio(double const x){
+  if(x > -10){
+    double const cdf = atomic::Rmath::Rf_pnorm5(x, 0, 1, 1, 0);
+    return M_1_SQRT_2PI * exp(-x * x * .5) / cdf;
+  }
+
+  double const cdf_log = atomic::Rmath::Rf_pnorm5(x, 0, 1, 1, 1),
+               pdf_log = -x * x * .5;
+  return M_1_SQRT_2PI * exp(pdf_log - cdf_log);
+}
+
+/* batch versions which set out[i] = f(x[i]) for i = 0, ..., n - 1. They are
+ * meant for loops over quadrature nodes. The double versions do not use the
+ * atomic function */
+template<class Type>
+void pnorm_log(Type const *x, Type *out, std::size_t const n){
+  for(std::size_t i = 0; i < n; ++i)
+    out[i] = pnorm_log(x[i]);
+}
+inline void pnorm_log(double const *x, double *out, std::size_t const n){
+  for(std::size_t i = 0; i < n; ++i)
+    out[i] = atomic::Rmath::Rf_pnorm5(x[i], 0, 1, 1, 1);
+}
+
+inline void inv_mills_ratio
+  (double const *x, double *out, std::size_t const n){
+  for(std::size_t i = 0; i < n; ++i)
+    out[i] = inv_mills_ratio(x[i]);
+}
+
 #endif
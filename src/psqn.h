@@ -0,0 +1,415 @@
+#ifndef PSQN_H
+#define PSQN_H
+
+#include <vector>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+namespace psqn {
+
+/* information about the result of the optimization */
+enum info_code : int {
+  converged = 0L,
+  max_it_reached = -1L,
+  line_search_failed = -2L
+};
+
+struct optim_info {
+  double value;
+  info_code info;
+  std::size_t n_eval, n_grad, n_cg, n_iter;
+};
+
+/* Partially separable quasi-Newton method to minimize
+
+     f(x) = \sum_{k = 1}^K f_k(x_g, x_k)
+
+   where x_g are global parameters which all element functions depend on and
+   x_k are private parameters of element function k. A BFGS approximation
+   is made for the Hessian of each element function. The search direction
+   is found with the preconditioned conjugate gradient method using the sum
+   of the approximations. Thus, the memory and the computation cost is
+   linear in the number of element functions.
+
+   The parameter vector is stored as x_g followed by x_1, x_2, ..., x_K.
+
+   The EFunc class needs the member functions:
+     n_private(): returns the number of private parameters.
+     func(double const *g, double const *p): returns f_k(g, p).
+     grad(double const *g, double const *p, double *gr): returns f_k(g, p)
+          and sets gr to the gradient w.r.t. (g, p).
+   The member functions are called in parallel for different elements. */
+template<class EFunc>
+class optimizer {
+  struct worker {
+    EFunc func;
+    std::size_t const n_private, par_start, n_ele;
+    /* BFGS approximation of the Hessian stored in column-major order, the
+     * current and old gradient, the old parameters, and temporary memory */
+    std::vector<double> B, gr, gr_old, x_old, tmp, tmp_gr;
+    double f = 0.;
+    bool first_update = true;
+
+    worker(EFunc &&func, std::size_t const n_global,
+           std::size_t const par_start):
+      func(std::move(func)), n_private(this->func.n_private()),
+      par_start(par_start), n_ele(n_global + n_private),
+      B(n_ele * n_ele, 0.), gr(n_ele), gr_old(n_ele), x_old(n_ele),
+      tmp(n_ele), tmp_gr(n_ele) {
+      for(std::size_t i = 0; i < n_ele; ++i)
+        B[i + i * n_ele] = 1.;
+    }
+
+    /* copies the element's parameters from the full parameter vector */
+    void copy_par(double const *x, std::size_t const n_global,
+                  double *out) const {
+      std::copy(x, x + n_global, out);
+      std::copy(x + par_start, x + par_start + n_private, out + n_global);
+    }
+
+    /* computes out = B x */
+    void B_vec(double const *x, double *out) const {
+      std::fill(out, out + n_ele, 0.);
+      double const *b = B.data();
+      for(std::size_t j = 0; j < n_ele; ++j)
+        for(std::size_t i = 0; i < n_ele; ++i, ++b)
+          out[i] += *b * x[j];
+    }
+
+    /* performs a damped BFGS update given the changes in the parameters,
+     * s, and the gradient, y. The vectors are overwritten */
+    void update(double *s, double *y){
+      double s_y = 0., s_s = 0., y_y = 0.;
+      for(std::size_t i = 0; i < n_ele; ++i){
+        s_y += s[i] * y[i];
+        s_s += s[i] * s[i];
+        y_y += y[i] * y[i];
+      }
+      if(s_s < std::numeric_limits<double>::epsilon() *
+           std::numeric_limits<double>::epsilon())
+        return;
+
+      if(first_update){
+        /* scale the initial approximation */
+        first_update = false;
+        if(s_y > 0){
+          double const scale = y_y / s_y;
+          std::fill(B.begin(), B.end(), 0.);
+          for(std::size_t i = 0; i < n_ele; ++i)
+            B[i + i * n_ele] = scale;
+        }
+      }
+
+      double * const B_s = tmp.data();
+      B_vec(s, B_s);
+      double s_B_s = 0.;
+      for(std::size_t i = 0; i < n_ele; ++i)
+        s_B_s += s[i] * B_s[i];
+      if(s_B_s <= 0)
+        return;
+
+      /* Powell's damping to keep the approximation positive definite */
+      if(s_y < .2 * s_B_s){
+        double const theta = .8 * s_B_s / (s_B_s - s_y);
+        for(std::size_t i = 0; i < n_ele; ++i)
+          y[i] = theta * y[i] + (1 - theta) * B_s[i];
+        s_y = 0.;
+        for(std::size_t i = 0; i < n_ele; ++i)
+          s_y += s[i] * y[i];
+      }
+
+      double *b = B.data();
+      for(std::size_t j = 0; j < n_ele; ++j)
+        for(std::size_t i = 0; i < n_ele; ++i, ++b)
+          *b += y[i] * y[j] / s_y - B_s[i] * B_s[j] / s_B_s;
+    }
+  };
+
+  std::size_t const n_global;
+  std::vector<worker> workers;
+  std::size_t const n_par;
+  unsigned const n_threads;
+
+  /* computes the function value and sets gr if it is not a nullptr */
+  double eval(double const *x, double *gr){
+    std::size_t const n_workers = workers.size();
+    bool const do_grad = gr;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) if(n_threads > 1L) \
+  num_threads(n_threads)
+#endif
+    for(std::size_t k = 0; k < n_workers; ++k){
+      worker &w = workers[k];
+      double * const xw = w.tmp.data();
+      w.copy_par(x, n_global, xw);
+      w.f = do_grad ?
+        w.func.grad(xw, xw + n_global, w.gr.data()) :
+        w.func.func(xw, xw + n_global);
+    }
+
+    /* sum in a fixed order */
+    double out(0.);
+    for(auto &w : workers)
+      out += w.f;
+
+    if(do_grad){
+      std::fill(gr, gr + n_global, 0.);
+      for(auto &w : workers){
+        for(std::size_t i = 0; i < n_global; ++i)
+          gr[i] += w.gr[i];
+        std::copy(w.gr.begin() + n_global, w.gr.end(), gr + w.par_start);
+      }
+    }
+
+    return out;
+  }
+
+  /* computes out = H x where H is the sum of the approximations */
+  void H_vec(double const *x, double *out){
+    std::size_t const n_workers = workers.size();
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) if(n_threads > 1L) \
+  num_threads(n_threads)
+#endif
+    for(std::size_t k = 0; k < n_workers; ++k){
+      worker &w = workers[k];
+      double * const xw = w.tmp_gr.data(),
+             * const res = w.tmp.data();
+      w.copy_par(x, n_global, xw);
+      w.B_vec(xw, res);
+      std::copy(res + n_global, res + w.n_ele, out + w.par_start);
+    }
+
+    std::fill(out, out + n_global, 0.);
+    for(auto &w : workers)
+      for(std::size_t i = 0; i < n_global; ++i)
+        out[i] += w.tmp[i];
+  }
+
+  /* sets out to the diagonal of H */
+  void H_diag(double *out) const {
+    std::fill(out, out + n_global, 0.);
+    for(auto &w : workers){
+      for(std::size_t i = 0; i < n_global; ++i)
+        out[i] += w.B[i + i * w.n_ele];
+      for(std::size_t i = n_global; i < w.n_ele; ++i)
+        out[w.par_start + i - n_global] = w.B[i + i * w.n_ele];
+    }
+  }
+
+  static double dot(double const *x, double const *y, std::size_t const n){
+    double out(0.);
+    for(std::size_t i = 0; i < n; ++i)
+      out += x[i] * y[i];
+    return out;
+  }
+
+  /* approximately solves H d = -gr with the preconditioned conjugate
+   * gradient method. Returns the number of iterations */
+  std::size_t get_direction(double const *gr, double *d,
+                            std::size_t const max_cg){
+    std::size_t const n = n_par;
+    std::vector<double> r(n), z(n), p(n), Hp(n), diag(n);
+    H_diag(diag.data());
+
+    std::fill(d, d + n, 0.);
+    for(std::size_t i = 0; i < n; ++i){
+      r[i] = -gr[i];
+      z[i] = r[i] / diag[i];
+      p[i] = z[i];
+    }
+
+    double const gr_norm = std::sqrt(dot(gr, gr, n)),
+                 tol = std::min(.5, std::sqrt(gr_norm)) * gr_norm;
+    double r_z = dot(r.data(), z.data(), n);
+
+    std::size_t it = 0;
+    for(; it < max_cg; ++it){
+      H_vec(p.data(), Hp.data());
+      double const p_H_p = dot(p.data(), Hp.data(), n);
+      if(p_H_p <= 0)
+        break;
+
+      double const alpha = r_z / p_H_p;
+      for(std::size_t i = 0; i < n; ++i){
+        d[i] += alpha * p [i];
+        r[i] -= alpha * Hp[i];
+      }
+      if(std::sqrt(dot(r.data(), r.data(), n)) < tol){
+        ++it;
+        break;
+      }
+
+      for(std::size_t i = 0; i < n; ++i)
+        z[i] = r[i] / diag[i];
+      double const r_z_new = dot(r.data(), z.data(), n),
+                   beta = r_z_new / r_z;
+      r_z = r_z_new;
+      for(std::size_t i = 0; i < n; ++i)
+        p[i] = z[i] + beta * p[i];
+    }
+
+    if(it == 0L)
+      /* use the preconditioned steepest descent direction */
+      for(std::size_t i = 0; i < n; ++i)
+        d[i] = -gr[i] / diag[i];
+
+    return it;
+  }
+
+  static std::size_t get_n_par(std::size_t const n_global,
+                               std::vector<worker> const &workers){
+    std::size_t out = n_global;
+    for(auto &w : workers)
+      out += w.n_private;
+    return out;
+  }
+
+  static std::vector<worker> get_workers
+    (std::vector<EFunc> &funcs, std::size_t const n_global){
+    std::vector<worker> out;
+    out.reserve(funcs.size());
+    std::size_t par_start = n_global;
+    for(auto &f : funcs){
+      out.emplace_back(std::move(f), n_global, par_start);
+      par_start += out.back().n_private;
+    }
+    return out;
+  }
+
+public:
+  optimizer(std::vector<EFunc> funcs, std::size_t const n_global,
+            unsigned const n_threads = 1L):
+  n_global(n_global), workers(get_workers(funcs, n_global)),
+  n_par(get_n_par(n_global, workers)), n_threads(n_threads) { }
+
+  std::size_t get_n_par() const {
+    return n_par;
+  }
+
+  /* minimizes the function starting at x which is overwritten with the
+   * result.
+   *
+   * Args:
+   *   x: starting value of length n_par and the final value on exit.
+   *   rel_eps: relative convergence threshold for the function value.
+   *   max_it: maximum number of iterations.
+   *   max_cg: maximum number of conjugate gradient iterations in each
+   *           iteration. Zero yields no limit.
+   *   c1: the Armijo condition constant in the backtracking line search.
+   *   gr_tol: convergence threshold for the Euclidean norm of the gradient.
+   *           A non-positive value disables the criterion.
+   */
+  optim_info optim(double *x, double const rel_eps,
+                   std::size_t const max_it, std::size_t max_cg = 0L,
+                   double const c1 = 1e-4, double const gr_tol = 0.){
+    if(max_cg < 1L)
+      max_cg = n_par;
+
+    optim_info out;
+    out.n_eval = 1L;
+    out.n_grad = 1L;
+    out.n_cg   = 0L;
+    out.info   = max_it_reached;
+
+    std::vector<double> gr(n_par), gr_new(n_par), d(n_par), x_new(n_par);
+    double f = eval(x, gr.data());
+
+    auto small_grad = [&]{
+      return gr_tol > 0 and
+        std::sqrt(dot(gr.data(), gr.data(), n_par)) < gr_tol;
+    };
+
+    if(small_grad()){
+      out.info   = converged;
+      out.value  = f;
+      out.n_iter = 0L;
+      return out;
+    }
+
+    std::size_t it = 0;
+    for(; it < max_it; ++it){
+      /* store old values */
+      for(auto &w : workers){
+        w.copy_par(x, n_global, w.x_old.data());
+        std::copy(w.gr.begin(), w.gr.end(), w.gr_old.begin());
+      }
+
+      /* find the direction */
+      out.n_cg += get_direction(gr.data(), d.data(), max_cg);
+      double d_gr = dot(d.data(), gr.data(), n_par);
+      if(d_gr >= 0){
+        for(std::size_t i = 0; i < n_par; ++i)
+          d[i] = -gr[i];
+        d_gr = -dot(gr.data(), gr.data(), n_par);
+      }
+      if(d_gr == 0){
+        out.info = converged;
+        break;
+      }
+
+      /* backtracking line search. The gradient is computed in each
+       * evaluation such that the last evaluation is used in the next
+       * iteration. The first step is typically accepted */
+      double step = 1., f_new = f;
+      bool found = false;
+      for(unsigned i = 0; i < 50L; ++i, step *= .5){
+        for(std::size_t j = 0; j < n_par; ++j)
+          x_new[j] = x[j] + step * d[j];
+        f_new = eval(x_new.data(), gr_new.data());
+        ++out.n_eval;
+        ++out.n_grad;
+        if(std::isfinite(f_new) and f_new <= f + c1 * step * d_gr){
+          found = true;
+          break;
+        }
+      }
+      if(!found){
+        out.info = line_search_failed;
+        break;
+      }
+
+      std::copy(x_new.begin(), x_new.end(), x);
+      gr.swap(gr_new);
+
+      /* update the Hessian approximations */
+      std::size_t const n_workers = workers.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1) if(n_threads > 1L) \
+  num_threads(n_threads)
+#endif
+      for(std::size_t k = 0; k < n_workers; ++k){
+        worker &w = workers[k];
+        double * const s = w.tmp_gr.data();
+        w.copy_par(x, n_global, s);
+        for(std::size_t i = 0; i < w.n_ele; ++i){
+          s[i] -= w.x_old[i];
+          w.gr_old[i] = w.gr[i] - w.gr_old[i];
+        }
+        w.update(s, w.gr_old.data());
+      }
+
+      bool const has_converged =
+        std::abs(f - f_new) < rel_eps * (std::abs(f) + rel_eps) or
+        small_grad();
+      f = f_new;
+      if(has_converged){
+        out.info = converged;
+        ++it;
+        break;
+      }
+    }
+
+    out.value  = f;
+    out.n_iter = it;
+    return out;
+  }
+};
+
+} // namespace psqn
+
+#endif
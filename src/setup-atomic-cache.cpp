@@ -1,47 +1,28 @@
 #include <string>
 #include "gva-utils.h"
 #include "snva-utils.h"
+#include "cond-dens-atomic.h"
 
 namespace {
-/* the atomic_base class has a static list here
- *   https://github.com/kaskr/adcomp/blob/07678703541b81966f18f134d7d7cbf5df9e3345/TMB/inst/include/cppad/local/atomic_base.hpp#L59
- *
- * which is written to here in the destructor
- *   https://github.com/kaskr/adcomp/blob/07678703541b81966f18f134d7d7cbf5df9e3345/TMB/inst/include/cppad/local/atomic_base.hpp#L211
- *
- * Because of the way the `get_cached` functions are written, this mean that
- * each type has to be constructed __before__ calling `get_cached` such that
- * the list gets destructed last. See
- *   https://stackoverflow.com/a/335746/5861244
- *
- * TODO: I only think we need to create one atomic class as the list should
- *       be shared between all derived classes.
- */
-template<template<class> class Int>
-void fix_atomic_seqfault_helper(){
-  Int<      double    > have_to      ("avoid seqfault", 2);
-  Int<   AD<double  > > have_to_ad   ("avoid seqfault", 2);
-  Int<AD<AD<double> > > have_to_ad_ad("avoid seqfault", 2);
-}
-
 template<template<class> class Int>
 void get_cached_atomic_objs(size_t const n_nodes){
   Int<   double  >::get_cached(n_nodes);
   Int<AD<double> >::get_cached(n_nodes);
 }
 
-} // namespace
-
-// [[Rcpp::export(rng = false)]]
-void fix_atomic_seqfault(){
-  fix_atomic_seqfault_helper<GaussHermite::GVA::mlogit_integral_atomic>();
-  fix_atomic_seqfault_helper<GaussHermite::GVA::probit_integral_atomic>();
-
-  fix_atomic_seqfault_helper<GaussHermite::SNVA::entropy_term_integral>();
-  fix_atomic_seqfault_helper<GaussHermite::SNVA::mlogit_integral_atomic>();
-  fix_atomic_seqfault_helper<GaussHermite::SNVA::probit_integral_atomic>();
+/* the conditional density atomic functions do not depend on the number of
+ * nodes so they are always stored at index one */
+void get_cached_cond_dens_objs(std::string const &link){
+  if(link == "PH" or link.empty())
+    get_cached_atomic_objs<survTMB::ph_cond_dens_atomic>(1L);
+  if(link == "PO" or link.empty())
+    get_cached_atomic_objs<survTMB::po_cond_dens_atomic>(1L);
+  if(link == "probit" or link.empty())
+    get_cached_atomic_objs<survTMB::probit_cond_dens_atomic>(1L);
 }
 
+} // namespace
+
 // [[Rcpp::export(rng = false)]]
 void setup_atomic_cache(size_t const n_nodes, std::string const type,
                         std::string const link = ""){
@@ -49,39 +30,46 @@ void setup_atomic_cache(size_t const n_nodes, std::string const type,
     throw std::runtime_error("setup_atomic_cache called in parallel mode");
 
   if(type == "GVA"){
-    if(link == "PO")
+    if(link == "PO"){
       get_cached_atomic_objs
       <GaussHermite::GVA::mlogit_integral_atomic>(n_nodes);
-    else if(link == "probit")
+      get_cached_atomic_objs
+      <GaussHermite::GVA::mlogit_integral_batch_atomic>(n_nodes);
+    } else if(link == "probit"){
       get_cached_atomic_objs
       <GaussHermite::GVA::probit_integral_atomic>(n_nodes);
-    else if(link == "PH" or link.empty()) { }
+      get_cached_atomic_objs
+      <GaussHermite::GVA::probit_integral_batch_atomic>(n_nodes);
+    } else if(link == "PH" or link.empty()) { }
     else
       throw std::invalid_argument("unkown link (GVA)");
 
+    get_cached_cond_dens_objs(link);
     return;
 
   } else if(type == "SNVA"){
-    GaussHermite::SNVA::entropy_term_integral<   double  >
-      have_to   ("avoid seqfaul", n_nodes);
-    GaussHermite::SNVA::entropy_term_integral<AD<double> >
-      have_ad_to("avoid seqfaul", n_nodes);
-
     GaussHermite::SNVA::entropy_term_integral<   double  >
       ::get_cached(n_nodes);
     GaussHermite::SNVA::entropy_term_integral<AD<double> >
       ::get_cached(n_nodes);
 
-    if(link == "PO")
+    if(link == "PO"){
       get_cached_atomic_objs
       <GaussHermite::SNVA::mlogit_integral_atomic>(n_nodes);
-    else if(link == "probit")
+      get_cached_atomic_objs
+      <GaussHermite::SNVA::mlogit_integral_batch_atomic>(n_nodes);
+    } else if(link == "probit"){
       get_cached_atomic_objs
       <GaussHermite::SNVA::probit_integral_atomic>(n_nodes);
-    else if(link == "PH" or link.empty()) { }
-    else
+      get_cached_atomic_objs
+      <GaussHermite::SNVA::probit_integral_batch_atomic>(n_nodes);
+    } else if(link == "PH" or link.empty()) {
+      survTMB::pnorm_std_atomic<   double  >::get_cached();
+      survTMB::pnorm_std_atomic<AD<double> >::get_cached();
+    } else
       throw std::invalid_argument("unkown link (SNVA)");
 
+    get_cached_cond_dens_objs(link);
     return;
 
   }
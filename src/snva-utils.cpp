@@ -1,10 +1,5 @@
 #include "snva-utils.h"
-#include <array>
-#include <memory>
-
-#ifdef _OPENMP
-#include <omp.h>
-#endif
+#include "atomic-registry.h"
 
 namespace GaussHermite {
 namespace SNVA {
@@ -13,56 +8,20 @@ template<class Type>
 entropy_term_integral<Type>&
 entropy_term_integral<Type>::get_cached(unsigned const n){
   using output_T = entropy_term_integral<Type>;
-
-  constexpr std::size_t const n_cache = GaussHermiteDataCachedMaxArg();
-  if(n > n_cache or n == 0l)
-    throw std::invalid_argument(
-        "entropy_term_integral<Type>::get_cached: invalid n (too large or zero)");
-
-  static std::array<std::unique_ptr<output_T>, n_cache> cached_values;
-
-  unsigned const idx = n - 1L;
-  bool has_value = cached_values[idx].get();
-
-  if(has_value)
-    return *cached_values[idx];
-
-#ifdef _OPENMP
-  if(CppAD::thread_alloc::in_parallel())
-    throw std::runtime_error("entropy_term_integral<Type>::get_cached called in parallel mode");
-#endif
-
-  cached_values[idx].reset(new output_T("entropy_term_integral<Type>", n));
-
-  return *cached_values[idx];
+  return survTMB::get_cached_atomic<output_T, Type>(
+    n, "entropy_term_integral<Type>", [&]{
+      return new output_T("entropy_term_integral<Type>", n);
+    });
 }
 
 template <class Type, class Fam>
 integral_atomic<Type, Fam>&
 integral_atomic<Type, Fam>::get_cached(unsigned const n){
   using output_T = integral_atomic<Type, Fam>;
-
-  constexpr std::size_t const n_cache = GaussHermiteDataCachedMaxArg();
-  if(n > n_cache or n == 0l)
-    throw std::invalid_argument(
-        "integral_atomic<Type, Fam>::get_cached: invalid n (too large or zero)");
-
-  static std::array<std::unique_ptr<output_T>, n_cache> cached_values;
-
-  unsigned const idx = n - 1L;
-  bool has_value = cached_values[idx].get();
-
-  if(has_value)
-    return *cached_values[idx];
-
-#ifdef _OPENMP
-  if(CppAD::thread_alloc::in_parallel())
-    throw std::runtime_error("integral_atomic<Type, Fam>::get_cached called in parallel mode");
-#endif
-
-  cached_values[idx].reset(new output_T("integral_atomic<Type, Fam>", n));
-
-  return *cached_values[idx];
+  return survTMB::get_cached_atomic<output_T, Type>(
+    n, "integral_atomic<Type, Fam>", [&]{
+      return new output_T("integral_atomic<Type, Fam>", n);
+    });
 }
 
 double const mlogit_fam::too_large = 30.;
@@ -3,8 +3,14 @@
 
 #include "gaus-hermite.h"
 #include "pnorm-log.h"
+#include "pnorm-atomic.h"
 #include "utils.h"
 #include "gamma-to-nu.h"
+#include "taylor-utils.h"
+#include "atomic-registry.h"
+#include "taping-arena.h"
+#include "batch-atomic.h"
+#include "cond-dens-atomic.h"
 
 namespace atomic {
 namespace Rmath {
@@ -87,6 +93,11 @@ public:
     this->option(CppAD::atomic_base<Type>::bool_sparsity_enum);
   }
 
+  /* name used by survTMB::phase_timers */
+  static char const * timer_name(){
+    return "SNVA entropy_term";
+  }
+
   /* returns a cached value to use in computations as the object must remain
    * in scope while all CppAD::ADfun functions are still in use. */
   static entropy_term_integral& get_cached(unsigned const);
@@ -96,74 +107,135 @@ public:
     double const mult_sum(M_2_SQRTPI / sqrt(sigma_sq + 1.)),
                      mult(mult_sum * sqrt(sigma_sq / M_2_PI));
 
-    for(unsigned i = 0; i < hd.x.size(); ++i){
-      double const xi = hd.x[i] * mult,
-             pnrm_log = pnorm_log(xi, 0., 1.);
-      out += hd.w[i] * exp(xi * xi / 2.) * exp(pnrm_log) * pnrm_log;
-    }
+    std::size_t const n_nodes = hd.x.size();
+    double * const xi = survTMB::thread_scratch<entropy_term_integral>(
+      2L * n_nodes),
+           * const pnrm_log = xi + n_nodes;
+    for(std::size_t i = 0; i < n_nodes; ++i)
+      xi[i] = hd.x[i] * mult;
+    pnorm_log(xi, pnrm_log, n_nodes);
+
+    for(std::size_t i = 0; i < n_nodes; ++i)
+      out += hd.w[i] * exp(xi[i] * xi[i] / 2.) * exp(pnrm_log[i]) *
+        pnrm_log[i];
 
     return mult_sum * out;
   }
 
+  /* computes the first and, if hess is not a nullptr, the second
+   * derivative. The latter uses that
+
+   \begin{align*}
+   \frac{\partial^2 f(\sigma^2)}{(\partial \sigma^2)^2} &=
+   \int \left(\frac{(z^2-\sigma^2)^2}{4\sigma^{8}}
+   + \frac 1{2\sigma^4} - \frac{z^2}{\sigma^6}\right)
+   2 \phi(z; \sigma^2)\Phi(z)\log \Phi(z)dz \\
+   &\approx
+   \frac 1{2\sigma^4\sqrt{\pi}}
+   \frac {\gamma}{\sqrt{\gamma^2 + \sigma^2}}
+   \sum_{i = 1}^n
+   w_i (c_i^2 - 6c_i + 3)
+   f(x_i \sqrt{2}\gamma\sigma/\sqrt{\gamma^2 + \sigma^2}) \\
+   c_i &= \frac{x_i^2 2\gamma^2}{\gamma^2 + \sigma^2}
+   \end{align*}
+
+   with \gamma(\sigma) = 1. */
+  void derivs(Type const sigma_sq_in, Type &gr, Type * const hess) const {
+    Type const  sigma_sq = sigma_sq_in + small,
+             sigma_sq_p1 = sigma_sq + one,
+                mult_sum =
+                  one / sigma_sq / sqrt(type_M_PI * sigma_sq_p1),
+                    mult = sqrt(two * sigma_sq / sigma_sq_p1),
+            mult_sq_term = two / sigma_sq_p1;
+
+    gr = Type(0.);
+    if(hess)
+      *hess = Type(0.);
+    for(unsigned i = 0; i < n; ++i){
+      Type const &x = xw_type.x[i],
+                 xi = x * mult,
+           pnrm_log = pnorm_log(xi, zero, one),
+          integrand = exp(xi * xi / two) * exp(pnrm_log) * pnrm_log,
+                  c = x * x * mult_sq_term;
+
+      gr += xw_type.w[i] * (c - one) * integrand;
+      if(hess)
+        *hess += xw_type.w[i] * (c * c - Type(6.) * c + Type(3.)) *
+          integrand;
+    }
+
+    gr *= mult_sum;
+    if(hess)
+      *hess *= mult_sum / (two * sigma_sq);
+  }
+
   virtual bool forward(std::size_t p, std::size_t q,
                        const CppAD::vector<bool> &vx,
                        CppAD::vector<bool> &vy,
                        const CppAD::vector<Type> &tx,
                        CppAD::vector<Type> &ty){
-    if(q > 0)
+    survTMB::scoped_atomic_timer timer(timer_name());
+    if(q > 2)
       return false;
 
-    ty[0] = Type(comp(asDouble(tx[0]), xw_double));
-
-    /* set variable flags */
-    if (vx.size() > 0) {
-      bool anyvx = false;
-      for (std::size_t i = 0; i < vx.size(); i++)
-        anyvx |= vx[i];
-      for (std::size_t i = 0; i < vy.size(); i++)
-        vy[i] = anyvx;
+    if(p == 0){
+      ty[0] = Type(comp(asDouble(tx[0]), xw_double));
+
+      /* set variable flags */
+      if (vx.size() > 0) {
+        bool anyvx = false;
+        for (std::size_t i = 0; i < vx.size(); i++)
+          anyvx |= vx[i];
+        for (std::size_t i = 0; i < vy.size(); i++)
+          vy[i] = anyvx;
+      }
     }
+    if(q < 1)
+      return true;
+
+    Type gr, hess, wk[2];
+    derivs(tx[0], gr, q > 1 ? &hess : nullptr);
+    auto hess_vec = [&](Type const *d, Type *o){
+      o[0] = hess * d[0];
+    };
 
-    return true;
+    return survTMB::taylor_forward(p, q, 1L, &gr, hess_vec, tx, ty, wk);
   }
 
   virtual bool reverse(std::size_t q, const CppAD::vector<Type> &tx,
                        const CppAD::vector<Type> &ty,
                        CppAD::vector<Type> &px,
                        const CppAD::vector<Type> &py){
-    if(q > 0)
+    survTMB::scoped_atomic_timer timer(timer_name());
+    if(q > 1)
       return false;
 
-    Type const  sigma_sq = tx[0] + small,
-             sigma_sq_p1 = sigma_sq + one,
-                mult_sum =
-                  one / sigma_sq / sqrt(type_M_PI * sigma_sq_p1),
-                    mult = sqrt(two * sigma_sq / sigma_sq_p1),
-            mult_sq_term = two / sigma_sq_p1;
+    Type gr, hess, wk[2];
+    derivs(tx[0], gr, q > 0 ? &hess : nullptr);
+    auto hess_vec = [&](Type const *d, Type *o){
+      o[0] = hess * d[0];
+    };
 
-    px[0] = Type(0.);
-    for(unsigned i = 0; i < n; ++i){
-      Type const &x = xw_type.x[i],
-                 xi = x * mult,
-           pnrm_log = pnorm_log(xi, zero, one),
-          integrand = exp(xi * xi / two) * exp(pnrm_log) * pnrm_log;
-
-      px[0] += xw_type.w[i] * (x * x * mult_sq_term - one) * integrand;
-    }
-
-    px[0] *= mult_sum * py[0];
+    return survTMB::taylor_reverse(q, 1L, &gr, hess_vec, tx, px, py, wk);
+  }
 
-    return true;
+  virtual bool for_sparse_jac(size_t q, const CppAD::vector<bool>& r,
+                              CppAD::vector<bool>& s) {
+    return survTMB::one_output_for_sparse_jac(q, r, s);
   }
 
   virtual bool rev_sparse_jac(size_t q, const CppAD::vector<bool>& rt,
                               CppAD::vector<bool>& st) {
-    bool anyrt = false;
-    for (std::size_t i = 0; i < rt.size(); i++)
-      anyrt |= rt[i];
-    for (std::size_t i = 0; i < st.size(); i++)
-      st[i] = anyrt;
-    return true;
+    return survTMB::one_output_rev_sparse_jac(q, rt, st);
+  }
+
+  virtual bool rev_sparse_hes(const CppAD::vector<bool>& vx,
+                              const CppAD::vector<bool>& s,
+                              CppAD::vector<bool>& t, size_t q,
+                              const CppAD::vector<bool>& r,
+                              const CppAD::vector<bool>& u,
+                              CppAD::vector<bool>& v) {
+    return survTMB::one_output_rev_sparse_hes(s, t, q, r, u, v);
   }
 };
 
@@ -258,6 +330,10 @@ mode_n_Hess<double> get_SNVA_mode_n_Hess
 struct mlogit_fam {
   static double const too_large;
 
+  static char const * timer_name(){
+    return "SNVA mlogit_integral";
+  }
+
   template<typename T>
   static T g(T const &eta) {
     return CppAD::CondExpGe(
@@ -285,6 +361,14 @@ class integral_atomic : public CppAD::atomic_base<Type> {
           type_M_2_SQRTPI = Type(M_2_SQRTPI);
 
 public:
+  /* number of inputs. Used by survTMB::batch_atomic */
+  static constexpr std::size_t n_in = 3L;
+
+  /* name used by survTMB::phase_timers */
+  static char const * timer_name(){
+    return Fam::timer_name();
+  }
+
   integral_atomic(char const *name, unsigned const n):
   CppAD::atomic_base<Type>(name), n(n) {
     this->option(CppAD::atomic_base<Type>::bool_sparsity_enum);
@@ -315,85 +399,188 @@ public:
     return out;
   }
 
+  /* computes the gradient and, if hess is not a nullptr, the Hessian in
+   * column-major order. The derivatives of the integrand are approximated
+   * with the same nodes as the integral. That is, the derivatives are
+   * computed of
+
+   \begin{align*}
+   K(\mu,\sigma,\rho; z) &= S(\mu,\sigma; z)P(\mu,\rho; z) \\
+   S(\mu,\sigma; z) &= \frac 1\sigma\exp\left(
+   -\frac{(z - \mu)^2}{2\sigma^2}\right) \\
+   P(\mu,\rho; z) &= \Phi(\rho(z - \mu))
+   \end{align*}
+   */
+  void derivs(Type const mu, Type const sig, Type const rho,
+              Type * const gr, Type * const hess) const {
+    auto const dvals = get_SNVA_mode_n_Hess(mu, sig, rho);
+    Type const xi = dvals.mode,
+           lambda = one / sqrt(-dvals.Hess),
+             mult = type_M_SQRT2 * lambda,
+            sig_2 = sig * sig,
+            sig_3 = sig_2 * sig,
+            rho_2 = rho * rho;
+
+    for(unsigned i = 0; i < 3; ++i)
+      gr[i] = Type(0.);
+    if(hess)
+      for(unsigned i = 0; i < 9; ++i)
+        hess[i] = Type(0.);
+
+    for(unsigned i = 0; i < xw_type.x.size(); ++i){
+      Type const xx = xw_type.x[i],
+                 zz = xi + mult * xx,
+                dif = zz - mu,
+                  u = dif / sig,
+                u_2 = u * u,
+          constants = xw_type.w[i] * Fam::g(zz) * exp(xx * xx),
+               dnrm = exp(- u_2 / 2),
+               pnrm =         pnorm (rho * dif),
+              dpnrm = atomic::dnorm1(rho * dif),
+                  S = dnrm / sig,
+               S_mu = dnrm * u / sig_2,
+              S_sig = dnrm * (u_2 - one) / sig_2,
+               P_mu = -rho * dpnrm,
+              P_rho = dif * dpnrm;
+
+      gr[0] += constants * (S_mu * pnrm + S * P_mu);
+      gr[1] += constants * S_sig * pnrm;
+      gr[2] += constants * S * P_rho;
+
+      if(hess){
+        Type const S_mu_mu = dnrm * (u_2 - one) / sig_3,
+                  S_mu_sig = dnrm * u * (u_2 - Type(3.)) / sig_3,
+                 S_sig_sig =
+                   dnrm * (u_2 * u_2 - Type(5.) * u_2 + Type(2.)) / sig_3,
+                   P_mu_mu = -rho_2 * rho * dif * dpnrm,
+                  P_mu_rho = dpnrm * (rho_2 * dif * dif - one),
+                 P_rho_rho = -rho * dif * dif * dif * dpnrm;
+
+        hess[0] += constants * (
+          S_mu_mu * pnrm + Type(2.) * S_mu * P_mu + S * P_mu_mu);
+        hess[1] += constants * (S_mu_sig * pnrm + S_sig * P_mu);
+        hess[2] += constants * (S_mu * P_rho + S * P_mu_rho);
+        hess[4] += constants * S_sig_sig * pnrm;
+        hess[5] += constants * S_sig * P_rho;
+        hess[8] += constants * S * P_rho_rho;
+      }
+    }
+
+    Type const fac = type_M_2_SQRTPI * lambda;
+    for(unsigned i = 0; i < 3; ++i)
+      gr[i] *= fac;
+    if(hess){
+      for(unsigned j = 0; j < 3; ++j)
+        for(unsigned i = j; i < 3; ++i){
+          hess[i + j * 3] *= fac;
+          hess[j + i * 3]  = hess[i + j * 3];
+        }
+    }
+  }
+
+  /* versions used by survTMB::batch_atomic with x = (mu, sigma, rho) */
+  double value(double const *x) const {
+    return comp(x[0], x[1], x[2], xw_double);
+  }
+  void derivs(Type const *x, Type * const gr, Type * const hess) const {
+    derivs(x[0], x[1], x[2], gr, hess);
+  }
+
   virtual bool forward(std::size_t p, std::size_t q,
                        const CppAD::vector<bool> &vx,
                        CppAD::vector<bool> &vy,
                        const CppAD::vector<Type> &tx,
                        CppAD::vector<Type> &ty){
-    if(q > 0)
+    survTMB::scoped_atomic_timer timer(timer_name());
+    if(q > 2)
       return false;
 
-    ty[0] = Type(
-      comp(asDouble(tx[0]), asDouble(tx[1]), asDouble(tx[2]), xw_double));
-
-    /* set variable flags */
-    if (vx.size() > 0) {
-      bool anyvx = false;
-      for (std::size_t i = 0; i < vx.size(); i++)
-        anyvx |= vx[i];
-      for (std::size_t i = 0; i < vy.size(); i++)
-        vy[i] = anyvx;
+    std::size_t const nq = q + 1L;
+    if(p == 0){
+      ty[0] = Type(
+        comp(asDouble(tx[0]), asDouble(tx[nq]), asDouble(tx[2 * nq]),
+             xw_double));
+
+      /* set variable flags */
+      if (vx.size() > 0) {
+        bool anyvx = false;
+        for (std::size_t i = 0; i < vx.size(); i++)
+          anyvx |= vx[i];
+        for (std::size_t i = 0; i < vy.size(); i++)
+          vy[i] = anyvx;
+      }
     }
+    if(q < 1)
+      return true;
 
-    return true;
+    Type gr[3], hess[9], wk[6];
+    derivs(tx[0], tx[nq], tx[2 * nq], gr, q > 1 ? hess : nullptr);
+    auto hess_vec = [&](Type const *d, Type *o){
+      for(unsigned i = 0; i < 3; ++i)
+        o[i] = hess[i] * d[0] + hess[i + 3] * d[1] + hess[i + 6] * d[2];
+    };
+
+    return survTMB::taylor_forward(p, q, 3L, gr, hess_vec, tx, ty, wk);
   }
 
   virtual bool reverse(std::size_t q, const CppAD::vector<Type> &tx,
                        const CppAD::vector<Type> &ty,
                        CppAD::vector<Type> &px,
                        const CppAD::vector<Type> &py){
-    if(q > 0)
+    survTMB::scoped_atomic_timer timer(timer_name());
+    if(q > 1)
       return false;
 
-    Type const mu = tx[0],
-              sig = tx[1],
-              rho = tx[2];
-
-    auto const dvals = get_SNVA_mode_n_Hess(mu, sig, rho);
-    Type const xi = dvals.mode,
-           lambda = one / sqrt(-dvals.Hess),
-             mult = type_M_SQRT2 * lambda;
-
-    px[0] = Type(0.);
-    px[1] = Type(0.);
-    px[2] = Type(0.);
-    for(unsigned i = 0; i < xw_type.x.size(); ++i){
-      Type const xx = xw_type.x[i],
-                 zz = xi + mult * xx,
-                dif = zz - mu,
-            dif_std = dif / sig,
-          constants = xw_type.w[i] * Fam::g(zz) * exp(xx * xx),
-               dnrm = exp(- dif_std * dif_std / 2),
-              ddnrm = -dnrm,
-               pnrm =         pnorm (rho * dif),
-              dpnrm = atomic::dnorm1(rho * dif);
-      px[0] -= constants * (
-        dif_std / sig * ddnrm * pnrm + rho * dnrm * dpnrm);
-      px[1] -= constants * pnrm * (dif_std * dif_std - one) / sig * ddnrm;
-      px[2] += constants * dnrm * dpnrm * dif;
-    }
+    std::size_t const nq = q + 1L;
+    Type gr[3], hess[9], wk[6];
+    derivs(tx[0], tx[nq], tx[2 * nq], gr, q > 0 ? hess : nullptr);
+    auto hess_vec = [&](Type const *d, Type *o){
+      for(unsigned i = 0; i < 3; ++i)
+        o[i] = hess[i] * d[0] + hess[i + 3] * d[1] + hess[i + 6] * d[2];
+    };
 
-    Type const fac =  py[0] * type_M_2_SQRTPI * lambda / sig;
-    px[0] *= fac;
-    px[1] *= fac;
-    px[2] *= fac;
+    return survTMB::taylor_reverse(q, 3L, gr, hess_vec, tx, px, py, wk);
+  }
 
-    return true;
+  virtual bool for_sparse_jac(size_t q, const CppAD::vector<bool>& r,
+                              CppAD::vector<bool>& s) {
+    return survTMB::one_output_for_sparse_jac(q, r, s);
   }
 
   virtual bool rev_sparse_jac(size_t q, const CppAD::vector<bool>& rt,
                               CppAD::vector<bool>& st) {
-    bool anyrt = false;
-    for (std::size_t i = 0; i < rt.size(); i++)
-      anyrt |= rt[i];
-    for (std::size_t i = 0; i < st.size(); i++)
-      st[i] = anyrt;
-    return true;
+    return survTMB::one_output_rev_sparse_jac(q, rt, st);
+  }
+
+  virtual bool rev_sparse_hes(const CppAD::vector<bool>& vx,
+                              const CppAD::vector<bool>& s,
+                              CppAD::vector<bool>& t, size_t q,
+                              const CppAD::vector<bool>& r,
+                              const CppAD::vector<bool>& u,
+                              CppAD::vector<bool>& v) {
+    return survTMB::one_output_rev_sparse_hes(s, t, q, r, u, v);
   }
 };
 
 template<class Type>
 using mlogit_integral_atomic = integral_atomic<Type, mlogit_fam>;
+template<class Type>
+using mlogit_integral_batch_atomic =
+  survTMB::batch_atomic<Type, mlogit_integral_atomic<Type> >;
+
+/* interleaves mu, sigma, and rho as required by survTMB::batch_atomic */
+template<class Type>
+vector<Type> integral_batch_input
+  (vector<Type> const &mu, vector<Type> const &sigma,
+   vector<Type> const &rho){
+  vector<Type> x(3L * mu.size());
+  for(int i = 0; i < mu.size(); ++i){
+    x[3L * i     ] = mu   [i];
+    x[3L * i + 1L] = sigma[i];
+    x[3L * i + 2L] = rho  [i];
+  }
+  return x;
+}
 
 template<class Type>
 AD<Type> mlogit_integral
@@ -426,6 +613,24 @@ Type mlogit_integral
   return mlogit_integral(mu_use, sigma, rho, n_nodes);
 }
 
+/* vector versions which adds one node to the tape for all the elements */
+template<class Type>
+vector<AD<Type> > mlogit_integral
+  (vector<AD<Type> > const &mu, vector<AD<Type> > const &sigma,
+   vector<AD<Type> > const &rho, unsigned const n_nodes){
+  return survTMB::eval_batch_atomic<mlogit_integral_atomic<Type> >(
+    integral_batch_input(mu, sigma, rho), n_nodes);
+}
+
+inline vector<double> mlogit_integral
+  (vector<double> const &mu, vector<double> const &sigma,
+   vector<double> const &rho, unsigned const n_nodes){
+  vector<double> out(mu.size());
+  for(int i = 0; i < mu.size(); ++i)
+    out[i] = mlogit_integral(mu[i], sigma[i], rho[i], n_nodes);
+  return out;
+}
+
 /* Makes an approximation of
  l(\mu,\sigma, \rho) =
  2\int\phi(z;\mu,\sigma^2)
@@ -436,6 +641,10 @@ Type mlogit_integral
  poor if there is a large skew.
  */
 struct probit_fam {
+  static char const * timer_name(){
+    return "SNVA probit_integral";
+  }
+
   template<class Type>
   static Type g(Type const &eta) {
     return - pnorm_log(eta);
@@ -447,6 +656,9 @@ struct probit_fam {
 
 template<class Type>
 using probit_integral_atomic = integral_atomic<Type, probit_fam>;
+template<class Type>
+using probit_integral_batch_atomic =
+  survTMB::batch_atomic<Type, probit_integral_atomic<Type> >;
 
 template<class Type>
 AD<Type> probit_integral
@@ -478,15 +690,36 @@ Type probit_integral
   return probit_integral(k - mu, sigma, -rho, n_nodes);
 }
 
+/* vector versions which adds one node to the tape for all the elements */
+template<class Type>
+vector<AD<Type> > probit_integral
+  (vector<AD<Type> > const &mu, vector<AD<Type> > const &sigma,
+   vector<AD<Type> > const &rho, unsigned const n_nodes){
+  return survTMB::eval_batch_atomic<probit_integral_atomic<Type> >(
+    integral_batch_input(mu, sigma, rho), n_nodes);
+}
+
+inline vector<double> probit_integral
+  (vector<double> const &mu, vector<double> const &sigma,
+   vector<double> const &rho, unsigned const n_nodes){
+  vector<double> out(mu.size());
+  for(int i = 0; i < mu.size(); ++i)
+    out[i] = probit_integral(mu[i], sigma[i], rho[i], n_nodes);
+  return out;
+}
+
 /* The following functions maps from the input vector to the
  * parameterization used in
  * > Ormerod, J. T. (2011). Skew-normal variational approximations for
  * > Bayesian inference. Unpublished article. */
 template<class Type>
 struct SNVA_MD_input {
-  std::vector<vector<Type> > va_mus,
-                             va_rhos;
-  std::vector<matrix<Type> > va_lambdas;
+  /* the containers use the taping arena while a tape is recorded */
+  survTMB::arena_vector<vector<Type> > va_mus,
+                                       va_rhos;
+  survTMB::arena_vector<matrix<Type> > va_lambdas;
+  /* the log determinants of the lambda matrices */
+  survTMB::arena_vector<Type> va_logdets;
 };
 
 template<class Type>
@@ -510,19 +743,22 @@ SNVA_MD_input<Type> SNVA_MD_theta_DP_to_DP
   (Type const * const theta_VA, size_t const n_params,
    size_t const rng_dim){
   using survTMB::get_vcov_from_trian;
+  using survTMB::get_logdet_from_trian;
   using vecT = vector<Type>;
   using std::move;
   unsigned const n_groups = n_params / (
     rng_dim * 2L + (rng_dim * (rng_dim + 1L)) / 2L);
 
   SNVA_MD_input<Type> out;
-  std::vector<vecT > &va_mus = out.va_mus,
-                     &va_rhos = out.va_rhos;
-  std::vector<matrix<Type> > &va_lambdas = out.va_lambdas;
+  auto &va_mus = out.va_mus,
+      &va_rhos = out.va_rhos;
+  auto &va_lambdas = out.va_lambdas;
+  auto &va_logdets = out.va_logdets;
 
   va_mus    .reserve(n_groups);
   va_rhos   .reserve(n_groups);
   va_lambdas.reserve(n_groups);
+  va_logdets.reserve(n_groups);
 
   Type const *t = theta_VA;
   for(unsigned g = 0; g < n_groups; ++g){
@@ -532,8 +768,9 @@ SNVA_MD_input<Type> SNVA_MD_theta_DP_to_DP
       mu_vec[i] = *t++;
     va_mus.emplace_back(move(mu_vec));
 
-    /* insert new lambda matrix */
+    /* insert new lambda matrix and its log determinant */
     va_lambdas.emplace_back(get_vcov_from_trian(t, rng_dim));
+    va_logdets.emplace_back(get_logdet_from_trian(t, rng_dim));
     t += (rng_dim * (rng_dim + 1L)) / 2L;
 
     matrix<Type> const &Lambda = va_lambdas.back();
@@ -555,7 +792,10 @@ template<class Type>
 SNVA_MD_input<Type> SNVA_MD_theta_CP_trans_to_DP
   (Type const * const theta_VA, size_t const n_params,
    size_t const rng_dim){
-  using survTMB::get_vcov_from_trian;
+  using survTMB::get_chol_from_trian;
+  using survTMB::get_vcov_from_chol;
+  using survTMB::get_logdet_from_trian;
+  using survTMB::lower_tri_solve;
   using vecT = vector<Type>;
   using std::move;
   unsigned const n_mu = rng_dim,
@@ -564,13 +804,15 @@ SNVA_MD_input<Type> SNVA_MD_theta_CP_trans_to_DP
              n_groups = n_params / n_per_g;
 
   SNVA_MD_input<Type> out;
-  std::vector<vecT > &va_mus = out.va_mus,
-                     &va_rhos = out.va_rhos;
-  std::vector<matrix<Type> > &va_lambdas = out.va_lambdas;
+  auto &va_mus = out.va_mus,
+      &va_rhos = out.va_rhos;
+  auto &va_lambdas = out.va_lambdas;
+  auto &va_logdets = out.va_logdets;
 
   va_mus    .reserve(n_groups);
   va_rhos   .reserve(n_groups);
   va_lambdas.reserve(n_groups);
+  va_logdets.reserve(n_groups);
 
   get_gamma<Type> trans_g;
   Type const *t = theta_VA,
@@ -590,7 +832,8 @@ SNVA_MD_input<Type> SNVA_MD_theta_CP_trans_to_DP
     }
 
     /* Compute intermediaries and rho */
-    matrix<Type> Sigma = get_vcov_from_trian(t + n_mu, rng_dim);
+    matrix<Type> const C = get_chol_from_trian(t + n_mu, rng_dim);
+    matrix<Type> Sigma = get_vcov_from_chol(C);
     vecT k(rng_dim);
     for(unsigned i = 0; i < rng_dim; ++i){
       Type const nu = gamma_to_nu(gamma[i]);
@@ -612,8 +855,25 @@ SNVA_MD_input<Type> SNVA_MD_theta_CP_trans_to_DP
     auto const k_sqrt_2_pi_mat = k_sqrt_2_pi.matrix();
     Sigma += k_sqrt_2_pi_mat * k_sqrt_2_pi_mat.transpose();
 
-    vecT tmp = atomic::matinv(Sigma) * k;
-    Type const denom = sqrt(one - vec_dot(k, tmp));
+    /* Lambda = Sigma + c^2 k k^T with c^2 = 2 / pi and Sigma = C C^T.
+     * Thus, with r = C^{-1}k, the matrix determinant lemma and the
+     * Sherman-Morrison formula yield
+     *
+     *   log |Lambda|   = log |Sigma| + log(1 + c^2 r^T r)
+     *   Lambda^{-1} k  = C^{-T} r / (1 + c^2 r^T r)
+     *   k^T Lambda^{-1} k = r^T r / (1 + c^2 r^T r)
+     *
+     * such that only triangular solves are needed */
+    vecT tmp = k;
+    lower_tri_solve(C, tmp);
+    Type const r_sq = vec_dot(tmp, tmp),
+             r_mult = one + sqrt_2_pi * sqrt_2_pi * r_sq;
+    va_logdets.emplace_back(
+      get_logdet_from_trian(t + n_mu, rng_dim) + log(r_mult));
+
+    lower_tri_solve(C, tmp, true);
+    tmp /= r_mult;
+    Type const denom = sqrt(one - r_sq / r_mult);
 
     tmp /= denom;
     va_rhos.emplace_back(move(tmp));
@@ -648,16 +908,51 @@ struct SNVA_cond_dens_dat {
   Type const &va_rho, Type const &va_d, Type const &va_var,      \
   Type const &dist_mean, Type const &dist_var
 
+/* arguments to compute the cumulative hazard terms, H, for a set of
+ * observations. The operator() which takes H as the last argument can be
+ * used to compute the conditional density terms afterwards. The vector
+ * versions of the integrals only add one node to the tape */
+#define SNVA_CUM_HAZ_ARGS                                        \
+  vector<Type> const &eta_fix, vector<Type> const &va_mu,        \
+  vector<Type> const &va_sd, vector<Type> const &va_rho,         \
+  vector<Type> const &va_d, vector<Type> const &va_var
+
+/* arguments to compute the conditional density terms of a set of
+ * observations with one node on the tape given H. eta is the fixed effects
+ * plus dist_mean */
+#define SNVA_COND_DENS_VEC_ARGS                                  \
+  vector<Type> const &eta, vector<Type> const &etaD_fix,         \
+  vector<Type> const &event, vector<Type> const &dist_var,       \
+  vector<Type> const &H
+
 /* computes the conditional density term for the PH (log-log) link
  * function */
 template<class Type>
 struct ph final : public SNVA_cond_dens_dat<Type> {
   using SNVA_cond_dens_dat<Type>::SNVA_cond_dens_dat;
 
+  vector<Type> cum_haz(SNVA_CUM_HAZ_ARGS) const {
+    vector<Type> out(eta_fix.size());
+    for(int i = 0; i < out.size(); ++i)
+      out[i] = this->two * exp(
+        eta_fix[i] + va_mu[i] + va_var[i] / this->two) * survTMB::pnorm_std(va_d[i]);
+    return out;
+  }
+
+  vector<Type> cond_dens(SNVA_COND_DENS_VEC_ARGS) const {
+    return survTMB::cond_dens<survTMB::cond_dens_ph>(
+      eta, etaD_fix, event, dist_var, H, this->eps, this->kappa);
+  }
+
   Type operator()(SNVA_COND_DENS_ARGS) const {
+    Type const H = this->two * exp(
+      eta_fix + va_mu + va_var / this->two) * survTMB::pnorm_std(va_d);
+    return operator()(eta_fix, etaD_fix, event, va_mu, va_sd, va_rho, va_d,
+                      va_var, dist_mean, dist_var, H);
+  }
+
+  Type operator()(SNVA_COND_DENS_ARGS, Type const &H) const {
     Type const h = etaD_fix * exp(eta_fix + dist_mean),
-               H = this->two * exp(
-                 eta_fix + va_mu + va_var / this->two) * pnorm(va_d),
           if_low = event * this->eps_log - H - h * h * this->kappa,
           if_ok  = event * log(h)  - H;
 
@@ -671,10 +966,25 @@ template<class Type>
 struct po final : public SNVA_cond_dens_dat<Type> {
   using SNVA_cond_dens_dat<Type>::SNVA_cond_dens_dat;
 
+  vector<Type> cum_haz(SNVA_CUM_HAZ_ARGS) const {
+    vector<Type> const mu_use = va_mu + eta_fix;
+    return mlogit_integral(mu_use, va_sd, va_rho, this->n_nodes);
+  }
+
+  vector<Type> cond_dens(SNVA_COND_DENS_VEC_ARGS) const {
+    return survTMB::cond_dens<survTMB::cond_dens_po>(
+      eta, etaD_fix, event, dist_var, H, this->eps, this->kappa);
+  }
+
   Type operator()(SNVA_COND_DENS_ARGS) const {
     Type const H = mlogit_integral(
-      va_mu, va_sd, va_rho, eta_fix, this->n_nodes),
-               h = etaD_fix * exp(eta_fix + dist_mean - H),
+      va_mu, va_sd, va_rho, eta_fix, this->n_nodes);
+    return operator()(eta_fix, etaD_fix, event, va_mu, va_sd, va_rho, va_d,
+                      va_var, dist_mean, dist_var, H);
+  }
+
+  Type operator()(SNVA_COND_DENS_ARGS, Type const &H) const {
+    Type const h = etaD_fix * exp(eta_fix + dist_mean - H),
           if_low = event * this->eps_log - H - h * h * this->kappa,
           if_ok  = event * log(h)  - H;
 
@@ -688,10 +998,26 @@ template<class Type>
 struct probit final : public SNVA_cond_dens_dat<Type> {
   using SNVA_cond_dens_dat<Type>::SNVA_cond_dens_dat;
 
+  vector<Type> cum_haz(SNVA_CUM_HAZ_ARGS) const {
+    vector<Type> const mu_use = -eta_fix - va_mu,
+                      rho_use = -va_rho;
+    return probit_integral(mu_use, va_sd, rho_use, this->n_nodes);
+  }
+
+  vector<Type> cond_dens(SNVA_COND_DENS_VEC_ARGS) const {
+    return survTMB::cond_dens<survTMB::cond_dens_probit>(
+      eta, etaD_fix, event, dist_var, H, this->eps, this->kappa);
+  }
+
   Type operator()(SNVA_COND_DENS_ARGS) const {
     Type const H = probit_integral(
-        va_mu, va_sd, va_rho, -eta_fix, this->n_nodes),
-            diff = (eta_fix + dist_mean),
+        va_mu, va_sd, va_rho, -eta_fix, this->n_nodes);
+    return operator()(eta_fix, etaD_fix, event, va_mu, va_sd, va_rho, va_d,
+                      va_var, dist_mean, dist_var, H);
+  }
+
+  Type operator()(SNVA_COND_DENS_ARGS, Type const &H) const {
+    Type const diff = (eta_fix + dist_mean),
                h = etaD_fix * exp(
                  this->mlog_2_pi_half - diff * diff / this->two -
                    dist_var / this->two + H),
@@ -703,6 +1029,8 @@ struct probit final : public SNVA_cond_dens_dat<Type> {
 };
 
 #undef SNVA_COND_DENS_ARGS
+#undef SNVA_CUM_HAZ_ARGS
+#undef SNVA_COND_DENS_VEC_ARGS
 
 } // namespace SNVA
 } // namespace GaussHermite
@@ -8,7 +8,80 @@ using namespace GaussHermite;
 using namespace GaussHermite::SNVA;
 using namespace survTMB;
 
-template<class Type, template <class> class Accumlator>
+/* adds the conditional density terms of the observed outcomes. Dim is the
+ * dimension of the random effects or Eigen::Dynamic. The former avoids heap
+ * allocations for each observation. The integrals and the conditional
+ * density terms of each cluster are computed in one call each to reduce the
+ * size of the tape */
+template<int Dim, class Type, template <class> class Accumlator,
+         class CondDens>
+void SNVA_cond_dens_terms
+  (Accumlator<Type> &result, CondDens const &func, matrix<Type> const &Z,
+   vector<Type> const &eta_fix, vector<Type> const &etaD_fix,
+   vector<Type> const &event, vector<int> const &grp_size,
+   arena_vector<vector<Type> > const &va_mus,
+   arena_vector<vector<Type> > const &va_ds,
+   arena_vector<matrix<Type> > const &va_lambdas,
+   region_balancer const &regions, bool const is_in_parallel){
+  using small_vec = Eigen::Matrix<Type, Dim, 1>;
+  using small_mat = Eigen::Matrix<Type, Dim, Dim>;
+  Type const sqrt_2_pi(sqrt(M_2_PI)),
+                   one(1.);
+
+  /* declared once to reuse the memory with Dynamic */
+  small_vec va_mu, va_d, z;
+  small_mat va_lambda;
+  unsigned i = 0;
+  for(unsigned g = 0; g < grp_size.size(); ++g){
+    unsigned const n_members = grp_size[g];
+    /* is this our cluster? */
+    if(is_in_parallel){
+      set_region(*result.obj, regions[g]);
+      if(!is_my_region(*result.obj)){
+        i += n_members;
+        continue;
+      }
+    }
+
+    va_mu     = va_mus[g].matrix();
+    va_d      = va_ds [g].matrix();
+    va_lambda = va_lambdas[g];
+
+    /* compute the parameters of the marginal distributions and then the
+     * cumulative hazard terms of the cluster in one call */
+    vector<Type> mu(n_members), sd(n_members), rho(n_members),
+                  d(n_members), sd_sq(n_members), eta(n_members);
+    for(unsigned j = 0; j < n_members; ++j){
+      z = Z.row(i + j).transpose();
+
+      mu   [j] = vec_dot(z, va_mu);
+      sd_sq[j] = quad_form_sym(z, va_lambda);
+      sd   [j] = sqrt(sd_sq[j]);
+      d    [j] = vec_dot(z, va_d);
+      rho  [j] = d[j] / sd_sq[j] / sqrt(one - d[j] * d[j] / sd_sq[j]);
+      eta  [j] = eta_fix[i + j];
+    }
+    vector<Type> const H = func.cum_haz(eta, mu, sd, rho, d, sd_sq);
+
+    /* the conditional density terms are computed in one call */
+    vector<Type> eta_all(n_members), dist_var(n_members);
+    for(unsigned j = 0; j < n_members; ++j){
+      Type const d_scaled = sqrt_2_pi * d[j];
+      eta_all [j] = eta[j] + mu[j] + d_scaled;
+      dist_var[j] = sd_sq[j] - d_scaled * d_scaled;
+    }
+    vector<Type> const etaD = etaD_fix.segment(i, n_members),
+                         ev = event   .segment(i, n_members);
+
+    result -= func.cond_dens(eta_all, etaD, ev, dist_var, H).sum();
+    i += n_members;
+  }
+}
+
+/* CondDens is the class for the conditional density terms of the link
+ * function */
+template<template <class> class CondDens, class Type,
+         template <class> class Accumlator>
 void SNVA_comp
   (COMMON_ARGS(Type, Accumlator), vector<Type> const &theta_VA,
    unsigned const n_nodes, std::string const &param_type,
@@ -23,19 +96,22 @@ void SNVA_comp
   * instead of using solve... */
   Type log_det_vcov;
   matrix<Type> vcov_inv;
-  vcov_inv = atomic::matinvpd(vcov, log_det_vcov);
+  vcov_inv = inv_pd(vcov, log_det_vcov);
 
-  /* get objects from VA distribution */
-  std::vector<vecT > va_mus,
-                    va_rhos;
-  std::vector<matrix<Type> > va_lambdas;
+  /* get objects from VA distribution. The containers use the taping
+   * arena while a tape is recorded */
+  arena_vector<vecT > va_mus,
+                     va_rhos;
+  arena_vector<matrix<Type> > va_lambdas;
+  arena_vector<Type> va_logdets;
 
 #define SET_PARAMS(meth_use)                                   \
-  auto const input = meth_use(                                 \
+  auto input = meth_use(                                       \
     &theta_VA[0], theta_VA.size(), rng_dim);                   \
   va_mus     = move(input.va_mus);                             \
   va_rhos    = move(input.va_rhos);                            \
-  va_lambdas = move(input.va_lambdas)
+  va_lambdas = move(input.va_lambdas);                         \
+  va_logdets = move(input.va_logdets)
 
   if(param_type == "DP"){
     SET_PARAMS(SNVA_MD_theta_DP_to_DP);
@@ -48,78 +124,60 @@ void SNVA_comp
 
   unsigned const n_groups = va_mus.size();
 
-  /* assign constant and fixed effect objects */
-  vecT const eta_fix = X  * b,
-            etaD_fix = XD * b;
+  /* assign constant and fixed effect objects for the rows of this region */
+  bool const is_in_parallel = CppAD::thread_alloc::in_parallel();
+  region_balancer const regions =
+    get_grp_regions(grp_size, *result.obj, is_in_parallel);
+  vecT const eta_fix = sparse_mat_vec(
+               X , b, grp_size, regions, *result.obj, is_in_parallel),
+            etaD_fix = sparse_mat_vec(
+               XD, b, grp_size, regions, *result.obj, is_in_parallel);
   Type const sqrt_2_pi(sqrt(M_2_PI)),
                    one(1.),
                    two(2.),
                  small(std::numeric_limits<double>::epsilon());
 
-  /* assign object used in the variational distribution */
-  std::vector<vecT> va_ds;
-  va_ds.reserve(n_groups);
+  /* assign object used in the variational distribution. rho^T Lambda rho
+   * is also used in the entropy term */
+  arena_vector<vecT> va_ds;
+  arena_vector<Type> va_rho_quads;
+  va_ds       .reserve(n_groups);
+  va_rho_quads.reserve(n_groups);
   for(unsigned g = 0; g < n_groups; ++g){
     vecT new_d = va_lambdas[g] * va_rhos[g];
-    Type const denom = sqrt(one + vec_dot(va_rhos[g], new_d));
+    va_rho_quads.emplace_back(vec_dot(va_rhos[g], new_d));
+    Type const denom = sqrt(one + va_rho_quads.back());
     new_d /= denom;
     va_ds.emplace_back(move(new_d));
   }
 
   /* handle terms from conditional density of observed outcomes */
-  bool const is_in_parallel = CppAD::thread_alloc::in_parallel();
-  ph    <Type>     ph_func(eps, kappa, n_nodes);
-  po    <Type>     po_func(eps, kappa, n_nodes);
-  probit<Type> probit_func(eps, kappa, n_nodes);
-  {
-    unsigned i = 0;
-    for(unsigned g = 0; g < grp_size.size(); ++g){
-      unsigned const n_members = grp_size[g];
-      /* is this our cluster? */
-      if(is_in_parallel and !is_my_region(*result.obj)){
-        i += n_members;
-        result.obj->parallel_region();
-        continue;
-      }
-
-      vecT const &va_mu = va_mus[g],
-                  &va_d = va_ds [g];
-      matrix<Type> const &va_lambda = va_lambdas[g];
-
-      Type term(0.);
-      unsigned const end = n_members + i;
-      for(; i < end; ++i){
-        vecT const z = Z.row(i);
-
-        Type const mu = vec_dot(z, va_mu),
-                sd_sq = quad_form_sym(z, va_lambda),
-                   sd = sqrt(sd_sq),
-                    d = vec_dot(z, va_d),
-                  rho = d / sd_sq / sqrt(one - d * d / sd_sq),
-             d_scaled = sqrt_2_pi * d,
-            dist_mean = mu + d_scaled,
-             dist_var = sd_sq - d_scaled * d_scaled;
-
-        if(link == "PH")
-          term += ph_func(
-            eta_fix[i], etaD_fix[i], event[i],
-            mu, sd, rho, d, sd_sq, dist_mean, dist_var);
-        else if(link == "PO")
-          term += po_func(
-            eta_fix[i], etaD_fix[i], event[i],
-            mu, sd, rho, d, sd_sq, dist_mean, dist_var);
-        else if(link == "probit")
-          term += probit_func(
-            eta_fix[i], etaD_fix[i], event[i],
-            mu, sd, rho, d, sd_sq, dist_mean, dist_var);
-        else
-          error("'%s' not implemented", link.c_str());
-      }
-
-      result -= term;
-    }
+  CondDens<Type> const func(eps, kappa, n_nodes);
+  /* use vectors and matrices with a fixed size for small dimensions */
+#define COND_DENS_CALL(DIM)                                    \
+  SNVA_cond_dens_terms<DIM>(                                   \
+    result, func, Z, eta_fix, etaD_fix, event, grp_size,       \
+    va_mus, va_ds, va_lambdas, regions, is_in_parallel)
+  switch(rng_dim){
+  case 1L:
+    COND_DENS_CALL(1);
+    break;
+  case 2L:
+    COND_DENS_CALL(2);
+    break;
+  case 3L:
+    COND_DENS_CALL(3);
+    break;
+  case 4L:
+    COND_DENS_CALL(4);
+    break;
+  default:
+    COND_DENS_CALL(Eigen::Dynamic);
   }
+#undef COND_DENS_CALL
 
+  if(is_in_parallel)
+    set_region(*result.obj, regions.rest());
   if(!is_my_region(*result.obj))
     /* only have to add one more term so just return */
     return;
@@ -131,16 +189,12 @@ void SNVA_comp
     va_lambda_sum.setZero();
     Type lb_t_mult_half(0.), lb_t_mult_other(0.);
     for(unsigned g = 0; g < n_groups; ++g){
-      lb_t_mult_half +=
-        atomic::logdet(va_lambdas[g]) - quad_form_sym(va_mus[g], vcov_inv);
+      lb_t_mult_half += va_logdets[g] - quad_form_sym(va_mus[g], vcov_inv);
       va_lambda_sum += va_lambdas[g];
       lb_t_mult_other -= quad_form(va_mus[g], vcov_inv, va_ds[g]);
 
-      vecT va_rho_scaled =
-        matrix<Type>(va_lambdas[g].llt().matrixU()) * va_rhos[g];
-      va_rho_scaled += small;
-      last_terms -= entropy_term(vec_dot(va_rho_scaled, va_rho_scaled),
-                                 n_nodes);
+      /* |U rho|^2 = rho^T Lambda rho where Lambda = U^T U */
+      last_terms -= entropy_term(va_rho_quads[g] + small, n_nodes);
 
     }
     lb_t_mult_half -= mat_mult_trace(va_lambda_sum, vcov_inv);
@@ -174,7 +228,14 @@ void SNVA(COMMON_ARGS(Type, Accumlator), vector<Type> const &theta_VA,
             theta_VA.size(), expe_size);
   }
 
-  return SNVA_comp(COMMON_CALL, theta_VA, n_nodes, param_type, rng_dim);
+  if(link == "PH")
+    SNVA_comp<ph>(COMMON_CALL, theta_VA, n_nodes, param_type, rng_dim);
+  else if(link == "PO")
+    SNVA_comp<po>(COMMON_CALL, theta_VA, n_nodes, param_type, rng_dim);
+  else if(link == "probit")
+    SNVA_comp<probit>(COMMON_CALL, theta_VA, n_nodes, param_type, rng_dim);
+  else
+    error("'%s' not implemented", link.c_str());
 }
 
 using ADd   = CppAD::AD<double>;
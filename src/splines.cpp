@@ -1,5 +1,5 @@
 #include "splines.h"
-#include <algorithm> // lower_bound
+#include <algorithm> // lower_bound, upper_bound, fill
 #include <cmath> // isnan
 #include <stdexcept> // invalid_argument
 
@@ -37,26 +37,33 @@ vec basisMixin::operator()(double const x, int const ders) const {
   return out;
 }
 
+void basisMixin::eval_batch(mat &out, const vec &x, const int ders) const {
+  uword const n_basis(get_n_basis()),
+              n_x    (x.n_elem);
+  out.set_size(n_basis, n_x);
+  vec wrk(n_basis);
+  for (uword i = 0; i < n_x; i++){
+    operator()(wrk, x[i], ders);
+    out.col(i) = wrk;
+  }
+}
+
 mat basisMixin::basis(const vec &x, const int ders,
                       const double centre) const {
 #ifdef DO_CHECKS
   if (ders < 0)
     throw std::invalid_argument("ders<0");
 #endif
-  uword const n_basis(get_n_basis()),
-              n_x    (x.n_elem);
-  rowvec centering =
-    (std::isnan(centre) || ders > 0 ?
-     zeros(n_basis) : operator()(centre, 0)).t();
+  uword const n_basis(get_n_basis());
+  vec centering =
+    std::isnan(centre) || ders > 0 ?
+     zeros(n_basis) : operator()(centre, 0);
 
-  mat out(n_x, n_basis);
-  vec wrk(n_basis);
-  for (uword i = 0; i < n_x; i++){
-    operator()(wrk, x[i], ders);
-    out.row(i) = wrk.t() - centering;
-  }
+  mat out;
+  eval_batch(out, x, ders);
+  out.each_col() -= centering;
 
-  return out;
+  return out.t();
 }
 
 SplineBasis::SplineBasis(const int order): order(order), knots() {
@@ -77,6 +84,11 @@ SplineBasis::SplineBasis(const vec knots, const int order):
 
 void SplineBasis::operator()(
     vec &out, double const x, const int ders) const {
+  eval(out, x, wk_mem, ders);
+}
+
+void SplineBasis::eval(
+    vec &out, double const x, workspace &wk, const int ders) const {
   out.zeros();
 #ifdef DO_CHECKS
   if(out.n_elem != SplineBasis::get_n_basis())
@@ -84,8 +96,34 @@ void SplineBasis::operator()(
       "splineBasis", out.n_elem, SplineBasis::get_n_basis());
 #endif
 
-  set_cursor(x);
-  int io = curs - order;
+  set_cursor(x, wk);
+  eval_at_cursor(out.memptr(), x, wk, ders);
+}
+
+void SplineBasis::eval_sorted(
+    mat &out, const vec &x, workspace &wk, const int ders) const {
+  uword const n_x = x.n_elem;
+  out.zeros(SplineBasis::get_n_basis(), n_x);
+
+  int start(0L);
+  for(uword i = 0; i < n_x; ++i){
+    if(i > 0 and x[i] < x[i - 1L])
+      start = 0L;
+    start = set_cursor(x[i], wk, start);
+    eval_at_cursor(out.colptr(i), x[i], wk, ders);
+  }
+}
+
+void SplineBasis::eval_batch(
+    mat &out, const vec &x, const int ders) const {
+  workspace wk = get_workspace();
+  eval_sorted(out, x, wk, ders);
+}
+
+void SplineBasis::eval_at_cursor(
+    double * const out, const double x, workspace &wk,
+    const int ders) const {
+  int io = wk.curs - order;
   if (io < 0 || io > nknots) {
     /* Do nothing. x is already zero by default
     for (size_t j = 0; j < (size_t)order; j++) {
@@ -94,50 +132,59 @@ void SplineBasis::operator()(
   } else if (ders > 0) { /* slow method for derivatives */
     for(uword i = 0; i < (size_t)order; i++) {
       for(uword j = 0; j < (size_t)order; j++)
-        a(j) = 0;
-      a(i) = 1;
-      out(i + io) = slow_evaluate(x, ders);
+        wk.a(j) = 0;
+      wk.a(i) = 1;
+      out[i + io] = slow_evaluate(x, ders, wk);
     }
   } else { /* fast method for value */
-    basis_funcs(wrk, x);
-    for (uword i = 0; i < wrk.n_elem; i++)
-      out(i + io) = wrk(i);
+    basis_funcs(wk.wrk, x, wk);
+    for (uword i = 0; i < wk.wrk.n_elem; i++)
+      out[i + io] = wk.wrk(i);
   }
 }
 
-int SplineBasis::set_cursor(const double x) const {
-  /* don't assume x's are sorted */
+int SplineBasis::set_cursor(
+    const double x, workspace &wk, int const start) const {
+  /* don't assume x's are sorted. Thus, the search starts at knot start */
+  int &curs = wk.curs;
   curs = -1; /* Wall */
-  boundary = 0;
-  for (int i = 0; i < nknots; i++) {
-    if (knots(i) >= x)
-      curs = i;
-    if (knots(i) > x)
-      break;
-  }
+  wk.boundary = 0;
+  int const ub = std::upper_bound(
+    knots.begin() + start, knots.end(), x) - knots.begin();
+  if(ub < nknots)
+    curs = ub;
+  else if(nknots > 0 and knots(nknots - 1L) >= x)
+    curs = nknots - 1L;
+
   if (curs > ncoef) {
     int const lastLegit = ncoef;
     if (x == knots(lastLegit)){
-      boundary = 1;
+      wk.boundary = 1;
       curs = lastLegit;
     }
   }
-  return curs;
+  return ub;
 }
 
-void SplineBasis::diff_table(const double x, const int ndiff) const {
+void SplineBasis::diff_table(
+    const double x, const int ndiff, workspace &wk) const {
+  int const curs = wk.curs;
   for (int i = 0; i < ndiff; i++) {
-    rdel(i) = knots(curs + i) - x;
-    ldel(i) = x - knots(curs - (i + 1));
+    wk.rdel(i) = knots(curs + i) - x;
+    wk.ldel(i) = x - knots(curs - (i + 1));
   }
 }
 
-double SplineBasis::slow_evaluate(const double x, int nder) const
+double SplineBasis::slow_evaluate
+  (const double x, int nder, workspace &wk) const
 {
-  int ti = curs,
+  vec &a = wk.a,
+      &ldel = wk.ldel,
+      &rdel = wk.rdel;
+  int ti = wk.curs,
      lpt, apt, rpt, inner,
    outer = ordm1;
-  if (boundary && nder == ordm1) /* value is arbitrary */
+  if (wk.boundary && nder == ordm1) /* value is arbitrary */
     return 0;
   while(nder--) {  // FIXME: divides by zero
     for(inner = outer, apt = 0, lpt = ti - outer; inner--; apt++, lpt++)
@@ -145,7 +192,7 @@ double SplineBasis::slow_evaluate(const double x, int nder) const
         (knots(lpt + outer) - knots(lpt));
     outer--;
   }
-  diff_table(x, outer);
+  diff_table(x, outer, wk);
   while(outer--)
     for(apt = 0, lpt = outer, rpt = 0, inner = outer + 1;
         inner--; lpt--, rpt++, apt++)
@@ -155,8 +202,10 @@ double SplineBasis::slow_evaluate(const double x, int nder) const
   return a(0);
 }
 
-void SplineBasis::basis_funcs(vec &b, const double x) const {
-  diff_table(x, ordm1);
+void SplineBasis::basis_funcs(vec &b, const double x, workspace &wk) const {
+  vec const &ldel = wk.ldel,
+            &rdel = wk.rdel;
+  diff_table(x, ordm1, wk);
   b(0) = 1;
   for (uword j = 1; j <= (uword)ordm1; j++) {
     double saved(0);
@@ -202,43 +251,56 @@ bs::bs(const vec &bk, const vec &ik, const bool inter, const int ord):
   check_splines(boundary_knots, interior_knots, order);
 }
 
+void bs::extrapolate(double * const out, double const x, workspace &wk,
+                     const int ders) const {
+  double const k_pivot =
+      x < boundary_knots(0) ?
+      0.75 * boundary_knots(0) + 0.25 * knots(order) :
+      0.75 * boundary_knots(1) + 0.25 * knots(knots.n_elem - order - 2),
+    delta = x - k_pivot;
+
+  uword const n_basis = SplineBasis::get_n_basis();
+  vec &b = wk.basis;
+  auto add_term = [&](int const d, double const f = 1){
+    SplineBasis::eval(b, k_pivot, wk, d);
+    for(uword i = 0; i < n_basis; ++i)
+      out[i] += f * b[i];
+  };
+
+  std::fill(out, out + n_basis, 0.);
+  if (ders == 0) {
+    add_term(0);
+    add_term(1, delta);
+    add_term(2, delta * delta/2.);
+    add_term(3, delta * delta * delta /6.);
+
+  } else if (ders == 1) {
+    add_term(1);
+    add_term(2, delta);
+    add_term(3, delta * delta / 2.);
+
+  } else if (ders == 2) {
+    add_term(2);
+    add_term(3, delta);
+
+  } else if (ders==3) {
+    add_term(3);
+
+  }
+}
+
 void bs::operator()(vec &out, double const x, const int ders) const {
 #ifdef DO_CHECKS
   if(out.n_elem != bs::get_n_basis())
     throw_invalid_out("bs", out.n_elem, bs::get_n_basis());
 #endif
   if (x < boundary_knots(0) || x > boundary_knots(1)) {
-    double const k_pivot =
-        x < boundary_knots(0) ?
-        0.75 * boundary_knots(0) + 0.25 * knots(order) :
-        0.75 * boundary_knots(1) + 0.25 * knots(knots.n_elem - order - 2),
-      delta = x - k_pivot;
-
-    auto add_term = [&](int const d, double const f = 1){
-      bs::operator()(wrks, k_pivot, d);
-      out += f * wrks;
-    };
-
-    out.zeros();
-    if (ders == 0) {
-      add_term(0);
-      add_term(1, delta);
-      add_term(2, delta * delta/2.);
-      add_term(3, delta * delta * delta /6.);
-
-    } else if (ders == 1) {
-      add_term(1);
-      add_term(2, delta);
-      add_term(3, delta * delta / 2.);
-
-    } else if (ders == 2) {
-      add_term(2);
-      add_term(3, delta);
-
-    } else if (ders==3) {
-      add_term(3);
-
-    }
+    extrapolate(wrk.memptr(), x, wk_mem, ders);
+    if(intercept)
+      out = wrk;
+    else
+      for(uword i = 1; i < wrk.n_elem; ++i)
+        out[i - 1L] = wrk[i];
 
     return;
   }
@@ -252,6 +314,22 @@ void bs::operator()(vec &out, double const x, const int ders) const {
   }
 }
 
+void bs::eval_sorted(mat &out, const vec &x, workspace &wk,
+                     const int ders) const {
+  SplineBasis::eval_sorted(out, x, wk, ders);
+  for(uword i = 0; i < x.n_elem; ++i)
+    if (x[i] < boundary_knots(0) || x[i] > boundary_knots(1))
+      extrapolate(out.colptr(i), x[i], wk, ders);
+
+  if(!intercept)
+    out.shed_row(0L);
+}
+
+void bs::eval_batch(mat &out, const vec &x, const int ders) const {
+  workspace wk = get_workspace();
+  eval_sorted(out, x, wk, ders);
+}
+
 ns::ns(const vec &boundary_knots, const vec &interior_knots,
        const bool intercept, const int order):
   bspline(boundary_knots, interior_knots, true, order),
@@ -294,7 +372,39 @@ void ns::operator()(vec &out, double const x, const int ders) const {
     return;
   }
 
-  out = trans(bspline(x));
+  out = trans(bspline(x, ders));
+}
+
+void ns::eval_sorted(mat &out, const vec &x, SplineBasis::workspace &wk,
+                     const int ders) const {
+  mat b;
+  bspline.eval_sorted(b, x, wk, ders);
+  out = intercept ? q_matrix * b : q_matrix * b.rows(1L, b.n_rows - 1L);
+  out.shed_rows(0L, 1L);
+
+  for(uword i = 0; i < x.n_elem; ++i){
+    bool const is_left  = x[i] < bspline.boundary_knots(0),
+               is_right = x[i] > bspline.boundary_knots(1);
+    if(!is_left and !is_right)
+      continue;
+
+    auto o = out.col(i);
+    vec const &t0 = is_left ? tl0 : tr0,
+              &t1 = is_left ? tl1 : tr1;
+    double const bk = is_left ?
+      bspline.boundary_knots(0) : bspline.boundary_knots(1);
+    if (ders == 0)
+      o = t0 + (x[i] - bk) * t1;
+    else if (ders == 1)
+      o = t1;
+    else
+      o.zeros();
+  }
+}
+
+void ns::eval_batch(mat &out, const vec &x, const int ders) const {
+  SplineBasis::workspace wk = get_workspace();
+  eval_sorted(out, x, wk, ders);
 }
 
 vec ns::trans(const vec &x) const {
@@ -19,6 +19,11 @@ public:
   vec operator()(
       double const x, int const ders = DEFAULT_DERS) const;
 
+  /* evaluates the basis at each element of x. Column i of out is the basis
+   * at x[i] */
+  virtual void eval_batch(
+      mat &out, const vec &x, const int ders = DEFAULT_DERS) const;
+
   mat basis(
       const vec &x, const int ders = DEFAULT_DERS,
       const double centre = std::numeric_limits<double>::quiet_NaN())
@@ -37,13 +42,23 @@ public:
              ncoef =               /* number of coefficients */
         nknots > order ? nknots - order : 0L;
 
-private:
-  int mutable curs,		/* current position in knots vector */
-          boundary;		/* must have knots[(curs) <= x < knots(curs+1) */
-  vec mutable ldel = vec(ordm1), /* differences from knots on the left */
-              rdel = vec(ordm1), /* differences from knots on the right */
-              a    = vec(order), /* scratch array */
-              wrk  = vec(order); /* working memory */
+  /* working memory for the re-entrant member functions. One object is
+   * needed per thread */
+  struct workspace {
+    int curs = -1,    /* current position in knots vector */
+        boundary = 0; /* must have knots[(curs) <= x < knots(curs+1) */
+    vec ldel,  /* differences from knots on the left */
+        rdel,  /* differences from knots on the right */
+        a,     /* scratch array */
+        wrk,   /* working memory */
+        basis; /* a vector with all the basis functions */
+
+    workspace(int const order, int const ncoef):
+    ldel(order - 1), rdel(order - 1), a(order), wrk(order), basis(ncoef) { }
+  };
+
+protected:
+  workspace mutable wk_mem = workspace(order, ncoef);
 
 public:
   SplineBasis(const int order);
@@ -53,18 +68,41 @@ public:
     return ncoef;
   }
 
+  workspace get_workspace() const {
+    return workspace(order, ncoef);
+  }
+
   using basisMixin::operator();
   void operator()(
       vec &out, double const x, const int ders = DEFAULT_DERS) const;
 
+  /* re-entrant version of operator() */
+  void eval(vec &out, double const x, workspace &wk,
+            const int ders = DEFAULT_DERS) const;
+
+  /* re-entrant version of eval_batch. The search for the knot intervals
+   * continues from the previous element if x is sorted in increasing
+   * order */
+  void eval_sorted(mat &out, const vec &x, workspace &wk,
+                   const int ders = DEFAULT_DERS) const;
+  void eval_batch(
+      mat &out, const vec &x, const int ders = DEFAULT_DERS) const;
+
   virtual ~SplineBasis() = default;
 
 private:
-  int set_cursor(const double x) const;
-  void diff_table(const double x, const int ndiff) const;
-  double slow_evaluate(const double x, int nder) const;
+  /* sets the cursor in wk searching from knot start. Returns the index of
+   * the first knot greater than x which can be used as the start for the
+   * next larger x */
+  int set_cursor(const double x, workspace &wk, int const start = 0L) const;
+  void diff_table(const double x, const int ndiff, workspace &wk) const;
+  double slow_evaluate(const double x, int nder, workspace &wk) const;
   /* fast evaluation of basis functions */
-  void basis_funcs(vec &b, const double x) const;
+  void basis_funcs(vec &b, const double x, workspace &wk) const;
+  /* evaluates the basis given that the cursor is set. out must have ncoef
+   * elements which are zero */
+  void eval_at_cursor(double * const out, const double x, workspace &wk,
+                      const int ders) const;
 };
 
 class bs final : public SplineBasis {
@@ -90,6 +128,18 @@ public:
   using SplineBasis::operator();
   void operator()(
       vec &out, double const x, const int ders = DEFAULT_DERS) const;
+
+  /* re-entrant batch evaluation. See SplineBasis::eval_sorted */
+  void eval_sorted(mat &out, const vec &x, workspace &wk,
+                   const int ders = DEFAULT_DERS) const;
+  void eval_batch(
+      mat &out, const vec &x, const int ders = DEFAULT_DERS) const;
+
+private:
+  /* sets out to the extrapolation outside the boundary knots of all the
+   * ncoef basis functions including the intercept */
+  void extrapolate(double * const out, double const x, workspace &wk,
+                   const int ders) const;
 };
 
 class ns final : public basisMixin {
@@ -125,6 +175,16 @@ public:
   void operator()(
       vec &out, double const x, const int ders = DEFAULT_DERS) const;
 
+  SplineBasis::workspace get_workspace() const {
+    return bspline.get_workspace();
+  }
+
+  /* re-entrant batch evaluation. See SplineBasis::eval_sorted */
+  void eval_sorted(mat &out, const vec &x, SplineBasis::workspace &wk,
+                   const int ders = DEFAULT_DERS) const;
+  void eval_batch(
+      mat &out, const vec &x, const int ders = DEFAULT_DERS) const;
+
 private:
   vec trans(const vec &x) const;
 }; // class ns
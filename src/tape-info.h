@@ -0,0 +1,80 @@
+#ifndef TAPE_INFO_H
+#define TAPE_INFO_H
+
+#define INCLUDE_RCPP
+#include "tmb_includes.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace survTMB {
+
+/* collects the size and the memory use of tapes and returns them to R
+ * together with the memory held by CppAD::thread_alloc for each thread */
+class tape_info {
+  std::vector<std::string> type;
+  std::vector<int> block;
+  std::vector<double> size_var, size_op, size_par, op_seq_bytes,
+                      taylor_bytes, sparsity_bytes;
+
+public:
+  /* adds a tape. type is the purpose of the tape (e.g. "lb" or "grad") and
+   * b is the block */
+  template<class Base>
+  void add(char const *type_i, unsigned const b,
+           CppAD::ADFun<Base> const &f){
+    type          .emplace_back(type_i);
+    block         .emplace_back(b);
+    size_var      .emplace_back(f.size_var());
+    size_op       .emplace_back(f.size_op());
+    size_par      .emplace_back(f.size_par());
+    op_seq_bytes  .emplace_back(f.size_op_seq());
+    /* the Taylor coefficients which are kept from the last forward sweep */
+    taylor_bytes  .emplace_back(
+      static_cast<double>(f.size_order()) * f.size_direction() *
+        f.size_var() * sizeof(Base));
+    /* the forward mode sparsity patterns which are kept */
+    sparsity_bytes.emplace_back(
+      static_cast<double>(f.size_forward_bool()) * sizeof(bool) +
+        f.size_forward_set() * sizeof(std::size_t));
+  }
+
+  /* adds a vector of tapes which each correspond to a block */
+  template<class Base>
+  void add(char const *type_i,
+           std::vector<std::unique_ptr<CppAD::ADFun<Base> > > const &fs){
+    for(std::size_t b = 0; b < fs.size(); ++b)
+      if(fs[b])
+        add(type_i, b, *fs[b]);
+  }
+
+  Rcpp::List to_R() const {
+    using Rcpp::Named;
+    namespace ta = CppAD::thread_alloc;
+
+    std::size_t const n_threads = ta::num_threads();
+    std::vector<int> thread(n_threads);
+    std::vector<double> inuse(n_threads), available(n_threads);
+    for(std::size_t t = 0; t < n_threads; ++t){
+      thread   [t] = t;
+      inuse    [t] = ta::inuse(t);
+      available[t] = ta::available(t);
+    }
+
+    return Rcpp::List::create(
+      Named("tapes") = Rcpp::DataFrame::create(
+        Named("type") = type, Named("block") = block,
+        Named("size_var") = size_var, Named("size_op") = size_op,
+        Named("size_par") = size_par, Named("op_seq_bytes") = op_seq_bytes,
+        Named("taylor_bytes") = taylor_bytes,
+        Named("sparsity_bytes") = sparsity_bytes,
+        Named("stringsAsFactors") = false),
+      Named("thread_alloc") = Rcpp::DataFrame::create(
+        Named("thread") = thread, Named("inuse") = inuse,
+        Named("available") = available));
+  }
+};
+
+} // namespace survTMB
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef TAPING_ARENA_H
+#define TAPING_ARENA_H
+
+#include "tmb_includes.h"
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <vector>
+
+namespace survTMB {
+
+/* per-thread bump allocator used for temporaries while a tape is recorded.
+ * The memory is taken in chunks from CppAD::thread_alloc. Thus, the chunks
+ * are kept in the pool of the thread when CppAD::thread_alloc::hold_memory
+ * is true and there is no contention between threads which tape at the
+ * same time.
+ *
+ * The arena is only used inside the scope of a scoped_taping_arena.
+ * Allocations outside such a scope are passed on to CppAD::thread_alloc.
+ * All the memory from the arena is released at once when the outermost
+ * scope ends. */
+class taping_arena {
+  struct chunk {
+    char *mem;
+    std::size_t size;
+  };
+  /* the chunks in the order they are added. Only the last chunk is used
+   * for new allocations */
+  std::vector<chunk> chunks;
+  std::size_t used = 0L;
+  unsigned depth = 0L;
+
+  static constexpr std::size_t min_chunk_size = 1L << 16L,
+                               alignment = 32L;
+
+  static std::size_t align_up(std::size_t const n){
+    return (n + alignment - 1L) & ~(alignment - 1L);
+  }
+
+  void add_chunk(std::size_t const n_bytes){
+    /* copy to avoid an odr-use of the static member */
+    std::size_t const min_chunk = min_chunk_size,
+                           last = chunks.empty() ? 0L : chunks.back().size,
+                       min_size = std::max<std::size_t>(
+                         std::max(n_bytes, min_chunk), 2L * last);
+    std::size_t cap;
+    void *mem = CppAD::thread_alloc::get_memory(min_size, cap);
+    chunks.push_back({static_cast<char*>(mem), cap});
+    used = 0L;
+  }
+
+  bool owns(void const *p) const {
+    char const *c = static_cast<char const*>(p);
+    for(auto &ch : chunks)
+      if(c >= ch.mem and c < ch.mem + ch.size)
+        return true;
+    return false;
+  }
+
+  /* releases all chunks but the largest */
+  void reset(){
+    if(chunks.size() > 1L){
+      chunk const keep = chunks.back();
+      for(std::size_t i = 0; i < chunks.size() - 1L; ++i)
+        CppAD::thread_alloc::return_memory(chunks[i].mem);
+      chunks.assign(1L, keep);
+    }
+    used = 0L;
+  }
+
+  taping_arena() = default;
+
+public:
+  taping_arena(taping_arena const&) = delete;
+  taping_arena& operator=(taping_arena const&) = delete;
+
+  ~taping_arena(){
+    for(auto &ch : chunks)
+      CppAD::thread_alloc::return_memory(ch.mem);
+  }
+
+  /* returns the arena of this thread */
+  static taping_arena& get(){
+    static thread_local taping_arena out;
+    return out;
+  }
+
+  bool is_active() const {
+    return depth > 0L;
+  }
+
+  void * allocate(std::size_t const n_bytes){
+    if(!is_active()){
+      std::size_t cap;
+      return CppAD::thread_alloc::get_memory(n_bytes, cap);
+    }
+
+    std::size_t const n_aligned = align_up(n_bytes);
+    if(chunks.empty() or used + n_aligned > chunks.back().size)
+      add_chunk(n_aligned);
+
+    void *out = chunks.back().mem + used;
+    used += n_aligned;
+    return out;
+  }
+
+  /* memory from the arena is released when the scope ends */
+  void deallocate(void *p){
+    if(!owns(p))
+      CppAD::thread_alloc::return_memory(p);
+  }
+
+  friend class scoped_taping_arena;
+};
+
+/* makes taping_arena::get() use the arena on this thread in its scope. All
+ * objects which use memory from the arena must be destructed before the
+ * scope ends */
+class scoped_taping_arena {
+  taping_arena &arena = taping_arena::get();
+
+public:
+  scoped_taping_arena(){
+    ++arena.depth;
+  }
+
+  scoped_taping_arena(scoped_taping_arena const&) = delete;
+  scoped_taping_arena& operator=(scoped_taping_arena const&) = delete;
+
+  ~scoped_taping_arena(){
+    if(--arena.depth == 0L)
+      arena.reset();
+  }
+};
+
+/* STL allocator which uses the arena of the calling thread */
+template<class T>
+class arena_allocator {
+public:
+  using value_type = T;
+
+  arena_allocator() = default;
+  template<class O>
+  arena_allocator(arena_allocator<O> const&) { }
+
+  T * allocate(std::size_t const n){
+    if(n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+      throw std::bad_alloc();
+    return static_cast<T*>(taping_arena::get().allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T * const p, std::size_t){
+    taping_arena::get().deallocate(p);
+  }
+
+  template<class O>
+  bool operator==(arena_allocator<O> const&) const {
+    return true;
+  }
+  template<class O>
+  bool operator!=(arena_allocator<O> const&) const {
+    return false;
+  }
+};
+
+template<class T>
+using arena_vector = std::vector<T, arena_allocator<T> >;
+
+} // namespace survTMB
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef TAYLOR_UTILS_H
+#define TAYLOR_UTILS_H
+
+#include "tmb_includes.h"
+#include <cstddef>
+
+namespace survTMB {
+
+/* helper functions to implement higher order forward and reverse sweeps in
+ * atomic functions with one output given the gradient and a function to
+ * compute Hessian-vector products at the zero order Taylor coefficients.
+ *
+ * The Taylor coefficient of order k for input j is tx[j * (q + 1) + k]. The
+ * directions are copied to a contiguous buffer before hess_vec is called.
+ *
+ * Args:
+ *   p, q: lowest and highest order to compute. Only q <= 2 is supported.
+ *   n: number of inputs.
+ *   gr: gradient at the zero order coefficients.
+ *   hess_vec: callable (Type const *dir, Type *out) which sets out to the
+ *             Hessian times dir.
+ *   wk: working memory with 2 * n elements.
+ */
+template<class Type, class HessVec>
+bool taylor_forward
+  (std::size_t const p, std::size_t const q, std::size_t const n,
+   Type const *gr, HessVec hess_vec, const CppAD::vector<Type> &tx,
+   CppAD::vector<Type> &ty, Type * const wk){
+  if(q > 2L)
+    return false;
+
+  std::size_t const nq = q + 1L;
+  for(std::size_t k = p < 1L ? 1L : p; k <= q; ++k){
+    Type out(0.);
+    for(std::size_t j = 0; j < n; ++j)
+      out += gr[j] * tx[j * nq + k];
+
+    if(k == 2L){
+      Type * const dir = wk,
+           * const hv  = wk + n;
+      for(std::size_t j = 0; j < n; ++j)
+        dir[j] = tx[j * nq + 1L];
+      hess_vec(dir, hv);
+
+      Type quad(0.);
+      for(std::size_t j = 0; j < n; ++j)
+        quad += dir[j] * hv[j];
+      out += Type(.5) * quad;
+    }
+
+    ty[k] = out;
+  }
+
+  return true;
+}
+
+/* computes the partial derivatives for a reverse sweep of order q <= 1. See
+ * taylor_forward for the arguments */
+template<class Type, class HessVec>
+bool taylor_reverse
+  (std::size_t const q, std::size_t const n, Type const *gr,
+   HessVec hess_vec, const CppAD::vector<Type> &tx,
+   CppAD::vector<Type> &px, const CppAD::vector<Type> &py,
+   Type * const wk){
+  if(q == 0L){
+    for(std::size_t j = 0; j < n; ++j)
+      px[j] = py[0] * gr[j];
+    return true;
+  }
+  if(q > 1L)
+    return false;
+
+  Type * const dir = wk,
+       * const hv  = wk + n;
+  for(std::size_t j = 0; j < n; ++j)
+    dir[j] = tx[j * 2L + 1L];
+  hess_vec(dir, hv);
+
+  for(std::size_t j = 0; j < n; ++j){
+    px[j * 2L     ] = py[0] * gr[j] + py[1] * hv[j];
+    px[j * 2L + 1L] = py[1] * gr[j];
+  }
+
+  return true;
+}
+
+/* sparsity patterns for atomic functions with one output which depends on
+ * all n inputs and where the Hessian is dense. The arguments are as in
+ * CppAD's atomic_base::for_sparse_jac, rev_sparse_jac, and rev_sparse_hes
+ * with bool sparsity patterns. */
+inline bool one_output_for_sparse_jac
+  (std::size_t const q, const CppAD::vector<bool> &r,
+   CppAD::vector<bool> &s){
+  std::size_t const n = r.size() / q;
+  for(std::size_t k = 0; k < q; ++k){
+    bool any(false);
+    for(std::size_t j = 0; j < n and !any; ++j)
+      any = r[j * q + k];
+    s[k] = any;
+  }
+
+  return true;
+}
+
+inline bool one_output_rev_sparse_jac
+  (std::size_t const q, const CppAD::vector<bool> &rt,
+   CppAD::vector<bool> &st){
+  std::size_t const n = st.size() / q;
+  for(std::size_t j = 0; j < n; ++j)
+    for(std::size_t k = 0; k < q; ++k)
+      st[j * q + k] = rt[k];
+
+  return true;
+}
+
+inline bool one_output_rev_sparse_hes
+  (const CppAD::vector<bool> &s, CppAD::vector<bool> &t,
+   std::size_t const q, const CppAD::vector<bool> &r,
+   const CppAD::vector<bool> &u, CppAD::vector<bool> &v){
+  std::size_t const n = t.size();
+  for(std::size_t j = 0; j < n; ++j)
+    t[j] = s[0];
+
+  /* V = f'(x)^T U + s f''(x) R where all entries of f' and f'' are
+   * non-zero */
+  for(std::size_t k = 0; k < q; ++k){
+    bool any_r(false);
+    if(s[0])
+      for(std::size_t j = 0; j < n and !any_r; ++j)
+        any_r = r[j * q + k];
+
+    bool const vk = u[k] or any_r;
+    for(std::size_t j = 0; j < n; ++j)
+      v[j * q + k] = vk;
+  }
+
+  return true;
+}
+
+} // namespace survTMB
+
+#endif
@@ -0,0 +1,60 @@
+#include "testthat-wrap.h"
+#include "commutation.h"
+#include <vector>
+
+using namespace survTMB;
+
+context("commutation unit tests") {
+  test_that("commutation_vec gives the vectorized transpose") {
+    /* A is a 3 x 2 matrix */
+    std::size_t const n = 3L, m = 2L;
+    std::vector<double> const A { 1, 2, 3, 4, 5, 6 },
+                             ex { 1, 4, 2, 5, 3, 6 };
+    std::vector<double> out(n * m);
+    commutation_vec(n, m, A.data(), out.data());
+    for(std::size_t i = 0; i < ex.size(); ++i)
+      expect_equal(ex[i], out[i]);
+
+    /* K_(m, n) K_(n, m) is the identity */
+    std::vector<double> back(n * m);
+    commutation_vec(m, n, out.data(), back.data());
+    for(std::size_t i = 0; i < A.size(); ++i)
+      expect_equal(A[i], back[i]);
+  }
+
+  test_that("commutation_lhs and commutation_rhs_t match the dense matrix") {
+    std::size_t const n = 2L, m = 3L, nm = n * m, k = 2L;
+
+    /* the dense commutation matrix */
+    std::vector<double> K(nm * nm, 0.);
+    for(std::size_t r = 0; r < nm; ++r)
+      K[r + commutation_index(n, m, r) * nm] = 1.;
+
+    std::vector<double> A(nm * k), B(k * nm);
+    for(std::size_t i = 0; i < A.size(); ++i){
+      A[i] = static_cast<double>(i) - 3.;
+      B[i] = static_cast<double>(i * i) / 7.;
+    }
+
+    /* K A */
+    std::vector<double> out(nm * k);
+    commutation_lhs(n, m, A.data(), k, out.data());
+    for(std::size_t j = 0; j < k; ++j)
+      for(std::size_t i = 0; i < nm; ++i){
+        double ex(0.);
+        for(std::size_t l = 0; l < nm; ++l)
+          ex += K[i + l * nm] * A[l + j * nm];
+        expect_equal(ex, out[i + j * nm]);
+      }
+
+    /* B K^T */
+    commutation_rhs_t(n, m, B.data(), k, out.data());
+    for(std::size_t j = 0; j < nm; ++j)
+      for(std::size_t i = 0; i < k; ++i){
+        double ex(0.);
+        for(std::size_t l = 0; l < nm; ++l)
+          ex += B[i + l * k] * K[j + l * nm];
+        expect_equal(ex, out[i + j * k]);
+      }
+  }
+}
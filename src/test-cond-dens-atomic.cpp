@@ -0,0 +1,88 @@
+#include "testthat-wrap.h"
+#include "cond-dens-atomic.h"
+#include "test-taylor-utils.h"
+#include <string>
+#include <vector>
+
+using namespace survTMB;
+
+namespace {
+using ADd = CppAD::AD<double>;
+
+/* the conditional density term computed as in the scalar versions which
+ * record a subgraph for each observation. x = (eta, etaD, event, var, H,
+ * eps, kappa) */
+ADd cond_dens_ref(ADd const *x, std::string const &link){
+  ADd const &eta = x[0], &etaD = x[1], &event = x[2], &var = x[3],
+            &H   = x[4], &eps  = x[5], &kappa = x[6];
+
+  ADd h;
+  if(link == "PH")
+    h = etaD * exp(eta);
+  else if(link == "PO")
+    h = etaD * exp(eta - H);
+  else
+    h = etaD * exp(ADd(-log(2 * M_PI) / 2.) - eta * eta / 2. - var / 2. + H);
+
+  ADd const if_low = event * log(eps) - H - h * h * kappa,
+            if_ok  = event * log(h) - H;
+  return CppAD::CondExpGe(h, eps, if_ok, if_low);
+}
+
+template<class Link>
+void test_link(std::string const &link){
+  constexpr size_t const n_in = cond_dens_idx::n_in, m = 3L;
+  /* the first and the last tuple are in the h >= eps branch and the second
+   * tuple is in the other branch */
+  std::vector<double> const x = {
+     .3, .8  , 1., .5, .4, .01, 5.,
+    -.5, .005, 1., .2, .7, .01, 5.,
+    1.2, .4  , 0., 1.1, 1.5, .01, 5. },
+                            w = { .5, -1., 2. };
+
+  auto split = [&](vector<ADd> const &a, std::vector<vector<ADd> > &out){
+    out.assign(5L, vector<ADd>(m));
+    for(size_t i = 0; i < m; ++i)
+      for(size_t j = 0; j < 5L; ++j)
+        out[j][i] = a[i * n_in + j];
+  };
+
+  expect_batch_consistent(
+    [&](ADd const *a){ return cond_dens_ref(a, link); },
+    [&](vector<ADd> const &a){
+      std::vector<vector<ADd> > v;
+      split(a, v);
+      return cond_dens<Link>(v[0], v[1], v[2], v[3], v[4], a[5], a[6]);
+    }, n_in, x, w, false);
+
+  /* the double version */
+  std::vector<vector<double> > v(5L, vector<double>(m));
+  for(size_t i = 0; i < m; ++i)
+    for(size_t j = 0; j < 5L; ++j)
+      v[j][i] = x[i * n_in + j];
+  vector<double> const res =
+    cond_dens<Link>(v[0], v[1], v[2], v[3], v[4], x[5], x[6]);
+  expect_true(res.size() == static_cast<int>(m));
+
+  for(size_t i = 0; i < m; ++i){
+    vector<ADd> a(n_in);
+    for(size_t j = 0; j < n_in; ++j)
+      a[j] = ADd(x[i * n_in + j]);
+    expect_equal(asDouble(cond_dens_ref(&a[0], link)), res[i]);
+  }
+}
+} // namespace
+
+context("cond-dens-atomic unit tests") {
+  test_that("the PH conditional density atomic gives the correct result") {
+    test_link<cond_dens_ph>("PH");
+  }
+
+  test_that("the PO conditional density atomic gives the correct result") {
+    test_link<cond_dens_po>("PO");
+  }
+
+  test_that("the probit conditional density atomic gives the correct result") {
+    test_link<cond_dens_probit>("probit");
+  }
+}
@@ -35,4 +35,15 @@ context("Gauss-Legendre unit tests") {
       expect_equal(out, expect_val);
     }
   }
+
+  test_that("GLPairsCached works with more than 100 nodes") {
+    double const expect_val = exp(2) - exp(-2);
+
+    for(unsigned n : { 101L, 250L }){
+      double const out = get_fastgl_testval<double>(n);
+      expect_equal(out, expect_val);
+      expect_true(&fastgl::GLPairsCached<double>(n) ==
+                  &fastgl::GLPairsCached<double>(n));
+    }
+  }
 }
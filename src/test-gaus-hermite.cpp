@@ -44,4 +44,18 @@ context("gaus-hermite unit tests") {
       expect_equal(out, 2.);
     }
   }
+
+  test_that("GaussHermiteDataCached works with more than 100 nodes") {
+    /* int x^2 exp(-x^2) dx = sqrt(pi) / 2 */
+    for(unsigned n : { 20L, 101L, 150L }){
+      auto const &xw = GaussHermite::GaussHermiteDataCached<double>(n);
+      expect_true(xw.x.size() == n);
+      expect_true(&xw == &GaussHermite::GaussHermiteDataCached<double>(n));
+
+      double out(0.);
+      for(unsigned i = 0; i < n; ++i)
+        out += xw.w[i] * xw.x[i] * xw.x[i];
+      expect_equal(out, sqrt(M_PI) / 2.);
+    }
+  }
 }
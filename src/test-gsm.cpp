@@ -1,6 +1,9 @@
 #include "testthat-wrap.h"
 #include "gsm.h"
 #include <vector>
+#include <cmath>
+#include <type_traits>
+#include <limits>
 
 namespace {
 template<class Fam>
@@ -29,9 +32,182 @@ struct test_gsm_fam_util {
     }
   }
 };
+
+/* simulated-like data with more observations than the block size in gsm */
+struct test_gsm_data {
+  size_t const n = 150L;
+  arma::mat X = arma::mat(2L, n), XD = arma::mat(2L, n), Z = arma::mat(1L, n);
+  arma::vec y = arma::vec(n), offset_eta = arma::vec(n, arma::fill::zeros),
+        offset_etaD = arma::vec(n, arma::fill::zeros);
+  arma::vec beta = arma::vec(2L), gamma = arma::vec(1L);
+
+  test_gsm_data(){
+    for(size_t i = 0; i < n; ++i){
+      double const ti = .1 + 2. * (i + .5) / n;
+      X (0, i) = 1.;
+      X (1, i) = log(ti);
+      XD(0, i) = 0.;
+      XD(1, i) = 1. / ti;
+      Z (0, i) = sin(static_cast<double>(i));
+      y[i] = i % 3L != 0L;
+    }
+    beta [0] = -.5;
+    beta [1] = 1.2;
+    gamma[0] = .3;
+  }
+
+  /* computes the log-likelihood one observation at a time */
+  template<class Fam>
+  double log_likelihood(double const eps, double const kappa) const {
+    double out(0.);
+    for(size_t i = 0; i < n; ++i){
+      double const eta = arma::dot(beta, X.col(i)) +
+        arma::dot(gamma, Z.col(i)),
+                 eta_p = arma::dot(beta, XD.col(i));
+      Fam fam(eta);
+      double const haz = -fam.gp_g() * eta_p;
+      if(haz > eps)
+        out += y[i] > 0 ? log(-fam.gp() * eta_p) : fam.g_log();
+      else
+        out += (y[i] > 0 ? log(eps) : 0.) + fam.g_log() -
+          kappa * (haz - eps) * (haz - eps);
+    }
+    return out;
+  }
+};
+
+/* converts a design matrix to the storage type used by gsm */
+template<class Storage>
+struct to_storage {
+  static arma::Mat<Storage> get(arma::mat const &X){
+    return arma::conv_to<arma::Mat<Storage> >::from(X);
+  }
+};
+template<>
+struct to_storage<gsm_objs::sparse_storage> {
+  static arma::sp_mat get(arma::mat const &X){
+    return arma::sp_mat(X);
+  }
+};
+
+template<class Fam, class Storage = double>
+void test_gsm_obj(){
+  test_gsm_data dat;
+  double const eps = 1e-8, kappa = 1e8;
+  gsm_objs::gsm<Fam, Storage> obj(
+      to_storage<Storage>::get(dat.X), to_storage<Storage>::get(dat.XD),
+      to_storage<Storage>::get(dat.Z), dat.y, eps, kappa, 1L, dat.offset_eta,
+      dat.offset_etaD);
+
+  double const ll = obj.log_likelihood(dat.beta, dat.gamma);
+  /* the design matrices are rounded if they are stored in single
+   * precision */
+  double const ll_eps = std::is_same<Storage, float>::value ? 1e-6 : 1e-10;
+  expect_equal_eps(dat.log_likelihood<Fam>(eps, kappa), ll, ll_eps);
+
+  /* compare the gradient with finite differences */
+  arma::vec const gr = obj.grad(dat.beta, dat.gamma);
+  double const h = 1e-6;
+  for(size_t k = 0; k < 3L; ++k){
+    arma::vec bp = dat.beta, bm = dat.beta, gp = dat.gamma, gm = dat.gamma;
+    if(k < 2L){
+      bp[k] += h;
+      bm[k] -= h;
+    } else {
+      gp[0] += h;
+      gm[0] -= h;
+    }
+    double const fd = (obj.log_likelihood(bp, gp) -
+                       obj.log_likelihood(bm, gm)) / (2 * h);
+    expect_equal_eps(fd, gr[k], 1e-5);
+  }
+
+  /* compare the Hessian with finite differences of the gradient */
+  arma::mat const he = obj.hess(dat.beta, dat.gamma);
+  for(size_t k = 0; k < 3L; ++k){
+    arma::vec bp = dat.beta, bm = dat.beta, gp = dat.gamma, gm = dat.gamma;
+    if(k < 2L){
+      bp[k] += h;
+      bm[k] -= h;
+    } else {
+      gp[0] += h;
+      gm[0] -= h;
+    }
+    arma::vec const fd = (obj.grad(bp, gp) - obj.grad(bm, gm)) / (2 * h);
+    for(size_t l = 0; l < 3L; ++l)
+      expect_equal_eps(fd[l], he(l, k), 1e-5);
+  }
+}
 } // namespace
 
 context("testing gsm") {
+  test_that("gsm objects give the same log-likelihood, gradient, and Hessian as an observation-wise computation") {
+    test_gsm_obj<gsm_objs::gsm_ph    >();
+    test_gsm_obj<gsm_objs::gsm_logit >();
+    test_gsm_obj<gsm_objs::gsm_probit>();
+  }
+
+  test_that("gsm objects give the same with sparse design matrices and with design matrices in single precision") {
+    test_gsm_obj<gsm_objs::gsm_ph, gsm_objs::sparse_storage>();
+    test_gsm_obj<gsm_objs::gsm_ph, float                   >();
+  }
+
+  test_that("gsm_base::fit finds a maximum of the log-likelihood") {
+    test_gsm_data dat;
+    double const eps = 1e-8, kappa = 1e8;
+    gsm_objs::gsm<gsm_objs::gsm_ph> obj(
+        dat.X, dat.XD, dat.Z, dat.y, eps, kappa, 1L, dat.offset_eta,
+        dat.offset_etaD);
+
+    gsm_objs::gsm_fit_control ctrl;
+    gsm_objs::gsm_fit_res const res = obj.fit(dat.beta, dat.gamma, ctrl);
+    expect_true(res.convergence == 0L);
+    expect_true(res.eval.log_lik >=
+      obj.log_likelihood(dat.beta, dat.gamma));
+    expect_equal_eps(res.eval.log_lik,
+                     obj.log_likelihood(res.beta, res.gamma), 1e-12);
+
+    arma::vec const gr = obj.grad(res.beta, res.gamma);
+    for(size_t i = 0; i < gr.n_elem; ++i)
+      expect_true(std::abs(gr[i]) < 1e-5);
+
+    /* the Hessian is negative definite at the maximum */
+    arma::vec const eig = arma::eig_sym(res.eval.hess);
+    expect_true(eig.max() < 0);
+  }
+
+  test_that("gsm_base::fit stops if the Hessian is not finite") {
+    /* returns a non-finite Hessian */
+    struct nan_hess final : public gsm_objs::gsm_base {
+      double log_likelihood(arma::vec const&, arma::vec const&) const {
+        return 0.;
+      }
+      arma::vec grad(arma::vec const&, arma::vec const&) const {
+        return arma::vec(2L, arma::fill::ones);
+      }
+      arma::mat hess(arma::vec const&, arma::vec const&) const {
+        arma::mat out(2L, 2L, arma::fill::eye);
+        out(1, 0) = out(0, 1) = std::numeric_limits<double>::quiet_NaN();
+        return out;
+      }
+      gsm_objs::gsm_eval_res eval
+      (arma::vec const &b, arma::vec const &g, unsigned const) const {
+        return { log_likelihood(b, g), grad(b, g), hess(b, g) };
+      }
+      unsigned get_n_threads() const {
+        return 1L;
+      }
+    };
+
+    nan_hess const obj;
+    gsm_objs::gsm_fit_control ctrl;
+    gsm_objs::gsm_fit_res const res = obj.fit(
+      arma::vec(1L, arma::fill::zeros), arma::vec(1L, arma::fill::zeros),
+      ctrl);
+    expect_true(res.convergence == 3L);
+    expect_true(res.n_iter == 1L);
+  }
+
   test_that("ph link is correct") {
     /*
      dput(eta <- as.numeric((-3):3))
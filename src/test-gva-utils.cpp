@@ -1,5 +1,6 @@
 #include "testthat-wrap.h"
 #include "gva-utils.h"
+#include "test-taylor-utils.h"
 #include <vector>
 
 using namespace GaussHermite;
@@ -171,4 +172,105 @@ context("gav-utils unit tests") {
       d++;
     }
   }
+
+  test_that("the integrals have correct second order derivatives") {
+    using ADd = AD<double>;
+    constexpr unsigned const n_nodes(20L);
+    std::vector<double> const x = { .3, .8, 1.4 },
+                            dir = { .6, -.4, .3 };
+    double const eps = std::pow(
+      std::numeric_limits<double>::epsilon(), 1./ 4.);
+
+    {
+      vector<ADd > a(3), b(1);
+      for(unsigned i = 0; i < 3; ++i)
+        a[i] = ADd(x[i]);
+      CppAD::Independent(a);
+      b[0] = mlogit_integral(a[0], a[1], log(a[2]), n_nodes);
+      CppAD::ADFun<double> func(a, b);
+      expect_taylor_consistent(func, x, dir, eps);
+    }
+    {
+      vector<ADd > a(3), b(1);
+      for(unsigned i = 0; i < 3; ++i)
+        a[i] = ADd(x[i]);
+      CppAD::Independent(a);
+      b[0] = probit_integral(a[0], a[1], a[2], n_nodes);
+      CppAD::ADFun<double> func(a, b);
+      expect_taylor_consistent(func, x, dir, eps);
+    }
+  }
+
+  test_that("the integrals have the correct sparsity patterns") {
+    /* two terms with separate arguments such that the Hessian is block
+     * diagonal */
+    using ADd = AD<double>;
+    constexpr unsigned const n_nodes(20L),
+                                   n(4L);
+    vector<ADd > a(n), b(1);
+    a << .3, .8, -.2, 1.1;
+    CppAD::Independent(a);
+    b[0] = mlogit_integral(a[0], a[1], n_nodes) +
+      probit_integral(a[2], a[3], n_nodes);
+    CppAD::ADFun<double> func(a, b);
+
+    std::vector<bool> r(n * n, false), s(1, true);
+    for(unsigned i = 0; i < n; ++i)
+      r[i * n + i] = true;
+
+    std::vector<bool> const jac = func.ForSparseJac(n, r);
+    for(unsigned i = 0; i < n; ++i)
+      expect_true(jac[i]);
+
+    std::vector<bool> const hes = func.RevSparseHes(n, s);
+    for(unsigned i = 0; i < n; ++i)
+      for(unsigned j = 0; j < n; ++j)
+        expect_true(hes[i * n + j] == (i / 2L == j / 2L));
+  }
+
+  test_that("the vector versions of the integrals match the scalar versions") {
+    using ADd = AD<double>;
+    constexpr unsigned const n_nodes(20L);
+    constexpr size_t const m(3L);
+    /* pairs of (mu, sigma) */
+    std::vector<double> const x = { .3, .8, -.2, 1.1, 1.5, .4 },
+                              w = { .5, -1., 2. };
+
+    auto to_mu_sig = [&](vector<ADd> const &a, vector<ADd> &mu,
+                         vector<ADd> &sig){
+      for(size_t i = 0; i < m; ++i){
+        mu [i] = a[2L * i     ];
+        sig[i] = a[2L * i + 1L];
+      }
+    };
+
+    expect_batch_consistent(
+      [&](ADd const *a){ return mlogit_integral(a[0], a[1], n_nodes); },
+      [&](vector<ADd> const &a){
+        vector<ADd> mu(m), sig(m);
+        to_mu_sig(a, mu, sig);
+        return mlogit_integral(mu, sig, n_nodes);
+      }, 2L, x, w);
+
+    expect_batch_consistent(
+      [&](ADd const *a){ return probit_integral(a[0], a[1], n_nodes); },
+      [&](vector<ADd> const &a){
+        vector<ADd> mu(m), sig(m);
+        to_mu_sig(a, mu, sig);
+        return probit_integral(mu, sig, n_nodes);
+      }, 2L, x, w);
+
+    /* the double versions */
+    vector<double> mu(m), sig(m);
+    for(size_t i = 0; i < m; ++i){
+      mu [i] = x[2L * i     ];
+      sig[i] = x[2L * i + 1L];
+    }
+    vector<double> const ml = mlogit_integral(mu, sig, n_nodes),
+                         pr = probit_integral(mu, sig, n_nodes);
+    for(size_t i = 0; i < m; ++i){
+      expect_equal(mlogit_integral(mu[i], sig[i], n_nodes), ml[i]);
+      expect_equal(probit_integral(mu[i], sig[i], n_nodes), pr[i]);
+    }
+  }
 }
@@ -2,7 +2,10 @@
 #include "joint-utils.h"
 #include "splines.h"
 #include "orth_poly.h"
+#include "test-taylor-utils.h"
 #include <vector>
+#include <cmath>
+#include <memory>
 
 using namespace fastgl::joint;
 
@@ -62,10 +65,12 @@ context("joint-utils unit tests") {
     b_ik[1L] = 1.5350567286627;
     splines::ns b(b_bk, b_ik, false);
 
+    /* the bounds of the three subjects are changed below */
     snva_integral<double, splines::ns, splines::ns, splines::ns> func(
-          "snva_integral", n_nodes, &b, &g, &m, dim_a, true);
+          "snva_integral", n_nodes, &b, &g, &m, dim_a, true, 0,
+          std::make_shared<subject_node_bases>(3L));
 
-    auto x = func.get_x(lb, ub, omega, alpha, B, U, k, Lambda);
+    auto x = func.get_x(lb, ub, ADd(0.), omega, alpha, B, U, k, Lambda);
     {
       CppAD::vector<ADd> y(1L);
       CppAD::Independent(x);
@@ -83,6 +88,31 @@ context("joint-utils unit tests") {
       auto yy = afunc.Forward(0, xx);
       expect_equal(intgral_val, yy[0L]);
 
+      /* the bases at the nodes are stored for each subject */
+      {
+        CppAD::vector<double> xx_other = xx;
+        xx_other[1L] = 7.5;
+        xx_other[2L] = 1.;
+        double const other_val = afunc.Forward(0, xx_other)[0L];
+        expect_true(std::abs(other_val - intgral_val) > 1e-4);
+        expect_equal(intgral_val, afunc.Forward(0, xx)[0L]);
+        expect_equal(other_val, afunc.Forward(0, xx_other)[0L]);
+      }
+
+      /* an adaptive rule yields about the same result */
+      {
+        snva_integral<double, splines::ns, splines::ns, splines::ns>
+          func_adapt("snva_integral", 64L, &b, &g, &m, dim_a, true, 1e-10);
+        auto x_adapt = func.get_x(lb, ub, ADd(0.), omega, alpha, B, U, k, Lambda);
+        CppAD::vector<ADd> y_adapt(1L);
+        CppAD::Independent(x_adapt);
+        func_adapt(x_adapt, y_adapt);
+        CppAD::ADFun<double> afunc_adapt(x_adapt, y_adapt);
+
+        expect_equal_eps(intgral_val, asDouble(y_adapt[0L]), 1e-6);
+        expect_equal_eps(intgral_val, afunc_adapt.Forward(0, xx)[0L], 1e-6);
+      }
+
       constexpr size_t n_grad_ele = 61L;
       constexpr double const grad[n_grad_ele] = {
          1.14724243199794, 2.95735564711031, 0.61440889004403, -0.683696240047505,
@@ -105,33 +135,35 @@ context("joint-utils unit tests") {
       vector<double> w(1L);
       w[0L] = 1.;
       auto dx = afunc.Reverse(1, w);
-      expect_true(dx.size() == n_grad_ele + 2L);
+      expect_true(dx.size() == n_grad_ele + 3L);
 
       {
         size_t i = 0L;
         /* omega  */
         for(size_t j = 0; j < dim_o; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* alpha */
         for(size_t j = 0; j < dim_a; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* B */
         for(size_t j = 0; j < dim_B; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* U */
         for(size_t j = 0; j < K; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* k */
         for(size_t j = 0; j < K; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* Lambda */
         for(size_t j = 0; j < K * K; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
       }
 
-      /* change upper and lower bounds and compute agian */
+      /* change upper and lower bounds and compute agian. The bounds are
+       * fixed for each subject so another subject is used */
       xx[0L] = 2.4;
       xx[1L] = 6.7;
+      xx[2L] = 2.;
 
       yy = afunc.Forward(0, xx);
       expect_equal(2.57545288795293, yy[0L]);
@@ -154,27 +186,27 @@ context("joint-utils unit tests") {
         -0.0207730766792519, -0.0328347461145753, 0.0197101583388251,
         -0.0178054942965017, -0.0281440680982074, 0.0168944214332787 };
       dx = afunc.Reverse(1, w);
-      expect_true(dx.size() == n_grad_ele + 2L);
+      expect_true(dx.size() == n_grad_ele + 3L);
       {
         size_t i = 0L;
         /* omega  */
         for(size_t j = 0; j < dim_o; ++j, ++i)
-          expect_equal(grad2[i], dx[i + 2L]);
+          expect_equal(grad2[i], dx[i + 3L]);
         /* alpha */
         for(size_t j = 0; j < dim_a; ++j, ++i)
-          expect_equal(grad2[i], dx[i + 2L]);
+          expect_equal(grad2[i], dx[i + 3L]);
         /* B */
         for(size_t j = 0; j < dim_B; ++j, ++i)
-          expect_equal(grad2[i], dx[i + 2L]);
+          expect_equal(grad2[i], dx[i + 3L]);
         /* U */
         for(size_t j = 0; j < K; ++j, ++i)
-          expect_equal(grad2[i], dx[i + 2L]);
+          expect_equal(grad2[i], dx[i + 3L]);
         /* k */
         for(size_t j = 0; j < K; ++j, ++i)
-          expect_equal(grad2[i], dx[i + 2L]);
+          expect_equal(grad2[i], dx[i + 3L]);
         /* Lambda */
         for(size_t j = 0; j < K * K; ++j, ++i)
-          expect_equal(grad2[i], dx[i + 2L]);
+          expect_equal(grad2[i], dx[i + 3L]);
       }
     }
   }
@@ -228,7 +260,7 @@ context("joint-utils unit tests") {
     snva_integral<double, splines::ns, splines::ns, splines::ns> func(
         "snva_integral", n_nodes, nullptr, &g, &m, dim_a, true);
 
-    auto x = func.get_x(lb, ub, omega, alpha, B, U, k, Lambda);
+    auto x = func.get_x(lb, ub, ADd(0.), omega, alpha, B, U, k, Lambda);
     {
       CppAD::vector<ADd> y(1L);
       CppAD::Independent(x);
@@ -268,28 +300,28 @@ context("joint-utils unit tests") {
       vector<double> w(1L);
       w[0L] = 1.;
       auto dx = afunc.Reverse(1, w);
-      expect_true(dx.size() == n_grad_ele + 2L);
+      expect_true(dx.size() == n_grad_ele + 3L);
 
       {
         size_t i = 0L;
         /* omega  */
         /*for(size_t j = 0; j < dim_o; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);*/
+          expect_equal(grad[i], dx[i + 3L]);*/
         /* alpha */
         for(size_t j = 0; j < dim_a; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* B */
         for(size_t j = 0; j < dim_B; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* U */
         for(size_t j = 0; j < K; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* k */
         for(size_t j = 0; j < K; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* Lambda */
         for(size_t j = 0; j < K * K; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
       }
     }
   }
@@ -342,7 +374,7 @@ context("joint-utils unit tests") {
     snva_integral<double, splines::ns, splines::ns, splines::ns> func(
         "snva_integral", n_nodes, &b, nullptr, &m, dim_a, true);
 
-    auto x = func.get_x(lb, ub, omega, alpha, B, U, k, Lambda);
+    auto x = func.get_x(lb, ub, ADd(0.), omega, alpha, B, U, k, Lambda);
     {
       CppAD::vector<ADd> y(1L);
       CppAD::Independent(x);
@@ -380,28 +412,28 @@ context("joint-utils unit tests") {
       vector<double> w(1L);
       w[0L] = 1.;
       auto dx = afunc.Reverse(1, w);
-      expect_true(dx.size() == n_grad_ele + 2L);
+      expect_true(dx.size() == n_grad_ele + 3L);
 
       {
         size_t i = 0L;
         /* omega  */
         for(size_t j = 0; j < dim_o; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* alpha */
         for(size_t j = 0; j < dim_a; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* B */
         /*for(size_t j = 0; j < dim_B; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);*/
+          expect_equal(grad[i], dx[i + 3L]);*/
         /* U */
         for(size_t j = 0; j < K; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* k */
         for(size_t j = 0; j < K; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* Lambda */
         for(size_t j = 0; j < K * K; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
       }
     }
   }
@@ -450,7 +482,7 @@ context("joint-utils unit tests") {
     snva_integral<double, splines::ns, splines::ns, splines::ns> func(
         "snva_integral", n_nodes, &b, &g, nullptr, dim_a, true);
 
-    auto x = func.get_x(lb, ub, omega, alpha, B, U, k, Lambda);
+    auto x = func.get_x(lb, ub, ADd(0.), omega, alpha, B, U, k, Lambda);
     {
       CppAD::vector<ADd> y(1L);
       CppAD::Independent(x);
@@ -478,28 +510,28 @@ context("joint-utils unit tests") {
       vector<double> w(1L);
       w[0L] = 1.;
       auto dx = afunc.Reverse(1, w);
-      expect_true(dx.size() == n_grad_ele + 2L);
+      expect_true(dx.size() == n_grad_ele + 3L);
 
       {
         size_t i = 0L;
         /* omega  */
         for(size_t j = 0; j < dim_o; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* alpha */
         for(size_t j = 0; j < dim_a; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* B */
         for(size_t j = 0; j < dim_B; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* U */
         /*for(size_t j = 0; j < K; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);*/
+          expect_equal(grad[i], dx[i + 3L]);*/
         /* k */
         /*for(size_t j = 0; j < K; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);*/
+          expect_equal(grad[i], dx[i + 3L]);*/
         /* Lambda */
         /*for(size_t j = 0; j < K * K; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);*/
+          expect_equal(grad[i], dx[i + 3L]);*/
       }
     }
   }
@@ -543,7 +575,7 @@ context("joint-utils unit tests") {
     snva_integral<double, poly::orth_poly, poly::orth_poly, poly::orth_poly>
       func("snva_integral", n_nodes, &basis, &basis, &basis, dim_a, false);
 
-    auto x = func.get_x(lb, ub, omega, alpha, B, U, k, Lambda);
+    auto x = func.get_x(lb, ub, ADd(0.), omega, alpha, B, U, k, Lambda);
     {
       CppAD::vector<ADd> y(1L);
       CppAD::Independent(x);
@@ -582,29 +614,85 @@ context("joint-utils unit tests") {
       vector<double> w(1L);
       w[0L] = 1.;
       auto dx = afunc.Reverse(1, w);
-      expect_true(dx.size() == n_grad_ele + 2L);
+      expect_true(dx.size() == n_grad_ele + 3L);
 
       {
         size_t i = 0L;
         /* omega  */
         for(size_t j = 0; j < dim_o; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* alpha */
         for(size_t j = 0; j < dim_a; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* B */
         for(size_t j = 0; j < dim_B; ++j, ++i)
-          expect_equal(grad[i], dx[i + 2L]);
+          expect_equal(grad[i], dx[i + 3L]);
         /* U */
         for(size_t j = 0; j < K; ++j, ++i)
-         expect_equal(grad[i], dx[i + 2L]);
+         expect_equal(grad[i], dx[i + 3L]);
         /* k */
         for(size_t j = 0; j < K; ++j, ++i)
-         expect_equal(grad[i], dx[i + 2L]);
+         expect_equal(grad[i], dx[i + 3L]);
         /* Lambda */
         for(size_t j = 0; j < K * K; ++j, ++i)
-         expect_equal(grad[i], dx[i + 2L]);
+         expect_equal(grad[i], dx[i + 3L]);
       }
     }
   }
+
+  test_that("eval_snva_integral has correct second order derivatives") {
+    using ADd = AD<double>;
+    constexpr size_t const dim_o(3L),
+                           dim_a(2L),
+                           dim_m(3L),
+                               K = dim_a * dim_m,
+                           dim_g(3L),
+                         n_nodes(30L);
+
+    vector<ADd> omega(dim_o);
+    omega << -0.74, 0.76, 0.10;
+
+    vector<ADd> alpha(dim_a);
+    alpha << 0.7, 0.6;
+
+    vector<ADd> U(K),
+    k(K);
+    U << -0.79, -0.67, 0.05, -0.71, -0.13, -0.33;
+    k << -0.155666233880193, -0.202626997173659, 0.480913001875679,
+         -0.185234121879782, 0.138273358586317, -0.056526844705098;
+
+    matrix<ADd> B(dim_g, dim_a),
+    Lambda(K, K);
+    B << 0.97, -0.78, 0.01, -0.86, 0.02, -0.03;
+    Lambda <<  1.08, 0.12, -0.36, -0.48, 0.36, -0.12, 0.12, 0.36,
+               0, 0.12, 0, -0.12, -0.36, 0, 0.84, 0.12, 0.12, 0.12, -0.48, 0.12,
+               0.12, 0.84, -0.12, 0.24, 0.36, 0, 0.12, -0.12, 0.84, -0.12, -0.12,
+               -0.12, 0.12, 0.24, -0.12, 0.6;
+
+    ADd const lb(1.2), ub(9.5);
+
+    arma::vec const norm2 = { 0.1, 1, 8.25, 52.8 },
+                alpha_bas = { 5.5, 5.5 };
+    poly::orth_poly basis(alpha_bas, norm2);
+
+    snva_integral<double, poly::orth_poly, poly::orth_poly, poly::orth_poly>
+      func("snva_integral", n_nodes, &basis, &basis, &basis, dim_a, false);
+
+    auto x = func.get_x(lb, ub, ADd(0.), omega, alpha, B, U, k, Lambda);
+    CppAD::vector<ADd> y(1L);
+    CppAD::Independent(x);
+    func(x, y);
+    CppAD::ADFun<double> afunc(x, y);
+
+    /* the bounds and the subject are fixed */
+    std::vector<double> xx(x.size()), dir(x.size(), 0.);
+    for(size_t i = 0; i < x.size(); ++i)
+      xx[i] = asDouble(x[i]);
+    for(size_t i = 3L; i < x.size(); ++i)
+      dir[i] = std::cos(static_cast<double>(i)) / 4.;
+
+    expect_taylor_consistent(
+      afunc, xx, dir,
+      std::pow(std::numeric_limits<double>::epsilon(), 1./ 4.));
+  }
 }
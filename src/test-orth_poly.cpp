@@ -47,5 +47,13 @@ context("testing orth_poly") {
       for(size_t j = 0; j < Xout.n_cols; ++j)
         expect_equal(Xout.at(i, j), b[j]);
     }
+
+    arma::mat Xeval;
+    obj.eval(x, Xeval);
+    expect_true(Xeval.n_cols == Xout.n_cols);
+    expect_true(Xeval.n_rows == Xout.n_rows);
+    for(size_t j = 0; j < Xout.n_cols; ++j)
+      for(size_t i = 0; i < Xout.n_rows; ++i)
+        expect_equal(Xout.at(i, j), Xeval.at(i, j));
   }
 }
@@ -0,0 +1,85 @@
+#include "testthat-wrap.h"
+#include "parallel-utils.h"
+#include <vector>
+
+using namespace survTMB;
+
+context("parallel-utils unit tests") {
+  test_that("block_reducer gives the correct sum") {
+    for(unsigned n_blocks : { 1L, 2L, 3L, 7L, 8L }){
+      unsigned const n_ele = 2500L;
+      block_reducer red(n_blocks, n_ele);
+      std::vector<double> ex(n_ele, 0.);
+
+      for(unsigned i = 0; i < n_blocks; ++i){
+        red.zero(i);
+        double *b = red.block(i);
+        for(unsigned j = 0; j < n_ele; ++j){
+          double const val = (i + 1.) * (j + 1.) / n_ele;
+          b[j] = val;
+          ex[j] += val;
+        }
+      }
+
+      std::vector<double> res(n_ele);
+      red.reduce(res.data(), 2L);
+      for(unsigned j = 0; j < n_ele; ++j)
+        expect_equal(ex[j], res[j]);
+    }
+  }
+
+  test_that("block_reducer only reallocates when the dimensions change") {
+    block_reducer red(3L, 4L);
+    double const *ptr = red.block(0L);
+    red.resize(3L, 4L);
+    expect_true(ptr == red.block(0L));
+    expect_true(red.get_n_blocks() == 3L);
+    expect_true(red.get_n_ele() == 4L);
+  }
+
+  test_that("sparse_block_reducer gives the correct sum") {
+    unsigned const n_shared = 3L,
+                   n_ele    = 3000L,
+                   n_blocks = 4L;
+    sparse_block_reducer red(n_shared, n_ele);
+
+    /* block i depends on every (i + 2)th element and the last block
+     * depends on all elements */
+    std::vector<std::vector<double> > dense(
+        n_blocks, std::vector<double>(n_ele, 0.));
+    for(unsigned i = 0; i < n_blocks; ++i){
+      std::vector<bool> pattern(n_ele);
+      for(unsigned j = 0; j < n_ele; ++j){
+        pattern[j] = j < n_shared or i == n_blocks - 1L or j % (i + 2L) == 0;
+        if(pattern[j])
+          dense[i][j] = (i + 1.) * (j + 1.) / n_ele;
+      }
+
+      red.add_block(sparse_block_reducer::get_ranges(pattern, n_shared));
+    }
+    expect_true(red.get_n_own(n_blocks - 1L) == n_ele);
+    expect_true(red.get_n_own(0L) < n_ele);
+
+    std::vector<double> ex(n_ele, 0.);
+    for(unsigned i = 0; i < n_blocks; ++i){
+      red.set_block(i, dense[i].data());
+      for(unsigned j = 0; j < n_ele; ++j)
+        ex[j] += dense[i][j];
+    }
+
+    std::vector<double> res(n_ele, -1.);
+    red.reduce(res.data(), 2L);
+    for(unsigned j = 0; j < n_ele; ++j)
+      expect_equal(ex[j], res[j]);
+  }
+
+  test_that("sparse_block_reducer::get_ranges gives the correct result") {
+    std::vector<bool> const pattern {
+      true, true, false, true, true, false, false, true };
+    auto ranges = sparse_block_reducer::get_ranges(pattern, 1L);
+    expect_true(ranges.size() == 3L);
+    expect_true(ranges[0].begin == 1L and ranges[0].end == 2L);
+    expect_true(ranges[1].begin == 3L and ranges[1].end == 5L);
+    expect_true(ranges[2].begin == 7L and ranges[2].end == 8L);
+  }
+}
@@ -35,4 +35,35 @@ context("pnorm_log unit tests") {
     vector<double> dy = func.Reverse(1, w);
     expect_equal(true_dy, dy[0]);
   }
+
+  test_that("the batch versions give the correct result") {
+    /*
+     x <- c(-40, -5, 0, 2)
+     dput(pnorm(x, log.p = TRUE))
+     dput(exp(dnorm(x, log = TRUE) - pnorm(x, log.p = TRUE)))
+     */
+    std::vector<double> const x = { -40, -5, 0, 2 },
+                      true_log = { -804.608442013754, -15.0649983939887,
+                                   -0.693147180559945, -0.0230129093289635 },
+                    true_mills = { 40.0249688472073, 5.18650396712583,
+                                   0.797884560802865, 0.05524786267899 };
+    size_t const n = x.size();
+
+    std::vector<double> out(n);
+    pnorm_log(x.data(), out.data(), n);
+    for(size_t i = 0; i < n; ++i){
+      expect_equal(true_log[i], out[i]);
+      expect_equal(true_log[i], pnorm_log(x[i]));
+    }
+
+    inv_mills_ratio(x.data(), out.data(), n);
+    for(size_t i = 0; i < n; ++i)
+      expect_equal(true_mills[i], out[i]);
+
+    /* the AD version */
+    std::vector<CppAD::AD<double> > x_ad(x.begin(), x.end()), out_ad(n);
+    pnorm_log(x_ad.data(), out_ad.data(), n);
+    for(size_t i = 0; i < n; ++i)
+      expect_equal(true_log[i], asDouble(out_ad[i]));
+  }
 }
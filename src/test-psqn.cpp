@@ -0,0 +1,108 @@
+#include "testthat-wrap.h"
+#include "psqn.h"
+#include <vector>
+#include <cmath>
+
+namespace {
+/* element function given by
+
+     f_k(g, p) = (g_1 - 1)^2 / K + (p_1 - g_1 (k + 1) / K)^2
+                 + 2 (p_2 - g_2 - p_1)^2 + (g_2 + .5)^2 / K
+                 + .1 (p_1^2 - p_2)^2
+ */
+class test_efunc {
+  double const k, K;
+
+public:
+  test_efunc(double const k, double const K): k(k), K(K) { }
+
+  std::size_t n_private() const {
+    return 2L;
+  }
+
+  double func(double const *g, double const *p) const {
+    double const a = p[0] - g[0] * (k + 1) / K,
+                 b = p[1] - g[1] - p[0],
+                 c = p[0] * p[0] - p[1];
+    return (g[0] - 1) * (g[0] - 1) / K + a * a + 2 * b * b +
+      (g[1] + .5) * (g[1] + .5) / K + .1 * c * c;
+  }
+
+  double grad(double const *g, double const *p, double *gr) const {
+    double const a = p[0] - g[0] * (k + 1) / K,
+                 b = p[1] - g[1] - p[0],
+                 c = p[0] * p[0] - p[1];
+    gr[0] = 2 * (g[0] - 1) / K - 2 * a * (k + 1) / K;
+    gr[1] = -4 * b + 2 * (g[1] + .5) / K;
+    gr[2] = 2 * a - 4 * b + .4 * c * p[0];
+    gr[3] = 4 * b - .2 * c;
+    return func(g, p);
+  }
+};
+} // namespace
+
+context("psqn unit tests") {
+  test_that("psqn::optimizer finds the minimum") {
+    unsigned const K = 50L;
+    std::vector<test_efunc> funcs;
+    for(unsigned k = 0; k < K; ++k)
+      funcs.emplace_back(k, K);
+    std::vector<test_efunc> const funcs_cp = funcs;
+
+    psqn::optimizer<test_efunc> opt(funcs, 2L);
+    expect_true(opt.get_n_par() == 2L + 2L * K);
+
+    std::vector<double> x(opt.get_n_par(), 0.);
+    psqn::optim_info const res = opt.optim(x.data(), 1e-12, 1000L);
+    expect_true(res.info == psqn::converged);
+
+    /* the gradient should be close to zero */
+    std::vector<double> gr(x.size(), 0.);
+    double gr_k[4L], val(0.);
+    for(unsigned k = 0; k < K; ++k){
+      val += funcs_cp[k].grad(x.data(), x.data() + 2L + 2L * k, gr_k);
+      gr[0] += gr_k[0];
+      gr[1] += gr_k[1];
+      gr[2L + 2L * k] = gr_k[2];
+      gr[3L + 2L * k] = gr_k[3];
+    }
+
+    expect_equal(val, res.value);
+    for(auto g : gr)
+      expect_true(std::abs(g) < 1e-5);
+
+    /* the last evaluation of the line search is used in the next
+     * iteration */
+    expect_true(res.n_eval == res.n_grad);
+  }
+
+  test_that("psqn::optimizer stops when the gradient norm is small") {
+    unsigned const K = 50L;
+    std::vector<test_efunc> funcs;
+    for(unsigned k = 0; k < K; ++k)
+      funcs.emplace_back(k, K);
+    std::vector<test_efunc> const funcs_cp = funcs;
+
+    psqn::optimizer<test_efunc> opt(funcs, 2L);
+    std::vector<double> x(opt.get_n_par(), 0.);
+    /* the relative change criterion would not stop the method */
+    double const gr_tol = 1e-3;
+    psqn::optim_info const res =
+      opt.optim(x.data(), 1e-300, 1000L, 0L, 1e-4, gr_tol);
+    expect_true(res.info == psqn::converged);
+
+    std::vector<double> gr(x.size(), 0.);
+    double gr_k[4L];
+    for(unsigned k = 0; k < K; ++k){
+      funcs_cp[k].grad(x.data(), x.data() + 2L + 2L * k, gr_k);
+      gr[0] += gr_k[0];
+      gr[1] += gr_k[1];
+      gr[2L + 2L * k] = gr_k[2];
+      gr[3L + 2L * k] = gr_k[3];
+    }
+    double gr_norm(0.);
+    for(auto g : gr)
+      gr_norm += g * g;
+    expect_true(std::sqrt(gr_norm) < gr_tol);
+  }
+}
@@ -1,5 +1,6 @@
 #include "testthat-wrap.h"
 #include "snva-utils.h"
+#include "test-taylor-utils.h"
 #include <vector>
 
 using namespace GaussHermite;
@@ -324,4 +325,90 @@ context("snva-utils unit tests") {
     do_test(Sig, input.va_lambdas[0]);
     do_test(rho, input.va_rhos[0]);
   }
+
+  test_that("the integrals have correct second order derivatives") {
+    using ADd = AD<double>;
+    constexpr unsigned const n_nodes(20L);
+    double const eps = std::pow(
+      std::numeric_limits<double>::epsilon(), 1./ 4.);
+
+    {
+      std::vector<double> const x = { .7 }, dir = { .6 };
+      vector<ADd > a(1), b(1);
+      a[0] = ADd(x[0]);
+      CppAD::Independent(a);
+      b[0] = entropy_term(a[0], n_nodes);
+      CppAD::ADFun<double> func(a, b);
+      expect_taylor_consistent(func, x, dir, eps);
+    }
+    {
+      std::vector<double> const x = { -.4 }, dir = { .6 };
+      vector<ADd > a(1), b(1);
+      a[0] = ADd(x[0]);
+      CppAD::Independent(a);
+      b[0] = survTMB::pnorm_std(a[0]);
+      CppAD::ADFun<double> func(a, b);
+      expect_taylor_consistent(func, x, dir, eps);
+      expect_equal(survTMB::pnorm_std(x[0]), func.Forward(0, x)[0]);
+    }
+
+    std::vector<double> const x = { .3, .8, .5, 1.4 },
+                            dir = { .6, -.4, .3, .2 };
+    {
+      vector<ADd > a(4), b(1);
+      for(unsigned i = 0; i < 4; ++i)
+        a[i] = ADd(x[i]);
+      CppAD::Independent(a);
+      b[0] = mlogit_integral(a[0], a[1], a[2], log(a[3]), n_nodes);
+      CppAD::ADFun<double> func(a, b);
+      expect_taylor_consistent(func, x, dir, eps);
+    }
+    {
+      vector<ADd > a(4), b(1);
+      for(unsigned i = 0; i < 4; ++i)
+        a[i] = ADd(x[i]);
+      CppAD::Independent(a);
+      b[0] = probit_integral(a[0], a[1], a[2], a[3], n_nodes);
+      CppAD::ADFun<double> func(a, b);
+      expect_taylor_consistent(func, x, dir, eps);
+    }
+  }
+
+  test_that("the vector versions of the integrals match the scalar versions") {
+    using ADd = AD<double>;
+    constexpr unsigned const n_nodes(20L);
+    constexpr size_t const m(3L);
+    /* tuples of (mu, sigma, rho) */
+    std::vector<double> const x = { .3, .8, .5, -.2, 1.1, -1.2, 1.5, .4, .1 },
+                              w = { .5, -1., 2. };
+
+    auto to_args = [&](vector<ADd> const &a, vector<ADd> &mu,
+                       vector<ADd> &sig, vector<ADd> &rho){
+      for(size_t i = 0; i < m; ++i){
+        mu [i] = a[3L * i     ];
+        sig[i] = a[3L * i + 1L];
+        rho[i] = a[3L * i + 2L];
+      }
+    };
+
+    expect_batch_consistent(
+      [&](ADd const *a){
+        return mlogit_integral(a[0], a[1], a[2], n_nodes);
+      },
+      [&](vector<ADd> const &a){
+        vector<ADd> mu(m), sig(m), rho(m);
+        to_args(a, mu, sig, rho);
+        return mlogit_integral(mu, sig, rho, n_nodes);
+      }, 3L, x, w);
+
+    expect_batch_consistent(
+      [&](ADd const *a){
+        return probit_integral(a[0], a[1], a[2], n_nodes);
+      },
+      [&](vector<ADd> const &a){
+        vector<ADd> mu(m), sig(m), rho(m);
+        to_args(a, mu, sig, rho);
+        return probit_integral(mu, sig, rho, n_nodes);
+      }, 3L, x, w);
+  }
 }
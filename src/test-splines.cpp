@@ -0,0 +1,94 @@
+#include "testthat-wrap.h"
+#include "splines.h"
+#include "bases-wrapper.h"
+
+namespace {
+/* checks that the batch evaluation gives the same as evaluating one point at
+ * a time */
+template<class Basis>
+void expect_batch_equal(Basis const &basis, arma::vec const &x,
+                        int const ders){
+  arma::mat out;
+  basis.eval_batch(out, x, ders);
+  expect_true(out.n_rows == basis.get_n_basis());
+  expect_true(out.n_cols == x.n_elem);
+
+  arma::vec wrk(basis.get_n_basis());
+  for(size_t i = 0; i < x.n_elem; ++i){
+    basis(wrk, x[i], ders);
+    for(size_t j = 0; j < wrk.n_elem; ++j)
+      expect_equal(wrk[j], out(j, i));
+  }
+}
+} // namespace
+
+context("testing splines") {
+  test_that("eval_batch gives the same as operator() for bs and ns") {
+    arma::vec const bk = { 0, 2.30258509299405 },
+                    ik = { 0.767528364331349, 1.5350567286627 },
+                sorted = { -.5, 0, .1, .5, 0.767528364331349, 1, 1.4, 2,
+                           2.30258509299405, 3 },
+              unsorted = { 1, -.5, 2, .1, 0.767528364331349, 3, .5, 1.4,
+                           2.30258509299405, 0 };
+
+    splines::bs const b_inter(bk, ik, true),
+                      b_no_inter(bk, ik, false);
+    splines::ns const n_inter(bk, ik, true),
+                      n_no_inter(bk, ik, false);
+
+    for(int ders = 0; ders < 2; ++ders){
+      expect_batch_equal(b_inter, sorted, ders);
+      expect_batch_equal(b_inter, unsorted, ders);
+      expect_batch_equal(b_no_inter, sorted, ders);
+      expect_batch_equal(b_no_inter, unsorted, ders);
+      expect_batch_equal(n_inter, sorted, ders);
+      expect_batch_equal(n_inter, unsorted, ders);
+      expect_batch_equal(n_no_inter, sorted, ders);
+      expect_batch_equal(n_no_inter, unsorted, ders);
+    }
+  }
+
+  test_that("eval_basis_batch uses the batched evaluation of all bases") {
+    arma::vec const bk = { 0, 2.30258509299405 },
+                    ik = { 0.767528364331349, 1.5350567286627 },
+                     x = { 1, -.5, 2, .1, 0.767528364331349, 3, .5 };
+    splines::bs const b_basis(bk, ik, true);
+    splines::ns const n_basis(bk, ik, true);
+
+    for(splines::basisMixin const *basis :
+          { static_cast<splines::basisMixin const*>(&b_basis),
+            static_cast<splines::basisMixin const*>(&n_basis) }){
+      arma::mat out;
+      eval_basis_batch(*basis, out, x);
+      expect_true(out.n_rows == basis->get_n_basis());
+      expect_true(out.n_cols == x.n_elem);
+
+      arma::vec wrk(basis->get_n_basis());
+      for(size_t i = 0; i < x.n_elem; ++i){
+        (*basis)(wrk, x[i]);
+        for(size_t j = 0; j < wrk.n_elem; ++j)
+          expect_equal(wrk[j], out(j, i));
+      }
+    }
+  }
+
+  test_that("eval_sorted can be used with a workspace per thread") {
+    arma::vec const bk = { 0, 2.30258509299405 },
+                    ik = { 0.767528364331349, 1.5350567286627 },
+                     x = { .1, .5, 1, 1.4, 2 };
+    splines::ns const basis(bk, ik, true);
+
+    arma::mat expect;
+    basis.eval_batch(expect, x);
+
+    splines::SplineBasis::workspace wk1 = basis.get_workspace(),
+                                    wk2 = basis.get_workspace();
+    arma::mat out1, out2;
+    basis.eval_sorted(out1, x, wk1);
+    basis.eval_sorted(out2, x, wk2);
+    for(size_t i = 0; i < expect.n_elem; ++i){
+      expect_equal(expect[i], out1[i]);
+      expect_equal(expect[i], out2[i]);
+    }
+  }
+}
@@ -0,0 +1,121 @@
+#ifndef TEST_TAYLOR_UTILS_H
+#define TEST_TAYLOR_UTILS_H
+#include "testthat-wrap.h"
+#include "tmb_includes.h"
+#include <cmath>
+#include <vector>
+
+/* checks the second order forward sweep and the first order reverse sweep of
+ * a function with one output against finite differences of the gradient in
+ * the direction dir */
+inline void expect_taylor_consistent
+  (CppAD::ADFun<double> &func, std::vector<double> const &x,
+   std::vector<double> const &dir, double const eps){
+  size_t const n = x.size();
+  std::vector<double> w(1L, 1.);
+
+  auto gr = [&](double const h){
+    std::vector<double> xh(n);
+    for(size_t i = 0; i < n; ++i)
+      xh[i] = x[i] + h * dir[i];
+    func.Forward(0, xh);
+    return func.Reverse(1, w);
+  };
+
+  double const h = 1e-5;
+  std::vector<double> const g0 = gr(0.),
+                            gp = gr( h),
+                            gm = gr(-h);
+  std::vector<double> hv(n);
+  double dg(0.), dhd(0.);
+  for(size_t i = 0; i < n; ++i){
+    hv[i] = (gp[i] - gm[i]) / (2 * h);
+    dg  += dir[i] * g0[i];
+    dhd += dir[i] * hv[i];
+  }
+
+  /* forward sweeps */
+  func.Forward(0, x);
+  std::vector<double> const y1 = func.Forward(1, dir),
+                            y2 = func.Forward(2, std::vector<double>(n, 0.));
+  expect_equal_eps(dg, y1[0], eps);
+  expect_equal_eps(dhd / 2, y2[0], eps);
+
+  /* reverse sweep */
+  func.Forward(1, dir);
+  /* the gradient is at the even elements and the Hessian times dir is at
+   * the odd elements */
+  std::vector<double> const px = func.Reverse(2, w);
+  for(size_t i = 0; i < n; ++i){
+    expect_equal_eps(g0[i], px[2 * i    ], eps);
+    expect_equal_eps(hv[i], px[2 * i + 1], eps);
+  }
+}
+
+/* checks that a vector version of a function with one output gives the same
+ * values, derivatives, and sparsity patterns as calling the scalar version
+ * for each tuple of n_in inputs. scalar is called with a pointer to the
+ * inputs of one tuple and batch is called with all the inputs. w are the
+ * weights of the outputs used for the Hessian. The sparsity patterns are not
+ * compared if check_sparsity is false which is needed if the batch version
+ * treats the Jacobian of each tuple as dense */
+template<class Scalar, class Batch>
+void expect_batch_consistent
+  (Scalar scalar, Batch batch, size_t const n_in,
+   std::vector<double> const &x, std::vector<double> const &w,
+   bool const check_sparsity = true){
+  using ADd = CppAD::AD<double>;
+  size_t const n = x.size(),
+               m = n / n_in;
+
+  vector<ADd> a(n);
+  for(size_t i = 0; i < n; ++i)
+    a[i] = ADd(x[i]);
+  CppAD::Independent(a);
+  vector<ADd> ys(m);
+  for(size_t i = 0; i < m; ++i)
+    ys[i] = scalar(&a[i * n_in]);
+  CppAD::ADFun<double> f_scalar(a, ys);
+
+  for(size_t i = 0; i < n; ++i)
+    a[i] = ADd(x[i]);
+  CppAD::Independent(a);
+  vector<ADd> yb = batch(a);
+  CppAD::ADFun<double> f_batch(a, yb);
+  expect_true(static_cast<size_t>(yb.size()) == m);
+
+  std::vector<double> const vs = f_scalar.Forward(0, x),
+                            vb = f_batch .Forward(0, x);
+  for(size_t i = 0; i < m; ++i)
+    expect_equal(vs[i], vb[i]);
+
+  std::vector<double> const js = f_scalar.Jacobian(x),
+                            jb = f_batch .Jacobian(x);
+  for(size_t i = 0; i < js.size(); ++i)
+    expect_equal(js[i], jb[i]);
+
+  std::vector<double> const hs = f_scalar.Hessian(x, w),
+                            hb = f_batch .Hessian(x, w);
+  for(size_t i = 0; i < hs.size(); ++i)
+    expect_equal(hs[i], hb[i]);
+
+  if(!check_sparsity)
+    return;
+
+  /* the sparsity patterns */
+  std::vector<bool> r(n * n, false), s(m, true);
+  for(size_t i = 0; i < n; ++i)
+    r[i * n + i] = true;
+
+  std::vector<bool> const sjs = f_scalar.ForSparseJac(n, r),
+                          sjb = f_batch .ForSparseJac(n, r);
+  for(size_t i = 0; i < sjs.size(); ++i)
+    expect_true(sjs[i] == sjb[i]);
+
+  std::vector<bool> const shs = f_scalar.RevSparseHes(n, s),
+                          shb = f_batch .RevSparseHes(n, s);
+  for(size_t i = 0; i < shs.size(); ++i)
+    expect_true(shs[i] == shb[i]);
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include "testthat-wrap.h"
 #include "utils.h"
+#include "atomic-registry.h"
+#include "taping-arena.h"
 #include <limits>
 #include <vector>
 
@@ -32,4 +34,161 @@ context("Utils unit tests") {
     double ex = std::exp(2 * theta);
     expect_equal(ex, *Sigma.data());
   }
+
+  test_that("get_chol_from_trian and get_logdet_from_trian give the correct result") {
+    vector<double> theta(6);
+    theta << 0.693147180559945, 0, -0.143841036225891, 1,
+             0.577350269189626, 0;
+    matrix<double> const C = get_chol_from_trian(&theta[0L], 3L),
+                     Sigma = get_vcov_from_trian(&theta[0L], 3L),
+                    CCt = C * C.transpose();
+
+    for(unsigned j = 0; j < 3L; ++j)
+      for(unsigned i = 0; i < 3L; ++i){
+        expect_equal(CCt(i, j), Sigma(i, j));
+        if(i < j)
+          expect_true(C(i, j) == 0);
+      }
+
+    /* the determinant of Sigma is 3 */
+    expect_equal(std::log(3.), get_logdet_from_trian(&theta[0L], 3L));
+  }
+
+  test_that("lower_tri_solve gives the correct result") {
+    vector<double> theta(6);
+    theta << 0.693147180559945, 0, -0.143841036225891, 1,
+             0.577350269189626, 0;
+    matrix<double> const C = get_chol_from_trian(&theta[0L], 3L);
+    vector<double> b(3);
+    b << 1, -2, .5;
+
+    vector<double> x = b;
+    lower_tri_solve(C, x);
+    vector<double> Cx = (C * x.matrix()).array();
+    for(unsigned i = 0; i < 3L; ++i)
+      expect_equal(b[i], Cx[i]);
+
+    x = b;
+    lower_tri_solve(C, x, true);
+    Cx = (C.transpose() * x.matrix()).array();
+    for(unsigned i = 0; i < 3L; ++i)
+      expect_equal(b[i], Cx[i]);
+  }
+
+  test_that("inv_pd gives the correct result") {
+    vector<double> theta(6);
+    theta << 0.693147180559945, 0, -0.143841036225891, 1,
+             0.577350269189626, 0;
+    matrix<double> const Sigma = get_vcov_from_trian(&theta[0L], 3L);
+    double log_det;
+    matrix<double> const S_inv = inv_pd(Sigma, log_det),
+                     eye = S_inv * Sigma;
+
+    for(unsigned j = 0; j < 3L; ++j)
+      for(unsigned i = 0; i < 3L; ++i)
+        expect_equal(i == j ? 1. : 0., eye(i, j));
+    expect_equal(std::log(3.), log_det);
+  }
+
+  test_that("thread_scratch only allocates when more memory is needed") {
+    struct tag_a { };
+    struct tag_b { };
+    double * const a = thread_scratch<tag_a>(10L);
+    a[9] = 1.;
+    expect_true(thread_scratch<tag_a>(5L) == a);
+    expect_true(thread_scratch<tag_a>(10L) == a);
+    expect_true(thread_scratch<tag_b>(5L) != a);
+
+    double * const a_large = thread_scratch<tag_a>(100L);
+    a_large[99] = 1.;
+    expect_true(thread_scratch<tag_a>(50L) == a_large);
+  }
+
+  test_that("taping_arena reuses the memory after each scope") {
+    taping_arena &arena = taping_arena::get();
+    expect_false(arena.is_active());
+
+    double *first(nullptr);
+    {
+      scoped_taping_arena scope;
+      expect_true(arena.is_active());
+      arena_vector<double> x(100L, 1.), y(10L, 2.);
+      first = x.data();
+      expect_true(y.data() != first);
+      expect_equal(x[99], 1.);
+      expect_equal(y[9], 2.);
+    }
+    expect_false(arena.is_active());
+
+    {
+      scoped_taping_arena scope;
+      arena_vector<double> x(100L, 3.);
+      expect_true(x.data() == first);
+
+      /* a large allocation needs a new chunk */
+      arena_vector<double> z(100000L, 4.);
+      expect_equal(z[99999], 4.);
+      expect_equal(x[99], 3.);
+    }
+
+    /* allocations outside a scope are not from the arena */
+    arena_vector<double> x(100L, 5.);
+    expect_equal(x[99], 5.);
+  }
+
+  test_that("region_balancer gives balanced regions") {
+    /* round-robin assignment gives loads 12 and 3 */
+    std::vector<double> const costs { 8, 1, 4, 1, 1 };
+    region_balancer const regions(costs, 2L);
+
+    double loads[2] = { 0, 0 };
+    for(size_t g = 0; g < costs.size(); ++g){
+      int const r = regions[g];
+      expect_true(r == 0 or r == 1);
+      loads[r] += costs[g];
+    }
+    expect_equal(loads[regions[0]], 8.);
+    expect_equal(loads[1L - regions[0]], 7.);
+    expect_true(regions.rest() == 1L - regions[0]);
+
+    /* all groups are in the first region with one region */
+    region_balancer const one_region(costs, 1L);
+    for(size_t g = 0; g < costs.size(); ++g)
+      expect_true(one_region[g] == 0L);
+    expect_true(one_region.rest() == 0L);
+  }
+
+  test_that("sparse_mat_vec only computes the rows of the current region") {
+    matrix<double> X(5, 2);
+    X << 1, 2,
+         0, 3,
+         4, 0,
+         5, 6,
+         0, 0;
+    vector<double> b(2);
+    b << 2, -1;
+    vector<double> const expect = sparse_mat_vec(X, b);
+
+    vector<int> grp_size(3);
+    grp_size << 2, 1, 2;
+    std::vector<double> const costs { 2, 1, 2 };
+    region_balancer const regions(costs, 2L);
+    objective_mock obj;
+
+    vector<double> const res =
+      sparse_mat_vec(X, b, grp_size, regions, obj, true);
+    expect_true(res.size() == expect.size());
+    int i(0L);
+    for(int g = 0; g < grp_size.size(); ++g){
+      set_region(obj, regions[g]);
+      bool const is_mine = is_my_region(obj);
+      for(int k = 0; k < grp_size[g]; ++k, ++i)
+        expect_equal(is_mine ? expect[i] : 0., res[i]);
+    }
+
+    vector<double> const res_serial =
+      sparse_mat_vec(X, b, grp_size, regions, obj, false);
+    for(int i = 0; i < expect.size(); ++i)
+      expect_equal(expect[i], res_serial[i]);
+  }
 }
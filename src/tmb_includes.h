@@ -133,6 +133,41 @@ Type quad_form_sym(vector<Type> const &x, matrix<Type> const &A){
   return out;
 }
 
+/* versions of vec_dot and quad_form_sym for Eigen vectors and matrices
+ * whose dimension may be known at compile time. This is used for small
+ * dimensions to avoid heap allocations */
+template<class Type, int Dim>
+Type vec_dot(Eigen::Matrix<Type, Dim, 1> const &x,
+             Eigen::Matrix<Type, Dim, 1> const &y){
+#ifdef DO_CHECKS
+  if(x.size() != y.size())
+    throw std::invalid_argument("vec_dot<Type>: dimension do not match");
+#endif
+  Type out(0.);
+  for(int i = 0; i < x.size(); ++i)
+    out += x[i] * y[i];
+  return out;
+}
+
+template<class Type, int Dim>
+Type quad_form_sym(Eigen::Matrix<Type, Dim, 1> const &x,
+                   Eigen::Matrix<Type, Dim, Dim> const &A){
+#ifdef DO_CHECKS
+  if(x.size() != A.rows() or x.size() != A.cols())
+    throw std::invalid_argument(
+        "quad_form_sym<Type>: dimension do not match");
+#endif
+  Type out(0.);
+  Type const TWO(2.);
+  for(int j = 0; j < A.cols(); ++j){
+    for(int i = 0; i < j; ++i)
+      out += TWO * A(i, j) * x[i] * x[j];
+    out += A(j, j) * x[j] * x[j];
+  }
+
+  return out;
+}
+
 template<class Type>
 Type mat_mult_trace(matrix<Type> const &X, matrix<Type> const &Y){
 #ifdef DO_CHECKS
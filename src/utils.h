@@ -6,6 +6,10 @@
 #include "omp.h"
 #endif
 #include <memory>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <cstddef>
 
 namespace survTMB {
 
@@ -31,10 +35,12 @@ unsigned get_rng_dim(vector<Type> x){
  \end{pmatrix} \\
  \Sigma &= \text{diag}(\sigma)LL^\top\text{diag}(\sigma)
  \end{align*}
+
+ get_chol_from_trian returns the lower triangular matrix diag(sigma)L.
 */
 template<class Type>
 matrix<Type>
-get_vcov_from_trian(Type const *vals, unsigned const dim){
+get_chol_from_trian(Type const *vals, unsigned const dim){
   matrix<Type> out(dim, dim);
   out.setZero();
 
@@ -48,7 +54,111 @@ get_vcov_from_trian(Type const *vals, unsigned const dim){
     for(unsigned rw = cl + 1L; rw < dim; rw++)
       out(rw, cl) = out(rw, rw) * *t++;
 
-  return out * out.transpose();
+  return out;
+}
+
+/* returns the covariance matrix from the lower triangular matrix C =
+ * diag(sigma)L. Only the non-zero terms of C C^T are computed */
+template<class Type>
+matrix<Type>
+get_vcov_from_chol(matrix<Type> const &C){
+  unsigned const dim = C.rows();
+  matrix<Type> out(dim, dim);
+  for(unsigned cl = 0; cl < dim; cl++)
+    for(unsigned rw = cl; rw < dim; rw++){
+      Type val(0.);
+      for(unsigned k = 0; k <= cl; ++k)
+        val += C(rw, k) * C(cl, k);
+      out(rw, cl) = val;
+      out(cl, rw) = val;
+    }
+
+  return out;
+}
+
+template<class Type>
+matrix<Type>
+get_vcov_from_trian(Type const *vals, unsigned const dim){
+  return get_vcov_from_chol(get_chol_from_trian(vals, dim));
+}
+
+/* returns the log determinant of the covariance matrix from
+ * get_vcov_from_trian. This is two times the sum of the log standard
+ * deviations as L has a unit diagonal */
+template<class Type>
+Type get_logdet_from_trian(Type const *vals, unsigned const dim){
+  Type out(0.);
+  for(unsigned i = 0; i < dim; ++i)
+    out += vals[i];
+  return Type(2.) * out;
+}
+
+/* overwrites x with C^{-1}x or, if transpose is true, C^{-T}x where C is a
+ * lower triangular matrix. Eigen's triangular solvers are not used as they
+ * skip terms based on the values which is not valid while taping */
+template<class Type>
+void lower_tri_solve(matrix<Type> const &C, vector<Type> &x,
+                     bool const transpose = false){
+  int const dim = C.rows();
+  if(!transpose){
+    for(int i = 0; i < dim; ++i){
+      for(int k = 0; k < i; ++k)
+        x[i] -= C(i, k) * x[k];
+      x[i] /= C(i, i);
+    }
+    return;
+  }
+
+  for(int i = dim - 1L; i >= 0; --i){
+    for(int k = i + 1L; k < dim; ++k)
+      x[i] -= C(k, i) * x[k];
+    x[i] /= C(i, i);
+  }
+}
+
+/* returns the inverse of a positive definite matrix X and sets log_det to
+ * the log determinant. Only plain operations are used such that forward and
+ * reverse sweeps of any order can be made on the tape unlike with
+ * atomic::matinvpd */
+template<class Type>
+matrix<Type> inv_pd(matrix<Type> const &X, Type &log_det){
+  int const dim = X.rows();
+
+  /* compute the Cholesky decomposition X = CC^T */
+  matrix<Type> C(dim, dim);
+  C.setZero();
+  for(int j = 0; j < dim; ++j){
+    Type diag = X(j, j);
+    for(int k = 0; k < j; ++k)
+      diag -= C(j, k) * C(j, k);
+    C(j, j) = sqrt(diag);
+
+    for(int i = j + 1L; i < dim; ++i){
+      Type val = X(i, j);
+      for(int k = 0; k < j; ++k)
+        val -= C(i, k) * C(j, k);
+      C(i, j) = val / C(j, j);
+    }
+  }
+
+  log_det = Type(0.);
+  for(int i = 0; i < dim; ++i)
+    log_det += log(C(i, i));
+  log_det *= Type(2.);
+
+  /* compute C^{-T}C^{-1} one column at a time */
+  matrix<Type> out(dim, dim);
+  vector<Type> e(dim);
+  for(int j = 0; j < dim; ++j){
+    e.setZero();
+    e[j] = Type(1.);
+    lower_tri_solve(C, e);
+    lower_tri_solve(C, e, true);
+    for(int i = 0; i < dim; ++i)
+      out(i, j) = e[i];
+  }
+
+  return out;
 }
 
 template<class Type>
@@ -72,8 +182,11 @@ bool is_my_region(objective_function<Type> const &o){
   return false;
 }
 
-/* mock class to use instead when not using the TMB framework */
+/* mock class to use instead when not using the TMB framework. All regions
+ * belong to the caller if is_serial is true. This is used when a tape only
+ * contains a subset of the groups */
 class objective_mock {
+  bool const is_serial;
 #ifdef _OPENMP
   int const my_num = omp_get_thread_num(),
          n_regions = omp_get_num_threads();
@@ -82,9 +195,19 @@ class objective_mock {
 public:
   int selected_parallel_region = 0;
 
+  objective_mock(bool const is_serial = false): is_serial(is_serial) { }
+
+  int get_n_regions() const {
+#ifdef _OPENMP
+    return n_regions;
+#else
+    return 1L;
+#endif
+  }
+
   inline bool is_my_region() const {
 #ifdef _OPENMP
-    return my_num == selected_parallel_region;
+    return is_serial or my_num == selected_parallel_region;
 #else
     return true;
 #endif
@@ -108,7 +231,8 @@ class accumulator_mock {
 public:
   std::unique_ptr<objective_mock> const obj;
 
-  accumulator_mock(): obj(new objective_mock()) { }
+  accumulator_mock(bool const is_serial = false):
+    obj(new objective_mock(is_serial)) { }
 
   inline void operator+=(Type x){
     if(obj->parallel_region())
@@ -127,6 +251,156 @@ inline bool is_my_region(objective_mock const &o){
   return o.is_my_region();
 }
 
+/* returns the number of parallel regions and sets the current region. The
+ * region is only set in parallel mode */
+template<class Type>
+int get_n_regions(objective_function<Type> const &o){
+  if(o.max_parallel_regions > 0)
+    return o.max_parallel_regions;
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1L;
+#endif
+}
+inline int get_n_regions(objective_mock const &o){
+  return o.get_n_regions();
+}
+
+template<class Type>
+void set_region(objective_function<Type> &o, int const region){
+  if(o.current_parallel_region >= 0 and o.selected_parallel_region >= 0)
+    o.current_parallel_region = region;
+}
+inline void set_region(objective_mock &o, int const region){
+  o.selected_parallel_region = region;
+}
+
+/* assigns groups to parallel regions such that the sum of the costs of the
+ * groups in each region is balanced. The groups are assigned in decreasing
+ * order of their cost to the region with the smallest total cost. The
+ * region for terms which are not associated with a group is the one with
+ * the smallest total cost after all groups are assigned.
+ *
+ * Round-robin assignment of the groups can give very unbalanced regions if
+ * the group sizes vary. */
+class region_balancer {
+  std::vector<int> regions;
+  int rest_region = 0;
+
+public:
+  region_balancer(std::vector<double> const &costs, int const n_regions):
+  regions(costs.size(), 0) {
+    if(n_regions < 2L)
+      return;
+
+    std::vector<std::size_t> order(costs.size());
+    std::iota(order.begin(), order.end(), 0L);
+    /* use a stable sort so all threads get the same assignment */
+    std::stable_sort(
+      order.begin(), order.end(), [&](std::size_t i, std::size_t j){
+        return costs[i] > costs[j];
+      });
+
+    std::vector<double> loads(n_regions, 0.);
+    for(auto i : order){
+      int const r = std::min_element(loads.begin(), loads.end()) -
+        loads.begin();
+      regions[i] = r;
+      loads[r] += costs[i];
+    }
+    rest_region = std::min_element(loads.begin(), loads.end()) -
+      loads.begin();
+  }
+
+  /* returns the region of group g */
+  int operator[](std::size_t const g) const {
+    return regions[g];
+  }
+  /* returns the region for terms which are not associated with a group */
+  int rest() const {
+    return rest_region;
+  }
+};
+
+/* returns a region_balancer for groups with a cost proportional to the
+ * number of members. All groups are in the same region if is_in_parallel
+ * is false */
+template<class Obj>
+region_balancer get_grp_regions
+  (vector<int> const &grp_size, Obj const &o, bool const is_in_parallel){
+  std::vector<double> costs(grp_size.size());
+  for(std::size_t g = 0; g < costs.size(); ++g)
+    costs[g] = grp_size[g];
+  return region_balancer(costs, is_in_parallel ? get_n_regions(o) : 1L);
+}
+
+/* returns true if x is identical zero and not a variable on any tape. The
+ * data are variables if they are arguments of the tapes */
+inline bool is_zero_constant(double const x){
+  return x == 0;
+}
+template<class T>
+bool is_zero_constant(CppAD::AD<T> const &x){
+  return CppAD::Parameter(x) and is_zero_constant(CppAD::Value(x));
+}
+
+/* computes X * b where the entries of X which are zero constants are
+ * skipped. Design matrices such as spline bases and dummies are mostly zero
+ * so this saves most of the work when the tapes are recorded */
+template<class Type>
+vector<Type> sparse_mat_vec(matrix<Type> const &X, vector<Type> const &b){
+  vector<Type> out(X.rows());
+  out.setZero();
+  for(int j = 0; j < X.cols(); ++j){
+    Type const &bj = b[j];
+    for(int i = 0; i < X.rows(); ++i){
+      Type const &xij = X(i, j);
+      if(!is_zero_constant(xij))
+        out[i] += xij * bj;
+    }
+  }
+
+  return out;
+}
+
+/* computes X * b like sparse_mat_vec but only the rows of the groups in the
+ * current parallel region. The other rows are zero. Thus, each tape only
+ * records the products of its own rows */
+template<class Type, class Obj>
+vector<Type> sparse_mat_vec
+  (matrix<Type> const &X, vector<Type> const &b, vector<int> const &grp_size,
+   region_balancer const &regions, Obj &obj, bool const is_in_parallel){
+  if(!is_in_parallel)
+    return sparse_mat_vec(X, b);
+
+  std::vector<bool> keep(X.rows(), false);
+  {
+    int i(0L);
+    for(int g = 0; g < grp_size.size(); ++g){
+      set_region(obj, regions[g]);
+      bool const is_mine = is_my_region(obj);
+      for(int k = 0; k < grp_size[g]; ++k, ++i)
+        keep[i] = is_mine;
+    }
+  }
+
+  vector<Type> out(X.rows());
+  out.setZero();
+  for(int j = 0; j < X.cols(); ++j){
+    Type const &bj = b[j];
+    for(int i = 0; i < X.rows(); ++i){
+      if(!keep[i])
+        continue;
+      Type const &xij = X(i, j);
+      if(!is_zero_constant(xij))
+        out[i] += xij * bj;
+    }
+  }
+
+  return out;
+}
+
 } // namespace survTMB
 
 #endif